@@ -1,9 +1,10 @@
 #include "animation/animation.h"
+#include "core/blob.h"
 #include "core/fs/file_system.h"
 #include "core/fs/ifile.h"
 #include "core/log.h"
+#include "core/math_utils.h"
 #include "core/matrix.h"
-#include "core/profiler.h"
 #include "core/quat.h"
 #include "core/resource_manager.h"
 #include "core/vec3.h"
@@ -29,132 +30,293 @@ void AnimationManager::destroyResource(Resource& resource)
 
 Animation::Animation(const Path& path, ResourceManager& resource_manager, IAllocator& allocator)
 	: Resource(path, resource_manager, allocator)
+	, m_allocator(allocator)
+	, m_bones(allocator)
+	, m_tracks(allocator)
+	, m_position_frames(allocator)
+	, m_positions(allocator)
+	, m_rotation_frames(allocator)
+	, m_rotations(allocator)
+	, m_remaps(allocator)
+	, m_remap_indices(allocator)
 {
-	m_rotations = nullptr;
-	m_positions = nullptr;
-	m_bones = nullptr;
 	m_frame_count = 0;
+	m_bone_count = 0;
 	m_fps = 30;
 }
 
 
 Animation::~Animation()
 {
-	IAllocator& allocator = getAllocator();
-	allocator.deallocate(m_positions);
-	allocator.deallocate(m_rotations);
-	allocator.deallocate(m_bones);
 }
 
 
-void Animation::getPose(float time, Pose& pose, Model& model) const
+// index of the last key at or before frame
+static int findKey(const uint16_t* frames, int count, float frame)
 {
-	PROFILE_FUNCTION();
-	if(model.isReady())
+	int lo = 0;
+	int hi = count - 1;
+	while (lo < hi)
 	{
-		int frame = (int)(time * m_fps);
-		frame = frame >= m_frame_count ? m_frame_count - 1 : frame;
-		Vec3* pos = pose.getPositions();
-		Quat* rot = pose.getRotations();
-		int off = frame * m_bone_count;
-		int off2 = off + m_bone_count;
-		float t = (time - frame / (float)m_fps) / (1.0f / m_fps);
-	
-		if(frame < m_frame_count - 1)
+		int mid = (lo + hi + 1) >> 1;
+		if (frames[mid] <= frame)
 		{
-			for(int i = 0; i < m_bone_count; ++i)
-			{
-				Model::BoneMap::iterator iter = model.getBoneIndex(m_bones[i]);
-				if (iter.isValid())
-				{
-					int model_bone_index = iter.value();
-					lerp(m_positions[off + i], m_positions[off2 + i], &pos[model_bone_index], t);
-					nlerp(m_rotations[off + i], m_rotations[off2 + i], &rot[model_bone_index], t);
-				}
-			}
+			lo = mid;
 		}
 		else
 		{
-			for(int i = 0; i < m_bone_count; ++i)
-			{
-				Model::BoneMap::iterator iter = model.getBoneIndex(m_bones[i]);
-				if (iter.isValid())
-				{
-					int model_bone_index = iter.value();
-					pos[model_bone_index] = m_positions[off + i];
-					rot[model_bone_index] = m_rotations[off + i];
-				}
-			}
+			hi = mid - 1;
 		}
+	}
+	return lo;
+}
+
+
+void Animation::samplePosition(const Track& track, float frame, Vec3* out) const
+{
+	const uint16_t* frames = &m_position_frames[track.m_first_position];
+	int key = findKey(frames, track.m_position_count, frame);
+	const uint16_t* q = &m_positions[(track.m_first_position + key) * 3];
+	const Vec3& min = track.m_position_min;
+	const Vec3& scale = track.m_position_scale;
+	Vec3 p0(min.x + q[0] * scale.x, min.y + q[1] * scale.y, min.z + q[2] * scale.z);
+	if (key + 1 >= track.m_position_count)
+	{
+		*out = p0;
+		return;
+	}
+	q += 3;
+	Vec3 p1(min.x + q[0] * scale.x, min.y + q[1] * scale.y, min.z + q[2] * scale.z);
+	float t = (frame - frames[key]) / (frames[key + 1] - frames[key]);
+	lerp(p0, p1, out, t);
+}
+
+
+void Animation::sampleRotation(const Track& track, float frame, Quat* out) const
+{
+	const uint16_t* frames = &m_rotation_frames[track.m_first_rotation];
+	int key = findKey(frames, track.m_rotation_count, frame);
+	const AnimationCompression::PackedQuat* q = &m_rotations[track.m_first_rotation + key];
+	if (key + 1 >= track.m_rotation_count)
+	{
+		AnimationCompression::unpackQuat(q[0], out);
+		return;
+	}
+	Quat q0, q1;
+	AnimationCompression::unpackQuat(q[0], &q0);
+	AnimationCompression::unpackQuat(q[1], &q1);
+	// packing loses the sign, interpolate along the shorter arc
+	if (q0.x * q1.x + q0.y * q1.y + q0.z * q1.z + q0.w * q1.w < 0)
+	{
+		q1.set(-q1.x, -q1.y, -q1.z, -q1.w);
+	}
+	float t = (frame - frames[key]) / (frames[key + 1] - frames[key]);
+	nlerp(q0, q1, out, t);
+}
+
+
+void Animation::getPose(float time, Pose& pose, Model& model) const
+{
+	getPose(time, pose, model, pose.getCount());
+}
+
+
+void Animation::getPose(float time, Pose& pose, Model& model, int bone_count) const
+{
+	if(model.isReady() && m_bone_count > 0)
+	{
+		sample(time, pose, model, bone_count);
 		pose.setIsRelative();
-		pose.computeAbsolute(model);
+		pose.computeAbsolute(model, bone_count);
+	}
+}
+
+
+void Animation::sample(float time, Pose& pose, Model& model, int bone_count) const
+{
+	if (!model.isReady() || m_bone_count == 0)
+	{
+		return;
+	}
+	float frame = Math::clamp(time * m_fps, 0.0f, (float)(m_frame_count - 1));
+	Vec3* pos = pose.getPositions();
+	Quat* rot = pose.getRotations();
+	const int* remap = getBoneRemap(model);
+
+	for(int i = 0; i < m_bone_count; ++i)
+	{
+		int model_bone_index = remap[i];
+		if (model_bone_index >= 0 && model_bone_index < bone_count)
+		{
+			samplePosition(m_tracks[i], frame, &pos[model_bone_index]);
+			sampleRotation(m_tracks[i], frame, &rot[model_bone_index]);
+		}
 	}
 }
 
 
-void Animation::loaded(FS::IFile& file, bool success, FS::FileSystem& fs)
+const int* Animation::getBoneRemap(Model& model) const
 {
-	if (success)
+	if (m_bone_count == 0)
+	{
+		return nullptr;
+	}
+	uint32_t skeleton_hash = model.getSkeletonHash();
+	for (int i = 0, c = m_remaps.size(); i < c; ++i)
 	{
-		IAllocator& allocator = getAllocator();
-		allocator.deallocate(m_positions);
-		allocator.deallocate(m_rotations);
-		allocator.deallocate(m_bones);
-		m_positions = nullptr;
-		m_rotations = nullptr;
-		m_bones = 0;
-		m_frame_count = m_bone_count = 0;
-		Header header;
-		file.read(&header, sizeof(header));
-		if (header.magic != HEADER_MAGIC)
+		if (m_remaps[i].m_skeleton_hash == skeleton_hash)
 		{
-			onFailure();
-			g_log_error.log("animation") << m_path.c_str() << " is not an animation file";
-			return;
+			return &m_remap_indices[m_remaps[i].m_offset];
 		}
-		if (header.version > 1)
+	}
+
+	BoneRemap& remap = m_remaps.pushEmpty();
+	remap.m_skeleton_hash = skeleton_hash;
+	remap.m_offset = m_remap_indices.size();
+	for (int i = 0; i < m_bone_count; ++i)
+	{
+		Model::BoneMap::iterator iter = model.getBoneIndex(m_bones[i]);
+		m_remap_indices.push(iter.isValid() ? iter.value() : -1);
+	}
+	return &m_remap_indices[remap.m_offset];
+}
+
+
+bool Animation::parseCompressed(InputBlob& data)
+{
+	data.read(m_frame_count);
+	data.read(m_bone_count);
+	if (m_frame_count <= 0 || m_bone_count < 0)
+	{
+		return false;
+	}
+	m_bones.resize(m_bone_count);
+	m_tracks.resize(m_bone_count);
+	if (m_bone_count > 0)
+	{
+		data.read(&m_bones[0], sizeof(m_bones[0]) * m_bone_count);
+	}
+
+	int position_count = 0;
+	int rotation_count = 0;
+	for (int i = 0; i < m_bone_count; ++i)
+	{
+		Track& track = m_tracks[i];
+		track.m_first_position = position_count;
+		track.m_first_rotation = rotation_count;
+		track.m_position_count = data.read<uint16_t>();
+		track.m_rotation_count = data.read<uint16_t>();
+		data.read(track.m_position_min);
+		data.read(track.m_position_scale);
+		if (track.m_position_count == 0 || track.m_rotation_count == 0)
 		{
-			onFailure();
-			g_log_error.log("animation") << "Unsupported animation version " << header.version << " (" << m_path.c_str() << ")";
-			return;
+			return false;
 		}
-		m_fps = header.fps;
-		file.read(&m_frame_count, sizeof(m_frame_count));
-		file.read(&m_bone_count, sizeof(m_bone_count));
+		position_count += track.m_position_count;
+		rotation_count += track.m_rotation_count;
+	}
+
+	if (data.read<int32_t>() != position_count)
+	{
+		return false;
+	}
+	m_position_frames.resize(position_count);
+	m_positions.resize(position_count * 3);
+	if (position_count > 0)
+	{
+		data.read(&m_position_frames[0], sizeof(m_position_frames[0]) * position_count);
+		data.read(&m_positions[0], sizeof(m_positions[0]) * position_count * 3);
+	}
+
+	if (data.read<int32_t>() != rotation_count)
+	{
+		return false;
+	}
+	m_rotation_frames.resize(rotation_count);
+	m_rotations.resize(rotation_count);
+	if (rotation_count > 0)
+	{
+		data.read(&m_rotation_frames[0], sizeof(m_rotation_frames[0]) * rotation_count);
+		return data.read(&m_rotations[0], sizeof(m_rotations[0]) * rotation_count);
+	}
+	return true;
+}
+
+
+bool Animation::parse(InputBlob& data)
+{
+	m_frame_count = m_bone_count = 0;
+	Header header;
+	if (!data.read(&header, sizeof(header)) || header.magic != HEADER_MAGIC ||
+		header.version >= (uint32_t)Version::LATEST)
+	{
+		return false;
+	}
+	m_fps = header.fps;
+	if (header.version >= (uint32_t)Version::COMPRESSED)
+	{
+		return parseCompressed(data);
+	}
 
-		m_positions = static_cast<Vec3*>(allocator.allocate(sizeof(Vec3) * m_frame_count * m_bone_count));
-		m_rotations = static_cast<Quat*>(allocator.allocate(sizeof(Quat) * m_frame_count * m_bone_count));
-		m_bones = static_cast<uint32_t*>(allocator.allocate(sizeof(uint32_t) * m_bone_count));
-		file.read(&m_positions[0], sizeof(Vec3)* m_bone_count * m_frame_count);
-		file.read(&m_rotations[0], sizeof(Quat)* m_bone_count * m_frame_count);
-		file.read(m_bones, sizeof(m_bones[0]) * m_bone_count);
-		
-		m_size = file.size();
-		decrementDepCount();
+	// raw data from old files are converted, only exactly redundant keys are dropped
+	int32_t frame_count = data.read<int32_t>();
+	int32_t bone_count = data.read<int32_t>();
+	if (frame_count <= 0 || frame_count > 0x10000 || bone_count < 0)
+	{
+		return false;
 	}
-	else
+	IAllocator& allocator = getAllocator();
+	Array<Vec3> positions(allocator);
+	Array<Quat> rotations(allocator);
+	Array<uint32_t> bones(allocator);
+	positions.resize(frame_count * bone_count);
+	rotations.resize(frame_count * bone_count);
+	bones.resize(bone_count);
+	if (bone_count > 0)
 	{
-		onFailure();
+		data.read(&positions[0], sizeof(positions[0]) * positions.size());
+		data.read(&rotations[0], sizeof(rotations[0]) * rotations.size());
+		if (!data.read(&bones[0], sizeof(bones[0]) * bone_count))
+		{
+			return false;
+		}
 	}
+
+	AnimationCompression::Settings settings;
+	settings.position_error = 0;
+	settings.rotation_error = 0;
+	OutputBlob compressed(allocator);
+	AnimationCompression::compress(frame_count,
+		bone_count,
+		bone_count > 0 ? &positions[0] : nullptr,
+		bone_count > 0 ? &rotations[0] : nullptr,
+		bone_count > 0 ? &bones[0] : nullptr,
+		settings,
+		allocator,
+		compressed);
+	InputBlob compressed_data(compressed);
+	return parseCompressed(compressed_data);
 }
 
 
 IAllocator& Animation::getAllocator()
 {
-	return static_cast<AnimationManager*>(m_resource_manager.get(ResourceManager::ANIMATION))->getAllocator();
+	return m_allocator;
 }
 
 
 void Animation::doUnload(void)
 {
-	IAllocator& allocator = getAllocator();
-	allocator.deallocate(m_positions);
-	allocator.deallocate(m_rotations);
-	allocator.deallocate(m_bones);
-	m_rotations = nullptr;
-	m_positions = nullptr;
-	m_bones = nullptr;
+	m_bones.clear();
+	m_tracks.clear();
+	m_position_frames.clear();
+	m_positions.clear();
+	m_rotation_frames.clear();
+	m_rotations.clear();
 	m_frame_count = 0;
+	m_bone_count = 0;
+	m_remaps.clear();
+	m_remap_indices.clear();
 	m_size = 0;
 	onEmpty();
 }
@@ -1,6 +1,9 @@
 #pragma once
 
+#include "animation/animation_compression.h"
+#include "core/array.h"
 #include "core/resource.h"
+#include "core/vec3.h"
 #include "core/resource_manager_base.h"
 
 namespace Lumix
@@ -42,6 +45,14 @@ class LUMIX_ANIMATION_API Animation : public Resource
 	public:
 		static const uint32_t HEADER_MAGIC = 0x5f4c4146; // '_LAF'
 
+		enum class Version : uint32_t
+		{
+			FIRST = 1,
+			COMPRESSED, // constant tracks, reduced keys, quantized values
+
+			LATEST // keep this last
+		};
+
 	public:
 		struct Header
 		{
@@ -54,24 +65,65 @@ class LUMIX_ANIMATION_API Animation : public Resource
 		Animation(const Path& path, ResourceManager& resource_manager, IAllocator& allocator);
 		~Animation();
 
+		// getPose may run concurrently for different poses as long as the
+		// remap table for the model's skeleton exists, see getBoneRemap
 		void getPose(float time, Pose& pose, Model& model) const;
+		// poses only the first bone_count bones of the model, see
+		// Model::getLODBoneCount
+		void getPose(float time, Pose& pose, Model& model, int bone_count) const;
+		// writes relative transforms of animated bones only, other bones
+		// are left untouched
+		void sample(float time, Pose& pose, Model& model, int bone_count) const;
+		// builds the table on first use, not thread safe
+		const int* getBoneRemap(Model& model) const;
 		int getFrameCount() const { return m_frame_count; }
 		float getLength() const { return m_frame_count / (float)m_fps; }
 		int getFPS() const { return m_fps; }
 
+	private:
+		struct BoneRemap
+		{
+			uint32_t m_skeleton_hash;
+			int m_offset;
+		};
+
+		struct Track
+		{
+			Vec3 m_position_min;
+			Vec3 m_position_scale;
+			int m_first_position;
+			int m_position_count;
+			int m_first_rotation;
+			int m_rotation_count;
+		};
+
 	private:
 		IAllocator& getAllocator();
+		bool parseCompressed(InputBlob& data);
+		void samplePosition(const Track& track, float frame, Vec3* out) const;
+		void sampleRotation(const Track& track, float frame, Quat* out) const;
 
 		virtual void doUnload(void) override;
-		virtual void loaded(FS::IFile& file, bool success, FS::FileSystem& fs) override;
+		virtual bool parse(InputBlob& data) override;
+		virtual bool commit(InputBlob& data) override { return true; }
 
 	private:
+		IAllocator& m_allocator;
 		int	m_frame_count;
 		int	m_bone_count;
-		Vec3* m_positions;
-		Quat* m_rotations;
-		uint32_t* m_bones;
 		int m_fps;
+		// one track per bone, keys of all tracks are stored in shared arrays,
+		// frame numbers and values of a track are contiguous
+		Array<uint32_t> m_bones;
+		Array<Track> m_tracks;
+		Array<uint16_t> m_position_frames;
+		Array<uint16_t> m_positions;
+		Array<uint16_t> m_rotation_frames;
+		Array<AnimationCompression::PackedQuat> m_rotations;
+		// model bone index (or -1) of every animated bone, one table per
+		// skeleton the animation was applied to, see getBoneRemap
+		mutable Array<BoneRemap> m_remaps;
+		mutable Array<int> m_remap_indices;
 };
 
 
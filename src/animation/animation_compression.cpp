@@ -0,0 +1,270 @@
+#include "animation/animation_compression.h"
+#include "core/array.h"
+#include "core/blob.h"
+#include "core/math_utils.h"
+#include "core/quat.h"
+#include "core/vec3.h"
+#include <cmath>
+
+
+namespace Lumix
+{
+
+
+namespace AnimationCompression
+{
+
+
+static const float SQRT2 = 1.41421356f;
+static const float INV_SQRT2 = 0.70710678f;
+
+
+void packQuat(const Quat& q, PackedQuat* out)
+{
+	const float* c = &q.x;
+	int largest = 0;
+	for (int i = 1; i < 4; ++i)
+	{
+		if (fabs(c[i]) > fabs(c[largest]))
+		{
+			largest = i;
+		}
+	}
+	// q and -q are the same rotation, make the dropped component positive
+	float sign = c[largest] < 0 ? -1.0f : 1.0f;
+
+	uint64_t bits = (uint64_t)largest << 45;
+	int shift = 30;
+	for (int i = 0; i < 4; ++i)
+	{
+		if (i == largest)
+		{
+			continue;
+		}
+		float v = Math::clamp(c[i] * sign * INV_SQRT2 + 0.5f, 0.0f, 1.0f);
+		bits |= (uint64_t)(v * 32767.0f + 0.5f) << shift;
+		shift -= 15;
+	}
+	out->a = (uint16_t)(bits >> 32);
+	out->b = (uint16_t)(bits >> 16);
+	out->c = (uint16_t)bits;
+}
+
+
+void unpackQuat(const PackedQuat& q, Quat* out)
+{
+	uint64_t bits = ((uint64_t)q.a << 32) | ((uint64_t)q.b << 16) | q.c;
+	int largest = (int)(bits >> 45) & 3;
+	float* c = &out->x;
+	float sum = 0;
+	int shift = 30;
+	for (int i = 0; i < 4; ++i)
+	{
+		if (i == largest)
+		{
+			continue;
+		}
+		float v = ((bits >> shift) & 0x7fff) / 32767.0f;
+		c[i] = (v - 0.5f) * SQRT2;
+		sum += c[i] * c[i];
+		shift -= 15;
+	}
+	c[largest] = sqrt(Math::maxValue(0.0f, 1.0f - sum));
+}
+
+
+struct PositionTrack
+{
+	const Vec3& get(int frame) const { return values[frame * stride]; }
+
+	bool isClose(const Vec3& a, const Vec3& b, float error) const
+	{
+		return fabs(a.x - b.x) <= error && fabs(a.y - b.y) <= error &&
+			   fabs(a.z - b.z) <= error;
+	}
+
+	bool canSkip(int from, int to, float error) const
+	{
+		for (int i = from + 1; i < to; ++i)
+		{
+			Vec3 interpolated;
+			lerp(get(from), get(to), &interpolated, (i - from) / (float)(to - from));
+			if (!isClose(interpolated, get(i), error))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	const Vec3* values;
+	int stride;
+};
+
+
+struct RotationTrack
+{
+	const Quat& get(int frame) const { return values[frame]; }
+
+	bool isClose(const Quat& a, const Quat& b, float error) const
+	{
+		return fabs(a.x - b.x) <= error && fabs(a.y - b.y) <= error &&
+			   fabs(a.z - b.z) <= error && fabs(a.w - b.w) <= error;
+	}
+
+	bool canSkip(int from, int to, float error) const
+	{
+		for (int i = from + 1; i < to; ++i)
+		{
+			Quat interpolated;
+			nlerp(get(from), get(to), &interpolated, (i - from) / (float)(to - from));
+			if (!isClose(interpolated, get(i), error))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// hemisphere aligned, so neighbours can be interpolated directly
+	const Quat* values;
+};
+
+
+template <typename Track>
+static void reduceKeys(const Track& track,
+	int frame_count,
+	float error,
+	int max_key_distance,
+	Array<uint16_t>& frames)
+{
+	frames.push(0);
+	bool is_constant = true;
+	for (int i = 1; i < frame_count && is_constant; ++i)
+	{
+		is_constant = track.isClose(track.get(0), track.get(i), error);
+	}
+	if (is_constant)
+	{
+		return;
+	}
+
+	int key = 0;
+	while (key < frame_count - 1)
+	{
+		int next = key + 1;
+		while (next + 1 < frame_count && next + 1 - key <= max_key_distance &&
+			   track.canSkip(key, next + 1, error))
+		{
+			++next;
+		}
+		frames.push((uint16_t)next);
+		key = next;
+	}
+}
+
+
+void compress(int frame_count,
+	int bone_count,
+	const Vec3* positions,
+	const Quat* rotations,
+	const uint32_t* bones,
+	const Settings& settings,
+	IAllocator& allocator,
+	OutputBlob& blob)
+{
+	ASSERT(frame_count > 0 && frame_count <= 0x10000);
+
+	Array<uint16_t> position_frames(allocator);
+	Array<uint16_t> quantized_positions(allocator);
+	Array<uint16_t> rotation_frames(allocator);
+	Array<PackedQuat> packed_rotations(allocator);
+	Array<Quat> aligned(allocator);
+	aligned.resize(frame_count);
+
+	blob.write((int32_t)frame_count);
+	blob.write((int32_t)bone_count);
+	blob.write(bones, sizeof(bones[0]) * bone_count);
+
+	for (int bone = 0; bone < bone_count; ++bone)
+	{
+		PositionTrack position_track;
+		position_track.values = positions + bone;
+		position_track.stride = bone_count;
+		int first_position = position_frames.size();
+		reduceKeys(position_track,
+			frame_count,
+			settings.position_error,
+			settings.max_key_distance,
+			position_frames);
+		int position_count = position_frames.size() - first_position;
+
+		Vec3 min = position_track.get(position_frames[first_position]);
+		Vec3 max = min;
+		for (int i = first_position; i < position_frames.size(); ++i)
+		{
+			const Vec3& p = position_track.get(position_frames[i]);
+			min.set(Math::minValue(min.x, p.x), Math::minValue(min.y, p.y), Math::minValue(min.z, p.z));
+			max.set(Math::maxValue(max.x, p.x), Math::maxValue(max.y, p.y), Math::maxValue(max.z, p.z));
+		}
+		Vec3 scale = (max - min) * (1 / 65535.0f);
+		for (int i = first_position; i < position_frames.size(); ++i)
+		{
+			const Vec3& p = position_track.get(position_frames[i]);
+			const float* value = &p.x;
+			const float* min_value = &min.x;
+			const float* scale_value = &scale.x;
+			for (int j = 0; j < 3; ++j)
+			{
+				float q = scale_value[j] > 0 ? (value[j] - min_value[j]) / scale_value[j] : 0;
+				quantized_positions.push((uint16_t)Math::clamp(q + 0.5f, 0.0f, 65535.0f));
+			}
+		}
+
+		aligned[0] = rotations[bone];
+		for (int i = 1; i < frame_count; ++i)
+		{
+			const Quat& q = rotations[i * bone_count + bone];
+			const Quat& prev = aligned[i - 1];
+			float dot = q.x * prev.x + q.y * prev.y + q.z * prev.z + q.w * prev.w;
+			aligned[i] = dot < 0 ? Quat(-q.x, -q.y, -q.z, -q.w) : q;
+		}
+		RotationTrack rotation_track;
+		rotation_track.values = &aligned[0];
+		int first_rotation = rotation_frames.size();
+		reduceKeys(rotation_track,
+			frame_count,
+			settings.rotation_error,
+			settings.max_key_distance,
+			rotation_frames);
+		int rotation_count = rotation_frames.size() - first_rotation;
+		for (int i = first_rotation; i < rotation_frames.size(); ++i)
+		{
+			packQuat(rotation_track.get(rotation_frames[i]), &packed_rotations.pushEmpty());
+		}
+
+		blob.write((uint16_t)position_count);
+		blob.write((uint16_t)rotation_count);
+		blob.write(min);
+		blob.write(scale);
+	}
+
+	blob.write((int32_t)position_frames.size());
+	if (!position_frames.empty())
+	{
+		blob.write(&position_frames[0], sizeof(position_frames[0]) * position_frames.size());
+		blob.write(&quantized_positions[0], sizeof(quantized_positions[0]) * quantized_positions.size());
+	}
+	blob.write((int32_t)rotation_frames.size());
+	if (!rotation_frames.empty())
+	{
+		blob.write(&rotation_frames[0], sizeof(rotation_frames[0]) * rotation_frames.size());
+		blob.write(&packed_rotations[0], sizeof(packed_rotations[0]) * packed_rotations.size());
+	}
+}
+
+
+} // ~namespace AnimationCompression
+
+
+} // ~namespace Lumix
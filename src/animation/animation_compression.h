@@ -0,0 +1,56 @@
+#pragma once
+
+#include "lumix.h"
+
+namespace Lumix
+{
+
+class IAllocator;
+class OutputBlob;
+struct Quat;
+struct Vec3;
+
+
+namespace AnimationCompression
+{
+	// smallest three encoding, 2 bits for the index of the largest
+	// component and 15 bits for each of the other three
+	struct PackedQuat
+	{
+		uint16_t a;
+		uint16_t b;
+		uint16_t c;
+	};
+
+	struct Settings
+	{
+		Settings()
+			: position_error(0.001f)
+			, rotation_error(0.0005f)
+			, max_key_distance(256)
+		{
+		}
+
+		float position_error;
+		float rotation_error;
+		int max_key_distance;
+	};
+
+	LUMIX_ANIMATION_API void packQuat(const Quat& q, PackedQuat* out);
+	LUMIX_ANIMATION_API void unpackQuat(const PackedQuat& q, Quat* out);
+
+	// writes the body of a version 2 animation file (everything after
+	// Animation::Header), positions and rotations are indexed by
+	// frame * bone_count + bone like in version 1
+	LUMIX_ANIMATION_API void compress(int frame_count,
+		int bone_count,
+		const Vec3* positions,
+		const Quat* rotations,
+		const uint32_t* bones,
+		const Settings& settings,
+		IAllocator& allocator,
+		OutputBlob& blob);
+} // ~namespace AnimationCompression
+
+
+} // ~namespace Lumix
@@ -0,0 +1,760 @@
+#include "animation/animation_graph.h"
+#include "animation/animation.h"
+#include "core/blob.h"
+#include "core/math_utils.h"
+#include "core/path.h"
+#include "core/quat.h"
+#include "core/resource_manager.h"
+#include "core/resource_manager_base.h"
+#include "core/vec3.h"
+#include "renderer/model.h"
+#include "renderer/pose.h"
+#include <cmath>
+#include <cstring>
+
+
+namespace Lumix
+{
+
+
+AnimationGraph::AnimationGraph(IAllocator& allocator)
+	: m_allocator(allocator)
+	, m_nodes(allocator)
+	, m_states(allocator)
+	, m_scratch(allocator)
+	, m_root(INVALID_NODE)
+	, m_skeleton_hash(0)
+	, m_evaluated_bone_count(0)
+{
+	m_bind_pose = m_allocator.newObject<Pose>(m_allocator);
+}
+
+
+AnimationGraph::~AnimationGraph()
+{
+	clear();
+	for (int i = 0; i < m_scratch.size(); ++i)
+	{
+		m_allocator.deleteObject(m_scratch[i]);
+	}
+	m_allocator.deleteObject(m_bind_pose);
+}
+
+
+void AnimationGraph::clear()
+{
+	for (int i = 0; i < m_nodes.size(); ++i)
+	{
+		Animation* animation = m_nodes[i].m_animation;
+		if (animation)
+		{
+			animation->getResourceManager()
+				.get(ResourceManager::ANIMATION)
+				->unload(*animation);
+		}
+	}
+	m_nodes.clear();
+	m_states.clear();
+	m_root = INVALID_NODE;
+}
+
+
+int AnimationGraph::addNode(NodeType type)
+{
+	Node& node = m_nodes.pushEmpty();
+	node.m_type = type;
+	node.m_weight = 1;
+	node.m_time = 0;
+	node.m_speed = 1;
+	node.m_looped = true;
+	node.m_animation = nullptr;
+	node.m_inputs[0] = node.m_inputs[1] = INVALID_NODE;
+	node.m_first_state = -1;
+	node.m_state_count = 0;
+	node.m_current_state = -1;
+	node.m_previous_state = -1;
+	node.m_fade_time = 0;
+	node.m_fade_length = 0;
+	m_root = m_nodes.size() - 1;
+	return m_root;
+}
+
+
+int AnimationGraph::addClip(Animation* animation, bool looped)
+{
+	int index = addNode(NodeType::CLIP);
+	m_nodes[index].m_animation = animation;
+	m_nodes[index].m_looped = looped;
+	return index;
+}
+
+
+int AnimationGraph::addBlend(int input0, int input1, float weight)
+{
+	ASSERT(input0 >= 0 && input0 < m_nodes.size());
+	ASSERT(input1 >= 0 && input1 < m_nodes.size());
+	int index = addNode(NodeType::BLEND);
+	m_nodes[index].m_inputs[0] = input0;
+	m_nodes[index].m_inputs[1] = input1;
+	m_nodes[index].m_weight = weight;
+	return index;
+}
+
+
+int AnimationGraph::addAdditive(int base, int additive_clip, float weight)
+{
+	ASSERT(base >= 0 && base < m_nodes.size());
+	ASSERT(additive_clip >= 0 && additive_clip < m_nodes.size());
+	ASSERT(m_nodes[additive_clip].m_type == NodeType::CLIP);
+	int index = addNode(NodeType::ADDITIVE);
+	m_nodes[index].m_inputs[0] = base;
+	m_nodes[index].m_inputs[1] = additive_clip;
+	m_nodes[index].m_weight = weight;
+	return index;
+}
+
+
+int AnimationGraph::addStateMachine()
+{
+	return addNode(NodeType::STATE_MACHINE);
+}
+
+
+int AnimationGraph::addState(int state_machine, int node)
+{
+	ASSERT(m_nodes[state_machine].m_type == NodeType::STATE_MACHINE);
+	ASSERT(node >= 0 && node < m_nodes.size());
+	Node& sm = m_nodes[state_machine];
+
+	State& state = m_states.pushEmpty();
+	state.m_state_machine = state_machine;
+	state.m_node = node;
+	state.m_next = -1;
+	int state_index = m_states.size() - 1;
+	if (sm.m_first_state < 0)
+	{
+		sm.m_first_state = state_index;
+	}
+	else
+	{
+		int last = sm.m_first_state;
+		while (m_states[last].m_next >= 0)
+		{
+			last = m_states[last].m_next;
+		}
+		m_states[last].m_next = state_index;
+	}
+	if (sm.m_current_state < 0)
+	{
+		sm.m_current_state = sm.m_state_count;
+	}
+	++sm.m_state_count;
+	return sm.m_state_count - 1;
+}
+
+
+int AnimationGraph::getStateNode(int state_machine, int state) const
+{
+	int index = m_nodes[state_machine].m_first_state;
+	for (int i = 0; i < state && index >= 0; ++i)
+	{
+		index = m_states[index].m_next;
+	}
+	return index < 0 ? INVALID_NODE : m_states[index].m_node;
+}
+
+
+void AnimationGraph::setWeight(int node, float weight)
+{
+	m_nodes[node].m_weight = Math::clamp(weight, 0.0f, 1.0f);
+}
+
+
+void AnimationGraph::setSpeed(int clip, float speed)
+{
+	ASSERT(m_nodes[clip].m_type == NodeType::CLIP);
+	m_nodes[clip].m_speed = speed;
+}
+
+
+void AnimationGraph::setTime(int clip, float time)
+{
+	ASSERT(m_nodes[clip].m_type == NodeType::CLIP);
+	m_nodes[clip].m_time = time;
+}
+
+
+void AnimationGraph::setState(int state_machine,
+	int state,
+	float crossfade_time)
+{
+	Node& sm = m_nodes[state_machine];
+	ASSERT(sm.m_type == NodeType::STATE_MACHINE);
+	if (state < 0 || state >= sm.m_state_count || state == sm.m_current_state)
+	{
+		return;
+	}
+	restart(getStateNode(state_machine, state));
+	if (crossfade_time > 0 && sm.m_current_state >= 0)
+	{
+		sm.m_previous_state = sm.m_current_state;
+		sm.m_fade_time = 0;
+		sm.m_fade_length = crossfade_time;
+	}
+	else
+	{
+		sm.m_previous_state = -1;
+	}
+	sm.m_current_state = state;
+}
+
+
+int AnimationGraph::getState(int state_machine) const
+{
+	return m_nodes[state_machine].m_current_state;
+}
+
+
+bool AnimationGraph::isInTransition(int state_machine) const
+{
+	return m_nodes[state_machine].m_previous_state >= 0;
+}
+
+
+void AnimationGraph::serialize(OutputBlob& serializer) const
+{
+	serializer.write((int32_t)m_nodes.size());
+	for (int i = 0; i < m_nodes.size(); ++i)
+	{
+		const Node& node = m_nodes[i];
+		serializer.write(node.m_type);
+		serializer.write(node.m_weight);
+		serializer.write(node.m_time);
+		serializer.write(node.m_speed);
+		serializer.write(node.m_looped);
+		serializer.writeString(
+			node.m_animation ? node.m_animation->getPath().c_str() : "");
+		serializer.write(node.m_inputs[0]);
+		serializer.write(node.m_inputs[1]);
+		serializer.write(node.m_first_state);
+		serializer.write(node.m_state_count);
+		serializer.write(node.m_current_state);
+		serializer.write(node.m_previous_state);
+		serializer.write(node.m_fade_time);
+		serializer.write(node.m_fade_length);
+	}
+	serializer.write((int32_t)m_states.size());
+	for (int i = 0; i < m_states.size(); ++i)
+	{
+		serializer.write(m_states[i].m_state_machine);
+		serializer.write(m_states[i].m_node);
+		serializer.write(m_states[i].m_next);
+	}
+	serializer.write(m_root);
+}
+
+
+// the smallest a serialized node or state can be, counts which do not fit
+// in the rest of the blob are rejected before anything is allocated
+static const int MIN_SERIALIZED_NODE_SIZE =
+	sizeof(uint32_t) * 2 + sizeof(float) * 5 + sizeof(uint8_t) + sizeof(int) * 6;
+static const int SERIALIZED_STATE_SIZE = sizeof(int) * 3;
+
+
+bool AnimationGraph::deserialize(InputBlob& serializer,
+	ResourceManager& resource_manager)
+{
+	clear();
+	int32_t count;
+	serializer.read(count);
+	int remaining = serializer.getSize() - serializer.getPosition();
+	if (count < 0 || count > remaining / MIN_SERIALIZED_NODE_SIZE)
+	{
+		return false;
+	}
+	m_nodes.reserve(count);
+	for (int i = 0; i < count; ++i)
+	{
+		Node& node = m_nodes.pushEmpty();
+		serializer.read(node.m_type);
+		serializer.read(node.m_weight);
+		serializer.read(node.m_time);
+		serializer.read(node.m_speed);
+		serializer.read(node.m_looped);
+		char path[MAX_PATH_LENGTH];
+		serializer.readString(path, sizeof(path));
+		path[sizeof(path) - 1] = '\0';
+		node.m_animation =
+			path[0] == '\0'
+				? nullptr
+				: static_cast<Animation*>(
+					  resource_manager.get(ResourceManager::ANIMATION)
+						  ->load(Path(path)));
+		serializer.read(node.m_inputs[0]);
+		serializer.read(node.m_inputs[1]);
+		serializer.read(node.m_first_state);
+		serializer.read(node.m_state_count);
+		serializer.read(node.m_current_state);
+		serializer.read(node.m_previous_state);
+		serializer.read(node.m_fade_time);
+		serializer.read(node.m_fade_length);
+	}
+	serializer.read(count);
+	remaining = serializer.getSize() - serializer.getPosition();
+	if (count < 0 || count > remaining / SERIALIZED_STATE_SIZE)
+	{
+		clear();
+		return false;
+	}
+	m_states.resize(count);
+	for (int i = 0; i < count; ++i)
+	{
+		serializer.read(m_states[i].m_state_machine);
+		serializer.read(m_states[i].m_node);
+		serializer.read(m_states[i].m_next);
+	}
+	serializer.read(m_root);
+	if (!isValid())
+	{
+		clear();
+		return false;
+	}
+	return true;
+}
+
+
+bool AnimationGraph::isValidNode(int node) const
+{
+	return node >= 0 && node < m_nodes.size();
+}
+
+
+// everything update() and evaluate() index with must be in range and the
+// graph must not have cycles, otherwise they would recurse forever
+bool AnimationGraph::isValid() const
+{
+	if (m_root != INVALID_NODE && !isValidNode(m_root))
+	{
+		return false;
+	}
+	for (int i = 0; i < m_states.size(); ++i)
+	{
+		const State& state = m_states[i];
+		if (!isValidNode(state.m_state_machine) ||
+			m_nodes[state.m_state_machine].m_type != NodeType::STATE_MACHINE ||
+			!isValidNode(state.m_node) ||
+			state.m_next < -1 || state.m_next >= m_states.size())
+		{
+			return false;
+		}
+	}
+	for (int i = 0; i < m_nodes.size(); ++i)
+	{
+		const Node& node = m_nodes[i];
+		switch (node.m_type)
+		{
+			case NodeType::CLIP:
+				break;
+			case NodeType::BLEND:
+			case NodeType::ADDITIVE:
+				if (!isValidNode(node.m_inputs[0]) ||
+					!isValidNode(node.m_inputs[1]))
+				{
+					return false;
+				}
+				if (node.m_type == NodeType::ADDITIVE &&
+					m_nodes[node.m_inputs[1]].m_type != NodeType::CLIP)
+				{
+					return false;
+				}
+				break;
+			case NodeType::STATE_MACHINE:
+			{
+				// the chain has exactly m_state_count states of this machine
+				int state = node.m_first_state;
+				for (int j = 0; j < node.m_state_count; ++j)
+				{
+					if (state < 0 || state >= m_states.size() ||
+						m_states[state].m_state_machine != i)
+					{
+						return false;
+					}
+					state = m_states[state].m_next;
+				}
+				if (node.m_state_count < 0 || state != -1 ||
+					node.m_current_state < -1 ||
+					node.m_current_state >= node.m_state_count ||
+					node.m_previous_state < -1 ||
+					node.m_previous_state >= node.m_state_count ||
+					(node.m_previous_state >= 0 &&
+						(node.m_current_state < 0 || node.m_fade_length <= 0)))
+				{
+					return false;
+				}
+				break;
+			}
+			default:
+				return false;
+		}
+	}
+
+	Array<uint8_t> marks(m_allocator);
+	marks.resize(m_nodes.size());
+	for (int i = 0; i < m_nodes.size(); ++i)
+	{
+		marks[i] = 0;
+	}
+	for (int i = 0; i < m_nodes.size(); ++i)
+	{
+		if (!isAcyclic(i, marks))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+
+// marks: 0 - not visited, 1 - on the current path, 2 - done
+bool AnimationGraph::isAcyclic(int node_index, Array<uint8_t>& marks) const
+{
+	if (marks[node_index] != 0)
+	{
+		return marks[node_index] == 2;
+	}
+	marks[node_index] = 1;
+	const Node& node = m_nodes[node_index];
+	switch (node.m_type)
+	{
+		case NodeType::CLIP:
+			break;
+		case NodeType::BLEND:
+		case NodeType::ADDITIVE:
+			if (!isAcyclic(node.m_inputs[0], marks) ||
+				!isAcyclic(node.m_inputs[1], marks))
+			{
+				return false;
+			}
+			break;
+		case NodeType::STATE_MACHINE:
+			for (int i = node.m_first_state; i >= 0; i = m_states[i].m_next)
+			{
+				if (!isAcyclic(m_states[i].m_node, marks))
+				{
+					return false;
+				}
+			}
+			break;
+	}
+	marks[node_index] = 2;
+	return true;
+}
+
+
+void AnimationGraph::restart(int node_index)
+{
+	Node& node = m_nodes[node_index];
+	switch (node.m_type)
+	{
+		case NodeType::CLIP:
+			node.m_time = 0;
+			break;
+		case NodeType::BLEND:
+		case NodeType::ADDITIVE:
+			restart(node.m_inputs[0]);
+			restart(node.m_inputs[1]);
+			break;
+		case NodeType::STATE_MACHINE:
+			node.m_previous_state = -1;
+			if (node.m_current_state >= 0)
+			{
+				restart(getStateNode(node_index, node.m_current_state));
+			}
+			break;
+	}
+}
+
+
+bool AnimationGraph::isReady() const
+{
+	for (int i = 0; i < m_nodes.size(); ++i)
+	{
+		const Animation* animation = m_nodes[i].m_animation;
+		if (animation && !animation->isReady() && !animation->isFailure())
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+
+int AnimationGraph::getScratchDepth(int node_index) const
+{
+	const Node& node = m_nodes[node_index];
+	switch (node.m_type)
+	{
+		case NodeType::CLIP:
+			return 0;
+		case NodeType::BLEND:
+			return Math::maxValue(getScratchDepth(node.m_inputs[0]),
+				1 + getScratchDepth(node.m_inputs[1]));
+		case NodeType::ADDITIVE:
+			return Math::maxValue(getScratchDepth(node.m_inputs[0]), 2);
+		case NodeType::STATE_MACHINE:
+		{
+			int depth = 0;
+			for (int i = node.m_first_state; i >= 0; i = m_states[i].m_next)
+			{
+				depth = Math::maxValue(
+					depth, 1 + getScratchDepth(m_states[i].m_node));
+			}
+			return depth;
+		}
+	}
+	return 0;
+}
+
+
+void AnimationGraph::prepare(Model& model)
+{
+	if (!model.isReady())
+	{
+		return;
+	}
+	for (int i = 0; i < m_nodes.size(); ++i)
+	{
+		Animation* animation = m_nodes[i].m_animation;
+		if (animation && animation->isReady())
+		{
+			animation->getBoneRemap(model);
+		}
+	}
+
+	int bone_count = model.getBoneCount();
+	int depth = m_root >= 0 ? getScratchDepth(m_root) : 0;
+	while (m_scratch.size() < depth)
+	{
+		m_scratch.push(m_allocator.newObject<Pose>(m_allocator));
+	}
+	for (int i = 0; i < m_scratch.size(); ++i)
+	{
+		if (m_scratch[i]->getCount() != bone_count)
+		{
+			m_scratch[i]->resize(bone_count);
+		}
+	}
+
+	if (m_bind_pose->getCount() == bone_count &&
+		m_skeleton_hash == model.getSkeletonHash())
+	{
+		return;
+	}
+	m_skeleton_hash = model.getSkeletonHash();
+
+	// bind pose is stored relative, so that clips which do not animate
+	// all bones can start from it
+	m_bind_pose->resize(bone_count);
+	model.getPose(*m_bind_pose);
+	Vec3* pos = m_bind_pose->getPositions();
+	Quat* rot = m_bind_pose->getRotations();
+	for (int i = bone_count - 1; i >= model.getFirstNonrootBoneIndex(); --i)
+	{
+		int parent = model.getBone(i).parent_idx;
+		Quat inv_parent;
+		rot[parent].conjugated(inv_parent);
+		pos[i] = inv_parent * (pos[i] - pos[parent]);
+		rot[i] = rot[i] * inv_parent;
+	}
+}
+
+
+void AnimationGraph::update(float time_delta)
+{
+	if (m_root >= 0)
+	{
+		update(m_root, time_delta);
+	}
+}
+
+
+void AnimationGraph::update(int node_index, float time_delta)
+{
+	Node& node = m_nodes[node_index];
+	switch (node.m_type)
+	{
+		case NodeType::CLIP:
+		{
+			float t = node.m_time + time_delta * node.m_speed;
+			if (node.m_animation && node.m_animation->isReady())
+			{
+				float length = node.m_animation->getLength();
+				if (node.m_looped && length > 0)
+				{
+					t = fmodf(t, length);
+					if (t < 0)
+					{
+						t += length;
+					}
+				}
+				else
+				{
+					t = Math::clamp(t, 0.0f, length);
+				}
+			}
+			node.m_time = t;
+			break;
+		}
+		case NodeType::BLEND:
+		case NodeType::ADDITIVE:
+			update(node.m_inputs[0], time_delta);
+			update(node.m_inputs[1], time_delta);
+			break;
+		case NodeType::STATE_MACHINE:
+			if (node.m_current_state >= 0)
+			{
+				update(getStateNode(node_index, node.m_current_state),
+					time_delta);
+			}
+			if (node.m_previous_state >= 0)
+			{
+				node.m_fade_time += time_delta;
+				if (node.m_fade_time >= node.m_fade_length)
+				{
+					node.m_previous_state = -1;
+				}
+				else
+				{
+					update(getStateNode(node_index, node.m_previous_state),
+						time_delta);
+				}
+			}
+			break;
+	}
+}
+
+
+void AnimationGraph::evaluate(Pose& pose, Model& model, int bone_count)
+{
+	if (m_root < 0 || !model.isReady() ||
+		pose.getCount() != m_bind_pose->getCount())
+	{
+		return;
+	}
+	ASSERT(m_scratch.size() >= getScratchDepth(m_root));
+	m_evaluated_bone_count = bone_count;
+	evaluate(m_root, pose, model, 0);
+	pose.setIsRelative();
+	pose.computeAbsolute(model, bone_count);
+}
+
+
+void AnimationGraph::evaluate(int node_index, Pose& pose, Model& model, int scratch)
+{
+	Node& node = m_nodes[node_index];
+	switch (node.m_type)
+	{
+		case NodeType::CLIP:
+			evaluateClip(node, pose, model, node.m_time);
+			break;
+		case NodeType::BLEND:
+			if (node.m_weight <= 0)
+			{
+				evaluate(node.m_inputs[0], pose, model, scratch);
+			}
+			else if (node.m_weight >= 1)
+			{
+				evaluate(node.m_inputs[1], pose, model, scratch);
+			}
+			else
+			{
+				Pose& tmp = *m_scratch[scratch];
+				evaluate(node.m_inputs[0], pose, model, scratch);
+				evaluate(node.m_inputs[1], tmp, model, scratch + 1);
+				pose.blend(tmp, node.m_weight);
+			}
+			break;
+		case NodeType::ADDITIVE:
+			evaluate(node.m_inputs[0], pose, model, scratch);
+			if (node.m_weight > 0)
+			{
+				Node& clip = m_nodes[node.m_inputs[1]];
+				Pose& additive = *m_scratch[scratch];
+				Pose& reference = *m_scratch[scratch + 1];
+				evaluateClip(clip, additive, model, clip.m_time);
+				evaluateClip(clip, reference, model, 0);
+				applyAdditive(pose, additive, reference, node.m_weight);
+			}
+			break;
+		case NodeType::STATE_MACHINE:
+			if (node.m_current_state < 0)
+			{
+				copyPose(*m_bind_pose, pose);
+				break;
+			}
+			evaluate(getStateNode(node_index, node.m_current_state),
+				pose,
+				model,
+				scratch);
+			if (node.m_previous_state >= 0)
+			{
+				Pose& tmp = *m_scratch[scratch];
+				evaluate(getStateNode(node_index, node.m_previous_state),
+					tmp,
+					model,
+					scratch + 1);
+				pose.blend(tmp, 1 - node.m_fade_time / node.m_fade_length);
+			}
+			break;
+	}
+}
+
+
+void AnimationGraph::evaluateClip(Node& node, Pose& pose, Model& model, float time)
+{
+	copyPose(*m_bind_pose, pose);
+	if (node.m_animation && node.m_animation->isReady())
+	{
+		node.m_animation->sample(time, pose, model, m_evaluated_bone_count);
+	}
+}
+
+
+void AnimationGraph::applyAdditive(Pose& pose,
+	const Pose& additive,
+	const Pose& reference,
+	float weight)
+{
+	Vec3* pos = pose.getPositions();
+	Quat* rot = pose.getRotations();
+	const Vec3* add_pos = additive.getPositions();
+	const Quat* add_rot = additive.getRotations();
+	const Vec3* ref_pos = reference.getPositions();
+	const Quat* ref_rot = reference.getRotations();
+	Quat identity(0, 0, 0, 1);
+	for (int i = 0, c = pose.getCount(); i < c; ++i)
+	{
+		pos[i] += (add_pos[i] - ref_pos[i]) * weight;
+
+		Quat inv_ref;
+		ref_rot[i].conjugated(inv_ref);
+		Quat delta = add_rot[i] * inv_ref;
+		if (delta.w < 0)
+		{
+			delta.set(-delta.x, -delta.y, -delta.z, -delta.w);
+		}
+		nlerp(identity, delta, &delta, weight);
+		rot[i] = delta * rot[i];
+	}
+}
+
+
+void AnimationGraph::copyPose(const Pose& src, Pose& dst)
+{
+	ASSERT(src.getCount() == dst.getCount());
+	memcpy(dst.getPositions(), src.getPositions(), sizeof(Vec3) * src.getCount());
+	memcpy(dst.getRotations(), src.getRotations(), sizeof(Quat) * src.getCount());
+}
+
+
+} // ~namespace Lumix
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "lumix.h"
+#include "core/array.h"
+
+namespace Lumix
+{
+
+class Animation;
+class IAllocator;
+class InputBlob;
+class Model;
+class OutputBlob;
+class Pose;
+class ResourceManager;
+
+
+// per character animation graph, nodes are created up front and referenced by
+// index, the root is the last added node unless set by setRoot;
+// after prepare() neither update() nor evaluate() allocate, and different
+// graphs can be updated and evaluated in parallel
+class LUMIX_ANIMATION_API AnimationGraph
+{
+public:
+	static const int INVALID_NODE = -1;
+
+	enum class NodeType : uint32_t
+	{
+		CLIP,
+		BLEND, // lerp between two inputs
+		ADDITIVE, // adds difference between a clip and its first frame
+		STATE_MACHINE // one active state, crossfades on state change
+	};
+
+public:
+	AnimationGraph(IAllocator& allocator);
+	~AnimationGraph();
+
+	void clear();
+
+	// the graph takes over the reference to the animation and unloads it
+	// in clear(), animation can be null, then the clip outputs the bind pose
+	int addClip(Animation* animation, bool looped = true);
+	int addBlend(int input0, int input1, float weight);
+	int addAdditive(int base, int additive_clip, float weight);
+	int addStateMachine();
+	// returns index of the state in the state machine
+	int addState(int state_machine, int node);
+
+	void setRoot(int node) { m_root = node; }
+	int getRoot() const { return m_root; }
+	int getNodeCount() const { return m_nodes.size(); }
+	NodeType getNodeType(int node) const { return m_nodes[node].m_type; }
+
+	void setWeight(int node, float weight);
+	float getWeight(int node) const { return m_nodes[node].m_weight; }
+	void setSpeed(int clip, float speed);
+	void setTime(int clip, float time);
+	float getTime(int clip) const { return m_nodes[clip].m_time; }
+
+	// crossfade_time == 0 switches immediately, clips of the new state
+	// start from the beginning
+	void setState(int state_machine, int state, float crossfade_time);
+	int getState(int state_machine) const;
+	bool isInTransition(int state_machine) const;
+
+	// nodes, states and running transitions, clips are stored by path;
+	// deserialize leaves the graph empty and returns false if the data
+	// does not describe a valid graph
+	void serialize(OutputBlob& serializer) const;
+	bool deserialize(InputBlob& serializer, ResourceManager& resource_manager);
+
+	bool isReady() const;
+	// must be called on the main thread before update()/evaluate() whenever
+	// the model or the graph changes, builds bone remap tables and scratch
+	// poses
+	void prepare(Model& model);
+	void update(float time_delta);
+	// output pose is absolute, only the first bone_count bones are valid
+	void evaluate(Pose& pose, Model& model, int bone_count);
+
+private:
+	struct Node
+	{
+		NodeType m_type;
+		float m_weight;
+		float m_time;
+		float m_speed;
+		bool m_looped;
+		Animation* m_animation;
+		int m_inputs[2];
+		// state machine
+		int m_first_state;
+		int m_state_count;
+		int m_current_state;
+		int m_previous_state;
+		float m_fade_time;
+		float m_fade_length;
+	};
+
+	struct State
+	{
+		int m_state_machine;
+		int m_node;
+		int m_next; // next state of the same state machine
+	};
+
+private:
+	int addNode(NodeType type);
+	int getStateNode(int state_machine, int state) const;
+	bool isValidNode(int node) const;
+	bool isValid() const;
+	bool isAcyclic(int node, Array<uint8_t>& marks) const;
+	int getScratchDepth(int node) const;
+	void restart(int node);
+	void update(int node, float time_delta);
+	void evaluate(int node, Pose& pose, Model& model, int scratch);
+	void evaluateClip(Node& node, Pose& pose, Model& model, float time);
+	void applyAdditive(Pose& pose, const Pose& additive, const Pose& reference, float weight);
+	void copyPose(const Pose& src, Pose& dst);
+
+private:
+	IAllocator& m_allocator;
+	Array<Node> m_nodes;
+	Array<State> m_states;
+	Array<Pose*> m_scratch;
+	Pose* m_bind_pose;
+	int m_root;
+	uint32_t m_skeleton_hash;
+	int m_evaluated_bone_count;
+};
+
+
+} // ~namespace Lumix
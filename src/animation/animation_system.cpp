@@ -1,16 +1,26 @@
 #include "animation_system.h"
 #include "animation/animation.h"
+#include "animation/animation_graph.h"
 #include "core/base_proxy_allocator.h"
 #include "core/blob.h"
 #include "core/crc32.h"
 #include "core/json_serializer.h"
+#include "core/log.h"
+#include "core/math_utils.h"
+#include "core/mtjd/generic_job.h"
+#include "core/mtjd/job.h"
+#include "core/mtjd/manager.h"
 #include "core/profiler.h"
 #include "core/resource_manager.h"
 #include "editor/world_editor.h"
 #include "engine.h"
 #include "engine/property_descriptor.h"
+#include "renderer/model.h"
+#include "renderer/pose.h"
 #include "renderer/render_scene.h"
 #include "universe/universe.h"
+#include <cfloat>
+#include <cmath>
 
 
 namespace Lumix
@@ -18,6 +28,20 @@ namespace Lumix
 
 static const uint32_t RENDERABLE_HASH = crc32("renderable");
 static const uint32_t ANIMABLE_HASH = crc32("animable");
+static const int MIN_ANIMABLES_PER_JOB = 16;
+
+
+// visible animables closer than the distance are updated every
+// m_update_interval-th frame, off-screen animables are not updated at all
+struct AnimationLOD
+{
+	float m_squared_distance;
+	int m_update_interval;
+};
+
+
+static const AnimationLOD ANIMATION_LODS[] = {
+	{20.0f * 20.0f, 1}, {50.0f * 50.0f, 2}, {FLT_MAX, 4}};
 
 namespace FS
 {
@@ -30,7 +54,7 @@ class JsonSerializer;
 class Universe;
 
 
-class AnimationSceneImpl : public IScene
+class AnimationSceneImpl : public AnimationScene
 {
 private:
 	struct Animable
@@ -38,10 +62,22 @@ private:
 		bool m_is_free;
 		ComponentIndex m_renderable;
 		float m_time;
+		// time delta accumulated while the animable was not updated
+		float m_pending_time;
 		class Animation* m_animation;
+		AnimationGraph* m_graph;
 		Entity m_entity;
 	};
 
+	struct AnimableUpdate
+	{
+		Animable* m_animable;
+		Pose* m_pose;
+		Model* m_model;
+		float m_time_delta;
+		int m_bone_count;
+	};
+
 public:
 	AnimationSceneImpl(IPlugin& anim_system,
 					   Engine& engine,
@@ -51,6 +87,10 @@ public:
 		, m_engine(engine)
 		, m_anim_system(anim_system)
 		, m_animables(allocator)
+		, m_updates(allocator)
+		, m_jobs(allocator)
+		, m_sync_point(true, allocator)
+		, m_allocator(allocator)
 	{
 		m_render_scene = nullptr;
 		uint32_t hash = crc32("renderer");
@@ -74,6 +114,10 @@ public:
 
 	~AnimationSceneImpl()
 	{
+		for (int i = 0; i < m_animables.size(); ++i)
+		{
+			m_allocator.deleteObject(m_animables[i].m_graph);
+		}
 		m_render_scene->renderableCreated()
 			.unbind<AnimationSceneImpl,
 					&AnimationSceneImpl::onRenderableCreated>(this);
@@ -108,6 +152,7 @@ public:
 		if (type == ANIMABLE_HASH)
 		{
 			m_animables[component].m_is_free = true;
+			destroyAnimationGraph(component);
 			m_universe.destroyComponent(
 				m_animables[component].m_entity, type, this, component);
 		}
@@ -126,17 +171,28 @@ public:
 				m_animables[i].m_animation
 					? m_animables[i].m_animation->getPath().c_str()
 					: "");
+			serializer.write(m_animables[i].m_graph != nullptr);
+			if (m_animables[i].m_graph)
+			{
+				m_animables[i].m_graph->serialize(serializer);
+			}
 		}
 	}
 
 
-	virtual void deserialize(InputBlob& serializer) override
+	virtual void deserialize(InputBlob& serializer, int version) override
 	{
 		int32_t count;
 		serializer.read(count);
+		for (int i = 0; i < m_animables.size(); ++i)
+		{
+			m_allocator.deleteObject(m_animables[i].m_graph);
+		}
 		m_animables.resize(count);
 		for (int i = 0; i < count; ++i)
 		{
+			m_animables[i].m_graph = nullptr;
+			m_animables[i].m_pending_time = 0;
 			serializer.read(m_animables[i].m_entity);
 			ComponentIndex renderable =
 				m_render_scene->getRenderableComponent(m_animables[i].m_entity);
@@ -150,6 +206,20 @@ public:
 			serializer.readString(path, sizeof(path));
 			m_animables[i].m_animation =
 				path[0] == '\0' ? nullptr : loadAnimation(path);
+			bool has_graph = false;
+			if (version > (int)SerializedEngineVersion::ANIMATION_GRAPHS)
+			{
+				serializer.read(has_graph);
+			}
+			if (has_graph &&
+				!getAnimationGraph(i).deserialize(
+					serializer, m_engine.getResourceManager()))
+			{
+				g_log_error.log("animation")
+					<< "Invalid animation graph of entity "
+					<< m_animables[i].m_entity;
+				destroyAnimationGraph(i);
+			}
 			m_universe.addComponent(
 				m_animables[i].m_entity, ANIMABLE_HASH, this, i);
 		}
@@ -170,46 +240,229 @@ public:
 	}
 
 
-	void playAnimation(ComponentIndex cmp, const char* path)
+	virtual void playAnimation(ComponentIndex cmp, const char* path) override
 	{
 		m_animables[cmp].m_animation = loadAnimation(path);
 		m_animables[cmp].m_time = 0;
 	}
 
 
+	virtual AnimationGraph& getAnimationGraph(ComponentIndex cmp) override
+	{
+		Animable& animable = m_animables[cmp];
+		if (!animable.m_graph)
+		{
+			animable.m_graph =
+				m_allocator.newObject<AnimationGraph>(m_allocator);
+		}
+		return *animable.m_graph;
+	}
+
+
+	virtual void destroyAnimationGraph(ComponentIndex cmp) override
+	{
+		m_allocator.deleteObject(m_animables[cmp].m_graph);
+		m_animables[cmp].m_graph = nullptr;
+	}
+
+
+	virtual void setAnimationGraphState(ComponentIndex cmp,
+		int state_machine,
+		int state,
+		float crossfade_time) override
+	{
+		AnimationGraph* graph = m_animables[cmp].m_graph;
+		if (graph && state_machine >= 0 &&
+			state_machine < graph->getNodeCount() &&
+			graph->getNodeType(state_machine) ==
+				AnimationGraph::NodeType::STATE_MACHINE)
+		{
+			graph->setState(state_machine, state, crossfade_time);
+		}
+	}
+
+
+	virtual int getAnimationGraphState(ComponentIndex cmp,
+		int state_machine) override
+	{
+		AnimationGraph* graph = m_animables[cmp].m_graph;
+		if (graph && state_machine >= 0 &&
+			state_machine < graph->getNodeCount() &&
+			graph->getNodeType(state_machine) ==
+				AnimationGraph::NodeType::STATE_MACHINE)
+		{
+			return graph->getState(state_machine);
+		}
+		return -1;
+	}
+
+
+	virtual Animation* loadAnimation(const char* path) override
+	{
+		ResourceManager& rm = m_engine.getResourceManager();
+		return static_cast<Animation*>(
+			rm.get(ResourceManager::ANIMATION)->load(Path(path)));
+	}
+
+
 	virtual void update(float time_delta) override
 	{
 		PROFILE_FUNCTION();
 		if (m_animables.empty())
 			return;
+
+		gatherUpdates(time_delta);
+		int count = m_updates.size();
+		if (count == 0)
+			return;
+
+		MTJD::Manager& manager = m_engine.getMTJDManager();
+		int job_count = Math::minValue(
+			(int)manager.getCpuThreadsCount(), count / MIN_ANIMABLES_PER_JOB);
+		if (job_count <= 1)
+		{
+			updateRange(&m_updates[0], count);
+			return;
+		}
+
+		m_jobs.clear();
+		int batch_size = (count + job_count - 1) / job_count;
+		for (int from = 0; from < count; from += batch_size)
+		{
+			AnimableUpdate* updates = &m_updates[from];
+			int batch_count = Math::minValue(batch_size, count - from);
+			MTJD::Job* job = MTJD::makeJob(manager,
+				[updates, batch_count]()
+				{
+					updateRange(updates, batch_count);
+				},
+				m_allocator);
+			job->addDependency(&m_sync_point);
+			m_jobs.push(job);
+		}
+		for (int i = 0; i < m_jobs.size(); ++i)
+		{
+			manager.schedule(m_jobs[i]);
+		}
+		m_sync_point.sync();
+	}
+
+
+private:
+	static int getUpdateInterval(float squared_distance)
+	{
+		for (int i = 0; i < lengthOf(ANIMATION_LODS) - 1; ++i)
+		{
+			if (squared_distance < ANIMATION_LODS[i].m_squared_distance)
+			{
+				return ANIMATION_LODS[i].m_update_interval;
+			}
+		}
+		return ANIMATION_LODS[lengthOf(ANIMATION_LODS) - 1].m_update_interval;
+	}
+
+
+	// collects animables which should be sampled this frame, runs on the main
+	// thread so that anything touching shared state, e.g. the lazily built
+	// bone remap tables, is done before the jobs start; visibility comes
+	// from the culling done while rendering the previous frame
+	void gatherUpdates(float time_delta)
+	{
+		m_updates.clear();
+		int frame = m_render_scene->getFrame();
 		for (int i = 0, c = m_animables.size(); i < c; ++i)
 		{
 			Animable& animable = m_animables[i];
-			if (!animable.m_is_free && animable.m_animation &&
-				animable.m_animation->isReady())
+			if (animable.m_is_free ||
+				animable.m_renderable == INVALID_COMPONENT)
+			{
+				continue;
+			}
+			if (!animable.m_graph && (!animable.m_animation ||
+										 !animable.m_animation->isReady()))
 			{
-				animable.m_animation->getPose(
-					animable.m_time,
-					m_render_scene->getPose(animable.m_renderable),
-					*m_render_scene->getRenderableModel(animable.m_renderable));
-				float t = animable.m_time + time_delta;
-				float l = animable.m_animation->getLength();
-				while (t > l)
+				continue;
+			}
+			Model* model =
+				m_render_scene->getRenderableModel(animable.m_renderable);
+			if (!model || !model->isReady())
+			{
+				continue;
+			}
+
+			animable.m_pending_time += time_delta;
+			int last_visible_frame =
+				m_render_scene->getRenderableLastVisibleFrame(
+					animable.m_renderable);
+			if (last_visible_frame < 0 || frame - last_visible_frame > 1)
+			{
+				continue;
+			}
+			float squared_distance =
+				m_render_scene->getRenderableVisibleSquaredDistance(
+					animable.m_renderable);
+			// spread animables with the same interval over frames
+			if ((frame + i) % getUpdateInterval(squared_distance) != 0)
+			{
+				continue;
+			}
+
+			if (animable.m_graph)
+			{
+				if (!animable.m_graph->isReady())
 				{
-					t -= l;
+					continue;
 				}
-				animable.m_time = t;
+				animable.m_graph->prepare(*model);
 			}
+			else
+			{
+				animable.m_animation->getBoneRemap(*model);
+			}
+
+			AnimableUpdate& update = m_updates.pushEmpty();
+			update.m_animable = &animable;
+			update.m_pose = &m_render_scene->getPose(animable.m_renderable);
+			update.m_model = model;
+			update.m_time_delta = animable.m_pending_time;
+			int bone_count = model->getLODBoneCount(squared_distance);
+			update.m_bone_count =
+				bone_count > 0 ? bone_count : update.m_pose->getCount();
+			animable.m_pending_time = 0;
 		}
 	}
 
 
-private:
-	Animation* loadAnimation(const char* path)
+	// runs on a worker thread, touches only the given animables and their
+	// poses, must not use the profiler or any other main thread only system
+	static void updateRange(AnimableUpdate* updates, int count)
 	{
-		ResourceManager& rm = m_engine.getResourceManager();
-		return static_cast<Animation*>(
-			rm.get(ResourceManager::ANIMATION)->load(Path(path)));
+		for (int i = 0; i < count; ++i)
+		{
+			AnimableUpdate& update = updates[i];
+			Animable& animable = *update.m_animable;
+			Pose& pose = *update.m_pose;
+			Model& model = *update.m_model;
+			if (animable.m_graph)
+			{
+				animable.m_graph->update(update.m_time_delta);
+				animable.m_graph->evaluate(pose, model, update.m_bone_count);
+				pose.computeSkinningMatrices(model, update.m_bone_count);
+				continue;
+			}
+
+			// skipped frames can add up to several loops
+			Animation& animation = *animable.m_animation;
+			float t = animable.m_time + update.m_time_delta;
+			float l = animation.getLength();
+			if (t > l)
+			{
+				t = fmodf(t, l);
+			}
+			animable.m_time = t;
+			animation.getPose(t, pose, model, update.m_bone_count);
+			pose.computeSkinningMatrices(model, update.m_bone_count);
+		}
 	}
 
 
@@ -254,9 +507,11 @@ private:
 		}
 		Animable& animable = src ? *src : m_animables.pushEmpty();
 		animable.m_time = 0;
+		animable.m_pending_time = 0;
 		animable.m_is_free = false;
 		animable.m_renderable = INVALID_COMPONENT;
 		animable.m_animation = nullptr;
+		animable.m_graph = nullptr;
 		animable.m_entity = entity;
 
 		ComponentIndex renderable =
@@ -280,6 +535,10 @@ private:
 	IPlugin& m_anim_system;
 	Engine& m_engine;
 	Array<Animable> m_animables;
+	Array<AnimableUpdate> m_updates;
+	Array<MTJD::Job*> m_jobs;
+	MTJD::Group m_sync_point;
+	IAllocator& m_allocator;
 	RenderScene* m_render_scene;
 };
 
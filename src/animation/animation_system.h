@@ -8,6 +8,32 @@
 namespace Lumix
 {
 
+class Animation;
+class AnimationGraph;
+
+
+class LUMIX_ANIMATION_API AnimationScene : public IScene
+{
+public:
+	// returned animation is owned by the caller, e.g. pass it to
+	// AnimationGraph::addClip
+	virtual Animation* loadAnimation(const char* path) = 0;
+	virtual void playAnimation(ComponentIndex cmp, const char* path) = 0;
+	// created on first use, while the animable has a graph it is evaluated
+	// instead of the single animation
+	virtual AnimationGraph& getAnimationGraph(ComponentIndex cmp) = 0;
+	virtual void destroyAnimationGraph(ComponentIndex cmp) = 0;
+	// transitions of a state machine node of the animable's graph, see
+	// AnimationGraph::setState
+	virtual void setAnimationGraphState(ComponentIndex cmp,
+		int state_machine,
+		int state,
+		float crossfade_time) = 0;
+	virtual int getAnimationGraphState(ComponentIndex cmp,
+		int state_machine) = 0;
+};
+
+
 extern "C" {
 LUMIX_ANIMATION_API IPlugin* createPlugin(Engine& engine);
 }
@@ -0,0 +1,591 @@
+#include "core/fs/cache_file_device.h"
+#include "core/array.h"
+#include "core/crc32.h"
+#include "core/iallocator.h"
+#include "core/log.h"
+#include "core/math_utils.h"
+#include "core/path.h"
+#include "core/pod_hash_map.h"
+#include "core/string.h"
+#include "core/fs/ifile.h"
+#include "core/fs/ifile_system_defines.h"
+#include "core/fs/os_file.h"
+#include "core/fs/tcp_file_device.h"
+#include "core/mt/mutex.h"
+
+
+namespace Lumix
+{
+	namespace FS
+	{
+		static const uint32_t CACHE_INDEX_MAGIC = 0x5f434649; // '_CFI'
+		static const uint32_t CACHE_INDEX_VERSION = 0;
+		static const int VALIDATE_BATCH_SIZE = 256;
+
+
+		struct CacheEntry
+		{
+			uint32_t m_content_hash;
+			uint32_t m_size;
+			char m_path[MAX_PATH_LENGTH];
+			bool m_is_valid;
+		};
+
+
+		struct CacheFileDeviceImpl
+		{
+			CacheFileDeviceImpl(const char* cache_dir, TCPFileDevice& remote, IAllocator& allocator)
+				: m_allocator(allocator)
+				, m_remote(remote)
+				, m_entries(allocator)
+				, m_map(allocator)
+				, m_mutex(false)
+				, m_is_disabled(false)
+				, m_is_dirty(false)
+				, m_hit_count(0)
+				, m_miss_count(0)
+			{
+				copyString(m_cache_dir, sizeof(m_cache_dir), cache_dir);
+				int len = (int)strlen(m_cache_dir);
+				if (len > 0 && m_cache_dir[len - 1] != '/' && m_cache_dir[len - 1] != '\\')
+				{
+					catString(m_cache_dir, sizeof(m_cache_dir), "/");
+				}
+			}
+
+
+			void getCachedFilePath(uint32_t content_hash, char* out, int max_size)
+			{
+				char name[20];
+				toCString(content_hash, name, sizeof(name));
+				copyString(out, max_size, m_cache_dir);
+				catString(out, max_size, name);
+				catString(out, max_size, ".bin");
+			}
+
+
+			void getIndexPath(char* out, int max_size)
+			{
+				copyString(out, max_size, m_cache_dir);
+				catString(out, max_size, "index.bin");
+			}
+
+
+			// the map is keyed by the hash of the path, a different path with
+			// the same hash is not the entry
+			int find(const char* path)
+			{
+				auto iter = m_map.find(crc32(path));
+				if (iter == m_map.end() || strcmp(m_entries[iter.value()].m_path, path) != 0)
+				{
+					return -1;
+				}
+				return iter.value();
+			}
+
+
+			void remove(int index)
+			{
+				m_map.erase(crc32(m_entries[index].m_path));
+				int last = m_entries.size() - 1;
+				if (index != last)
+				{
+					m_entries[index] = m_entries[last];
+					m_map[crc32(m_entries[index].m_path)] = index;
+				}
+				m_entries.pop();
+				m_is_dirty = true;
+			}
+
+
+			void loadIndex()
+			{
+				char path[MAX_PATH_LENGTH];
+				getIndexPath(path, sizeof(path));
+				OsFile file;
+				if (!file.open(path, Mode::OPEN | Mode::READ, m_allocator))
+				{
+					return;
+				}
+
+				uint32_t magic = 0;
+				uint32_t version = 0;
+				int32_t count = 0;
+				if (file.read(&magic, sizeof(magic)) && magic == CACHE_INDEX_MAGIC &&
+					file.read(&version, sizeof(version)) && version == CACHE_INDEX_VERSION &&
+					file.read(&count, sizeof(count)))
+				{
+					m_entries.reserve(count);
+					for (int i = 0; i < count; ++i)
+					{
+						CacheEntry entry;
+						uint32_t path_len = 0;
+						if (!file.read(&entry.m_content_hash, sizeof(entry.m_content_hash)) ||
+							!file.read(&entry.m_size, sizeof(entry.m_size)) ||
+							!file.read(&path_len, sizeof(path_len)) ||
+							path_len >= sizeof(entry.m_path) ||
+							!file.read(entry.m_path, path_len))
+						{
+							g_log_warning.log("cache file device") << "Corrupted cache index " << path;
+							m_entries.clear();
+							m_map.clear();
+							break;
+						}
+						entry.m_path[path_len] = '\0';
+						entry.m_is_valid = false;
+						// only one of paths with the same hash can be cached
+						if (m_map.find(crc32(entry.m_path)) != m_map.end())
+						{
+							m_is_dirty = true;
+							continue;
+						}
+						m_map[crc32(entry.m_path)] = m_entries.size();
+						m_entries.push(entry);
+					}
+				}
+				file.close();
+			}
+
+
+			void saveIndex()
+			{
+				char path[MAX_PATH_LENGTH];
+				getIndexPath(path, sizeof(path));
+				OsFile file;
+				if (!file.open(path, Mode::CREATE | Mode::WRITE, m_allocator))
+				{
+					g_log_error.log("cache file device") << "Could not save " << path;
+					return;
+				}
+
+				int32_t count = m_entries.size();
+				file.write(&CACHE_INDEX_MAGIC, sizeof(CACHE_INDEX_MAGIC));
+				file.write(&CACHE_INDEX_VERSION, sizeof(CACHE_INDEX_VERSION));
+				file.write(&count, sizeof(count));
+				for (int i = 0; i < count; ++i)
+				{
+					const CacheEntry& entry = m_entries[i];
+					uint32_t path_len = (uint32_t)strlen(entry.m_path);
+					file.write(&entry.m_content_hash, sizeof(entry.m_content_hash));
+					file.write(&entry.m_size, sizeof(entry.m_size));
+					file.write(&path_len, sizeof(path_len));
+					file.write(entry.m_path, path_len);
+				}
+				file.close();
+				m_is_dirty = false;
+			}
+
+
+			bool stat(const char* const* paths, int count, TCPFileStat* stats)
+			{
+				if (m_is_disabled)
+				{
+					return false;
+				}
+				if (!m_remote.stat(paths, count, stats))
+				{
+					g_log_warning.log("cache file device") << "Server does not provide file hashes, cache disabled";
+					m_is_disabled = true;
+					return false;
+				}
+				return true;
+			}
+
+
+			bool isUpToDate(const CacheEntry& entry, const TCPFileStat& stat)
+			{
+				return stat.m_size == (int32_t)entry.m_size && stat.m_hash == entry.m_content_hash;
+			}
+
+
+			void validate()
+			{
+				TCPFileStat stats[VALIDATE_BATCH_SIZE];
+				const char* paths[VALIDATE_BATCH_SIZE];
+				for (int batch_begin = 0; batch_begin < m_entries.size(); batch_begin += VALIDATE_BATCH_SIZE)
+				{
+					int count = Math::minValue(VALIDATE_BATCH_SIZE, m_entries.size() - batch_begin);
+					for (int i = 0; i < count; ++i)
+					{
+						paths[i] = m_entries[batch_begin + i].m_path;
+					}
+					if (!stat(paths, count, stats))
+					{
+						return;
+					}
+
+					for (int i = 0; i < count; ++i)
+					{
+						CacheEntry& entry = m_entries[batch_begin + i];
+						entry.m_is_valid = isUpToDate(entry, stats[i]);
+					}
+				}
+
+				for (int i = m_entries.size() - 1; i >= 0; --i)
+				{
+					if (!m_entries[i].m_is_valid)
+					{
+						remove(i);
+					}
+				}
+			}
+
+
+			IAllocator& m_allocator;
+			TCPFileDevice& m_remote;
+			Array<CacheEntry> m_entries;
+			PODHashMap<uint32_t, int> m_map;
+			MT::Mutex m_mutex;
+			char m_cache_dir[MAX_PATH_LENGTH];
+			bool m_is_disabled;
+			bool m_is_dirty;
+			int m_hit_count;
+			int m_miss_count;
+		};
+
+
+		class CacheFile : public IFile
+		{
+		public:
+			CacheFile(IFile* file, CacheFileDevice& device, IAllocator& allocator)
+				: m_device(device)
+				, m_allocator(allocator)
+				, m_file(file)
+				, m_data(nullptr)
+				, m_size(0)
+				, m_pos(0)
+				, m_is_cached(false)
+			{
+			}
+
+			~CacheFile()
+			{
+				if (m_file)
+				{
+					m_file->release();
+				}
+				m_allocator.deallocate(m_data);
+			}
+
+			virtual IFileDevice& getDevice() override
+			{
+				return m_device;
+			}
+
+			virtual bool open(const char* path, Mode mode) override
+			{
+				if (mode & Mode::WRITE)
+				{
+					m_device.invalidate(path);
+					return m_file && m_file->open(path, mode);
+				}
+
+				if (m_device.load(path, m_allocator, m_data, m_size))
+				{
+					m_is_cached = true;
+					m_pos = 0;
+					return true;
+				}
+
+				if (!m_file || !m_file->open(path, mode))
+				{
+					return false;
+				}
+				m_size = m_file->size();
+				m_data = (uint8_t*)m_allocator.allocate(m_size);
+				bool success = m_file->read(m_data, m_size);
+				m_file->close();
+				if (success)
+				{
+					m_device.store(path, m_data, m_size);
+					m_is_cached = true;
+					m_pos = 0;
+				}
+				else
+				{
+					m_allocator.deallocate(m_data);
+					m_data = nullptr;
+				}
+				return success;
+			}
+
+			virtual void close() override
+			{
+				if (m_is_cached)
+				{
+					m_allocator.deallocate(m_data);
+					m_data = nullptr;
+					m_is_cached = false;
+				}
+				else if (m_file)
+				{
+					m_file->close();
+				}
+			}
+
+			virtual bool read(void* buffer, size_t size) override
+			{
+				if (!m_is_cached)
+				{
+					return m_file->read(buffer, size);
+				}
+				size_t amount = m_pos + size < m_size ? size : m_size - m_pos;
+				memcpy(buffer, m_data + m_pos, amount);
+				m_pos += amount;
+				return amount == size;
+			}
+
+			virtual bool write(const void* buffer, size_t size) override
+			{
+				ASSERT(!m_is_cached);
+				return m_file->write(buffer, size);
+			}
+
+			virtual const void* getBuffer() const override
+			{
+				return m_is_cached ? m_data : nullptr;
+			}
+
+			virtual size_t size() override
+			{
+				return m_is_cached ? m_size : m_file->size();
+			}
+
+			virtual size_t seek(SeekMode base, size_t pos) override
+			{
+				if (!m_is_cached)
+				{
+					return m_file->seek(base, pos);
+				}
+				switch (base)
+				{
+					case SeekMode::BEGIN:
+						m_pos = pos;
+						break;
+					case SeekMode::CURRENT:
+						m_pos += pos;
+						break;
+					case SeekMode::END:
+						m_pos = m_size - pos;
+						break;
+					default:
+						ASSERT(0);
+						break;
+				}
+				m_pos = Math::minValue(m_pos, m_size);
+				return m_pos;
+			}
+
+			virtual size_t pos() override
+			{
+				return m_is_cached ? m_pos : m_file->pos();
+			}
+
+		private:
+			void operator=(const CacheFile&);
+			CacheFile(const CacheFile&);
+
+			CacheFileDevice& m_device;
+			IAllocator& m_allocator;
+			IFile* m_file;
+			uint8_t* m_data;
+			size_t m_size;
+			size_t m_pos;
+			bool m_is_cached;
+		};
+
+
+		CacheFileDevice::CacheFileDevice(const char* cache_dir,
+										 TCPFileDevice& remote,
+										 IAllocator& allocator)
+		{
+			m_impl = allocator.newObject<CacheFileDeviceImpl>(cache_dir, remote, allocator);
+			m_impl->loadIndex();
+		}
+
+
+		CacheFileDevice::~CacheFileDevice()
+		{
+			if (m_impl->m_is_dirty)
+			{
+				m_impl->saveIndex();
+			}
+			m_impl->m_allocator.deleteObject(m_impl);
+		}
+
+
+		IFile* CacheFileDevice::createFile(IFile* child)
+		{
+			return m_impl->m_allocator.newObject<CacheFile>(child, *this, m_impl->m_allocator);
+		}
+
+
+		void CacheFileDevice::destroyFile(IFile* file)
+		{
+			m_impl->m_allocator.deleteObject(file);
+		}
+
+
+		void CacheFileDevice::validate()
+		{
+			MT::Lock lock(m_impl->m_mutex);
+			m_impl->validate();
+		}
+
+
+		void CacheFileDevice::invalidate(const char* path)
+		{
+			MT::Lock lock(m_impl->m_mutex);
+			int index = m_impl->find(path);
+			if (index >= 0)
+			{
+				m_impl->remove(index);
+			}
+		}
+
+
+		void CacheFileDevice::saveIndex()
+		{
+			MT::Lock lock(m_impl->m_mutex);
+			m_impl->saveIndex();
+		}
+
+
+		int CacheFileDevice::getHitCount() const
+		{
+			return m_impl->m_hit_count;
+		}
+
+
+		int CacheFileDevice::getMissCount() const
+		{
+			return m_impl->m_miss_count;
+		}
+
+
+		bool CacheFileDevice::isDisabled() const
+		{
+			return m_impl->m_is_disabled;
+		}
+
+
+		// entries checked by validate() or stored in this session are served
+		// as they are, the others are checked against the server once
+		bool CacheFileDevice::load(const char* path, IAllocator& allocator, uint8_t*& data, size_t& size)
+		{
+			{
+				MT::Lock lock(m_impl->m_mutex);
+				int index = m_impl->find(path);
+				if (index < 0)
+				{
+					++m_impl->m_miss_count;
+					return false;
+				}
+				if (m_impl->m_entries[index].m_is_valid)
+				{
+					return loadEntry(index, allocator, data, size);
+				}
+			}
+
+			// the file could have changed since it was cached, other files are
+			// served while the server answers
+			TCPFileStat stat;
+			bool has_stat = m_impl->stat(&path, 1, &stat);
+
+			MT::Lock lock(m_impl->m_mutex);
+			// the entry could have been moved or removed in the meantime
+			int index = m_impl->find(path);
+			if (index < 0 || !has_stat || !m_impl->isUpToDate(m_impl->m_entries[index], stat))
+			{
+				if (index >= 0 && !m_impl->m_is_disabled)
+				{
+					m_impl->remove(index);
+				}
+				++m_impl->m_miss_count;
+				return false;
+			}
+			m_impl->m_entries[index].m_is_valid = true;
+			return loadEntry(index, allocator, data, size);
+		}
+
+
+		// m_mutex must be locked
+		bool CacheFileDevice::loadEntry(int index, IAllocator& allocator, uint8_t*& data, size_t& size)
+		{
+			const CacheEntry& entry = m_impl->m_entries[index];
+			char cached_path[MAX_PATH_LENGTH];
+			m_impl->getCachedFilePath(entry.m_content_hash, cached_path, sizeof(cached_path));
+			OsFile file;
+			if (!file.open(cached_path, Mode::OPEN | Mode::READ, m_impl->m_allocator))
+			{
+				m_impl->remove(index);
+				++m_impl->m_miss_count;
+				return false;
+			}
+
+			size = entry.m_size;
+			data = (uint8_t*)allocator.allocate(size);
+			bool success = file.size() == size && file.read(data, size) &&
+						   crc32(data, (int)size) == entry.m_content_hash;
+			file.close();
+			if (!success)
+			{
+				allocator.deallocate(data);
+				data = nullptr;
+				m_impl->remove(index);
+				++m_impl->m_miss_count;
+				return false;
+			}
+
+			++m_impl->m_hit_count;
+			return true;
+		}
+
+
+		void CacheFileDevice::store(const char* path, const uint8_t* data, size_t size)
+		{
+			if (strlen(path) >= MAX_PATH_LENGTH || m_impl->m_is_disabled)
+			{
+				return;
+			}
+
+			uint32_t content_hash = crc32(data, (int)size);
+			char cached_path[MAX_PATH_LENGTH];
+			m_impl->getCachedFilePath(content_hash, cached_path, sizeof(cached_path));
+
+			MT::Lock lock(m_impl->m_mutex);
+			OsFile file;
+			if (!file.open(cached_path, Mode::CREATE | Mode::WRITE, m_impl->m_allocator))
+			{
+				g_log_warning.log("cache file device") << "Could not write " << cached_path;
+				return;
+			}
+			bool success = file.write(data, size);
+			file.close();
+			if (!success)
+			{
+				return;
+			}
+
+			int index = m_impl->find(path);
+			if (index < 0)
+			{
+				// a different path with the same hash loses its entry
+				auto iter = m_impl->m_map.find(crc32(path));
+				if (iter != m_impl->m_map.end())
+				{
+					m_impl->remove(iter.value());
+				}
+				index = m_impl->m_entries.size();
+				CacheEntry& entry = m_impl->m_entries.pushEmpty();
+				copyString(entry.m_path, sizeof(entry.m_path), path);
+				m_impl->m_map[crc32(path)] = index;
+			}
+			CacheEntry& entry = m_impl->m_entries[index];
+			entry.m_content_hash = content_hash;
+			entry.m_size = (uint32_t)size;
+			entry.m_is_valid = true;
+			m_impl->m_is_dirty = true;
+		}
+	} // ~namespace FS
+} // ~namespace Lumix
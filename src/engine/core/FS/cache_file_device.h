@@ -0,0 +1,51 @@
+#pragma once
+
+#include "lumix.h"
+#include "core/fs/ifile_device.h"
+
+namespace Lumix
+{
+	class IAllocator;
+
+	namespace FS
+	{
+		class IFile;
+		class TCPFileDevice;
+
+		// local on-disk cache of files fetched from TCPFileDevice, mount it
+		// as "memory:cache:tcp", entries are keyed by path and checked
+		// against the content hash provided by the server once per session,
+		// by validate() or the first time they are served; the cache is
+		// disabled for the session if the server can not provide the hash
+		class LUMIX_ENGINE_API CacheFileDevice : public IFileDevice
+		{
+		public:
+			CacheFileDevice(const char* cache_dir, TCPFileDevice& remote, IAllocator& allocator);
+			~CacheFileDevice();
+
+			virtual void destroyFile(IFile* file) override;
+			virtual IFile* createFile(IFile* child) override;
+
+			const char* name() const override { return "cache"; }
+
+			// checks all cached entries with a single round trip and drops
+			// the stale ones
+			void validate();
+			void invalidate(const char* path);
+			void saveIndex();
+
+			int getHitCount() const;
+			int getMissCount() const;
+			bool isDisabled() const;
+
+			bool load(const char* path, IAllocator& allocator, uint8_t*& data, size_t& size);
+			void store(const char* path, const uint8_t* data, size_t size);
+
+		private:
+			bool loadEntry(int index, IAllocator& allocator, uint8_t*& data, size_t& size);
+
+		private:
+			struct CacheFileDeviceImpl* m_impl;
+		};
+	} // ~namespace FS
+} // ~namespace Lumix
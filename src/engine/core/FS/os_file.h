@@ -23,6 +23,8 @@ namespace Lumix
 
 			size_t size();
 			size_t pos();
+			// time of the last write, only for comparison
+			uint64_t getLastModified();
 
 			size_t seek(SeekMode base, size_t pos);
 			void writeEOF();
@@ -89,6 +89,17 @@ size_t OsFile::size()
 	return ::GetFileSize(m_impl->m_file, 0);
 }
 
+uint64_t OsFile::getLastModified()
+{
+	ASSERT(nullptr != m_impl);
+	FILETIME time;
+	if (!::GetFileTime(m_impl->m_file, nullptr, nullptr, &time))
+	{
+		return 0;
+	}
+	return ((uint64_t)time.dwHighDateTime << 32) | time.dwLowDateTime;
+}
+
 size_t OsFile::pos()
 {
 	ASSERT(nullptr != m_impl);
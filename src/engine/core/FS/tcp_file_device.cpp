@@ -1,29 +1,271 @@
 #include "core/fs/tcp_file_device.h"
 #include "core/iallocator.h"
-#include "core/blob.h"
+#include "core/free_list.h"
+#include "core/log.h"
+#include "core/math_utils.h"
 #include "core/fs/ifile.h"
 #include "core/fs/ifile_system_defines.h"
 #include "core/fs/file_system.h"
 #include "core/net/tcp_connector.h"
 #include "core/net/tcp_stream.h"
+#include "core/mt/event.h"
+#include "core/mt/mutex.h"
+#include "core/mt/semaphore.h"
 #include "core/mt/spin_mutex.h"
+#include "core/mt/task.h"
 
 
 namespace Lumix
 {
 	namespace FS
 	{
+		struct TCPRequest
+		{
+			TCPRequest()
+				: m_done(MT::EventFlags::MANUAL_RESET)
+				, m_buffer(nullptr)
+				, m_buffer_size(0)
+				, m_payload(nullptr)
+				, m_payload_size(0)
+				, m_result(-1)
+				, m_in_use(false)
+				, m_is_pending(false)
+			{}
+
+			MT::Event m_done;
+			void* m_buffer;
+			size_t m_buffer_size;
+			uint8_t* m_payload;
+			uint32_t m_payload_size;
+			int32_t m_result;
+			bool m_in_use;
+			// waits for the response, a response to any other request is
+			// a protocol error
+			bool m_is_pending;
+		};
+
+
+		class TCPReceiverTask : public MT::Task
+		{
+		public:
+			TCPReceiverTask(TCPImpl& impl, IAllocator& allocator)
+				: MT::Task(allocator)
+				, m_impl(impl)
+			{}
+
+			int task() override;
+
+		private:
+			void operator=(const TCPReceiverTask&);
+
+			TCPImpl& m_impl;
+		};
+
+
+		struct TCPImpl
+		{
+			TCPImpl(IAllocator& allocator)
+				: m_allocator(allocator)
+				, m_connector(m_allocator)
+				, m_stream(nullptr)
+				, m_write_mutex(false)
+				, m_requests_mutex(false)
+				, m_free_requests(TCP_MAX_PENDING_REQUESTS, TCP_MAX_PENDING_REQUESTS)
+				, m_receiver(*this, m_allocator)
+				, m_is_connected(false)
+			{
+				for (int i = 0; i < TCP_MAX_PENDING_REQUESTS; ++i)
+				{
+					m_requests[i] = m_allocator.newObject<TCPRequest>();
+				}
+			}
+
+			~TCPImpl()
+			{
+				for (int i = 0; i < TCP_MAX_PENDING_REQUESTS; ++i)
+				{
+					m_allocator.deallocate(m_requests[i]->m_payload);
+					m_allocator.deleteObject(m_requests[i]);
+				}
+			}
+
+			// returns TCP_NO_RESPONSE if there is no connection, otherwise
+			// the request header is sent and the stream stays locked for
+			// the arguments until endRequest is called
+			uint32_t beginRequest(int32_t op, void* buffer, size_t buffer_size)
+			{
+				m_free_requests.wait();
+				int32_t id = -1;
+				{
+					MT::SpinLock lock(m_requests_mutex);
+					if (m_is_connected)
+					{
+						id = m_ids.alloc();
+						TCPRequest& request = *m_requests[id];
+						request.m_in_use = true;
+						request.m_is_pending = true;
+						request.m_buffer = buffer;
+						request.m_buffer_size = buffer_size;
+						request.m_payload = nullptr;
+						request.m_payload_size = 0;
+						request.m_result = -1;
+						request.m_done.reset();
+					}
+				}
+				if (id < 0)
+				{
+					m_free_requests.signal();
+					return TCP_NO_RESPONSE;
+				}
+
+				m_write_mutex.lock();
+				m_stream->write(op);
+				m_stream->write((uint32_t)id);
+				return (uint32_t)id;
+			}
+
+			void endRequest() { m_write_mutex.unlock(); }
+
+			// nullptr if there is no request waiting for a response with
+			// the id, the request stops waiting
+			TCPRequest* takePendingRequest(uint32_t id)
+			{
+				if (id >= (uint32_t)TCP_MAX_PENDING_REQUESTS)
+				{
+					return nullptr;
+				}
+				MT::SpinLock lock(m_requests_mutex);
+				TCPRequest* request = m_requests[id];
+				if (!request->m_in_use || !request->m_is_pending)
+				{
+					return nullptr;
+				}
+				request->m_is_pending = false;
+				return request;
+			}
+
+			int32_t waitForResponse(uint32_t id)
+			{
+				TCPRequest& request = *m_requests[id];
+				request.m_done.wait();
+				return request.m_result;
+			}
+
+			uint8_t* takePayload(uint32_t id)
+			{
+				TCPRequest& request = *m_requests[id];
+				uint8_t* payload = request.m_payload;
+				request.m_payload = nullptr;
+				return payload;
+			}
+
+			void releaseRequest(uint32_t id)
+			{
+				TCPRequest& request = *m_requests[id];
+				m_allocator.deallocate(request.m_payload);
+				request.m_payload = nullptr;
+				{
+					MT::SpinLock lock(m_requests_mutex);
+					request.m_in_use = false;
+					m_ids.release(id);
+				}
+				m_free_requests.signal();
+			}
+
+			void failPendingRequests()
+			{
+				MT::SpinLock lock(m_requests_mutex);
+				m_is_connected = false;
+				for (int i = 0; i < TCP_MAX_PENDING_REQUESTS; ++i)
+				{
+					if (m_requests[i]->m_in_use)
+					{
+						m_requests[i]->m_is_pending = false;
+						m_requests[i]->m_result = -1;
+						m_requests[i]->m_done.trigger();
+					}
+				}
+			}
+
+			IAllocator& m_allocator;
+			Net::TCPConnector m_connector;
+			Net::TCPStream* m_stream;
+			MT::Mutex m_write_mutex;
+			MT::SpinMutex m_requests_mutex;
+			MT::Semaphore m_free_requests;
+			FreeList<int32_t, TCP_MAX_PENDING_REQUESTS> m_ids;
+			TCPRequest* m_requests[TCP_MAX_PENDING_REQUESTS];
+			TCPReceiverTask m_receiver;
+			volatile bool m_is_connected;
+		};
+
+
+		int TCPReceiverTask::task()
+		{
+			Net::TCPStream* stream = m_impl.m_stream;
+			for (;;)
+			{
+				uint32_t id = 0;
+				int32_t result = -1;
+				uint32_t payload_size = 0;
+				if (!stream->read(id) || !stream->read(result) ||
+					!stream->read(payload_size))
+				{
+					break;
+				}
+
+				TCPRequest* pending_request = m_impl.takePendingRequest(id);
+				if (!pending_request)
+				{
+					g_log_error.log("tcp file device") << "Invalid response " << id << ", disconnecting";
+					break;
+				}
+				TCPRequest& request = *pending_request;
+				bool success = true;
+				if (payload_size > 0)
+				{
+					if (request.m_buffer && payload_size <= request.m_buffer_size)
+					{
+						success = stream->read(request.m_buffer, payload_size);
+					}
+					else
+					{
+						request.m_payload =
+							(uint8_t*)m_impl.m_allocator.allocate(payload_size);
+						success = stream->read(request.m_payload, payload_size);
+					}
+				}
+				request.m_payload_size = payload_size;
+				request.m_result = result;
+				request.m_done.trigger();
+				if (!success)
+				{
+					break;
+				}
+			}
+
+			m_impl.failPendingRequests();
+			return 0;
+		}
+
+
 		class TCPFile : public IFile
 		{
 		public:
-			TCPFile(Net::TCPStream* stream, TCPFileDevice& device, MT::SpinMutex& spin_mutex) 
+			TCPFile(TCPImpl& impl, TCPFileDevice& device)
 				: m_device(device)
-				, m_stream(stream)
-				, m_spin_mutex(spin_mutex)
+				, m_impl(impl)
 				, m_file(-1)
+				, m_data(nullptr)
+				, m_size(0)
+				, m_pos(0)
+				, m_is_cached(false)
 			{}
 
-			~TCPFile() {}
+			~TCPFile()
+			{
+				m_impl.m_allocator.deallocate(m_data);
+			}
 
 			virtual IFileDevice& getDevice() override
 			{
@@ -32,143 +274,225 @@ namespace Lumix
 
 			virtual bool open(const char* path, Mode mode) override
 			{
-				if (!m_stream)
+				if ((mode & Mode::READ) && !(mode & Mode::WRITE))
 				{
-					return false;
+					return openAndReadAll(path);
 				}
 
-				int32_t op = TCPCommand::OpenFile;
+				uint32_t id = m_impl.beginRequest(TCPCommand::OpenFile, nullptr, 0);
+				if (id == TCP_NO_RESPONSE)
+				{
+					return false;
+				}
+				m_impl.m_stream->write(mode.value);
+				m_impl.m_stream->writeString(path);
+				m_impl.endRequest();
 
-				MT::SpinLock lock(m_spin_mutex);
-				m_stream->write(op);
-				m_stream->write(mode);
-				m_stream->writeString(path);
-				m_stream->read(m_file);
+				m_file = m_impl.waitForResponse(id);
+				m_impl.releaseRequest(id);
 
-				return -1 != m_file;
+				return -1 < m_file;
 			}
 
 			virtual void close() override
 			{
-				if(-1 != m_file)
+				if (m_is_cached)
 				{
-					int32_t op = TCPCommand::Close;
-
-					MT::SpinLock lock(m_spin_mutex);
-					m_stream->write(op);
-					m_stream->write(m_file);
+					m_impl.m_allocator.deallocate(m_data);
+					m_data = nullptr;
+					m_is_cached = false;
 				}
+				else if (-1 < m_file)
+				{
+					// the file is closed on the server when this returns, so
+					// it can be opened again right away
+					sendFileCommand(TCPCommand::Close);
+				}
+				m_file = -1;
 			}
 
 			virtual bool read(void* buffer, size_t size) override
 			{
-				int32_t op = TCPCommand::Read;
-
-				MT::SpinLock lock(m_spin_mutex);
-				m_stream->write(op);
-				m_stream->write(m_file);
-				m_stream->write(size);
-
-				m_stream->read(buffer, size);
-				bool successful = false;
-				m_stream->read(successful);
+				if (m_is_cached)
+				{
+					size_t amount = m_pos + size < m_size ? size : m_size - m_pos;
+					memcpy(buffer, m_data + m_pos, amount);
+					m_pos += amount;
+					return amount == size;
+				}
 
-				return successful;
+				uint8_t* data = (uint8_t*)buffer;
+				while (size > 0)
+				{
+					uint32_t chunk = (uint32_t)Math::minValue(size, (size_t)TCP_MAX_TRANSFER_SIZE);
+					uint32_t id = m_impl.beginRequest(TCPCommand::Read, data, chunk);
+					if (id == TCP_NO_RESPONSE)
+					{
+						return false;
+					}
+					m_impl.m_stream->write(m_file);
+					m_impl.m_stream->write(chunk);
+					m_impl.endRequest();
+
+					bool successful = m_impl.waitForResponse(id) > 0;
+					m_impl.releaseRequest(id);
+					if (!successful)
+					{
+						return false;
+					}
+					data += chunk;
+					size -= chunk;
+				}
+				return true;
 			}
 
 			virtual bool write(const void* buffer, size_t size) override
 			{
-				int32_t op = TCPCommand::Write;
-
-				MT::SpinLock lock(m_spin_mutex);
-				m_stream->write(op);
-				m_stream->write(m_file);
-				m_stream->write(size);
-				m_stream->write(buffer, size);
-
-				bool successful = false;
-				m_stream->read(successful);
-
-				return successful;
+				ASSERT(!m_is_cached);
+				const uint8_t* data = (const uint8_t*)buffer;
+				while (size > 0)
+				{
+					uint32_t chunk = (uint32_t)Math::minValue(size, (size_t)TCP_MAX_TRANSFER_SIZE);
+					uint32_t id = m_impl.beginRequest(TCPCommand::Write, nullptr, 0);
+					if (id == TCP_NO_RESPONSE)
+					{
+						return false;
+					}
+					m_impl.m_stream->write(m_file);
+					m_impl.m_stream->write(chunk);
+					m_impl.m_stream->write(data, chunk);
+					m_impl.endRequest();
+
+					bool successful = m_impl.waitForResponse(id) > 0;
+					m_impl.releaseRequest(id);
+					if (!successful)
+					{
+						return false;
+					}
+					data += chunk;
+					size -= chunk;
+				}
+				return true;
 			}
 
 			virtual const void* getBuffer() const override
 			{
-				return nullptr;
+				return m_is_cached ? m_data : nullptr;
 			}
 
 			virtual size_t size() override
 			{
-				int32_t op = TCPCommand::Size;
-				uint32_t size = 0;
-
-				MT::SpinLock lock(m_spin_mutex);
-				m_stream->write(op);
-				m_stream->write(m_file);
-
-				m_stream->read(size);
-
-				return (size_t)size;
+				if (m_is_cached)
+				{
+					return m_size;
+				}
+				return (size_t)Math::maxValue(0, sendFileCommand(TCPCommand::Size));
 			}
 
 			virtual size_t seek(SeekMode base, size_t pos) override
 			{
-				int32_t op = TCPCommand::Seek;
+				if (m_is_cached)
+				{
+					switch (base)
+					{
+						case SeekMode::BEGIN:
+							m_pos = pos;
+							break;
+						case SeekMode::CURRENT:
+							m_pos += pos;
+							break;
+						case SeekMode::END:
+							m_pos = m_size - pos;
+							break;
+						default:
+							ASSERT(0);
+							break;
+					}
+					m_pos = Math::minValue(m_pos, m_size);
+					return m_pos;
+				}
 
-				MT::SpinLock lock(m_spin_mutex);
-				m_stream->write(op);
-				m_stream->write(m_file);
-				m_stream->write(base);
-				m_stream->write(pos);
+				uint32_t id = m_impl.beginRequest(TCPCommand::Seek, nullptr, 0);
+				if (id == TCP_NO_RESPONSE)
+				{
+					return 0;
+				}
+				m_impl.m_stream->write(m_file);
+				m_impl.m_stream->write(base.value);
+				m_impl.m_stream->write((int32_t)pos);
+				m_impl.endRequest();
 
-				int32_t ret = 0;
-				m_stream->read(ret);
+				int32_t ret = m_impl.waitForResponse(id);
+				m_impl.releaseRequest(id);
 
-				return (size_t)ret;
+				return (size_t)Math::maxValue(0, ret);
 			}
 
 			virtual size_t pos() override
 			{
-				int32_t op = TCPCommand::Seek;
-				int32_t pos = 0;
-
-				MT::SpinLock lock(m_spin_mutex);
-				m_stream->write(op);
-				m_stream->write(m_file);
-
-				m_stream->read(pos);
-
-				return (size_t)pos;
+				if (m_is_cached)
+				{
+					return m_pos;
+				}
+				return (size_t)Math::maxValue(0, sendFileCommand(TCPCommand::Pos));
 			}
 
 		private:
 			void operator=(const TCPFile&);
 			TCPFile(const TCPFile&);
 
-			TCPFileDevice& m_device;
-			Net::TCPStream* m_stream;
-			MT::SpinMutex& m_spin_mutex;
-			uint32_t m_file;
-		};
+			bool openAndReadAll(const char* path)
+			{
+				uint32_t id =
+					m_impl.beginRequest(TCPCommand::OpenAndReadAll, nullptr, 0);
+				if (id == TCP_NO_RESPONSE)
+				{
+					return false;
+				}
+				m_impl.m_stream->writeString(path);
+				m_impl.endRequest();
 
-		struct TCPImpl
-		{
-			TCPImpl(IAllocator& allocator)
-				: m_spin_mutex(false)
-				, m_allocator(allocator)
-				, m_connector(m_allocator)
-				, m_stream(nullptr)
-			{}
+				int32_t size = m_impl.waitForResponse(id);
+				if (size >= 0)
+				{
+					m_data = m_impl.takePayload(id);
+					m_size = (size_t)size;
+					m_pos = 0;
+					m_is_cached = true;
+				}
+				m_impl.releaseRequest(id);
 
-			IAllocator& m_allocator;
-			Net::TCPConnector m_connector;
-			Net::TCPStream* m_stream;
-			MT::SpinMutex m_spin_mutex;
+				return m_is_cached;
+			}
+
+			int32_t sendFileCommand(int32_t op)
+			{
+				uint32_t id = m_impl.beginRequest(op, nullptr, 0);
+				if (id == TCP_NO_RESPONSE)
+				{
+					return -1;
+				}
+				m_impl.m_stream->write(m_file);
+				m_impl.endRequest();
+
+				int32_t ret = m_impl.waitForResponse(id);
+				m_impl.releaseRequest(id);
+				return ret;
+			}
+
+			TCPFileDevice& m_device;
+			TCPImpl& m_impl;
+			int32_t m_file;
+			uint8_t* m_data;
+			size_t m_size;
+			size_t m_pos;
+			bool m_is_cached;
 		};
 
+
 		IFile* TCPFileDevice::createFile(IFile*)
 		{
-			return m_impl->m_allocator.newObject<TCPFile>(m_impl->m_stream, *this, m_impl->m_spin_mutex);
+			return m_impl->m_allocator.newObject<TCPFile>(*m_impl, *this);
 		}
 
 		void TCPFileDevice::destroyFile(IFile* file)
@@ -176,17 +500,117 @@ namespace Lumix
 			m_impl->m_allocator.deleteObject(file);
 		}
 
-		void TCPFileDevice::connect(const char* ip, uint16_t port, IAllocator& allocator)
+		bool TCPFileDevice::connect(const char* ip, uint16_t port, IAllocator& allocator)
 		{
 			m_impl = allocator.newObject<TCPImpl>(allocator);
 			m_impl->m_stream = m_impl->m_connector.connect(ip, port);
+			if (!m_impl->m_stream)
+			{
+				g_log_error.log("tcp file device") << "Could not connect to "
+												   << ip << ":" << (uint32_t)port;
+				allocator.deleteObject(m_impl);
+				m_impl = nullptr;
+				return false;
+			}
+
+			m_impl->m_is_connected = true;
+			m_impl->m_receiver.create("TCP File Device Receiver");
+			m_impl->m_receiver.run();
+
+			// disconnect stops the receiver and frees what connect created
+			uint32_t id = m_impl->beginRequest(TCPCommand::Version, nullptr, 0);
+			if (id == TCP_NO_RESPONSE)
+			{
+				disconnect();
+				return false;
+			}
+			m_impl->endRequest();
+			int32_t version = m_impl->waitForResponse(id);
+			m_impl->releaseRequest(id);
+			if (version != TCP_FILE_PROTOCOL_VERSION)
+			{
+				g_log_error.log("tcp file device")
+					<< "Unsupported file server protocol version " << version;
+				disconnect();
+				return false;
+			}
+			return true;
+		}
+
+		static bool statBatch(TCPImpl& impl,
+			const char* const* paths,
+			int count,
+			uint32_t data_size,
+			TCPFileStat* stats)
+		{
+			size_t stats_size = sizeof(TCPFileStat) * count;
+			uint32_t id = impl.beginRequest(TCPCommand::Stat, stats, stats_size);
+			if (id == TCP_NO_RESPONSE)
+			{
+				return false;
+			}
+			impl.m_stream->write((uint32_t)count);
+			impl.m_stream->write(data_size);
+			for (int i = 0; i < count; ++i)
+			{
+				impl.m_stream->write(paths[i], strlen(paths[i]) + 1);
+			}
+			impl.endRequest();
+
+			int32_t result = impl.waitForResponse(id);
+			impl.releaseRequest(id);
+			return result == count;
+		}
+
+		bool TCPFileDevice::stat(const char* const* paths, int count, TCPFileStat* stats)
+		{
+			if (!m_impl || count <= 0)
+			{
+				return false;
+			}
+
+			// as many paths in a request as the server accepts
+			int first = 0;
+			uint32_t data_size = 0;
+			for (int i = 0; i < count; ++i)
+			{
+				uint32_t path_size = (uint32_t)strlen(paths[i]) + 1;
+				if (data_size + path_size > TCP_MAX_TRANSFER_SIZE)
+				{
+					if (!statBatch(*m_impl, paths + first, i - first, data_size, stats + first))
+					{
+						return false;
+					}
+					first = i;
+					data_size = 0;
+				}
+				data_size += path_size;
+			}
+			return statBatch(*m_impl, paths + first, count - first, data_size, stats + first);
 		}
 
 		void TCPFileDevice::disconnect()
 		{
-			m_impl->m_stream->write(TCPCommand::Disconnect);
-			m_impl->m_connector.close(m_impl->m_stream);
+			if (!m_impl)
+			{
+				return;
+			}
+
+			if (m_impl->m_stream)
+			{
+				uint32_t id =
+					m_impl->beginRequest(TCPCommand::Disconnect, nullptr, 0);
+				if (id != TCP_NO_RESPONSE)
+				{
+					m_impl->endRequest();
+					m_impl->waitForResponse(id);
+					m_impl->releaseRequest(id);
+				}
+				m_impl->m_receiver.destroy();
+				m_impl->m_connector.close(m_impl->m_stream);
+			}
 			m_impl->m_allocator.deleteObject(m_impl);
+			m_impl = nullptr;
 		}
 	} // namespace FS
 } // ~namespace Lumix
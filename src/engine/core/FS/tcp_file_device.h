@@ -18,6 +18,15 @@ namespace Lumix
 		class TCPFileSystemTask;
 		struct TCPImpl;
 
+		// every request is [op][request id][arguments], every response is
+		// [request id][result][payload size][payload], responses can arrive
+		// in any order, the server drops the connection on a read, a write
+		// or a stat with more than TCP_MAX_TRANSFER_SIZE bytes of data
+		static const int32_t TCP_FILE_PROTOCOL_VERSION = 4;
+		static const uint32_t TCP_NO_RESPONSE = 0xffffFFFF;
+		static const int32_t TCP_MAX_PENDING_REQUESTS = 64;
+		static const uint32_t TCP_MAX_TRANSFER_SIZE = 0x400000;
+
 		struct TCPCommand
 		{
 			enum Value
@@ -30,6 +39,9 @@ namespace Lumix
 				Seek,
 				Pos,
 				Disconnect,
+				OpenAndReadAll,
+				Version,
+				Stat,
 			};
 
 			TCPCommand() : value(0) {}
@@ -39,17 +51,27 @@ namespace Lumix
 			int32_t value;
 		};
 
+		struct TCPFileStat
+		{
+			uint32_t m_hash;
+			int32_t m_size;
+		};
+
 		class LUMIX_ENGINE_API TCPFileDevice : public IFileDevice
 		{
 		public:
+			TCPFileDevice() : m_impl(nullptr) {}
+
 			virtual void destroyFile(IFile* file) override;
 			virtual IFile* createFile(IFile* child) override;
 			virtual const char* name() const override { return "tcp"; }
 
-			void connect(const char* ip, uint16_t port, IAllocator& allocator);
+			bool connect(const char* ip, uint16_t port, IAllocator& allocator);
 			void disconnect();
 
-			Net::TCPStream* getStream();
+			// one round trip for all paths, crc32 of the content and size
+			// of each file, size is -1 if the file does not exist
+			bool stat(const char* const* paths, int count, TCPFileStat* stats);
 
 		private:
 			TCPImpl* m_impl;
@@ -1,13 +1,18 @@
 #include "core/fs/tcp_file_server.h"
 
 #include "core/array.h"
+#include "core/crc32.h"
 #include "core/free_list.h"
 #include "core/path.h"
+#include "core/pod_hash_map.h"
 #include "core/stack_allocator.h"
 #include "core/static_array.h"
 #include "core/string.h"
 #include "core/fs/os_file.h"
 #include "core/fs/tcp_file_device.h"
+#include "core/mt/lock_free_fixed_queue.h"
+#include "core/mt/mutex.h"
+#include "core/mt/spin_mutex.h"
 #include "core/mt/task.h"
 #include "core/net/tcp_acceptor.h"
 #include "core/net/tcp_stream.h"
@@ -20,13 +25,78 @@ namespace FS
 {
 
 
+static const int32_t C_WORKER_COUNT = 4;
+static const int32_t C_MAX_QUEUED_REQUESTS = 128;
+static const int32_t C_WORKER_BUFFER_SIZE = 0x10000;
+
+
+struct TCPFileServerRequest
+{
+	int32_t m_op;
+	uint32_t m_request_id;
+	int32_t m_file;
+	int32_t m_mode;
+	int32_t m_value;
+	uint8_t* m_data;
+	char m_path[MAX_PATH_LENGTH];
+};
+
+
+typedef MT::LockFreeFixedQueue<TCPFileServerRequest, C_MAX_QUEUED_REQUESTS>
+	TCPFileServerQueue;
+
+
+// content hash of a file, reused by stat while the size and the time of the
+// last write do not change
+struct TCPFileServerHash
+{
+	uint64_t m_last_modified;
+	uint32_t m_size;
+	uint32_t m_hash;
+};
+
+
+class TCPFileServerTask;
+
+
+// requests for a file are processed by one worker in the order they came,
+// see TCPFileServerTask::getWorker
+class TCPFileServerWorker : public MT::Task
+{
+public:
+	TCPFileServerWorker(TCPFileServerTask& server, int index, IAllocator& allocator)
+		: MT::Task(allocator)
+		, m_server(server)
+		, m_index(index)
+	{
+	}
+
+
+	int task() override;
+
+private:
+	void operator=(const TCPFileServerWorker&);
+
+	TCPFileServerTask& m_server;
+	int m_index;
+	StaticArray<uint8_t, C_WORKER_BUFFER_SIZE> m_buffer;
+};
+
+
 class TCPFileServerTask : public MT::Task
 {
 public:
 	TCPFileServerTask(IAllocator& allocator)
 		: MT::Task(allocator)
 		, m_acceptor(allocator)
+		, m_stream(nullptr)
+		, m_write_mutex(false)
+		, m_files_mutex(false)
+		, m_hashes_mutex(false)
+		, m_hashes(allocator)
+		, m_next_worker(0)
 	{
+		m_files.assign(nullptr);
 	}
 
 
@@ -35,183 +105,522 @@ public:
 	}
 
 
-	void openFile(Net::TCPStream* stream)
+	void respond(uint32_t request_id,
+				 int32_t result,
+				 const void* payload,
+				 uint32_t payload_size)
+	{
+		if (request_id == TCP_NO_RESPONSE)
+		{
+			return;
+		}
+
+		MT::Lock lock(m_write_mutex);
+		m_stream->write(request_id);
+		m_stream->write(result);
+		m_stream->write(payload_size);
+		if (payload_size > 0)
+		{
+			m_stream->write(payload, payload_size);
+		}
+	}
+
+
+	void getFullPath(const char* path, char* out, int max_size)
 	{
-		int32_t mode = 0;
-		stream->read(mode);
-		stream->readString(m_buffer.data(), m_buffer.size());
+		if (strncmp(path, m_base_path.c_str(), m_base_path.length()) != 0)
+		{
+			copyString(out, max_size, m_base_path.c_str());
+			catString(out, max_size, path);
+		}
+		else
+		{
+			copyString(out, max_size, path);
+		}
+	}
 
+
+	// ids come from the client, nullptr if the id is not an open file
+	OsFile* getFile(int32_t id)
+	{
+		if (id < 0 || id >= m_files.size())
+		{
+			return nullptr;
+		}
+		MT::SpinLock lock(m_files_mutex);
+		return m_files[id];
+	}
+
+
+	void openFile(TCPFileServerRequest& request)
+	{
 		int32_t ret = -2;
-		int32_t id = m_ids.alloc();
-		if (id > 0)
+		int32_t id = -1;
+		{
+			MT::SpinLock lock(m_files_mutex);
+			id = m_ids.alloc();
+		}
+		if (id >= 0)
 		{
 			OsFile* file = getAllocator().newObject<OsFile>();
-			m_files[id] = file;
 
 			char path[MAX_PATH_LENGTH];
-			if (strncmp(m_buffer.data(),
-						m_base_path.c_str(),
-						m_base_path.length()) != 0)
+			getFullPath(request.m_path, path, sizeof(path));
+			ret = file->open(path, request.m_mode, getAllocator()) ? id : -1;
 			{
-				copyString(path, sizeof(path), m_base_path.c_str());
-				catString(path, sizeof(path), m_buffer.data());
+				MT::SpinLock lock(m_files_mutex);
+				if (ret == -1)
+				{
+					m_ids.release(id);
+				}
+				else
+				{
+					m_files[id] = file;
+				}
 			}
-			else
-			{
-				copyString(path, sizeof(path), m_buffer.data());
-			}
-			ret = file->open(path, mode, getAllocator()) ? id : -1;
 			if (ret == -1)
 			{
-				m_ids.release(id);
 				file->close();
 				getAllocator().deleteObject(file);
 			}
 		}
-		stream->write(ret);
+		respond(request.m_request_id, ret, nullptr, 0);
+	}
+
+
+	void openAndReadAll(TCPFileServerRequest& request, uint8_t* buffer, int buffer_size)
+	{
+		char path[MAX_PATH_LENGTH];
+		getFullPath(request.m_path, path, sizeof(path));
+
+		OsFile file;
+		if (!file.open(path, Mode::OPEN | Mode::READ, getAllocator()))
+		{
+			respond(request.m_request_id, -1, nullptr, 0);
+			return;
+		}
+
+		uint32_t size = (uint32_t)file.size();
+		uint8_t* data = size <= (uint32_t)buffer_size
+							? buffer
+							: (uint8_t*)getAllocator().allocate(size);
+		bool read_successful = file.read(data, size);
+		file.close();
+
+		if (read_successful)
+		{
+			respond(request.m_request_id, (int32_t)size, data, size);
+		}
+		else
+		{
+			respond(request.m_request_id, -1, nullptr, 0);
+		}
+		if (data != buffer)
+		{
+			getAllocator().deallocate(data);
+		}
+	}
+
+
+	bool getHash(OsFile& file, const char* path, uint8_t* buffer, int buffer_size, uint32_t& hash)
+	{
+		uint32_t path_hash = crc32(path);
+		uint32_t size = (uint32_t)file.size();
+		uint64_t last_modified = file.getLastModified();
+		{
+			MT::SpinLock lock(m_hashes_mutex);
+			auto iter = m_hashes.find(path_hash);
+			if (iter != m_hashes.end() && iter.value().m_size == size &&
+				iter.value().m_last_modified == last_modified)
+			{
+				hash = iter.value().m_hash;
+				return true;
+			}
+		}
+
+		uint8_t* data = size <= (uint32_t)buffer_size
+							? buffer
+							: (uint8_t*)getAllocator().allocate(size);
+		bool read_successful = file.read(data, size);
+		if (read_successful)
+		{
+			hash = crc32(data, size);
+			TCPFileServerHash value;
+			value.m_last_modified = last_modified;
+			value.m_size = size;
+			value.m_hash = hash;
+			MT::SpinLock lock(m_hashes_mutex);
+			m_hashes[path_hash] = value;
+		}
+		if (data != buffer)
+		{
+			getAllocator().deallocate(data);
+		}
+		return read_successful;
 	}
 
 
-	void read(Net::TCPStream* stream)
+	void stat(TCPFileServerRequest& request, uint8_t* buffer, int buffer_size)
 	{
-		bool read_successful = true;
-		uint32_t id = 0xffffFFFF;
-		stream->read(id);
-		OsFile* file = m_files[id];
+		int32_t count = request.m_value;
+		TCPFileStat* stats =
+			(TCPFileStat*)getAllocator().allocate(sizeof(TCPFileStat) * count);
+		const char* path = (const char*)request.m_data;
+		for (int i = 0; i < count; ++i)
+		{
+			char full_path[MAX_PATH_LENGTH];
+			getFullPath(path, full_path, sizeof(full_path));
+			path += strlen(path) + 1;
+
+			stats[i].m_hash = 0;
+			stats[i].m_size = -1;
+			OsFile file;
+			if (file.open(full_path, Mode::OPEN | Mode::READ, getAllocator()))
+			{
+				if (getHash(file, full_path, buffer, buffer_size, stats[i].m_hash))
+				{
+					stats[i].m_size = (int32_t)file.size();
+				}
+				file.close();
+			}
+		}
+		getAllocator().deallocate(request.m_data);
+		request.m_data = nullptr;
+
+		respond(request.m_request_id,
+				count,
+				stats,
+				sizeof(TCPFileStat) * count);
+		getAllocator().deallocate(stats);
+	}
 
-		uint32_t size = 0;
-		stream->read(size);
 
-		while (size > 0)
+	void read(TCPFileServerRequest& request, uint8_t* buffer, int buffer_size)
+	{
+		OsFile* file = getFile(request.m_file);
+		if (!file)
 		{
-			int32_t read = (int32_t)size > m_buffer.size() ? m_buffer.size()
-														   : (int32_t)size;
-			read_successful &= file->read((void*)m_buffer.data(), read);
-			stream->write((const void*)m_buffer.data(), read);
-			size -= read;
+			respond(request.m_request_id, 0, nullptr, 0);
+			return;
 		}
 
-		stream->write(read_successful);
+		uint32_t size = (uint32_t)request.m_value;
+		uint8_t* data = size <= (uint32_t)buffer_size
+							? buffer
+							: (uint8_t*)getAllocator().allocate(size);
+		bool read_successful = file->read(data, size);
+		// nothing of a failed read is sent
+		respond(request.m_request_id,
+				read_successful ? 1 : 0,
+				data,
+				read_successful ? size : 0);
+
+		if (data != buffer)
+		{
+			getAllocator().deallocate(data);
+		}
 	}
 
 
-	void close(Net::TCPStream* stream)
+	void close(TCPFileServerRequest& request)
 	{
-		uint32_t id = 0xffffFFFF;
-		stream->read(id);
-		OsFile* file = m_files[id];
-		m_ids.release(id);
+		OsFile* file = nullptr;
+		if (request.m_file >= 0 && request.m_file < m_files.size())
+		{
+			MT::SpinLock lock(m_files_mutex);
+			file = m_files[request.m_file];
+			if (file)
+			{
+				m_files[request.m_file] = nullptr;
+				m_ids.release(request.m_file);
+			}
+		}
+		if (!file)
+		{
+			respond(request.m_request_id, 0, nullptr, 0);
+			return;
+		}
 
 		file->close();
 		getAllocator().deleteObject(file);
+		respond(request.m_request_id, 1, nullptr, 0);
 	}
 
 
-	void write(Net::TCPStream* stream)
+	void write(TCPFileServerRequest& request)
 	{
-		bool write_successful = true;
-		uint32_t id = 0xffffFFFF;
-		stream->read(id);
-		OsFile* file = m_files[id];
+		OsFile* file = getFile(request.m_file);
+
+		bool write_successful = file && file->write(request.m_data, request.m_value);
+		getAllocator().deallocate(request.m_data);
+		request.m_data = nullptr;
+
+		respond(request.m_request_id, write_successful ? 1 : 0, nullptr, 0);
+	}
 
-		uint32_t size = 0;
-		stream->read(size);
 
-		while (size > 0)
+	void seek(TCPFileServerRequest& request)
+	{
+		OsFile* file = getFile(request.m_file);
+		if (!file)
 		{
-			int32_t read = (int32_t)size > m_buffer.size() ? m_buffer.size()
-														   : (int32_t)size;
-			write_successful &= stream->read((void*)m_buffer.data(), read);
-			file->write(m_buffer.data(), read);
-			size -= read;
+			respond(request.m_request_id, -1, nullptr, 0);
+			return;
 		}
 
-		stream->write(write_successful);
+		uint32_t pos = (uint32_t)file->seek((SeekMode)(uint32_t)request.m_mode, request.m_value);
+		respond(request.m_request_id, (int32_t)pos, nullptr, 0);
 	}
 
 
-	void seek(Net::TCPStream* stream)
+	void size(TCPFileServerRequest& request)
 	{
-		uint32_t id = 0xffffFFFF;
-		stream->read(id);
-		OsFile* file = m_files[id];
+		OsFile* file = getFile(request.m_file);
+		if (!file)
+		{
+			respond(request.m_request_id, -1, nullptr, 0);
+			return;
+		}
 
-		uint32_t base = 0;
-		int32_t offset = 0;
-		stream->read(base);
-		stream->read(offset);
+		uint32_t size = (uint32_t)file->size();
+		respond(request.m_request_id, (int32_t)size, nullptr, 0);
+	}
+
+
+	void pos(TCPFileServerRequest& request)
+	{
+		OsFile* file = getFile(request.m_file);
+		if (!file)
+		{
+			respond(request.m_request_id, -1, nullptr, 0);
+			return;
+		}
 
-		uint32_t pos = (uint32_t)file->seek((SeekMode)base, offset);
-		stream->write(pos);
+		uint32_t pos = (uint32_t)file->pos();
+		respond(request.m_request_id, (int32_t)pos, nullptr, 0);
 	}
 
 
-	void size(Net::TCPStream* stream)
+	void process(TCPFileServerRequest& request, uint8_t* buffer, int buffer_size)
 	{
-		uint32_t id = 0xffffFFFF;
-		stream->read(id);
-		OsFile* file = m_files[id];
+		switch (request.m_op)
+		{
+			case TCPCommand::OpenFile:
+				openFile(request);
+				break;
+			case TCPCommand::OpenAndReadAll:
+				openAndReadAll(request, buffer, buffer_size);
+				break;
+			case TCPCommand::Close:
+				close(request);
+				break;
+			case TCPCommand::Read:
+				read(request, buffer, buffer_size);
+				break;
+			case TCPCommand::Write:
+				write(request);
+				break;
+			case TCPCommand::Size:
+				size(request);
+				break;
+			case TCPCommand::Seek:
+				seek(request);
+				break;
+			case TCPCommand::Pos:
+				pos(request);
+				break;
+			case TCPCommand::Stat:
+				stat(request, buffer, buffer_size);
+				break;
+			default:
+				ASSERT(0);
+				break;
+		}
+	}
 
-		uint32_t size = (uint32_t)file->size();
-		stream->write(size);
+
+	TCPFileServerRequest* popRequest(int worker)
+	{
+		TCPFileServerRequest* request = m_queues[worker].pop(true);
+		if (request && request->m_op == TCPCommand::Disconnect)
+		{
+			m_queues[worker].dealoc(request, true);
+			return nullptr;
+		}
+		return request;
 	}
 
 
-	void pos(Net::TCPStream* stream)
+	void releaseRequest(int worker, TCPFileServerRequest* request)
 	{
-		uint32_t id = 0xffffFFFF;
-		stream->read(id);
-		OsFile* file = m_files[id];
+		m_queues[worker].dealoc(request, true);
+	}
 
-		uint32_t pos = (uint32_t)file->pos();
-		stream->write(pos);
+
+	// a file is always handled by the same worker, so a read, a seek and
+	// a close of the file can not overtake each other, requests without
+	// a file are spread over all workers
+	int getWorker(int32_t op, int32_t file)
+	{
+		switch (op)
+		{
+			case TCPCommand::Close:
+			case TCPCommand::Read:
+			case TCPCommand::Write:
+			case TCPCommand::Size:
+			case TCPCommand::Seek:
+			case TCPCommand::Pos:
+				return (int)((uint32_t)file % C_WORKER_COUNT);
+			default:
+				m_next_worker = (m_next_worker + 1) % C_WORKER_COUNT;
+				return m_next_worker;
+		}
 	}
 
 
-	int task()
+	// stat paths are zero terminated, there must be as many of them as
+	// the request says
+	static bool isValidStatData(const uint8_t* data, uint32_t data_size, int32_t count)
+	{
+		if (data_size == 0 || data[data_size - 1] != '\0')
+		{
+			return false;
+		}
+		int32_t path_count = 0;
+		for (uint32_t i = 0; i < data_size; ++i)
+		{
+			path_count += data[i] == '\0' ? 1 : 0;
+		}
+		return path_count == count;
+	}
+
+
+	bool readRequest(int32_t op, TCPFileServerRequest& request)
 	{
-		bool quit = false;
+		bool ret = true;
+		switch (op)
+		{
+			case TCPCommand::OpenFile:
+				ret &= m_stream->read(request.m_mode);
+				ret &= m_stream->readString(request.m_path, sizeof(request.m_path));
+				break;
+			case TCPCommand::OpenAndReadAll:
+				ret &= m_stream->readString(request.m_path, sizeof(request.m_path));
+				break;
+			case TCPCommand::Close:
+			case TCPCommand::Size:
+			case TCPCommand::Pos:
+				ret &= m_stream->read(request.m_file);
+				break;
+			case TCPCommand::Read:
+				ret &= m_stream->read(request.m_file);
+				ret &= m_stream->read(request.m_value);
+				ret &= (uint32_t)request.m_value <= TCP_MAX_TRANSFER_SIZE;
+				break;
+			case TCPCommand::Write:
+				ret &= m_stream->read(request.m_file);
+				ret &= m_stream->read(request.m_value);
+				ret &= (uint32_t)request.m_value <= TCP_MAX_TRANSFER_SIZE;
+				if (ret)
+				{
+					request.m_data = (uint8_t*)getAllocator().allocate(request.m_value);
+					ret &= m_stream->read(request.m_data, request.m_value);
+				}
+				break;
+			case TCPCommand::Seek:
+				ret &= m_stream->read(request.m_file);
+				ret &= m_stream->read(request.m_mode);
+				ret &= m_stream->read(request.m_value);
+				break;
+			case TCPCommand::Stat:
+			{
+				uint32_t data_size = 0;
+				ret &= m_stream->read(request.m_value);
+				ret &= m_stream->read(data_size);
+				ret &= data_size <= TCP_MAX_TRANSFER_SIZE;
+				if (ret)
+				{
+					request.m_data = (uint8_t*)getAllocator().allocate(data_size);
+					ret = m_stream->read(request.m_data, data_size) &&
+						  isValidStatData(request.m_data, data_size, request.m_value);
+				}
+				break;
+			}
+			default:
+				ASSERT(0);
+				ret = false;
+				break;
+		}
+		return ret;
+	}
 
+
+	int task()
+	{
 		m_acceptor.start("127.0.0.1", 10001);
-		Net::TCPStream* stream = m_acceptor.accept();
+		m_stream = m_acceptor.accept();
+
+		TCPFileServerWorker* workers[C_WORKER_COUNT];
+		for (int i = 0; i < C_WORKER_COUNT; ++i)
+		{
+			workers[i] = getAllocator().newObject<TCPFileServerWorker>(*this, i, getAllocator());
+			workers[i]->create("TCP File Server Worker");
+			workers[i]->run();
+		}
 
-		while (!quit)
+		uint32_t disconnect_request_id = TCP_NO_RESPONSE;
+		for (;;)
 		{
 			int32_t op = 0;
-			stream->read(op);
-			switch (op)
+			uint32_t request_id = TCP_NO_RESPONSE;
+			if (!m_stream->read(op) || !m_stream->read(request_id))
+			{
+				break;
+			}
+
+			if (op == TCPCommand::Disconnect)
+			{
+				disconnect_request_id = request_id;
+				break;
+			}
+			if (op == TCPCommand::Version)
 			{
-				case TCPCommand::OpenFile:
-					openFile(stream);
-					break;
-				case TCPCommand::Close:
-					close(stream);
-					break;
-				case TCPCommand::Read:
-					read(stream);
-					break;
-				case TCPCommand::Write:
-					write(stream);
-					break;
-				case TCPCommand::Size:
-					size(stream);
-					break;
-				case TCPCommand::Seek:
-					seek(stream);
-					break;
-				case TCPCommand::Pos:
-					pos(stream);
-					break;
-				case TCPCommand::Disconnect:
-					quit = true;
-					break;
-				default:
-					ASSERT(0);
-					break;
+				respond(request_id, TCP_FILE_PROTOCOL_VERSION, nullptr, 0);
+				continue;
 			}
+
+			// the worker is known only after the arguments are read
+			TCPFileServerRequest request;
+			request.m_op = op;
+			request.m_request_id = request_id;
+			request.m_file = -1;
+			request.m_data = nullptr;
+			if (!readRequest(op, request))
+			{
+				getAllocator().deallocate(request.m_data);
+				break;
+			}
+			TCPFileServerQueue& queue = m_queues[getWorker(op, request.m_file)];
+			TCPFileServerRequest* queued = queue.alloc(true);
+			*queued = request;
+			queue.push(queued, true);
+		}
+
+		for (int i = 0; i < C_WORKER_COUNT; ++i)
+		{
+			TCPFileServerRequest* request = m_queues[i].alloc(true);
+			request->m_op = TCPCommand::Disconnect;
+			m_queues[i].push(request, true);
+		}
+		for (int i = 0; i < C_WORKER_COUNT; ++i)
+		{
+			workers[i]->destroy();
+			getAllocator().deleteObject(workers[i]);
 		}
 
-		m_acceptor.close(stream);
+		respond(disconnect_request_id, 1, nullptr, 0);
+		m_acceptor.close(m_stream);
+		m_stream = nullptr;
 		return 0;
 	}
 
@@ -235,13 +644,30 @@ public:
 
 private:
 	Net::TCPAcceptor m_acceptor;
-	StaticArray<char, 0x50000> m_buffer;
+	Net::TCPStream* m_stream;
+	MT::Mutex m_write_mutex;
+	MT::SpinMutex m_files_mutex;
+	MT::SpinMutex m_hashes_mutex;
+	PODHashMap<uint32_t, TCPFileServerHash> m_hashes;
+	TCPFileServerQueue m_queues[C_WORKER_COUNT];
+	int m_next_worker;
 	StaticArray<OsFile*, 0x50000> m_files;
 	FreeList<int32_t, 0x50000> m_ids;
 	Path m_base_path;
 };
 
 
+int TCPFileServerWorker::task()
+{
+	while (TCPFileServerRequest* request = m_server.popRequest(m_index))
+	{
+		m_server.process(*request, m_buffer.data(), m_buffer.size());
+		m_server.releaseRequest(m_index, request);
+	}
+	return 0;
+}
+
+
 struct TCPFileServerImpl
 {
 	TCPFileServerImpl(IAllocator& allocator)
@@ -15,12 +15,18 @@ namespace Lumix
 		bool TCPStream::readString(char* string, uint32_t max_size)
 		{
 			uint32_t len = 0;
-			bool ret = true;
-			ret &= read(len);
-			ASSERT(len < max_size);
-			ret &= read((void*)string, len);
-
-			return ret;
+			// the length comes from the other end, nothing is read into
+			// the string if it does not fit
+			if (!read(len) || len == 0 || len > max_size)
+			{
+				return false;
+			}
+			if (!read((void*)string, len))
+			{
+				return false;
+			}
+			string[len - 1] = '\0';
+			return true;
 		}
 
 		bool TCPStream::writeString(const char* string)
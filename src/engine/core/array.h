@@ -62,6 +62,23 @@ public:
 		m_allocator.deallocate(m_data);
 	}
 
+	void swap(Array<T, false>& rhs)
+	{
+		ASSERT(&rhs.m_allocator == &m_allocator);
+
+		int i = rhs.m_capacity;
+		rhs.m_capacity = m_capacity;
+		m_capacity = i;
+
+		i = m_size;
+		m_size = rhs.m_size;
+		rhs.m_size = i;
+
+		T* p = rhs.m_data;
+		rhs.m_data = m_data;
+		m_data = p;
+	}
+
 	int indexOf(const T& item)
 	{
 		for (int i = 0; i < m_size; ++i)
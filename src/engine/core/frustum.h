@@ -128,6 +128,25 @@ namespace Lumix
 				return true;
 			}
 
+
+			// axis aligned box given by its center and half of its size
+			bool isBoxInside(const Vec3& center, const Vec3& half_size) const
+			{
+				for (int i = 0; i < (int)Sides::COUNT; ++i)
+				{
+					const Plane& plane = m_plane[i];
+					float distance = dotProduct(center, plane.normal) + plane.d;
+					float radius = Math::abs(plane.normal.x) * half_size.x +
+								   Math::abs(plane.normal.y) * half_size.y +
+								   Math::abs(plane.normal.z) * half_size.z;
+					if (distance < -radius)
+					{
+						return false;
+					}
+				}
+				return true;
+			}
+
 			const Vec3& getCenter() const { return m_center; }
 			const Vec3& getPosition() const { return m_position; }
 			const Vec3& getDirection() const { return m_direction; }
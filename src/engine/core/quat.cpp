@@ -44,7 +44,7 @@ void Quat::conjugate()
 }
 
 
-void Quat::conjugated(Quat& q)
+void Quat::conjugated(Quat& q) const
 {
 	q.x = x;
 	q.y = y;
@@ -31,7 +31,7 @@ struct LUMIX_ENGINE_API Quat
 	AxisAngle getAxisAngle() const;
 	void set(float _x, float _y, float _z, float _w) { x = _x; y = _y; z = _z; w = _w; } 
 	void conjugate();
-	void conjugated(Quat& q);
+	void conjugated(Quat& q) const;
 	void normalize();
 	void toMatrix(Matrix& mtx) const;
 
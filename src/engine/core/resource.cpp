@@ -1,9 +1,14 @@
 #include "lumix.h"
 #include "core/resource.h"
 
+#include "core/blob.h"
 #include "core/fs/file_system.h"
+#include "core/fs/ifile.h"
+#include "core/log.h"
 #include "core/path.h"
 #include "core/resource_manager.h"
+#include "core/resource_manager_base.h"
+#include "core/string.h"
 
 namespace Lumix
 {
@@ -11,11 +16,19 @@ namespace Lumix
 		: m_ref_count()
 		, m_dep_count(1)
 		, m_state(State::EMPTY)
+		, m_is_parsing(false)
+		, m_is_cached(false)
+		, m_lru_prev(nullptr)
+		, m_lru_next(nullptr)
+		, m_base_manager(nullptr)
+		, m_resident_size(0)
 		, m_path(path)
 		, m_size()
 		, m_cb(allocator)
 		, m_resource_manager(resource_manager)
-	{ }
+	{
+		m_parse_error[0] = '\0';
+	}
 
 	Resource::~Resource()
 	{ }
@@ -24,6 +37,7 @@ namespace Lumix
 	{
 		State old_state = m_state;
 		m_state = State::EMPTY;
+		updateResidentSize();
 		m_cb.invoke(old_state, State::EMPTY);
 		if (old_state == State::LOADING)
 		{
@@ -35,6 +49,7 @@ namespace Lumix
 	{
 		State old_state = m_state;
 		m_state = State::LOADING;
+		updateResidentSize();
 		m_cb.invoke(old_state, State::LOADING);
 		m_resource_manager.incrementLoadingResources();
 	}
@@ -43,6 +58,7 @@ namespace Lumix
 	{
 		State old_state = m_state;
 		m_state = State::READY;
+		updateResidentSize();
 		m_cb.invoke(old_state, State::READY);
 		if (old_state == State::LOADING)
 		{
@@ -54,6 +70,7 @@ namespace Lumix
 	{
 		State old_state = m_state;
 		m_state = State::UNLOADING;
+		updateResidentSize();
 		m_cb.invoke(old_state, State::UNLOADING);
 		if (old_state == State::LOADING)
 		{
@@ -66,6 +83,7 @@ namespace Lumix
 		State old_state = m_state;
 
 		m_state = State::UNLOADING;
+		updateResidentSize();
 		m_cb.invoke(old_state, State::UNLOADING);
 		if (old_state == State::LOADING)
 		{
@@ -77,6 +95,7 @@ namespace Lumix
 	{
 		State old_state = m_state;
 		m_state = State::FAILURE;
+		updateResidentSize();
 		m_cb.invoke(old_state, State::FAILURE);
 		if (old_state == State::LOADING)
 		{
@@ -84,6 +103,18 @@ namespace Lumix
 		}
 	}
 
+	void Resource::updateResidentSize()
+	{
+		if (!m_base_manager)
+		{
+			return;
+		}
+		size_t size = isReady() ? m_size : 0;
+		m_base_manager->m_resident_size -= m_resident_size;
+		m_base_manager->m_resident_size += size;
+		m_resident_size = size;
+	}
+
 	void Resource::doLoad(void)
 	{
 		FS::FileSystem& fs = m_resource_manager.getFileSystem();
@@ -92,6 +123,41 @@ namespace Lumix
 		fs.openAsync(fs.getDefaultDevice(), m_path, FS::Mode::OPEN | FS::Mode::READ, cb);
 	}
 
+	void Resource::loaded(FS::IFile& file, bool success, FS::FileSystem&)
+	{
+		if (!success)
+		{
+			g_log_error.log("resource") << "Could not open " << m_path.c_str();
+			onFailure();
+			return;
+		}
+		m_parse_error[0] = '\0';
+		m_resource_manager.parse(*this, file);
+	}
+
+	void Resource::parsed(InputBlob& data, bool success)
+	{
+		if (success && commit(data))
+		{
+			m_size = data.getSize();
+			decrementDepCount();
+		}
+		else
+		{
+			if (m_parse_error[0])
+			{
+				g_log_error.log("resource") << m_path.c_str() << ": " << m_parse_error;
+			}
+			g_log_error.log("resource") << "Error loading " << m_path.c_str();
+			onFailure();
+		}
+	}
+
+	void Resource::setParseError(const char* error)
+	{
+		copyString(m_parse_error, sizeof(m_parse_error), error);
+	}
+
 	void Resource::addDependency(Resource& dependent_resource)
 	{
 		dependent_resource.m_cb.bind<Resource, &Resource::onStateChanged>(this);
@@ -7,11 +7,14 @@
 namespace Lumix
 {
 	// forward declarations
+	class InputBlob;
 	class ResourceManager;
+	class ResourceManagerBase;
 
 	class LUMIX_ENGINE_API Resource
 	{
 	public:
+		friend class ResourceManager;
 		friend class ResourceManagerBase;
 
 		enum class State : uint32_t
@@ -64,7 +67,16 @@ namespace Lumix
 
 		void doLoad(void);
 		virtual void doUnload(void) = 0;
-		virtual void loaded(FS::IFile& file, bool success, FS::FileSystem& fs) = 0;
+		virtual void loaded(FS::IFile& file, bool success, FS::FileSystem& fs);
+
+		// default loaded() splits loading in two phases, parse() runs on a worker
+		// thread and must not touch the renderer, the log or other resources,
+		// commit() runs on the main thread and creates GPU objects and dependencies
+		virtual bool parse(InputBlob& data) { return true; }
+		virtual bool commit(InputBlob& data) { return false; }
+		void parsed(InputBlob& data, bool success);
+		// parse() can not log, the error is logged by parsed() on the main thread
+		void setParseError(const char* error);
 
 		uint32_t addRef(void) { return ++m_ref_count; }
 		uint32_t remRef(void) { return --m_ref_count; }
@@ -80,9 +92,21 @@ namespace Lumix
 
 	private:
 		void operator=(const Resource&);
+		void updateResidentSize();
+
+	private:
 		uint16_t m_ref_count;
 		uint16_t m_dep_count;
 		State m_state;
+		volatile bool m_is_parsing;
+		bool m_is_cached;
+		// zero-ref LRU list owned by ResourceManagerBase
+		Resource* m_lru_prev;
+		Resource* m_lru_next;
+		// counted in the resident size of the manager while ready
+		ResourceManagerBase* m_base_manager;
+		size_t m_resident_size;
+		char m_parse_error[256];
 
 	protected:
 		Path m_path;
@@ -1,19 +1,42 @@
 #include "lumix.h"
+#include "core/blob.h"
+#include "core/fs/ifile.h"
+#include "core/mt/atomic.h"
+#include "core/mt/thread.h"
+#include "core/mtjd/generic_job.h"
+#include "core/mtjd/manager.h"
 #include "core/path.h"
+#include "core/profiler.h"
+#include "core/resource.h"
 #include "core/resource_manager.h"
 #include "core/resource_manager_base.h"
+#include "core/timer.h"
 
 namespace Lumix
 {
+	const float ResourceManager::RELOAD_DELAY = 0.2f;
+
+
 	ResourceManager::ResourceManager(IAllocator& allocator) 
 		: m_resource_managers(allocator)
 		, m_allocator(allocator)
 		, m_loading_resources_count(0)
+		, m_job_manager(nullptr)
+		, m_parsed_mutex(false)
+		, m_parsed(allocator)
+		, m_committing(allocator)
+		, m_parsing_count(0)
+		, m_reload_queue(allocator)
+		, m_last_reload_request(0)
 	{
+		m_reload_timer = Timer::create(allocator);
 	}
 
 	ResourceManager::~ResourceManager()
 	{
+		Timer::destroy(m_reload_timer);
+		ASSERT(m_parsing_count == 0);
+		ASSERT(m_parsed.empty());
 	}
 
 	void ResourceManager::create(FS::FileSystem& fs)
@@ -23,6 +46,15 @@ namespace Lumix
 
 	void ResourceManager::destroy()
 	{
+		while (m_parsing_count > 0)
+		{
+			MT::yield();
+		}
+		for (int i = 0; i < m_parsed.size(); ++i)
+		{
+			m_allocator.deallocate(m_parsed[i].m_data);
+		}
+		m_parsed.clear();
 	}
 	
 	ResourceManagerBase* ResourceManager::get(uint32_t id)
@@ -41,6 +73,21 @@ namespace Lumix
 	}
 
 	void ResourceManager::reload(const char* path)
+	{
+		Path reload_path(path);
+		m_last_reload_request = m_reload_timer->getTimeSinceStart();
+		for (int i = 0; i < m_reload_queue.size(); ++i)
+		{
+			if (m_reload_queue[i] == reload_path)
+			{
+				return;
+			}
+		}
+		m_reload_queue.push(reload_path);
+	}
+
+
+	void ResourceManager::reloadNow(const char* path)
 	{
 		for (auto iter = m_resource_managers.begin(), end = m_resource_managers.end(); iter != end; ++iter)
 		{
@@ -49,6 +96,56 @@ namespace Lumix
 	}
 
 
+	void ResourceManager::processReloadQueue()
+	{
+		if (m_reload_queue.empty() ||
+			m_reload_timer->getTimeSinceStart() - m_last_reload_request < RELOAD_DELAY)
+		{
+			return;
+		}
+
+		PROFILE_FUNCTION();
+		// every changed resource is reloaded once, its dependents are only
+		// notified through their observer callbacks, they do not reload
+		int i = 0;
+		while (i < m_reload_queue.size())
+		{
+			bool is_loading = false;
+			for (auto iter = m_resource_managers.begin(), end = m_resource_managers.end(); iter != end; ++iter)
+			{
+				Resource* resource = iter.value()->get(m_reload_queue[i]);
+				is_loading = is_loading || (resource && resource->isLoading());
+			}
+			// the file changed again while the previous reload is in progress,
+			// try again next frame so the latest content gets loaded
+			if (is_loading)
+			{
+				++i;
+				continue;
+			}
+			reloadNow(m_reload_queue[i].c_str());
+			m_reload_queue.erase(i);
+		}
+	}
+
+
+	void ResourceManager::getStats(ResourceManagerBase::Stats& stats)
+	{
+		memset(&stats, 0, sizeof(stats));
+		for (auto iter = m_resource_managers.begin(), end = m_resource_managers.end(); iter != end; ++iter)
+		{
+			ResourceManagerBase::Stats manager_stats;
+			iter.value()->getStats(manager_stats);
+			stats.m_hits += manager_stats.m_hits;
+			stats.m_misses += manager_stats.m_misses;
+			stats.m_evictions += manager_stats.m_evictions;
+			stats.m_cached_count += manager_stats.m_cached_count;
+			stats.m_cached_size += manager_stats.m_cached_size;
+			stats.m_resident_size += manager_stats.m_resident_size;
+		}
+	}
+
+
 	void ResourceManager::incrementLoadingResources()
 	{
 		++m_loading_resources_count;
@@ -66,4 +163,114 @@ namespace Lumix
 	{
 		return m_loading_resources_count > 0;
 	}
-}
\ No newline at end of file
+
+
+	void ResourceManager::parse(Resource& resource, FS::IFile& file)
+	{
+		int size = (int)file.size();
+		if (!m_job_manager)
+		{
+			const void* buffer = file.getBuffer();
+			Array<uint8_t> tmp(m_allocator);
+			if (!buffer)
+			{
+				tmp.resize(size);
+				file.read(&tmp[0], size);
+				buffer = &tmp[0];
+			}
+			InputBlob blob(buffer, size);
+			bool success = resource.parse(blob);
+			blob.rewind();
+			resource.parsed(blob, success);
+			return;
+		}
+
+		// the file is closed as soon as loaded() returns, so the worker gets a copy
+		uint8_t* data = (uint8_t*)m_allocator.allocate(size);
+		const void* buffer = file.getBuffer();
+		if (buffer)
+		{
+			memcpy(data, buffer, size);
+		}
+		else
+		{
+			file.read(data, size);
+		}
+
+		resource.m_is_parsing = true;
+		MT::atomicIncrement(&m_parsing_count);
+		Resource* resource_ptr = &resource;
+		MTJD::Job* job = MTJD::makeJob(*m_job_manager,
+			[this, resource_ptr, data, size]()
+			{
+				InputBlob blob(data, size);
+				bool success = resource_ptr->parse(blob);
+
+				MT::SpinLock lock(m_parsed_mutex);
+				ParsedResource& parsed = m_parsed.pushEmpty();
+				parsed.m_resource = resource_ptr;
+				parsed.m_data = data;
+				parsed.m_size = size;
+				parsed.m_success = success;
+				resource_ptr->m_is_parsing = false;
+				MT::atomicDecrement(&m_parsing_count);
+			},
+			m_allocator);
+		m_job_manager->schedule(job);
+	}
+
+
+	void ResourceManager::cancelParse(Resource& resource)
+	{
+		while (resource.m_is_parsing)
+		{
+			MT::yield();
+		}
+
+		MT::SpinLock lock(m_parsed_mutex);
+		for (int i = m_parsed.size() - 1; i >= 0; --i)
+		{
+			if (m_parsed[i].m_resource == &resource)
+			{
+				m_allocator.deallocate(m_parsed[i].m_data);
+				m_parsed.eraseFast(i);
+			}
+		}
+		for (int i = 0; i < m_committing.size(); ++i)
+		{
+			if (m_committing[i].m_resource == &resource)
+			{
+				m_committing[i].m_resource = nullptr;
+			}
+		}
+	}
+
+
+	void ResourceManager::update()
+	{
+		PROFILE_FUNCTION();
+		processReloadQueue();
+		{
+			MT::SpinLock lock(m_parsed_mutex);
+			if (m_parsed.empty())
+			{
+				return;
+			}
+			m_committing.swap(m_parsed);
+		}
+
+		// commit can load or unload other resources, cancelParse() clears
+		// m_resource of entries which must not be committed anymore
+		for (int i = 0; i < m_committing.size(); ++i)
+		{
+			ParsedResource& parsed = m_committing[i];
+			if (parsed.m_resource)
+			{
+				InputBlob blob(parsed.m_data, parsed.m_size);
+				parsed.m_resource->parsed(blob, parsed.m_success);
+			}
+			m_allocator.deallocate(parsed.m_data);
+		}
+		m_committing.clear();
+	}
+}
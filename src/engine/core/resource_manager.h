@@ -1,27 +1,44 @@
 #pragma once
 
+#include "core/array.h"
+#include "core/mt/spin_mutex.h"
+#include "core/path.h"
 #include "core/pod_hash_map.h"
+#include "core/resource_manager_base.h"
 
 namespace Lumix
 {
 
 
 class Resource;
+class Timer;
 
 
 namespace FS
 {
 class FileSystem;
+class IFile;
 }
 
 
-class ResourceManagerBase;
+namespace MTJD
+{
+class Manager;
+}
 
 
 class LUMIX_ENGINE_API ResourceManager final
 {
 	typedef PODHashMap<uint32_t, ResourceManagerBase*> ResourceManagerTable;
 
+	struct ParsedResource
+	{
+		Resource* m_resource;
+		uint8_t* m_data;
+		int m_size;
+		bool m_success;
+	};
+
 public:
 	static const uint32_t MATERIAL = 0xba8de9d9; // MATERIAL
 	static const uint32_t MODEL = 0x06991edf; // MODEL
@@ -31,6 +48,8 @@ public:
 	static const uint32_t ANIMATION = 0xc9909a33; // ANIMATION
 	static const uint32_t PHYSICS = 0xE77419F9; // PHYSICS
 
+	static const float RELOAD_DELAY;
+
 	ResourceManager(IAllocator& allocator);
 	~ResourceManager();
 
@@ -42,18 +61,41 @@ public:
 
 	void add(uint32_t id, ResourceManagerBase* rm);
 	void remove(uint32_t id);
+	// queues a reload, requests are coalesced and processed by update()
+	// once no new request came for RELOAD_DELAY seconds
 	void reload(const char* path);
+	void reloadNow(const char* path);
 	bool isLoading() const;
 	void incrementLoadingResources();
 	void decrementLoadingResources();
 
+	// without a job manager resources are parsed synchronously in loaded()
+	void setJobManager(MTJD::Manager* manager) { m_job_manager = manager; }
+	// commits resources parsed on worker threads, call from the main thread
+	void update();
+	void parse(Resource& resource, FS::IFile& file);
+	void cancelParse(Resource& resource);
+	// sum of the statistics of all managers
+	void getStats(ResourceManagerBase::Stats& stats);
+
 	FS::FileSystem& getFileSystem() { return *m_file_system; }
 
+private:
+	void processReloadQueue();
+
 private:
 	IAllocator& m_allocator;
 	ResourceManagerTable m_resource_managers;
 	FS::FileSystem* m_file_system;
 	int m_loading_resources_count;
+	MTJD::Manager* m_job_manager;
+	MT::SpinMutex m_parsed_mutex;
+	Array<ParsedResource> m_parsed;
+	Array<ParsedResource> m_committing;
+	volatile int32_t m_parsing_count;
+	Array<Path> m_reload_queue;
+	Timer* m_reload_timer;
+	float m_last_reload_request;
 };
 
 
@@ -17,6 +17,7 @@ namespace Lumix
 
 	void ResourceManagerBase::destroy(void)
 	{ 
+		clearCache();
 		for (auto iter = m_resources.begin(), end = m_resources.end(); iter != end; ++iter)
 		{
 			Resource* resource = iter.value();
@@ -49,6 +50,8 @@ namespace Lumix
 	{
 		ASSERT(resource && resource->isReady());
 		m_resources.insert(resource->getPath(), resource);
+		resource->m_base_manager = this;
+		resource->updateResidentSize();
 		resource->addRef();
 	}
 
@@ -59,23 +62,29 @@ namespace Lumix
 		if(nullptr == resource)
 		{
 			resource = createResource(path);
+			resource->m_base_manager = this;
 			m_resources.insert(path, resource);
 		}
 		
-		if(resource->isEmpty())
-		{
-			resource->onLoading();
-			resource->doLoad();
-		}
-
-		resource->addRef();
+		load(*resource);
 		return resource;
 	}
 
 	void ResourceManagerBase::load(Resource& resource)
 	{
-		if(resource.isEmpty())
+		if (resource.m_is_cached)
 		{
+			++m_hits;
+			removeFromCache(resource);
+		}
+		else if(resource.isEmpty())
+		{
+			++m_misses;
+			if (m_cached_count > 0)
+			{
+				// make room before the new resource is loaded
+				evict();
+			}
 			resource.onLoading();
 			resource.doLoad();
 		}
@@ -96,13 +105,25 @@ namespace Lumix
 	{
 		if(0 == resource.remRef())
 		{
-			if (resource.isReady() || resource.isFailure() || resource.isEmpty())
+			if (m_budget > 0 && resource.isReady())
 			{
-				resource.incrementDepCount();
+				addToCache(resource);
+				evict();
+				return;
 			}
-			resource.onUnloading();
-			resource.doUnload();
+			doUnload(resource);
+		}
+	}
+
+	void ResourceManagerBase::doUnload(Resource& resource)
+	{
+		if (resource.isReady() || resource.isFailure() || resource.isEmpty())
+		{
+			resource.incrementDepCount();
 		}
+		m_owner->cancelParse(resource);
+		resource.onUnloading();
+		resource.doUnload();
 	}
 
 	void ResourceManagerBase::forceUnload(const Path& path)
@@ -116,12 +137,11 @@ namespace Lumix
 
 	void ResourceManagerBase::forceUnload(Resource& resource)
 	{
-		if (resource.isReady() || resource.isFailure() || resource.isEmpty())
+		if (resource.m_is_cached)
 		{
-			resource.incrementDepCount();
+			removeFromCache(resource);
 		}
-		resource.onUnloading();
-		resource.doUnload();
+		doUnload(resource);
 		resource.m_ref_count = 0;
 	}
 
@@ -136,12 +156,20 @@ namespace Lumix
 
 	void ResourceManagerBase::reload(Resource& resource)
 	{
+		if (resource.m_is_cached)
+		{
+			// nobody uses it, there is nothing to reload
+			removeFromCache(resource);
+			doUnload(resource);
+			return;
+		}
 		if (resource.isReady() || resource.isFailure() || resource.isEmpty())
 		{
 			if (!resource.isFailure())
 			{
 				resource.incrementDepCount();
 			}
+			m_owner->cancelParse(resource);
 			resource.onReloading();
 			resource.doUnload();
 			resource.onLoading();
@@ -149,13 +177,111 @@ namespace Lumix
 		}
 	}
 
+	void ResourceManagerBase::setBudget(size_t budget)
+	{
+		m_budget = budget;
+		if (m_budget == 0)
+		{
+			clearCache();
+		}
+		else if (m_cached_count > 0)
+		{
+			evict();
+		}
+	}
+
+	void ResourceManagerBase::clearCache()
+	{
+		while (m_lru_head)
+		{
+			Resource* resource = m_lru_head;
+			removeFromCache(*resource);
+			doUnload(*resource);
+		}
+	}
+
+	void ResourceManagerBase::getStats(Stats& stats)
+	{
+		stats.m_hits = m_hits;
+		stats.m_misses = m_misses;
+		stats.m_evictions = m_evictions;
+		stats.m_cached_count = m_cached_count;
+		stats.m_cached_size = m_cached_size;
+		stats.m_resident_size = m_resident_size;
+	}
+
+	void ResourceManagerBase::addToCache(Resource& resource)
+	{
+		ASSERT(!resource.m_is_cached);
+		resource.m_is_cached = true;
+		resource.m_lru_prev = m_lru_tail;
+		resource.m_lru_next = nullptr;
+		if (m_lru_tail)
+		{
+			m_lru_tail->m_lru_next = &resource;
+		}
+		else
+		{
+			m_lru_head = &resource;
+		}
+		m_lru_tail = &resource;
+		m_cached_size += resource.size();
+		++m_cached_count;
+	}
+
+	void ResourceManagerBase::removeFromCache(Resource& resource)
+	{
+		ASSERT(resource.m_is_cached);
+		if (resource.m_lru_prev)
+		{
+			resource.m_lru_prev->m_lru_next = resource.m_lru_next;
+		}
+		else
+		{
+			m_lru_head = resource.m_lru_next;
+		}
+		if (resource.m_lru_next)
+		{
+			resource.m_lru_next->m_lru_prev = resource.m_lru_prev;
+		}
+		else
+		{
+			m_lru_tail = resource.m_lru_prev;
+		}
+		resource.m_lru_prev = resource.m_lru_next = nullptr;
+		resource.m_is_cached = false;
+		m_cached_size -= resource.size();
+		--m_cached_count;
+	}
+
+	void ResourceManagerBase::evict()
+	{
+		while (m_lru_head && m_resident_size > m_budget)
+		{
+			Resource* resource = m_lru_head;
+			removeFromCache(*resource);
+			doUnload(*resource);
+			++m_evictions;
+		}
+	}
+
 	ResourceManagerBase::ResourceManagerBase(IAllocator& allocator)
 		: m_size(0)
 		, m_resources(allocator)
+		, m_owner(nullptr)
+		, m_budget(0)
+		, m_cached_size(0)
+		, m_resident_size(0)
+		, m_cached_count(0)
+		, m_hits(0)
+		, m_misses(0)
+		, m_evictions(0)
+		, m_lru_head(nullptr)
+		, m_lru_tail(nullptr)
 	{ }
 
 	ResourceManagerBase::~ResourceManagerBase()
 	{ 
 		ASSERT(m_resources.empty());
 	}
-}
\ No newline at end of file
+}
@@ -24,6 +24,17 @@ class LUMIX_ENGINE_API ResourceManagerBase
 	friend class Resource;
 	typedef PODHashMap<uint32_t, Resource*> ResourceTable;
 
+public:
+	struct Stats
+	{
+		int m_hits;
+		int m_misses;
+		int m_evictions;
+		int m_cached_count;
+		size_t m_cached_size;
+		size_t m_resident_size;
+	};
+
 public:
 	void create(uint32_t id, ResourceManager& owner);
 	void destroy(void);
@@ -43,6 +54,13 @@ public:
 	void reload(const Path& path);
 	void reload(Resource& resource);
 
+	// resources released by their last user stay resident until all ready
+	// resources of this manager take more than budget bytes, 0 disables it
+	void setBudget(size_t budget);
+	size_t getBudget() const { return m_budget; }
+	void clearCache();
+	void getStats(Stats& stats);
+
 	ResourceManagerBase(IAllocator& allocator);
 	virtual ~ResourceManagerBase(void);
 
@@ -51,10 +69,26 @@ protected:
 	virtual void destroyResource(Resource& resource) = 0;
 
 	ResourceManager& getOwner() const { return *m_owner; }
+private:
+	void doUnload(Resource& resource);
+	void addToCache(Resource& resource);
+	void removeFromCache(Resource& resource);
+	void evict();
+
 private:
 	uint32_t m_size;
 	ResourceTable m_resources;
 	ResourceManager* m_owner;
+	size_t m_budget;
+	size_t m_cached_size;
+	// size of the ready resources, kept up to date by the resources
+	size_t m_resident_size;
+	int m_cached_count;
+	int m_hits;
+	int m_misses;
+	int m_evictions;
+	Resource* m_lru_head;
+	Resource* m_lru_tail;
 };
 
 
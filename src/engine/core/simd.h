@@ -0,0 +1,172 @@
+#pragma once
+
+
+#include "lumix.h"
+#include <emmintrin.h>
+
+
+namespace Lumix
+{
+
+
+typedef __m128 float4;
+
+
+LUMIX_FORCE_INLINE float4 f4LoadUnaligned(const void* src)
+{
+	return _mm_loadu_ps((const float*)(src));
+}
+
+
+// loads x, y, z, the fourth component is zero, safe for the last item of
+// an array
+LUMIX_FORCE_INLINE float4 f4Load3(const float* src)
+{
+	return _mm_set_ps(0, src[2], src[1], src[0]);
+}
+
+
+LUMIX_FORCE_INLINE void f4StoreUnaligned(void* dest, float4 src)
+{
+	_mm_storeu_ps((float*)dest, src);
+}
+
+
+LUMIX_FORCE_INLINE void f4Store3(float* dest, float4 src)
+{
+	_mm_store_ss(dest, src);
+	_mm_store_ss(dest + 1, _mm_shuffle_ps(src, src, _MM_SHUFFLE(1, 1, 1, 1)));
+	_mm_store_ss(dest + 2, _mm_shuffle_ps(src, src, _MM_SHUFFLE(2, 2, 2, 2)));
+}
+
+
+LUMIX_FORCE_INLINE float4 f4Splat(float value)
+{
+	return _mm_set_ps1(value);
+}
+
+
+LUMIX_FORCE_INLINE float4 f4Zero()
+{
+	return _mm_setzero_ps();
+}
+
+
+LUMIX_FORCE_INLINE float4 f4Add(float4 a, float4 b)
+{
+	return _mm_add_ps(a, b);
+}
+
+
+LUMIX_FORCE_INLINE float4 f4Sub(float4 a, float4 b)
+{
+	return _mm_sub_ps(a, b);
+}
+
+
+LUMIX_FORCE_INLINE float4 f4Mul(float4 a, float4 b)
+{
+	return _mm_mul_ps(a, b);
+}
+
+
+LUMIX_FORCE_INLINE float4 f4Div(float4 a, float4 b)
+{
+	return _mm_div_ps(a, b);
+}
+
+
+LUMIX_FORCE_INLINE float4 f4Sqrt(float4 a)
+{
+	return _mm_sqrt_ps(a);
+}
+
+
+LUMIX_FORCE_INLINE float4 f4Min(float4 a, float4 b)
+{
+	return _mm_min_ps(a, b);
+}
+
+
+LUMIX_FORCE_INLINE float4 f4Max(float4 a, float4 b)
+{
+	return _mm_max_ps(a, b);
+}
+
+
+// comparisons return all bits set in the lanes where the condition holds,
+// comparisons with NaN are false
+LUMIX_FORCE_INLINE float4 f4CmpLT(float4 a, float4 b)
+{
+	return _mm_cmplt_ps(a, b);
+}
+
+
+LUMIX_FORCE_INLINE float4 f4CmpLE(float4 a, float4 b)
+{
+	return _mm_cmple_ps(a, b);
+}
+
+
+// sign bit of each lane, lane 0 is the lowest bit
+LUMIX_FORCE_INLINE int f4MoveMask(float4 a)
+{
+	return _mm_movemask_ps(a);
+}
+
+
+LUMIX_FORCE_INLINE float f4GetX(float4 a)
+{
+	return _mm_cvtss_f32(a);
+}
+
+
+// rounds towards zero, i.e. floor of non-negative values
+LUMIX_FORCE_INLINE float4 f4Trunc(float4 a)
+{
+	return _mm_cvtepi32_ps(_mm_cvttps_epi32(a));
+}
+
+
+// lanes of a where the mask is set, lanes of b elsewhere
+LUMIX_FORCE_INLINE float4 f4Select(float4 mask, float4 a, float4 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+
+LUMIX_FORCE_INLINE float4 f4And(float4 a, float4 b)
+{
+	return _mm_and_ps(a, b);
+}
+
+
+LUMIX_FORCE_INLINE float4 f4Xor(float4 a, float4 b)
+{
+	return _mm_xor_ps(a, b);
+}
+
+
+// sign bits of a, other bits cleared
+LUMIX_FORCE_INLINE float4 f4Sign(float4 a)
+{
+	return _mm_and_ps(a, _mm_set_ps1(-0.0f));
+}
+
+
+#define f4Shuffle(a, b, x, y, z, w) _mm_shuffle_ps(a, b, _MM_SHUFFLE(w, z, y, x))
+#define f4Splat4(a, i) _mm_shuffle_ps(a, a, _MM_SHUFFLE(i, i, i, i))
+#define f4Transpose(a, b, c, d) _MM_TRANSPOSE4_PS(a, b, c, d)
+
+
+// cross product of the xyz parts, w is zero if both w are zero
+LUMIX_FORCE_INLINE float4 f4Cross3(float4 a, float4 b)
+{
+	float4 a_yzx = f4Shuffle(a, a, 1, 2, 0, 3);
+	float4 b_yzx = f4Shuffle(b, b, 1, 2, 0, 3);
+	float4 c = f4Sub(f4Mul(a, b_yzx), f4Mul(a_yzx, b));
+	return f4Shuffle(c, c, 1, 2, 0, 3);
+}
+
+
+} // ~namespace Lumix
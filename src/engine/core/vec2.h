@@ -0,0 +1,27 @@
+#pragma once
+
+
+#include "lumix.h"
+
+
+namespace Lumix
+{
+
+
+struct LUMIX_ENGINE_API Vec2
+{
+	Vec2() {}
+
+	Vec2(float a, float b) : x(a), y(b) {}
+
+	void set(float a, float b)
+	{
+		x = a;
+		y = b;
+	}
+
+	float x, y;
+};
+
+
+} // !namespace Lumix
@@ -26,14 +26,6 @@ namespace Lumix
 static const uint32_t SERIALIZED_ENGINE_MAGIC = 0x5f4c454e; // == '_LEN'
 
 
-enum class SerializedEngineVersion : int32_t
-{
-	BASE,
-
-	LATEST // must be the last one
-};
-
-
 #pragma pack(1)
 class SerializedEngineHeader
 {
@@ -92,6 +84,7 @@ public:
 		}
 
 		m_resource_manager.create(*m_file_system);
+		m_resource_manager.setJobManager(&m_mtjd_manager);
 
 		m_timer = Timer::create(m_allocator);
 		m_fps_timer = Timer::create(m_allocator);
@@ -128,6 +121,7 @@ public:
 		Timer::destroy(m_timer);
 		Timer::destroy(m_fps_timer);
 		PluginManager::destroy(m_plugin_manager);
+		m_resource_manager.destroy();
 		m_input_system.destroy();
 		if (m_disk_file_device)
 		{
@@ -307,6 +301,7 @@ public:
 		m_plugin_manager->update(dt);
 		m_input_system.update(dt);
 		getFileSystem().updateAsyncTransactions();
+		m_resource_manager.update();
 	}
 
 
@@ -411,7 +406,7 @@ public:
 		{
 			char tmp[32];
 			serializer.readString(tmp, sizeof(tmp));
-			ctx.getScene(crc32(tmp))->deserialize(serializer);
+			ctx.getScene(crc32(tmp))->deserialize(serializer, (int)header.m_version);
 		}
 		g_path_manager.clear();
 		return true;
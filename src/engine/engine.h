@@ -32,6 +32,17 @@ class Universe;
 class WorldEditor;
 
 
+// scenes get the version of the serialized universe in deserialize
+enum class SerializedEngineVersion : int32_t
+{
+	BASE,
+	TERRAIN_TILES,
+	ANIMATION_GRAPHS,
+
+	LATEST // must be the last one
+};
+
+
 struct LUMIX_ENGINE_API UniverseContext
 {
 	UniverseContext(IAllocator& allocator)
@@ -22,7 +22,7 @@ namespace Lumix
 			virtual ComponentIndex createComponent(uint32_t, Entity) = 0;
 			virtual void destroyComponent(ComponentIndex component, uint32_t type) = 0;
 			virtual void serialize(OutputBlob& serializer) = 0;
-			virtual void deserialize(InputBlob& serializer) = 0;
+			virtual void deserialize(InputBlob& serializer, int version) = 0;
 			virtual IPlugin& getPlugin() const = 0;
 			virtual void update(float time_delta) = 0;
 			virtual bool ownComponentType(uint32_t type) const = 0;
@@ -0,0 +1,60 @@
+#include "core/crc32.h"
+#include "core/lua_wrapper.h"
+#include "engine.h"
+#include "iplugin.h"
+#include "universe/universe.h"
+#include "animation/animation_system.h"
+
+
+namespace Lumix
+{
+
+
+namespace LuaAPI
+{
+
+
+static void setAnimationGraphState(IScene* scene,
+	int component,
+	int state_machine,
+	int state,
+	float crossfade_time)
+{
+	static_cast<AnimationScene*>(scene)->setAnimationGraphState(
+		component, state_machine, state, crossfade_time);
+}
+
+
+static int getAnimationGraphState(IScene* scene, int component, int state_machine)
+{
+	return static_cast<AnimationScene*>(scene)->getAnimationGraphState(
+		component, state_machine);
+}
+
+
+} // namespace LuaAPI
+
+
+static void
+registerCFunction(lua_State* L, const char* name, lua_CFunction func)
+{
+	lua_pushcfunction(L, func);
+	lua_setglobal(L, name);
+}
+
+
+void registerAnimationLuaAPI(Engine& engine, Universe& universe, lua_State* L)
+{
+	registerCFunction(L,
+					  "API_setAnimationGraphState",
+					  LuaWrapper::wrap<decltype(&LuaAPI::setAnimationGraphState),
+									   LuaAPI::setAnimationGraphState>);
+
+	registerCFunction(L,
+					  "API_getAnimationGraphState",
+					  LuaWrapper::wrap<decltype(&LuaAPI::getAnimationGraphState),
+									   LuaAPI::getAnimationGraphState>);
+}
+
+
+} // namespace Lumix
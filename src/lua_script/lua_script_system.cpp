@@ -35,6 +35,7 @@ class LuaScriptSystemImpl;
 
 void registerEngineLuaAPI(Engine&, UniverseContext&, lua_State* L);
 void registerPhysicsLuaAPI(Engine&, Universe&, lua_State* L);
+void registerAnimationLuaAPI(Engine&, Universe&, lua_State* L);
 
 
 static const uint32_t LUA_SCRIPT_HASH = crc32("lua_script");
@@ -132,6 +133,10 @@ public:
 		{
 			registerPhysicsLuaAPI(m_system.m_engine, *m_universe_context.m_universe, L);
 		}
+		if (m_system.m_engine.getPluginManager().getPlugin("animation"))
+		{
+			registerAnimationLuaAPI(m_system.m_engine, *m_universe_context.m_universe, L);
+		}
 	}
 
 
@@ -316,7 +321,7 @@ public:
 	}
 
 
-	virtual void deserialize(InputBlob& serializer) override
+	virtual void deserialize(InputBlob& serializer, int) override
 	{
 		int len = serializer.read<int>();
 		unloadAllScripts();
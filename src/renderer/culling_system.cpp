@@ -5,18 +5,75 @@
 #include "core/binary_array.h"
 #include "core/free_list.h"
 #include "core/frustum.h"
+#include "core/math_utils.h"
 #include "core/sphere.h"
 
 #include "core/mtjd/group.h"
 #include "core/mtjd/manager.h"
 #include "core/mtjd/job.h"
 
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+
 namespace Lumix
 {
 	typedef BinaryArray VisibilityFlags;
 	typedef Array<int64_t> LayerMasks;
 
 	static const int MIN_ENTITIES_PER_THREAD = 50;
+	static const int MAX_SPHERES_PER_RAY_NODE = 4;
+	// deeper nodes are split in the middle of the index range, so the depth
+	// and the traversal stack are bounded
+	static const int MAX_RAY_NODE_SPLIT_DEPTH = 32;
+	static const int MAX_RAY_STACK_SIZE = 64;
+	// refitted tree is rebuilt when its root grows this much
+	static const float RAY_TREE_REBUILD_AREA_RATIO = 2.0f;
+
+
+	struct RayNode
+	{
+		Vec3 m_min;
+		Vec3 m_max;
+		// leaves: range in the index array, inner nodes: m_count is 0,
+		// m_first is the right child, the left child is the next node
+		int m_first;
+		int m_count;
+	};
+
+
+	static float getHalfArea(const RayNode& node)
+	{
+		Vec3 size = node.m_max - node.m_min;
+		return size.x * size.y + size.y * size.z + size.z * size.x;
+	}
+
+
+	static bool getRayAABBDistance(const Vec3& origin,
+		const Vec3& inv_dir,
+		const Vec3& min,
+		const Vec3& max,
+		float max_t)
+	{
+		float t_min = 0;
+		float t_max = max_t;
+		for (int i = 0; i < 3; ++i)
+		{
+			float t0 = ((&min.x)[i] - (&origin.x)[i]) * (&inv_dir.x)[i];
+			float t1 = ((&max.x)[i] - (&origin.x)[i]) * (&inv_dir.x)[i];
+			t_min = Math::maxValue(t_min, Math::minValue(t0, t1));
+			t_max = Math::minValue(t_max, Math::maxValue(t0, t1));
+		}
+		return t_min <= t_max;
+	}
+
+
+	static int compareRayHits(const void* a, const void* b)
+	{
+		float t_a = static_cast<const CullingSystem::RayHit*>(a)->m_t;
+		float t_b = static_cast<const CullingSystem::RayHit*>(b)->m_t;
+		return t_a < t_b ? -1 : (t_a > t_b ? 1 : 0);
+	}
 
 	static void doCulling(
 		int start_index,
@@ -98,6 +155,11 @@ namespace Lumix
 			, m_sync_point(true, allocator)
 			, m_mtjd_manager(mtjd_manager)
 			, m_layer_masks(m_allocator)
+			, m_ray_nodes(m_allocator)
+			, m_ray_indices(m_allocator)
+			, m_is_ray_tree_dirty(true)
+			, m_is_ray_tree_moved(false)
+			, m_ray_tree_area(0)
 		{
 			m_result.emplace(m_allocator);
 			int cpu_count = (int)m_mtjd_manager.getCpuThreadsCount();
@@ -119,6 +181,7 @@ namespace Lumix
 			m_spheres.clear();
 			m_visibility_flags.clear();
 			m_layer_masks.clear();
+			m_is_ray_tree_dirty = true;
 		}
 
 
@@ -224,6 +287,7 @@ namespace Lumix
 			m_spheres.push(sphere);
 			m_visibility_flags.push(true);
 			m_layer_masks.push(1);
+			m_is_ray_tree_dirty = true;
 		}
 
 
@@ -234,18 +298,21 @@ namespace Lumix
 			m_spheres.erase(index);
 			m_visibility_flags.erase(index);
 			m_layer_masks.erase(index);
+			m_is_ray_tree_dirty = true;
 		}
 
 
 		virtual void updateBoundingRadius(float radius, int index) override
 		{
 			m_spheres[index].m_radius = radius;
+			m_is_ray_tree_moved = true;
 		}
 
 
 		virtual void updateBoundingPosition(const Vec3& position, int index) override
 		{
 			m_spheres[index].m_position = position;
+			m_is_ray_tree_moved = true;
 		}
 
 
@@ -257,6 +324,7 @@ namespace Lumix
 				m_visibility_flags.push(true);
 				m_layer_masks.push(1);
 			}
+			m_is_ray_tree_dirty = true;
 		}
 
 
@@ -266,6 +334,204 @@ namespace Lumix
 		}
 
 
+		virtual void prepareRayCasts() override
+		{
+			if (!m_is_ray_tree_dirty && m_is_ray_tree_moved)
+			{
+				refitRayTree();
+				m_is_ray_tree_moved = false;
+				if (m_ray_nodes.empty() ||
+					getHalfArea(m_ray_nodes[0]) >
+						m_ray_tree_area * RAY_TREE_REBUILD_AREA_RATIO)
+				{
+					m_is_ray_tree_dirty = true;
+				}
+			}
+			if (!m_is_ray_tree_dirty)
+			{
+				return;
+			}
+
+			m_ray_nodes.clear();
+			m_ray_indices.resize(m_spheres.size());
+			for (int i = 0; i < m_spheres.size(); ++i)
+			{
+				m_ray_indices[i] = i;
+			}
+			if (!m_spheres.empty())
+			{
+				buildRayNode(0, m_spheres.size(), 0);
+			}
+			m_ray_tree_area =
+				m_ray_nodes.empty() ? 0 : getHalfArea(m_ray_nodes[0]);
+			m_is_ray_tree_dirty = false;
+			m_is_ray_tree_moved = false;
+		}
+
+
+		virtual void castRay(const Vec3& origin,
+			const Vec3& dir,
+			float max_t,
+			RayHits& hits) const override
+		{
+			ASSERT(!m_is_ray_tree_dirty && !m_is_ray_tree_moved);
+			hits.clear();
+			if (m_ray_nodes.empty())
+			{
+				return;
+			}
+
+			Vec3 inv_dir;
+			for (int i = 0; i < 3; ++i)
+			{
+				float d = (&dir.x)[i];
+				// avoid 0 * inf in the slab test
+				(&inv_dir.x)[i] =
+					1 / (fabs(d) < 1e-20f ? (d < 0 ? -1e-20f : 1e-20f) : d);
+			}
+			float a = dotProduct(dir, dir);
+			if (a == 0)
+			{
+				return;
+			}
+
+			int stack[MAX_RAY_STACK_SIZE];
+			int stack_size = 1;
+			stack[0] = 0;
+			while (stack_size > 0)
+			{
+				const RayNode& node = m_ray_nodes[stack[--stack_size]];
+				if (!getRayAABBDistance(
+						origin, inv_dir, node.m_min, node.m_max, max_t))
+				{
+					continue;
+				}
+				if (node.m_count == 0)
+				{
+					stack[stack_size++] = node.m_first;
+					stack[stack_size++] = int(&node - &m_ray_nodes[0]) + 1;
+					continue;
+				}
+				for (int i = node.m_first; i < node.m_first + node.m_count; ++i)
+				{
+					int index = m_ray_indices[i];
+					const Sphere& sphere = m_spheres[index];
+					Vec3 rel_origin = origin - sphere.m_position;
+					float b = dotProduct(rel_origin, dir);
+					float c = dotProduct(rel_origin, rel_origin) -
+							  sphere.m_radius * sphere.m_radius;
+					float t = 0;
+					if (c > 0)
+					{
+						float discriminant = b * b - a * c;
+						if (b > 0 || discriminant < 0)
+						{
+							continue;
+						}
+						t = (-b - sqrt(discriminant)) / a;
+					}
+					if (t <= max_t)
+					{
+						RayHit& hit = hits.pushEmpty();
+						hit.m_index = index;
+						hit.m_t = t;
+					}
+				}
+			}
+			if (hits.size() > 1)
+			{
+				qsort(&hits[0], hits.size(), sizeof(hits[0]), compareRayHits);
+			}
+		}
+
+
+	private:
+		void computeRayNodeBounds(RayNode& node) const
+		{
+			node.m_min.set(FLT_MAX, FLT_MAX, FLT_MAX);
+			node.m_max.set(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+			for (int i = node.m_first; i < node.m_first + node.m_count; ++i)
+			{
+				const Sphere& sphere = m_spheres[m_ray_indices[i]];
+				Vec3 radius(sphere.m_radius, sphere.m_radius, sphere.m_radius);
+				Vec3 min = sphere.m_position - radius;
+				Vec3 max = sphere.m_position + radius;
+				node.m_min.set(Math::minValue(node.m_min.x, min.x),
+					Math::minValue(node.m_min.y, min.y),
+					Math::minValue(node.m_min.z, min.z));
+				node.m_max.set(Math::maxValue(node.m_max.x, max.x),
+					Math::maxValue(node.m_max.y, max.y),
+					Math::maxValue(node.m_max.z, max.z));
+			}
+		}
+
+
+		void buildRayNode(int first, int count, int depth)
+		{
+			int node_index = m_ray_nodes.size();
+			RayNode& node = m_ray_nodes.pushEmpty();
+			node.m_first = first;
+			node.m_count = count;
+			computeRayNodeBounds(node);
+			if (count <= MAX_SPHERES_PER_RAY_NODE)
+			{
+				return;
+			}
+
+			// split in the middle of the longest axis
+			int left_count = 0;
+			if (depth < MAX_RAY_NODE_SPLIT_DEPTH)
+			{
+				Vec3 size = node.m_max - node.m_min;
+				int axis = size.x > size.y ? (size.x > size.z ? 0 : 2)
+										   : (size.y > size.z ? 1 : 2);
+				float middle =
+					((&node.m_min.x)[axis] + (&node.m_max.x)[axis]) * 0.5f;
+				for (int i = first; i < first + count; ++i)
+				{
+					int index = m_ray_indices[i];
+					if ((&m_spheres[index].m_position.x)[axis] < middle)
+					{
+						m_ray_indices[i] = m_ray_indices[first + left_count];
+						m_ray_indices[first + left_count] = index;
+						++left_count;
+					}
+				}
+			}
+			if (left_count == 0 || left_count == count)
+			{
+				left_count = count / 2;
+			}
+
+			m_ray_nodes[node_index].m_count = 0;
+			buildRayNode(first, left_count, depth + 1);
+			m_ray_nodes[node_index].m_first = m_ray_nodes.size();
+			buildRayNode(first + left_count, count - left_count, depth + 1);
+		}
+
+
+		// children follow their parent, so nodes are refitted in reverse
+		void refitRayTree()
+		{
+			for (int i = m_ray_nodes.size() - 1; i >= 0; --i)
+			{
+				RayNode& node = m_ray_nodes[i];
+				if (node.m_count > 0)
+				{
+					computeRayNodeBounds(node);
+					continue;
+				}
+				const RayNode& left = m_ray_nodes[i + 1];
+				const RayNode& right = m_ray_nodes[node.m_first];
+				node.m_min.set(Math::minValue(left.m_min.x, right.m_min.x),
+					Math::minValue(left.m_min.y, right.m_min.y),
+					Math::minValue(left.m_min.z, right.m_min.z));
+				node.m_max.set(Math::maxValue(left.m_max.x, right.m_max.x),
+					Math::maxValue(left.m_max.y, right.m_max.y),
+					Math::maxValue(left.m_max.z, right.m_max.z));
+			}
+		}
+
 	private:
 		IAllocator&		m_allocator;
 		FreeList<CullingJob, 8> m_job_allocator;
@@ -277,6 +543,13 @@ namespace Lumix
 		MTJD::Manager& m_mtjd_manager;
 		MTJD::Group m_sync_point;
 		bool m_is_async_result;
+
+		// bounding volume hierarchy of the spheres for castRay()
+		Array<RayNode> m_ray_nodes;
+		Array<int> m_ray_indices;
+		bool m_is_ray_tree_dirty;
+		bool m_is_ray_tree_moved;
+		float m_ray_tree_area;
 	};
 
 
@@ -18,6 +18,15 @@ namespace Lumix
 		typedef Array<int> Subresults;
 		typedef Array<Subresults> Results;
 
+		struct RayHit
+		{
+			int m_index;
+			// entry point in units of the ray direction, 0 if the ray starts
+			// inside the sphere
+			float m_t;
+		};
+		typedef Array<RayHit> RayHits;
+
 		CullingSystem() { }
 		virtual ~CullingSystem() { }
 
@@ -42,6 +51,16 @@ namespace Lumix
 		virtual void updateBoundingRadius(float radius, int index) = 0;
 		virtual void updateBoundingPosition(const Vec3& position, int index) = 0;
 
+		// rebuilds or refits the tree used by castRay() after spheres
+		// changed, castRay() can be called from worker threads afterwards
+		virtual void prepareRayCasts() = 0;
+		// all spheres hit closer than max_t sorted by the distance, visibility
+		// flags and layers are ignored
+		virtual void castRay(const Vec3& origin,
+			const Vec3& dir,
+			float max_t,
+			RayHits& hits) const = 0;
+
 		virtual void insert(const InputSpheres& spheres) = 0;
 		virtual const InputSpheres& getSpheres() = 0;
 	};
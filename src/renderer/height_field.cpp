@@ -0,0 +1,266 @@
+#include "renderer/height_field.h"
+#include "core/simd.h"
+#include <cmath>
+
+
+namespace Lumix
+{
+
+
+// the four samples around a point and the position of the point in the cell
+struct Cell
+{
+	float m_h00;
+	float m_h10;
+	float m_h01;
+	float m_h11;
+	float m_dec_x;
+	float m_dec_z;
+};
+
+
+static void getCell(const float* heights,
+	int width,
+	int height,
+	float x,
+	float z,
+	float xz_scale,
+	Cell& cell)
+{
+	x = Math::clamp(x / xz_scale, 0.0f, (float)(width - 1));
+	z = Math::clamp(z / xz_scale, 0.0f, (float)(height - 1));
+	int int_x = (int)x;
+	int int_z = (int)z;
+	int next_x = Math::minValue(int_x + 1, width - 1);
+	int next_z = Math::minValue(int_z + 1, height - 1);
+	const float* row = heights + int_z * width;
+	const float* next_row = heights + next_z * width;
+	cell.m_h00 = row[int_x];
+	cell.m_h10 = row[next_x];
+	cell.m_h01 = next_row[int_x];
+	cell.m_h11 = next_row[next_x];
+	cell.m_dec_x = x - int_x;
+	cell.m_dec_z = z - int_z;
+}
+
+
+static float decodeHeight(const uint8_t* data, int bytes_per_pixel, int index)
+{
+	if (bytes_per_pixel == 2)
+	{
+		return ((const uint16_t*)data)[index] / 65535.0f;
+	}
+	ASSERT(bytes_per_pixel == 4);
+	return data[index * 4] / 255.0f;
+}
+
+
+HeightField::HeightField(IAllocator& allocator)
+	: m_heights(allocator)
+	, m_width(0)
+	, m_height(0)
+{
+}
+
+
+void HeightField::clear()
+{
+	m_heights.clear();
+	m_width = m_height = 0;
+}
+
+
+void HeightField::create(const uint8_t* data,
+	int width,
+	int height,
+	int bytes_per_pixel)
+{
+	m_width = width;
+	m_height = height;
+	m_heights.resize(width * height);
+	update(data, bytes_per_pixel, 0, 0, width, height);
+}
+
+
+void HeightField::update(const uint8_t* data,
+	int bytes_per_pixel,
+	int x,
+	int z,
+	int width,
+	int height)
+{
+	int from_x = Math::maxValue(x, 0);
+	int from_z = Math::maxValue(z, 0);
+	int to_x = Math::minValue(x + width, m_width);
+	int to_z = Math::minValue(z + height, m_height);
+	for (int j = from_z; j < to_z; ++j)
+	{
+		for (int i = from_x; i < to_x; ++i)
+		{
+			int index = i + j * m_width;
+			m_heights[index] = decodeHeight(data, bytes_per_pixel, index);
+		}
+	}
+}
+
+
+float HeightField::getHeight(float x, float z, const Vec3& scale) const
+{
+	if (m_heights.empty())
+	{
+		return 0;
+	}
+	return getHeight(&m_heights[0], m_width, m_height, x, z, scale);
+}
+
+
+float HeightField::getHeight(const float* heights,
+	int width,
+	int height,
+	float x,
+	float z,
+	const Vec3& scale)
+{
+	Cell cell;
+	getCell(heights, width, height, x, z, scale.x, cell);
+	float h;
+	if (cell.m_dec_z < cell.m_dec_x)
+	{
+		h = cell.m_h00 + (cell.m_h10 - cell.m_h00) * cell.m_dec_x +
+			(cell.m_h11 - cell.m_h10) * cell.m_dec_z;
+	}
+	else
+	{
+		h = cell.m_h00 + (cell.m_h01 - cell.m_h00) * cell.m_dec_z +
+			(cell.m_h11 - cell.m_h01) * cell.m_dec_x;
+	}
+	return h * scale.y;
+}
+
+
+void HeightField::getHeights(const Vec2* points,
+	float* heights,
+	int count,
+	const Vec3& scale) const
+{
+	if (m_heights.empty())
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			heights[i] = 0;
+		}
+		return;
+	}
+
+	const float* samples = &m_heights[0];
+	float4 inv_xz_scale = f4Splat(1 / scale.x);
+	float4 y_scale = f4Splat(scale.y);
+	float4 zero = f4Zero();
+	float4 max_x = f4Splat((float)(m_width - 1));
+	float4 max_z = f4Splat((float)(m_height - 1));
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		// points are x, z pairs
+		float4 xz01 = f4LoadUnaligned(&points[i]);
+		float4 xz23 = f4LoadUnaligned(&points[i + 2]);
+		float4 x = f4Shuffle(xz01, xz23, 0, 2, 0, 2);
+		float4 z = f4Shuffle(xz01, xz23, 1, 3, 1, 3);
+		x = f4Min(f4Max(f4Mul(x, inv_xz_scale), zero), max_x);
+		z = f4Min(f4Max(f4Mul(z, inv_xz_scale), zero), max_z);
+		float4 int_x = f4Trunc(x);
+		float4 int_z = f4Trunc(z);
+		float4 dec_x = f4Sub(x, int_x);
+		float4 dec_z = f4Sub(z, int_z);
+
+		// the samples are gathered one lane at a time
+		float cell_x[4];
+		float cell_z[4];
+		float h00[4];
+		float h10[4];
+		float h01[4];
+		float h11[4];
+		f4StoreUnaligned(cell_x, int_x);
+		f4StoreUnaligned(cell_z, int_z);
+		for (int k = 0; k < 4; ++k)
+		{
+			int sx = (int)cell_x[k];
+			int sz = (int)cell_z[k];
+			int next_x = sx < m_width - 1 ? sx + 1 : sx;
+			int next_z = sz < m_height - 1 ? sz + 1 : sz;
+			const float* row = samples + sz * m_width;
+			const float* next_row = samples + next_z * m_width;
+			h00[k] = row[sx];
+			h10[k] = row[next_x];
+			h01[k] = next_row[sx];
+			h11[k] = next_row[next_x];
+		}
+		float4 v00 = f4LoadUnaligned(h00);
+		float4 v10 = f4LoadUnaligned(h10);
+		float4 v01 = f4LoadUnaligned(h01);
+		float4 v11 = f4LoadUnaligned(h11);
+
+		float4 lower = f4Add(v00,
+			f4Add(f4Mul(f4Sub(v10, v00), dec_x), f4Mul(f4Sub(v11, v10), dec_z)));
+		float4 upper = f4Add(v00,
+			f4Add(f4Mul(f4Sub(v01, v00), dec_z), f4Mul(f4Sub(v11, v01), dec_x)));
+		float4 h = f4Select(f4CmpLT(dec_z, dec_x), lower, upper);
+		f4StoreUnaligned(heights + i, f4Mul(h, y_scale));
+	}
+	for (; i < count; ++i)
+	{
+		heights[i] = getHeight(points[i].x, points[i].y, scale);
+	}
+}
+
+
+Vec3 HeightField::getNormal(float x, float z, const Vec3& scale) const
+{
+	if (m_heights.empty())
+	{
+		return Vec3(0, 1, 0);
+	}
+	return getNormal(&m_heights[0], m_width, m_height, x, z, scale);
+}
+
+
+Vec3 HeightField::getNormal(const float* heights,
+	int width,
+	int height,
+	float x,
+	float z,
+	const Vec3& scale)
+{
+	Cell cell;
+	getCell(heights, width, height, x, z, scale.x, cell);
+	float dx, dz;
+	if (cell.m_dec_z < cell.m_dec_x)
+	{
+		dx = cell.m_h10 - cell.m_h00;
+		dz = cell.m_h11 - cell.m_h10;
+	}
+	else
+	{
+		dx = cell.m_h11 - cell.m_h01;
+		dz = cell.m_h01 - cell.m_h00;
+	}
+	float slope_scale = scale.y / scale.x;
+	Vec3 normal(-dx * slope_scale, 1, -dz * slope_scale);
+	normal.normalize();
+	return normal;
+}
+
+
+void HeightField::getNormals(const Vec2* points,
+	Vec3* normals,
+	int count,
+	const Vec3& scale) const
+{
+	for (int i = 0; i < count; ++i)
+	{
+		normals[i] = getNormal(points[i].x, points[i].y, scale);
+	}
+}
+
+
+} // ~namespace Lumix
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "lumix.h"
+#include "core/array.h"
+#include "core/math_utils.h"
+#include "core/vec2.h"
+#include "core/vec3.h"
+
+namespace Lumix
+{
+
+
+// terrain heightmap decoded once to normalized floats; queries are in
+// terrain local space, scale is the terrain scale, and heights are
+// interpolated over the same two triangles per cell the terrain ray cast
+// uses
+class LUMIX_RENDERER_API HeightField
+{
+public:
+	HeightField(IAllocator& allocator);
+
+	void clear();
+	// 2 bytes per pixel are 16 bit heights, 4 bytes per pixel use the first
+	// channel
+	void create(const uint8_t* data, int width, int height, int bytes_per_pixel);
+	// decodes a rectangle of the source data again after it has been edited
+	void update(const uint8_t* data,
+		int bytes_per_pixel,
+		int x,
+		int z,
+		int width,
+		int height);
+	bool isEmpty() const { return m_heights.empty(); }
+
+	// normalized height, coordinates are clamped to the field
+	float getSample(int x, int z) const
+	{
+		x = Math::clamp(x, 0, m_width - 1);
+		z = Math::clamp(z, 0, m_height - 1);
+		return m_heights[x + z * m_width];
+	}
+	float getHeight(float x, float z, const Vec3& scale) const;
+	// four points at a time with SSE
+	void getHeights(const Vec2* points,
+		float* heights,
+		int count,
+		const Vec3& scale) const;
+	// normal of the triangle under the point
+	Vec3 getNormal(float x, float z, const Vec3& scale) const;
+	void getNormals(const Vec2* points,
+		Vec3* normals,
+		int count,
+		const Vec3& scale) const;
+
+	// the same queries for any row by row array of normalized heights, e.g.
+	// a terrain tile
+	static float getHeight(const float* heights,
+		int width,
+		int height,
+		float x,
+		float z,
+		const Vec3& scale);
+	static Vec3 getNormal(const float* heights,
+		int width,
+		int height,
+		float x,
+		float z,
+		const Vec3& scale);
+
+private:
+	Array<float> m_heights;
+	int m_width;
+	int m_height;
+};
+
+
+} // ~namespace Lumix
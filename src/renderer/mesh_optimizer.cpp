@@ -0,0 +1,960 @@
+#include "renderer/mesh_optimizer.h"
+#include "core/array.h"
+#include "core/math_utils.h"
+#include "core/vec3.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+
+namespace Lumix
+{
+
+
+namespace MeshOptimizer
+{
+
+
+// constants from Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+static const int MAX_CACHE_SIZE = 32;
+static const float CACHE_DECAY_POWER = 1.5f;
+static const float LAST_TRIANGLE_SCORE = 0.75f;
+static const float VALENCE_BOOST_SCALE = 2.0f;
+static const float VALENCE_BOOST_POWER = -0.5f;
+
+
+static float getVertexScore(int cache_position, int live_triangles)
+{
+	if (live_triangles == 0)
+	{
+		return -1.0f;
+	}
+
+	float score = 0;
+	if (cache_position >= 0)
+	{
+		if (cache_position < 3)
+		{
+			// vertices of the last triangle, fixed score so the next triangle
+			// does not just continue a strip
+			score = LAST_TRIANGLE_SCORE;
+		}
+		else
+		{
+			const float scaler = 1.0f / (MAX_CACHE_SIZE - 3);
+			score = powf(
+				1.0f - (cache_position - 3) * scaler, CACHE_DECAY_POWER);
+		}
+	}
+	// prefer vertices with few triangles left, so they are not left behind
+	score += VALENCE_BOOST_SCALE *
+			 powf((float)live_triangles, VALENCE_BOOST_POWER);
+	return score;
+}
+
+
+float computeACMR(const uint32_t* indices,
+	int index_count,
+	int vertex_count,
+	int cache_size,
+	IAllocator& allocator)
+{
+	int triangle_count = index_count / 3;
+	if (triangle_count == 0)
+	{
+		return 0;
+	}
+
+	// vertex is in the FIFO cache if it was inserted during the last
+	// cache_size misses
+	Array<int> timestamps(allocator);
+	timestamps.resize(vertex_count);
+	memset(&timestamps[0], 0, sizeof(timestamps[0]) * vertex_count);
+	int time = cache_size + 1;
+	int misses = 0;
+	for (int i = 0; i < index_count; ++i)
+	{
+		uint32_t v = indices[i];
+		if (time - timestamps[v] > cache_size)
+		{
+			timestamps[v] = time;
+			++time;
+			++misses;
+		}
+	}
+	return misses / (float)triangle_count;
+}
+
+
+void optimizeVertexCache(uint32_t* indices,
+	int index_count,
+	int vertex_count,
+	IAllocator& allocator)
+{
+	int triangle_count = index_count / 3;
+	if (triangle_count == 0)
+	{
+		return;
+	}
+
+	// triangles of each vertex, emitted triangles are removed
+	Array<int> live_triangles(allocator);
+	Array<int> adjacency_offsets(allocator);
+	Array<int> adjacency(allocator);
+	live_triangles.resize(vertex_count);
+	adjacency_offsets.resize(vertex_count);
+	adjacency.resize(triangle_count * 3);
+	memset(&live_triangles[0], 0, sizeof(live_triangles[0]) * vertex_count);
+	for (int i = 0; i < triangle_count * 3; ++i)
+	{
+		++live_triangles[indices[i]];
+	}
+	int offset = 0;
+	for (int i = 0; i < vertex_count; ++i)
+	{
+		adjacency_offsets[i] = offset;
+		offset += live_triangles[i];
+		live_triangles[i] = 0;
+	}
+	for (int i = 0; i < triangle_count * 3; ++i)
+	{
+		uint32_t v = indices[i];
+		adjacency[adjacency_offsets[v] + live_triangles[v]] = i / 3;
+		++live_triangles[v];
+	}
+
+	Array<float> vertex_scores(allocator);
+	Array<int> cache_positions(allocator);
+	Array<uint8_t> emitted(allocator);
+	Array<uint32_t> output(allocator);
+	vertex_scores.resize(vertex_count);
+	cache_positions.resize(vertex_count);
+	emitted.resize(triangle_count);
+	output.resize(triangle_count * 3);
+	for (int i = 0; i < vertex_count; ++i)
+	{
+		cache_positions[i] = -1;
+		vertex_scores[i] = getVertexScore(-1, live_triangles[i]);
+	}
+	memset(&emitted[0], 0, triangle_count);
+
+	uint32_t cache[MAX_CACHE_SIZE + 3];
+	int cache_size = 0;
+	int best_triangle = -1;
+	int first_not_emitted = 0;
+	for (int out_triangle = 0; out_triangle < triangle_count; ++out_triangle)
+	{
+		if (best_triangle < 0)
+		{
+			// nothing adjacent to the cache, continue with any triangle
+			while (emitted[first_not_emitted])
+			{
+				++first_not_emitted;
+			}
+			best_triangle = first_not_emitted;
+		}
+
+		emitted[best_triangle] = 1;
+		const uint32_t* triangle = &indices[best_triangle * 3];
+		uint32_t new_cache[MAX_CACHE_SIZE + 3];
+		int new_cache_size = 0;
+		for (int i = 0; i < 3; ++i)
+		{
+			uint32_t v = triangle[i];
+			output[out_triangle * 3 + i] = v;
+			if (i == 0 || (v != triangle[0] && (i == 1 || v != triangle[1])))
+			{
+				new_cache[new_cache_size++] = v;
+			}
+
+			int* triangles = &adjacency[adjacency_offsets[v]];
+			int count = live_triangles[v];
+			for (int j = 0; j < count; ++j)
+			{
+				if (triangles[j] == best_triangle)
+				{
+					triangles[j] = triangles[count - 1];
+					break;
+				}
+			}
+			--live_triangles[v];
+		}
+
+		for (int i = 0; i < cache_size; ++i)
+		{
+			uint32_t v = cache[i];
+			if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+			{
+				new_cache[new_cache_size++] = v;
+			}
+		}
+		for (int i = MAX_CACHE_SIZE; i < new_cache_size; ++i)
+		{
+			uint32_t v = new_cache[i];
+			cache_positions[v] = -1;
+			vertex_scores[v] = getVertexScore(-1, live_triangles[v]);
+		}
+		cache_size = Math::minValue(new_cache_size, MAX_CACHE_SIZE);
+		for (int i = 0; i < cache_size; ++i)
+		{
+			uint32_t v = new_cache[i];
+			cache[i] = v;
+			cache_positions[v] = i;
+			vertex_scores[v] = getVertexScore(i, live_triangles[v]);
+		}
+
+		// only triangles using cached vertices changed their score
+		best_triangle = -1;
+		float best_score = -1;
+		for (int i = 0; i < cache_size; ++i)
+		{
+			uint32_t v = cache[i];
+			const int* triangles = &adjacency[adjacency_offsets[v]];
+			for (int j = 0, c = live_triangles[v]; j < c; ++j)
+			{
+				const uint32_t* t = &indices[triangles[j] * 3];
+				float score = vertex_scores[t[0]] + vertex_scores[t[1]] +
+							  vertex_scores[t[2]];
+				if (score > best_score)
+				{
+					best_score = score;
+					best_triangle = triangles[j];
+				}
+			}
+		}
+	}
+
+	memcpy(indices, &output[0], sizeof(indices[0]) * triangle_count * 3);
+}
+
+
+struct Cluster
+{
+	int m_first_triangle;
+	int m_triangle_count;
+	float m_sort_key;
+};
+
+
+static int compareClusters(const void* a, const void* b)
+{
+	float key_a = static_cast<const Cluster*>(a)->m_sort_key;
+	float key_b = static_cast<const Cluster*>(b)->m_sort_key;
+	if (key_a != key_b)
+	{
+		return key_a > key_b ? -1 : 1;
+	}
+	// keep the order stable
+	return static_cast<const Cluster*>(a)->m_first_triangle -
+		   static_cast<const Cluster*>(b)->m_first_triangle;
+}
+
+
+// Sander et al., "Fast Triangle Reordering for Vertex Locality and Reduced
+// Overdraw"
+void optimizeOverdraw(uint32_t* indices,
+	int index_count,
+	const Vec3* positions,
+	int vertex_count,
+	float threshold,
+	IAllocator& allocator)
+{
+	int triangle_count = index_count / 3;
+	if (triangle_count < 2)
+	{
+		return;
+	}
+
+	// split at triangles which do not share any vertex with the cache,
+	// but only if the cluster so far is not worse than the whole mesh
+	float max_acmr = threshold * computeACMR(indices,
+									 index_count,
+									 vertex_count,
+									 DEFAULT_CACHE_SIZE,
+									 allocator);
+	Array<Cluster> clusters(allocator);
+	Array<int> timestamps(allocator);
+	timestamps.resize(vertex_count);
+	memset(&timestamps[0], 0, sizeof(timestamps[0]) * vertex_count);
+	int time = DEFAULT_CACHE_SIZE + 1;
+	int cluster_misses = 0;
+	int cluster_start = 0;
+	for (int i = 0; i < triangle_count; ++i)
+	{
+		int misses = 0;
+		for (int j = 0; j < 3; ++j)
+		{
+			uint32_t v = indices[i * 3 + j];
+			if (time - timestamps[v] > DEFAULT_CACHE_SIZE)
+			{
+				timestamps[v] = time;
+				++time;
+				++misses;
+			}
+		}
+		if (misses == 3 && i > cluster_start &&
+			cluster_misses <= max_acmr * (i - cluster_start))
+		{
+			Cluster& cluster = clusters.pushEmpty();
+			cluster.m_first_triangle = cluster_start;
+			cluster.m_triangle_count = i - cluster_start;
+			cluster_start = i;
+			cluster_misses = 0;
+		}
+		cluster_misses += misses;
+	}
+	Cluster& last_cluster = clusters.pushEmpty();
+	last_cluster.m_first_triangle = cluster_start;
+	last_cluster.m_triangle_count = triangle_count - cluster_start;
+	if (clusters.size() < 2)
+	{
+		return;
+	}
+
+	// clusters facing away from the center are more likely to occlude others,
+	// so they are drawn first
+	Vec3 mesh_center(0, 0, 0);
+	float mesh_area = 0;
+	for (int i = 0; i < triangle_count; ++i)
+	{
+		const Vec3& p0 = positions[indices[i * 3]];
+		const Vec3& p1 = positions[indices[i * 3 + 1]];
+		const Vec3& p2 = positions[indices[i * 3 + 2]];
+		float area = crossProduct(p1 - p0, p2 - p0).length();
+		mesh_center += (p0 + p1 + p2) * area;
+		mesh_area += area;
+	}
+	if (mesh_area == 0)
+	{
+		return;
+	}
+	mesh_center *= 1.0f / (mesh_area * 3);
+
+	for (int i = 0; i < clusters.size(); ++i)
+	{
+		Cluster& cluster = clusters[i];
+		Vec3 center(0, 0, 0);
+		Vec3 normal(0, 0, 0);
+		float area = 0;
+		int end = cluster.m_first_triangle + cluster.m_triangle_count;
+		for (int j = cluster.m_first_triangle; j < end; ++j)
+		{
+			const Vec3& p0 = positions[indices[j * 3]];
+			const Vec3& p1 = positions[indices[j * 3 + 1]];
+			const Vec3& p2 = positions[indices[j * 3 + 2]];
+			Vec3 triangle_normal = crossProduct(p1 - p0, p2 - p0);
+			float triangle_area = triangle_normal.length();
+			center += (p0 + p1 + p2) * triangle_area;
+			normal += triangle_normal;
+			area += triangle_area;
+		}
+		float normal_length = normal.length();
+		if (area == 0 || normal_length == 0)
+		{
+			cluster.m_sort_key = 0;
+			continue;
+		}
+		center *= 1.0f / (area * 3);
+		cluster.m_sort_key =
+			dotProduct(center - mesh_center, normal) / normal_length;
+	}
+
+	qsort(&clusters[0], clusters.size(), sizeof(Cluster), compareClusters);
+
+	Array<uint32_t> output(allocator);
+	output.resize(triangle_count * 3);
+	int out_index = 0;
+	for (int i = 0; i < clusters.size(); ++i)
+	{
+		int count = clusters[i].m_triangle_count * 3;
+		memcpy(&output[out_index],
+			&indices[clusters[i].m_first_triangle * 3],
+			sizeof(indices[0]) * count);
+		out_index += count;
+	}
+	memcpy(indices, &output[0], sizeof(indices[0]) * triangle_count * 3);
+}
+
+
+// symmetric matrix A, vector b and scalar c of the quadric error
+// p^T A p + 2 b.p + c, i.e. the sum of weighted squared distances to planes
+struct Quadric
+{
+	void addPlane(const Vec3& normal, float d, float weight)
+	{
+		a00 += weight * normal.x * normal.x;
+		a01 += weight * normal.x * normal.y;
+		a02 += weight * normal.x * normal.z;
+		a11 += weight * normal.y * normal.y;
+		a12 += weight * normal.y * normal.z;
+		a22 += weight * normal.z * normal.z;
+		b0 += weight * normal.x * d;
+		b1 += weight * normal.y * d;
+		b2 += weight * normal.z * d;
+		c += weight * d * d;
+	}
+
+	void add(const Quadric& rhs)
+	{
+		a00 += rhs.a00;
+		a01 += rhs.a01;
+		a02 += rhs.a02;
+		a11 += rhs.a11;
+		a12 += rhs.a12;
+		a22 += rhs.a22;
+		b0 += rhs.b0;
+		b1 += rhs.b1;
+		b2 += rhs.b2;
+		c += rhs.c;
+	}
+
+	double getError(const Vec3& p) const
+	{
+		double x = p.x, y = p.y, z = p.z;
+		double error = a00 * x * x + a11 * y * y + a22 * z * z +
+					   2 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+					   2 * (b0 * x + b1 * y + b2 * z) + c;
+		return fabs(error);
+	}
+
+	double a00, a01, a02, a11, a12, a22;
+	double b0, b1, b2;
+	double c;
+};
+
+
+struct SortedPosition
+{
+	Vec3 m_position;
+	int m_vertex;
+};
+
+
+struct Collapse
+{
+	int m_from;
+	int m_to;
+	double m_error;
+};
+
+
+static int comparePositions(const void* a, const void* b)
+{
+	const SortedPosition* pa = static_cast<const SortedPosition*>(a);
+	const SortedPosition* pb = static_cast<const SortedPosition*>(b);
+	if (pa->m_position.x != pb->m_position.x)
+	{
+		return pa->m_position.x < pb->m_position.x ? -1 : 1;
+	}
+	if (pa->m_position.y != pb->m_position.y)
+	{
+		return pa->m_position.y < pb->m_position.y ? -1 : 1;
+	}
+	if (pa->m_position.z != pb->m_position.z)
+	{
+		return pa->m_position.z < pb->m_position.z ? -1 : 1;
+	}
+	return pa->m_vertex - pb->m_vertex;
+}
+
+
+static int compareCollapses(const void* a, const void* b)
+{
+	double error_a = static_cast<const Collapse*>(a)->m_error;
+	double error_b = static_cast<const Collapse*>(b)->m_error;
+	if (error_a != error_b)
+	{
+		return error_a < error_b ? -1 : 1;
+	}
+	return static_cast<const Collapse*>(a)->m_from -
+		   static_cast<const Collapse*>(b)->m_from;
+}
+
+
+// triangles of each position, vertices with the same position share the list
+struct PositionAdjacency
+{
+	PositionAdjacency(IAllocator& allocator)
+		: m_offsets(allocator)
+		, m_counts(allocator)
+		, m_triangles(allocator)
+	{
+	}
+
+	void build(const uint32_t* indices,
+		int index_count,
+		const int* position_ids,
+		int vertex_count)
+	{
+		m_offsets.resize(vertex_count);
+		m_counts.resize(vertex_count);
+		m_triangles.resize(index_count);
+		memset(&m_counts[0], 0, sizeof(m_counts[0]) * vertex_count);
+		for (int i = 0; i < index_count; ++i)
+		{
+			++m_counts[position_ids[indices[i]]];
+		}
+		int offset = 0;
+		for (int i = 0; i < vertex_count; ++i)
+		{
+			m_offsets[i] = offset;
+			offset += m_counts[i];
+			m_counts[i] = 0;
+		}
+		for (int i = 0; i < index_count; ++i)
+		{
+			int id = position_ids[indices[i]];
+			m_triangles[m_offsets[id] + m_counts[id]] = i / 3;
+			++m_counts[id];
+		}
+	}
+
+	Array<int> m_offsets;
+	Array<int> m_counts;
+	Array<int> m_triangles;
+};
+
+
+static bool hasEdge(const PositionAdjacency& adjacency,
+	const uint32_t* indices,
+	const int* position_ids,
+	int from,
+	int to)
+{
+	const int* triangles = &adjacency.m_triangles[adjacency.m_offsets[from]];
+	for (int i = 0, c = adjacency.m_counts[from]; i < c; ++i)
+	{
+		const uint32_t* t = &indices[triangles[i] * 3];
+		for (int k = 0; k < 3; ++k)
+		{
+			if (position_ids[t[k]] == from &&
+				position_ids[t[(k + 1) % 3]] == to)
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+
+// the same edge made of these very vertices, not only of their positions
+static bool hasVertexEdge(const PositionAdjacency& adjacency,
+	const uint32_t* indices,
+	const int* position_ids,
+	int from,
+	int to)
+{
+	int id = position_ids[from];
+	const int* triangles = &adjacency.m_triangles[adjacency.m_offsets[id]];
+	for (int i = 0, c = adjacency.m_counts[id]; i < c; ++i)
+	{
+		const uint32_t* t = &indices[triangles[i] * 3];
+		for (int k = 0; k < 3; ++k)
+		{
+			if ((int)t[k] == from && (int)t[(k + 1) % 3] == to)
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+
+// all vertices of the position of from move together, each to the vertex of
+// the position of to it shares a triangle with, so the attributes on both
+// sides of a seam stay apart; pairs are filled with from, to pairs; false if
+// a vertex has no such partner or more of them, i.e. the edge does not go
+// along the seam
+static bool getCollapsePairs(const PositionAdjacency& adjacency,
+	const uint32_t* indices,
+	const int* position_ids,
+	const int* next_at_position,
+	int from,
+	int to,
+	Array<int>& pairs)
+{
+	pairs.clear();
+	int from_id = position_ids[from];
+	int to_id = position_ids[to];
+	const int* triangles = &adjacency.m_triangles[adjacency.m_offsets[from_id]];
+	int triangle_count = adjacency.m_counts[from_id];
+	for (int v = from_id; v >= 0; v = next_at_position[v])
+	{
+		int partner = -1;
+		bool is_used = false;
+		for (int i = 0; i < triangle_count; ++i)
+		{
+			const uint32_t* t = &indices[triangles[i] * 3];
+			if ((int)t[0] != v && (int)t[1] != v && (int)t[2] != v)
+			{
+				continue;
+			}
+			is_used = true;
+			for (int k = 0; k < 3; ++k)
+			{
+				if (position_ids[t[k]] != to_id)
+				{
+					continue;
+				}
+				if (partner >= 0 && partner != (int)t[k])
+				{
+					return false;
+				}
+				partner = t[k];
+			}
+		}
+		// collapsed away in an earlier pass
+		if (!is_used)
+		{
+			continue;
+		}
+		if (partner < 0)
+		{
+			return false;
+		}
+		pairs.push(v);
+		pairs.push(partner);
+	}
+	return !pairs.empty();
+}
+
+
+// no triangle around the position from may flip when it is moved to the
+// position of to, from is a position id
+static bool isCollapseValid(const PositionAdjacency& adjacency,
+	const uint32_t* indices,
+	const int* position_ids,
+	const int* remap,
+	const Vec3* positions,
+	int from,
+	int to)
+{
+	const int* triangles = &adjacency.m_triangles[adjacency.m_offsets[from]];
+	for (int i = 0, c = adjacency.m_counts[from]; i < c; ++i)
+	{
+		const uint32_t* t = &indices[triangles[i] * 3];
+		if (position_ids[t[0]] == position_ids[to] ||
+			position_ids[t[1]] == position_ids[to] ||
+			position_ids[t[2]] == position_ids[to])
+		{
+			continue; // this triangle is removed by the collapse
+		}
+		Vec3 p[3];
+		Vec3 moved[3];
+		for (int k = 0; k < 3; ++k)
+		{
+			p[k] = positions[remap[t[k]]];
+			moved[k] = position_ids[t[k]] == from ? positions[to] : p[k];
+		}
+		Vec3 normal = crossProduct(p[1] - p[0], p[2] - p[0]);
+		Vec3 moved_normal =
+			crossProduct(moved[1] - moved[0], moved[2] - moved[0]);
+		if (dotProduct(normal, moved_normal) <= 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+
+int simplify(uint32_t* indices,
+	int index_count,
+	const Vec3* positions,
+	int vertex_count,
+	int target_index_count,
+	IAllocator& allocator)
+{
+	static const uint8_t BORDER = 1;
+	// border and seam planes are weighted more so the outline and the uv
+	// islands are kept
+	static const float BORDER_WEIGHT = 10.0f;
+	static const int MAX_PASSES = 100;
+
+	if (index_count <= target_index_count || vertex_count == 0)
+	{
+		return index_count;
+	}
+
+	// vertices with the same position are copies with different attributes,
+	// e.g. on uv seams, they are moved together; the position id is the
+	// first of them, the rest is linked by next_at_position
+	Array<int> position_ids(allocator);
+	Array<int> next_at_position(allocator);
+	Array<uint8_t> flags(allocator);
+	Array<SortedPosition> sorted(allocator);
+	position_ids.resize(vertex_count);
+	next_at_position.resize(vertex_count);
+	flags.resize(vertex_count);
+	sorted.resize(vertex_count);
+	memset(&flags[0], 0, vertex_count);
+	for (int i = 0; i < vertex_count; ++i)
+	{
+		sorted[i].m_position = positions[i];
+		sorted[i].m_vertex = i;
+	}
+	qsort(&sorted[0], vertex_count, sizeof(sorted[0]), comparePositions);
+	for (int i = 0; i < vertex_count; ++i)
+	{
+		int v = sorted[i].m_vertex;
+		position_ids[v] = v;
+		next_at_position[v] = -1;
+		if (i > 0 && sorted[i - 1].m_position.x == sorted[i].m_position.x &&
+			sorted[i - 1].m_position.y == sorted[i].m_position.y &&
+			sorted[i - 1].m_position.z == sorted[i].m_position.z)
+		{
+			int prev = sorted[i - 1].m_vertex;
+			position_ids[v] = position_ids[prev];
+			next_at_position[prev] = v;
+		}
+	}
+
+	Array<Quadric> quadrics(allocator);
+	quadrics.resize(vertex_count);
+	memset(&quadrics[0], 0, sizeof(quadrics[0]) * vertex_count);
+	for (int i = 0; i < index_count; i += 3)
+	{
+		const Vec3& p0 = positions[indices[i]];
+		Vec3 normal = crossProduct(
+			positions[indices[i + 1]] - p0, positions[indices[i + 2]] - p0);
+		float double_area = normal.length();
+		if (double_area == 0)
+		{
+			continue;
+		}
+		normal *= 1.0f / double_area;
+		for (int k = 0; k < 3; ++k)
+		{
+			quadrics[indices[i + k]].addPlane(
+				normal, -dotProduct(normal, p0), double_area * 0.5f);
+		}
+	}
+
+	PositionAdjacency adjacency(allocator);
+	Array<Collapse> collapses(allocator);
+	Array<int> pairs(allocator);
+	Array<int> remap(allocator);
+	Array<uint8_t> touched(allocator);
+	remap.resize(vertex_count);
+	touched.resize(vertex_count);
+	for (int pass = 0; pass < MAX_PASSES && index_count > target_index_count;
+		 ++pass)
+	{
+		adjacency.build(indices, index_count, &position_ids[0], vertex_count);
+
+		// collect collapses of both directions of every edge, a border edge
+		// does not have its reversed twin
+		for (int i = 0; i < vertex_count; ++i)
+		{
+			flags[i] &= ~BORDER;
+		}
+		collapses.clear();
+		for (int i = 0; i < index_count; ++i)
+		{
+			int v0 = indices[i];
+			int v1 = indices[i - i % 3 + (i + 1) % 3];
+			bool is_border = !hasEdge(adjacency,
+				indices,
+				&position_ids[0],
+				position_ids[v1],
+				position_ids[v0]);
+			if (is_border)
+			{
+				flags[v0] |= BORDER;
+				flags[v1] |= BORDER;
+			}
+			// the twin of a seam edge is made of the other copies
+			bool is_seam = !is_border &&
+						   !hasVertexEdge(adjacency, indices, &position_ids[0], v1, v0);
+			if ((is_border || is_seam) && pass == 0)
+			{
+				// plane through the edge, perpendicular to the triangle
+				const uint32_t* t = &indices[i - i % 3];
+				Vec3 edge = positions[v1] - positions[v0];
+				Vec3 normal = crossProduct(edge,
+					crossProduct(positions[t[1]] - positions[t[0]],
+						positions[t[2]] - positions[t[0]]));
+				float length = normal.length();
+				if (length > 0)
+				{
+					normal *= 1.0f / length;
+					float d = -dotProduct(normal, positions[v0]);
+					float weight = BORDER_WEIGHT * edge.squaredLength();
+					quadrics[v0].addPlane(normal, d, weight);
+					quadrics[v1].addPlane(normal, d, weight);
+				}
+			}
+		}
+		for (int i = 0; i < index_count; ++i)
+		{
+			int v0 = indices[i];
+			int v1 = indices[i - i % 3 + (i + 1) % 3];
+			if (position_ids[v0] == position_ids[v1])
+			{
+				continue;
+			}
+			bool is_border = !hasEdge(adjacency,
+				indices,
+				&position_ids[0],
+				position_ids[v1],
+				position_ids[v0]);
+			for (int dir = 0; dir < 2; ++dir)
+			{
+				int from = dir == 0 ? v0 : v1;
+				int to = dir == 0 ? v1 : v0;
+				// border vertices can move only along the border, seam
+				// vertices only along the seam, see getCollapsePairs
+				if ((flags[from] & BORDER) && !is_border)
+				{
+					continue;
+				}
+				Quadric q = quadrics[to];
+				for (int v = position_ids[from]; v >= 0; v = next_at_position[v])
+				{
+					q.add(quadrics[v]);
+				}
+				Collapse& collapse = collapses.pushEmpty();
+				collapse.m_from = from;
+				collapse.m_to = to;
+				collapse.m_error = q.getError(positions[to]);
+			}
+		}
+		if (collapses.empty())
+		{
+			break;
+		}
+		qsort(&collapses[0],
+			collapses.size(),
+			sizeof(collapses[0]),
+			compareCollapses);
+
+		// an interior collapse removes two triangles; only the cheaper half
+		// of the collapses is used in one pass so errors do not pile up
+		int max_collapses =
+			Math::maxValue(1, (index_count - target_index_count) / 6);
+		double max_error = collapses[collapses.size() / 2].m_error;
+		for (int i = 0; i < vertex_count; ++i)
+		{
+			remap[i] = i;
+		}
+		memset(&touched[0], 0, vertex_count);
+		int collapse_count = 0;
+		for (int i = 0; i < collapses.size() && collapse_count < max_collapses;
+			 ++i)
+		{
+			const Collapse& collapse = collapses[i];
+			if (collapse_count > 0 && collapse.m_error > max_error)
+			{
+				break;
+			}
+			if (!getCollapsePairs(adjacency,
+					indices,
+					&position_ids[0],
+					&next_at_position[0],
+					collapse.m_from,
+					collapse.m_to,
+					pairs))
+			{
+				continue;
+			}
+			bool is_touched = false;
+			for (int j = 0; j < pairs.size(); ++j)
+			{
+				is_touched = is_touched || touched[pairs[j]];
+			}
+			if (is_touched ||
+				!isCollapseValid(adjacency,
+					indices,
+					&position_ids[0],
+					&remap[0],
+					positions,
+					position_ids[collapse.m_from],
+					collapse.m_to))
+			{
+				continue;
+			}
+
+			for (int j = 0; j < pairs.size(); j += 2)
+			{
+				remap[pairs[j]] = pairs[j + 1];
+				quadrics[pairs[j + 1]].add(quadrics[pairs[j]]);
+			}
+			// the whole neighbourhood is locked so the flip test of the next
+			// collapses sees the final triangles
+			int from = position_ids[collapse.m_from];
+			const int* triangles =
+				&adjacency.m_triangles[adjacency.m_offsets[from]];
+			for (int j = 0, c = adjacency.m_counts[from]; j < c; ++j)
+			{
+				const uint32_t* t = &indices[triangles[j] * 3];
+				touched[t[0]] = touched[t[1]] = touched[t[2]] = 1;
+			}
+			++collapse_count;
+		}
+		if (collapse_count == 0)
+		{
+			break;
+		}
+
+		int new_index_count = 0;
+		for (int i = 0; i < index_count; i += 3)
+		{
+			uint32_t a = remap[indices[i]];
+			uint32_t b = remap[indices[i + 1]];
+			uint32_t c = remap[indices[i + 2]];
+			if (a != b && b != c && a != c)
+			{
+				indices[new_index_count] = a;
+				indices[new_index_count + 1] = b;
+				indices[new_index_count + 2] = c;
+				new_index_count += 3;
+			}
+		}
+		index_count = new_index_count;
+	}
+
+	return index_count;
+}
+
+
+int optimizeVertexFetch(uint32_t* indices,
+	int index_count,
+	int vertex_count,
+	int* remap)
+{
+	for (int i = 0; i < vertex_count; ++i)
+	{
+		remap[i] = -1;
+	}
+
+	int next_vertex = 0;
+	for (int i = 0; i < index_count; ++i)
+	{
+		uint32_t v = indices[i];
+		if (remap[v] < 0)
+		{
+			remap[v] = next_vertex;
+			++next_vertex;
+		}
+		indices[i] = remap[v];
+	}
+
+	int used_count = next_vertex;
+	for (int i = 0; i < vertex_count; ++i)
+	{
+		if (remap[i] < 0)
+		{
+			remap[i] = next_vertex;
+			++next_vertex;
+		}
+	}
+	return used_count;
+}
+
+
+} // ~namespace MeshOptimizer
+
+
+} // ~namespace Lumix
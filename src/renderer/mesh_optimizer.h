@@ -0,0 +1,67 @@
+#pragma once
+
+#include "lumix.h"
+
+namespace Lumix
+{
+
+class IAllocator;
+struct Vec3;
+
+
+// offline index and vertex reordering, used by the model importer;
+// all functions work on one mesh with mesh local indices
+namespace MeshOptimizer
+{
+	static const int DEFAULT_CACHE_SIZE = 16;
+
+	// average cache miss ratio, i.e. transformed vertices per triangle,
+	// of a FIFO post-transform cache, 0.5 is optimal for big regular meshes,
+	// 3 is the worst case
+	LUMIX_RENDERER_API float computeACMR(const uint32_t* indices,
+		int index_count,
+		int vertex_count,
+		int cache_size,
+		IAllocator& allocator);
+
+	// reorders triangles for the post-transform vertex cache, Forsyth's
+	// linear-speed algorithm
+	LUMIX_RENDERER_API void optimizeVertexCache(uint32_t* indices,
+		int index_count,
+		int vertex_count,
+		IAllocator& allocator);
+
+	// reorders clusters of triangles so the ones likely to occlude others are
+	// drawn first, indices must be optimized by optimizeVertexCache first,
+	// a cluster can have an ACMR at most threshold times the ACMR of the whole
+	// mesh, e.g. 1.05
+	LUMIX_RENDERER_API void optimizeOverdraw(uint32_t* indices,
+		int index_count,
+		const Vec3* positions,
+		int vertex_count,
+		float threshold,
+		IAllocator& allocator);
+
+	// quadric error edge collapse, collapses edges until there are at most
+	// target_index_count indices or nothing can be collapsed without changing
+	// the mesh border; copies of a vertex on uv seams collapse together along
+	// the seam; indices are rewritten in place and still refer to the
+	// original vertices; returns the new index count
+	LUMIX_RENDERER_API int simplify(uint32_t* indices,
+		int index_count,
+		const Vec3* positions,
+		int vertex_count,
+		int target_index_count,
+		IAllocator& allocator);
+
+	// renumbers vertices in the order of first use, remap[old] is the new
+	// index, vertices not referenced by any triangle go last;
+	// returns the number of referenced vertices
+	LUMIX_RENDERER_API int optimizeVertexFetch(uint32_t* indices,
+		int index_count,
+		int vertex_count,
+		int* remap);
+} // ~namespace MeshOptimizer
+
+
+} // ~namespace Lumix
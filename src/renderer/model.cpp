@@ -2,6 +2,7 @@
 #include "renderer/model.h"
 
 #include "core/array.h"
+#include "core/blob.h"
 #include "core/crc32.h"
 #include "core/fs/file_system.h"
 #include "core/fs/ifile.h"
@@ -42,6 +43,8 @@ Mesh::Mesh(const bgfx::VertexDecl& def,
 	m_name_hash = crc32(name);
 	m_name = name;
 	m_instance_idx = -1;
+	m_first_bone = 0;
+	m_bone_count = 0;
 }
 
 
@@ -67,63 +70,12 @@ RayCastModelHit Model::castRay(const Vec3& origin,
 	Vec3 local_origin = inv.multiplyPosition(origin);
 	Vec3 local_dir = static_cast<Vec3>(inv * Vec4(dir.x, dir.y, dir.z, 0));
 
-	const Array<Vec3>& vertices = m_vertices;
-	const Array<int32_t>& indices = m_indices;
-	int vertex_offset = 0;
-	for (int mesh_index = 0; mesh_index < m_meshes.size(); ++mesh_index)
+	TriangleBVH::Hit bvh_hit;
+	if (!m_vertices.empty() && m_bvh.castRay(&m_vertices[0], local_origin, local_dir, bvh_hit))
 	{
-		int indices_end = m_meshes[mesh_index].getIndicesOffset() +
-						  m_meshes[mesh_index].getIndexCount();
-		for (int i = m_meshes[mesh_index].getIndicesOffset(); i < indices_end;
-			 i += 3)
-		{
-			Vec3 p0 = vertices[vertex_offset + indices[i]];
-			Vec3 p1 = vertices[vertex_offset + indices[i + 1]];
-			Vec3 p2 = vertices[vertex_offset + indices[i + 2]];
-			Vec3 normal = crossProduct(p1 - p0, p2 - p0);
-			float q = dotProduct(normal, local_dir);
-			if (q == 0)
-			{
-				continue;
-			}
-			float d = -dotProduct(normal, p0);
-			float t = -(dotProduct(normal, local_origin) + d) / q;
-			if (t < 0)
-			{
-				continue;
-			}
-			Vec3 hit_point = local_origin + local_dir * t;
-
-			Vec3 edge0 = p1 - p0;
-			Vec3 VP0 = hit_point - p0;
-			if (dotProduct(normal, crossProduct(edge0, VP0)) < 0)
-			{
-				continue;
-			}
-
-			Vec3 edge1 = p2 - p1;
-			Vec3 VP1 = hit_point - p1;
-			if (dotProduct(normal, crossProduct(edge1, VP1)) < 0)
-			{
-				continue;
-			}
-
-			Vec3 edge2 = p0 - p2;
-			Vec3 VP2 = hit_point - p2;
-			if (dotProduct(normal, crossProduct(edge2, VP2)) < 0)
-			{
-				continue;
-			}
-
-			if (!hit.m_is_hit || hit.m_t > t)
-			{
-				hit.m_is_hit = true;
-				hit.m_t = t;
-				hit.m_mesh = &m_meshes[mesh_index];
-			}
-		}
-		vertex_offset += m_meshes[mesh_index].getAttributeArraySize() /
-						 m_meshes[mesh_index].getVertexDefinition().getStride();
+		hit.m_is_hit = true;
+		hit.m_t = bvh_hit.m_t;
+		hit.m_mesh = &m_meshes[bvh_hit.m_mesh];
 	}
 	hit.m_origin = origin;
 	hit.m_dir = dir;
@@ -142,6 +94,17 @@ LODMeshIndices Model::getLODMeshIndices(float squared_distance) const
 }
 
 
+int Model::getLODBoneCount(float squared_distance) const
+{
+	int i = 0;
+	while (squared_distance >= m_lods[i].m_distance)
+	{
+		++i;
+	}
+	return m_lods[i].m_bone_count;
+}
+
+
 void Model::getPose(Pose& pose)
 {
 	ASSERT(pose.getCount() == getBoneCount());
@@ -158,23 +121,26 @@ void Model::getPose(Pose& pose)
 }
 
 
-bool Model::parseVertexDef(FS::IFile& file, bgfx::VertexDecl* vertex_definition)
+bool Model::parseVertexDef(InputBlob& data,
+	FileVersion version,
+	bgfx::VertexDecl* vertex_definition)
 {
+	bool is_compact = version >= FileVersion::COMPACT;
 	vertex_definition->begin();
 
 	uint32_t attribute_count;
-	file.read(&attribute_count, sizeof(attribute_count));
+	data.read(attribute_count);
 
 	for (uint32_t i = 0; i < attribute_count; ++i)
 	{
 		char tmp[50];
 		uint32_t len;
-		file.read(&len, sizeof(len));
+		data.read(len);
 		if (len > sizeof(tmp) - 1)
 		{
 			return false;
 		}
-		file.read(tmp, len);
+		data.read(tmp, len);
 		tmp[len] = '\0';
 
 		if (strcmp(tmp, "in_position") == 0)
@@ -184,8 +150,9 @@ bool Model::parseVertexDef(FS::IFile& file, bgfx::VertexDecl* vertex_definition)
 		}
 		else if (strcmp(tmp, "in_tex_coords") == 0)
 		{
-			vertex_definition->add(
-				bgfx::Attrib::TexCoord0, 2, bgfx::AttribType::Float);
+			vertex_definition->add(bgfx::Attrib::TexCoord0,
+				2,
+				is_compact ? bgfx::AttribType::Half : bgfx::AttribType::Float);
 		}
 		else if (strcmp(tmp, "in_normal") == 0)
 		{
@@ -199,8 +166,16 @@ bool Model::parseVertexDef(FS::IFile& file, bgfx::VertexDecl* vertex_definition)
 		}
 		else if (strcmp(tmp, "in_weights") == 0)
 		{
-			vertex_definition->add(
-				bgfx::Attrib::Weight, 4, bgfx::AttribType::Float);
+			if (is_compact)
+			{
+				vertex_definition->add(
+					bgfx::Attrib::Weight, 4, bgfx::AttribType::Uint8, true);
+			}
+			else
+			{
+				vertex_definition->add(
+					bgfx::Attrib::Weight, 4, bgfx::AttribType::Float);
+			}
 		}
 		else if (strcmp(tmp, "in_indices") == 0)
 		{
@@ -209,12 +184,11 @@ bool Model::parseVertexDef(FS::IFile& file, bgfx::VertexDecl* vertex_definition)
 		}
 		else
 		{
-			ASSERT(false);
 			return false;
 		}
 
 		uint32_t type;
-		file.read(&type, sizeof(type));
+		data.read(type);
 	}
 
 	vertex_definition->end();
@@ -246,6 +220,7 @@ void Model::create(const bgfx::VertexDecl& def,
 	lod.m_distance = FLT_MAX;
 	lod.m_from_mesh = 0;
 	lod.m_to_mesh = 0;
+	lod.m_bone_count = 0;
 	m_lods.push(lod);
 
 	m_indices.resize(indices_size / sizeof(m_indices[0]));
@@ -253,6 +228,7 @@ void Model::create(const bgfx::VertexDecl& def,
 
 	m_vertices.resize(attributes_size / def.getStride());
 	computeRuntimeData((const uint8_t*)attributes_data);
+	buildBVH();
 
 	onReady();
 }
@@ -300,32 +276,91 @@ void Model::computeRuntimeData(const uint8_t* vertices)
 }
 
 
-bool Model::parseGeometry(FS::IFile& file)
+// lower LODs are not tested, they approximate the first one
+void Model::buildBVH()
+{
+	m_bvh.clear();
+	if (m_vertices.empty())
+	{
+		return;
+	}
+	Array<TriangleBVH::Triangle> triangles(m_allocator);
+	int vertex_offset = 0;
+	for (int mesh_index = 0;
+		 mesh_index <= m_lods[0].m_to_mesh && mesh_index < m_meshes.size();
+		 ++mesh_index)
+	{
+		const Mesh& mesh = m_meshes[mesh_index];
+		int indices_end = mesh.getIndicesOffset() + mesh.getIndexCount();
+		for (int i = mesh.getIndicesOffset(); i < indices_end; i += 3)
+		{
+			TriangleBVH::Triangle& triangle = triangles.pushEmpty();
+			for (int k = 0; k < 3; ++k)
+			{
+				triangle.m_vertices[k] = vertex_offset + m_indices[i + k];
+			}
+			triangle.m_mesh = mesh_index;
+		}
+		vertex_offset += mesh.getAttributeArraySize() /
+						 mesh.getVertexDefinition().getStride();
+	}
+	m_bvh.build(&m_vertices[0],
+		triangles.empty() ? nullptr : &triangles[0],
+		triangles.size());
+}
+
+
+bool Model::parseGeometry(InputBlob& data, FileVersion version)
 {
+	int32_t index_size = sizeof(int32_t);
+	if (version >= FileVersion::COMPACT)
+	{
+		data.read(index_size);
+		if (index_size != sizeof(int16_t) && index_size != sizeof(int32_t))
+		{
+			return false;
+		}
+	}
 	int32_t indices_count = 0;
-	file.read(&indices_count, sizeof(indices_count));
-	if (indices_count <= 0)
+	data.read(indices_count);
+	if (indices_count <= 0 ||
+		data.getPosition() + indices_count * index_size > data.getSize())
 	{
 		return false;
 	}
+	m_index_size = index_size;
+	m_indices_offset = data.getPosition();
 	m_indices.resize(indices_count);
-	file.read(&m_indices[0], sizeof(m_indices[0]) * indices_count);
+	if (index_size == sizeof(int16_t))
+	{
+		// CPU copy is kept 32-bit for ray casting
+		const uint16_t* indices =
+			(const uint16_t*)((const uint8_t*)data.getData() + m_indices_offset);
+		for (int i = 0; i < indices_count; ++i)
+		{
+			m_indices[i] = indices[i];
+		}
+		data.setPosition(m_indices_offset + indices_count * index_size);
+	}
+	else
+	{
+		data.read(&m_indices[0], sizeof(m_indices[0]) * indices_count);
+	}
 
 	int32_t vertices_size = 0;
-	file.read(&vertices_size, sizeof(vertices_size));
-	if (vertices_size <= 0)
+	data.read(vertices_size);
+	if (vertices_size <= 0 ||
+		data.getPosition() + vertices_size > data.getSize())
 	{
 		return false;
 	}
 
-	Array<uint8_t> vertices(m_allocator);
-	vertices.resize(vertices_size);
-	file.read(&vertices[0], sizeof(vertices[0]) * vertices.size());
-
-	m_geometry_buffer_object.setAttributesData(
-		&vertices[0], vertices.size(), m_meshes[0].getVertexDefinition());
-	m_geometry_buffer_object.setIndicesData(
-		&m_indices[0], m_indices.size() * sizeof(m_indices[0]));
+	// GPU buffers are created in commit() straight from the file data
+	m_vertices_offset = data.getPosition();
+	m_vertices_size = vertices_size;
+	const uint8_t* vertices =
+		(const uint8_t*)data.getData() + m_vertices_offset;
+	data.setPosition(m_vertices_offset + vertices_size);
 
 	int vertex_count = 0;
 	for (int i = 0; i < m_meshes.size(); ++i)
@@ -335,15 +370,15 @@ bool Model::parseGeometry(FS::IFile& file)
 	}
 	m_vertices.resize(vertex_count);
 
-	computeRuntimeData(&vertices[0]);
+	computeRuntimeData(vertices);
 
 	return true;
 }
 
-bool Model::parseBones(FS::IFile& file)
+bool Model::parseBones(InputBlob& data)
 {
 	int bone_count;
-	file.read(&bone_count, sizeof(bone_count));
+	data.read(bone_count);
 	if (bone_count < 0)
 	{
 		return false;
@@ -353,28 +388,34 @@ bool Model::parseBones(FS::IFile& file)
 	{
 		Model::Bone& b = m_bones.emplace(m_allocator);
 		int len;
-		file.read(&len, sizeof(len));
+		data.read(len);
 		char tmp[MAX_PATH_LENGTH];
 		if (len >= MAX_PATH_LENGTH)
 		{
 			return false;
 		}
-		file.read(tmp, len);
+		data.read(tmp, len);
 		tmp[len] = 0;
 		b.name = tmp;
 		m_bone_map.insert(crc32(b.name.c_str()), m_bones.size() - 1);
-		file.read(&len, sizeof(len));
+		data.read(len);
 		if (len >= MAX_PATH_LENGTH)
 		{
 			return false;
 		}
-		file.read(tmp, len);
+		data.read(tmp, len);
 		tmp[len] = 0;
 		b.parent = tmp;
-		file.read(&b.position.x, sizeof(float) * 3);
-		file.read(&b.rotation.x, sizeof(float) * 4);
+		data.read(&b.position.x, sizeof(float) * 3);
+		data.read(&b.rotation.x, sizeof(float) * 4);
 	}
 	m_first_nonroot_bone_index = -1;
+	m_skeleton_hash = 0;
+	for (int i = 0; i < bone_count; ++i)
+	{
+		m_skeleton_hash = continueCrc32(m_skeleton_hash, m_bones[i].name.c_str());
+		m_skeleton_hash = continueCrc32(m_skeleton_hash, "/");
+	}
 	for (int i = 0; i < bone_count; ++i)
 	{
 		Model::Bone& b = m_bones[i];
@@ -387,8 +428,7 @@ bool Model::parseBones(FS::IFile& file)
 			b.parent_idx = getBoneIdx(b.parent.c_str());
 			if (b.parent_idx > i || b.parent_idx < 0)
 			{
-				g_log_error.log("renderer") << "Invalid skeleton in "
-											<< getPath().c_str();
+				setParseError("Invalid skeleton");
 				return false;
 			}
 			if (m_first_nonroot_bone_index == -1)
@@ -421,75 +461,185 @@ int Model::getBoneIdx(const char* name)
 	return -1;
 }
 
-bool Model::parseMeshes(FS::IFile& file)
+bool Model::parseMeshes(InputBlob& data, FileVersion version)
 {
 	int object_count = 0;
-	file.read(&object_count, sizeof(object_count));
+	data.read(object_count);
 	if (object_count <= 0)
 	{
 		return false;
 	}
 	m_meshes.reserve(object_count);
-	char model_dir[MAX_PATH_LENGTH];
-	PathUtils::getDir(model_dir, MAX_PATH_LENGTH, m_path.c_str());
+	m_material_name_offsets.reserve(object_count);
 	for (int i = 0; i < object_count; ++i)
 	{
+		// materials are loaded in commit(), resource managers are not thread safe
+		m_material_name_offsets.push(data.getPosition());
 		int32_t str_size;
-		file.read(&str_size, sizeof(str_size));
-		char material_name[MAX_PATH_LENGTH];
-		file.read(material_name, str_size);
-		if (str_size >= MAX_PATH_LENGTH)
+		data.read(str_size);
+		if (str_size < 0 || str_size >= MAX_PATH_LENGTH)
 		{
 			return false;
 		}
-		material_name[str_size] = 0;
-
-		char material_path[MAX_PATH_LENGTH];
-		copyString(material_path, sizeof(material_path), model_dir);
-		catString(material_path, sizeof(material_path), material_name);
-		catString(material_path, sizeof(material_path), ".mat");
-		Material* material = static_cast<Material*>(
-			m_resource_manager.get(ResourceManager::MATERIAL)
-				->load(Path(material_path)));
+		data.setPosition(data.getPosition() + str_size);
 
 		int32_t attribute_array_offset = 0;
-		file.read(&attribute_array_offset, sizeof(attribute_array_offset));
+		data.read(attribute_array_offset);
 		int32_t attribute_array_size = 0;
-		file.read(&attribute_array_size, sizeof(attribute_array_size));
+		data.read(attribute_array_size);
 		int32_t indices_offset = 0;
-		file.read(&indices_offset, sizeof(indices_offset));
+		data.read(indices_offset);
 		int32_t mesh_tri_count = 0;
-		file.read(&mesh_tri_count, sizeof(mesh_tri_count));
+		data.read(mesh_tri_count);
 
-		file.read(&str_size, sizeof(str_size));
-		if (str_size >= MAX_PATH_LENGTH)
+		data.read(str_size);
+		if (str_size < 0 || str_size >= MAX_PATH_LENGTH)
 		{
 			return false;
 		}
 		char mesh_name[MAX_PATH_LENGTH];
 		mesh_name[str_size] = 0;
-		file.read(mesh_name, str_size);
+		data.read(mesh_name, str_size);
 
 		bgfx::VertexDecl def;
-		parseVertexDef(file, &def);
+		if (!parseVertexDef(data, version, &def))
+		{
+			return false;
+		}
 		m_meshes.emplace(def,
-						 material,
+						 nullptr,
 						 attribute_array_offset,
 						 attribute_array_size,
 						 indices_offset,
 						 mesh_tri_count * 3,
 						 mesh_name,
 						 m_allocator);
-		addDependency(*material);
 	}
 	return true;
 }
 
 
-bool Model::parseLODs(FS::IFile& file)
+bool Model::computeMeshBones(const uint8_t* vertices)
+{
+	m_mesh_bones.clear();
+	m_skinned_vertices.clear();
+	for (int i = 0; i < m_lods.size(); ++i)
+	{
+		m_lods[i].m_bone_count = 0;
+	}
+	int bone_count = m_bones.size();
+	if (bone_count == 0)
+	{
+		return true;
+	}
+
+	Array<int> remap(m_allocator);
+	remap.resize(bone_count);
+	bool is_remap_needed = false;
+	for (int i = 0; i < m_meshes.size(); ++i)
+	{
+		Mesh& mesh = m_meshes[i];
+		const bgfx::VertexDecl& def = mesh.getVertexDefinition();
+		if (!def.has(bgfx::Attrib::Indices))
+		{
+			continue;
+		}
+		int stride = def.getStride();
+		int vertex_count = mesh.getAttributeArraySize() / stride;
+		const uint8_t* indices = vertices + mesh.getAttributeArrayOffset() +
+								 def.getOffset(bgfx::Attrib::Indices);
+		int first_bone = m_mesh_bones.size();
+		for (int j = 0; j < bone_count; ++j)
+		{
+			remap[j] = -1;
+		}
+		for (int j = 0; j < vertex_count; ++j)
+		{
+			const int16_t* vertex_bones = (const int16_t*)(indices + j * stride);
+			for (int k = 0; k < 4; ++k)
+			{
+				int bone = vertex_bones[k];
+				if (bone < 0 || bone >= bone_count)
+				{
+					setParseError("Invalid bone index in vertex data");
+					return false;
+				}
+				if (remap[bone] < 0)
+				{
+					remap[bone] = m_mesh_bones.size() - first_bone;
+					is_remap_needed = is_remap_needed || remap[bone] != bone;
+					m_mesh_bones.push(bone);
+				}
+			}
+		}
+		mesh.setBones(first_bone, m_mesh_bones.size() - first_bone);
+		// u_boneMatrices can not hold more, the importer splits such meshes
+		if (mesh.getBoneCount() > MAX_BONES_PER_MESH)
+		{
+			char error[256];
+			copyString(error, sizeof(error), "Too many bones in mesh ");
+			catString(error, sizeof(error), mesh.getName());
+			setParseError(error);
+			return false;
+		}
+	}
+
+	for (int i = 0; i < m_lods.size(); ++i)
+	{
+		LOD& lod = m_lods[i];
+		for (int j = lod.m_from_mesh; j <= lod.m_to_mesh && j < m_meshes.size(); ++j)
+		{
+			const Mesh& mesh = m_meshes[j];
+			for (int k = 0; k < mesh.getBoneCount(); ++k)
+			{
+				lod.m_bone_count = Math::maxValue(
+					lod.m_bone_count, m_mesh_bones[mesh.getFirstBone() + k] + 1);
+			}
+		}
+	}
+
+	if (!is_remap_needed)
+	{
+		return true;
+	}
+
+	// the file data is not ours to modify, patch a copy
+	m_skinned_vertices.resize(m_vertices_size);
+	memcpy(&m_skinned_vertices[0], vertices, m_vertices_size);
+	for (int i = 0; i < m_meshes.size(); ++i)
+	{
+		Mesh& mesh = m_meshes[i];
+		if (mesh.getBoneCount() == 0)
+		{
+			continue;
+		}
+		const bgfx::VertexDecl& def = mesh.getVertexDefinition();
+		for (int j = 0; j < mesh.getBoneCount(); ++j)
+		{
+			remap[m_mesh_bones[mesh.getFirstBone() + j]] = j;
+		}
+		int stride = def.getStride();
+		int vertex_count = mesh.getAttributeArraySize() / stride;
+		uint8_t* indices = &m_skinned_vertices[0] +
+						   mesh.getAttributeArrayOffset() +
+						   def.getOffset(bgfx::Attrib::Indices);
+		for (int j = 0; j < vertex_count; ++j)
+		{
+			int16_t* vertex_bones = (int16_t*)(indices + j * stride);
+			for (int k = 0; k < 4; ++k)
+			{
+				vertex_bones[k] = (int16_t)remap[vertex_bones[k]];
+			}
+		}
+	}
+	return true;
+}
+
+
+bool Model::parseLODs(InputBlob& data)
 {
 	int32_t lod_count;
-	file.read(&lod_count, sizeof(lod_count));
+	data.read(lod_count);
 	if (lod_count <= 0)
 	{
 		return false;
@@ -497,56 +647,114 @@ bool Model::parseLODs(FS::IFile& file)
 	m_lods.resize(lod_count);
 	for (int i = 0; i < lod_count; ++i)
 	{
-		file.read(&m_lods[i].m_to_mesh, sizeof(m_lods[i].m_to_mesh));
-		file.read(&m_lods[i].m_distance, sizeof(m_lods[i].m_distance));
+		data.read(m_lods[i].m_to_mesh);
+		data.read(m_lods[i].m_distance);
 		m_lods[i].m_from_mesh = i > 0 ? m_lods[i - 1].m_to_mesh + 1 : 0;
 	}
 	return true;
 }
 
 
-void Model::loaded(FS::IFile& file, bool success, FS::FileSystem& fs)
+bool Model::parse(InputBlob& data)
 {
 	PROFILE_FUNCTION();
-	if (success)
-	{
-		FileHeader header;
-		file.read(&header, sizeof(header));
-		if (header.m_magic == FILE_MAGIC &&
-			header.m_version <= (uint32_t)FileVersion::LATEST &&
-			parseMeshes(file) && parseGeometry(file) && parseBones(file) &&
-			parseLODs(file))
-		{
-			m_size = file.size();
-			decrementDepCount();
-		}
-		else
-		{
-			g_log_warning.log("renderer") << "Error loading model "
-										  << m_path.c_str();
-			onFailure();
-			return;
-		}
+	m_material_name_offsets.clear();
+	FileHeader header;
+	data.read(header);
+	if (header.m_magic != FILE_MAGIC)
+	{
+		setParseError("Not a model file");
+		return false;
+	}
+	if (header.m_version > (uint32_t)FileVersion::LATEST)
+	{
+		setParseError("Unsupported model version");
+		return false;
+	}
+	if (!parseMeshes(data, (FileVersion)header.m_version) ||
+		!parseGeometry(data, (FileVersion)header.m_version) ||
+		!parseBones(data) ||
+		!parseLODs(data) ||
+		!computeMeshBones((const uint8_t*)data.getData() + m_vertices_offset))
+	{
+		return false;
+	}
+	buildBVH();
+	return true;
+}
+
+
+bool Model::commit(InputBlob& data)
+{
+	PROFILE_FUNCTION();
+	const uint8_t* vertices =
+		m_skinned_vertices.empty()
+			? (const uint8_t*)data.getData() + m_vertices_offset
+			: &m_skinned_vertices[0];
+	m_geometry_buffer_object.setAttributesData(
+		vertices, m_vertices_size, m_meshes[0].getVertexDefinition());
+	Array<uint8_t> empty(m_allocator);
+	m_skinned_vertices.swap(empty);
+	if (m_index_size == sizeof(int16_t))
+	{
+		m_geometry_buffer_object.setIndicesData(
+			(const short*)((const uint8_t*)data.getData() + m_indices_offset),
+			m_indices.size() * sizeof(int16_t));
 	}
 	else
 	{
-		g_log_warning.log("renderer") << "Error loading model "
-									  << m_path.c_str();
-		onFailure();
+		m_geometry_buffer_object.setIndicesData(
+			&m_indices[0], m_indices.size() * sizeof(m_indices[0]));
+	}
+
+	char model_dir[MAX_PATH_LENGTH];
+	PathUtils::getDir(model_dir, MAX_PATH_LENGTH, m_path.c_str());
+	ResourceManagerBase* material_manager =
+		m_resource_manager.get(ResourceManager::MATERIAL);
+	for (int i = 0; i < m_meshes.size(); ++i)
+	{
+		data.setPosition(m_material_name_offsets[i]);
+		char material_name[MAX_PATH_LENGTH];
+		int32_t str_size;
+		data.read(str_size);
+		data.read(material_name, str_size);
+		material_name[str_size] = 0;
+
+		char material_path[MAX_PATH_LENGTH];
+		copyString(material_path, sizeof(material_path), model_dir);
+		catString(material_path, sizeof(material_path), material_name);
+		catString(material_path, sizeof(material_path), ".mat");
+		Material* material =
+			static_cast<Material*>(material_manager->load(Path(material_path)));
+		m_meshes[i].setMaterial(material);
+		addDependency(*material);
 	}
+	m_material_name_offsets.clear();
+	return true;
 }
 
+
 void Model::doUnload(void)
 {
 	for (int i = 0; i < m_meshes.size(); ++i)
 	{
-		removeDependency(*m_meshes[i].getMaterial());
-		m_resource_manager.get(ResourceManager::MATERIAL)
-			->unload(*m_meshes[i].getMaterial());
+		// meshes of a model which failed to parse have no material
+		Material* material = m_meshes[i].getMaterial();
+		if (material)
+		{
+			removeDependency(*material);
+			m_resource_manager.get(ResourceManager::MATERIAL)->unload(*material);
+		}
 	}
 	m_meshes.clear();
 	m_bones.clear();
+	m_bone_map.clear();
+	m_skeleton_hash = 0;
 	m_lods.clear();
+	m_mesh_bones.clear();
+	m_bvh.clear();
+	m_skinned_vertices.clear();
+	m_material_name_offsets.clear();
 	m_geometry_buffer_object.clear();
 
 	m_size = 0;
@@ -11,6 +11,7 @@
 #include "core/resource.h"
 #include "renderer/geometry.h"
 #include "renderer/ray_cast_model_hit.h"
+#include "renderer/triangle_bvh.h"
 #include <bgfx.h>
 
 
@@ -18,6 +19,7 @@ namespace Lumix
 {
 
 class Frustum;
+class InputBlob;
 class Material;
 class Model;
 class Pose;
@@ -58,6 +60,14 @@ public:
 	const bgfx::VertexDecl& getVertexDefinition() const { return m_vertex_def; }
 	int getInstanceIdx() const { return m_instance_idx; }
 	void setInstanceIdx(int value) { m_instance_idx = value; }
+	// bones referenced by the mesh's vertices, see Model::getMeshBones
+	int getFirstBone() const { return m_first_bone; }
+	int getBoneCount() const { return m_bone_count; }
+	void setBones(int first_bone, int bone_count)
+	{
+		m_first_bone = first_bone;
+		m_bone_count = bone_count;
+	}
 
 private:
 	Mesh(const Mesh&);
@@ -70,6 +80,8 @@ private:
 	int32_t m_attribute_array_size;
 	int32_t m_indices_offset;
 	int32_t m_index_count;
+	int32_t m_first_bone;
+	int32_t m_bone_count;
 	uint32_t m_name_hash;
 	Material* m_material;
 	string m_name;
@@ -111,6 +123,8 @@ public:
 	enum class FileVersion : uint32_t
 	{
 		FIRST,
+		// 1 is skipped, older importers stored LATEST with FIRST layout
+		COMPACT = 2, // 16-bit indices if possible, half uvs, 8-bit weights
 
 		LATEST // keep this last
 	};
@@ -122,6 +136,8 @@ public:
 		int m_to_mesh;
 
 		float m_distance;
+		// see getLODBoneCount
+		int m_bone_count;
 	};
 
 	struct Bone
@@ -152,7 +168,16 @@ public:
 		, m_bones(m_allocator)
 		, m_indices(m_allocator)
 		, m_vertices(m_allocator)
+		, m_bvh(m_allocator)
 		, m_lods(m_allocator)
+		, m_mesh_bones(m_allocator)
+		, m_material_name_offsets(m_allocator)
+		, m_vertices_offset(0)
+		, m_vertices_size(0)
+		, m_indices_offset(0)
+		, m_index_size(4)
+		, m_skinned_vertices(m_allocator)
+		, m_skeleton_hash(0)
 	{
 	}
 
@@ -166,6 +191,10 @@ public:
 				int attributes_size);
 
 	LODMeshIndices getLODMeshIndices(float squared_distance) const;
+	// bones the meshes of the LOD are skinned with, parents precede their
+	// children, so posing this prefix of the skeleton is enough to draw
+	// the LOD; 0 if no mesh of the LOD is skinned
+	int getLODBoneCount(float squared_distance) const;
 	const Geometry& getGeometry() const { return m_geometry_buffer_object; }
 	Mesh& getMesh(int index) { return m_meshes[index]; }
 	const Mesh& getMesh(int index) const { return m_meshes[index]; }
@@ -178,30 +207,47 @@ public:
 	{
 		return m_bone_map.find(hash);
 	}
+	// models with the same bone names in the same order share the hash
+	uint32_t getSkeletonHash() const { return m_skeleton_hash; }
 	void getPose(Pose& pose);
 	float getBoundingRadius() const { return m_bounding_radius; }
 	RayCastModelHit
 	castRay(const Vec3& origin, const Vec3& dir, const Matrix& model_transform);
 	const AABB& getAABB() const { return m_aabb; }
 
+	// skeleton bone index for each bone of a mesh's palette, vertices of
+	// skinned meshes are remapped to index the palette
+	const int* getMeshBones(const Mesh& mesh) const
+	{
+		return mesh.getBoneCount() > 0 ? &m_mesh_bones[mesh.getFirstBone()]
+									   : nullptr;
+	}
+
 public:
 	static const uint32_t FILE_MAGIC = 0x5f4c4d4f; // == '_LMO'
+	// size of u_boneMatrices, the skeleton can be bigger, but models with
+	// a mesh referencing more bones fail to load
+	static const int MAX_BONES_PER_MESH = 64;
 
 private:
 	Model(const Model&);
 	void operator=(const Model&);
 
-	bool parseVertexDef(FS::IFile& file, bgfx::VertexDecl* vertex_definition);
-	bool parseGeometry(FS::IFile& file);
-	bool parseBones(FS::IFile& file);
-	bool parseMeshes(FS::IFile& file);
-	bool parseLODs(FS::IFile& file);
+	bool parseVertexDef(InputBlob& data,
+		FileVersion version,
+		bgfx::VertexDecl* vertex_definition);
+	bool parseGeometry(InputBlob& data, FileVersion version);
+	bool parseBones(InputBlob& data);
+	bool parseMeshes(InputBlob& data, FileVersion version);
+	bool parseLODs(InputBlob& data);
 	int getBoneIdx(const char* name);
+	bool computeMeshBones(const uint8_t* vertices);
 	void computeRuntimeData(const uint8_t* vertices);
+	void buildBVH();
 
 	virtual void doUnload(void) override;
-	virtual void
-	loaded(FS::IFile& file, bool success, FS::FileSystem& fs) override;
+	virtual bool parse(InputBlob& data) override;
+	virtual bool commit(InputBlob& data) override;
 
 private:
 	IAllocator& m_allocator;
@@ -210,11 +256,25 @@ private:
 	Array<Bone> m_bones;
 	Array<int32_t> m_indices;
 	Array<Vec3> m_vertices;
+	// triangles of the first LOD, indices into m_vertices
+	TriangleBVH m_bvh;
 	Array<LOD> m_lods;
+	Array<int> m_mesh_bones;
 	float m_bounding_radius;
 	BoneMap m_bone_map;
 	AABB m_aabb;
 	int m_first_nonroot_bone_index;
+	uint32_t m_skeleton_hash;
+
+	// positions in the file data, filled by parse() and consumed by commit()
+	Array<int> m_material_name_offsets;
+	int m_vertices_offset;
+	int m_vertices_size;
+	// 16-bit indices are uploaded straight from the file data
+	int m_indices_offset;
+	int m_index_size;
+	// copy of the vertex data with bone indices remapped to mesh palettes
+	Array<uint8_t> m_skinned_vertices;
 };
 
 
@@ -8,7 +8,6 @@
 #include "core/fs/ifile.h"
 #include "core/fs/file_system.h"
 #include "core/json_serializer.h"
-#include "core/lifo_allocator.h"
 #include "core/log.h"
 #include "core/lua_wrapper.h"
 #include "core/profiler.h"
@@ -30,6 +29,7 @@
 #include "renderer/transient_geometry.h"
 #include "universe/universe.h"
 #include <bgfx.h>
+#include <cfloat>
 
 
 namespace Lumix
@@ -62,6 +62,8 @@ public:
 	const bgfx::InstanceDataBuffer* m_buffer;
 	int m_instance_count;
 	RenderableMesh m_mesh;
+	// the biggest of the instances, see getScreenSize
+	float m_screen_size;
 };
 
 class BaseVertex
@@ -241,12 +243,12 @@ struct PipelineInstanceImpl : public PipelineInstance
 		, m_custom_commands_handlers(allocator)
 		, m_allocator(allocator)
 		, m_tmp_terrains(allocator)
+		, m_tmp_shadow_terrains(allocator)
 		, m_tmp_grasses(allocator)
 		, m_tmp_meshes(allocator)
 		, m_framebuffers(allocator)
 		, m_uniforms(allocator)
 		, m_global_textures(allocator)
-		, m_frame_allocator(allocator, 10 * 1024 * 1024)
 		, m_renderer(static_cast<PipelineImpl&>(pipeline).getRenderer())
 		, m_screen_space_material(nullptr)
 		, m_default_framebuffer(nullptr)
@@ -276,11 +278,15 @@ struct PipelineInstanceImpl : public PipelineInstance
 		m_shadowmap_splits_uniform =
 			bgfx::createUniform("u_shadowmapSplits", bgfx::UniformType::Vec4);
 		m_bone_matrices_uniform =
-			bgfx::createUniform("u_boneMatrices", bgfx::UniformType::Mat4, 64);
+			bgfx::createUniform("u_boneMatrices",
+				bgfx::UniformType::Mat4,
+				Model::MAX_BONES_PER_MESH);
 		m_specular_shininess_uniform = bgfx::createUniform(
 			"u_materialSpecularShininess", bgfx::UniformType::Vec4);
 		m_terrain_matrix_uniform =
 			bgfx::createUniform("u_terrainMatrix", bgfx::UniformType::Mat4);
+		m_terrain_tile_uniform =
+			bgfx::createUniform("u_terrainTile", bgfx::UniformType::Vec4);
 
 		ResourceManagerBase* material_manager =
 			pipeline.getResourceManager().get(ResourceManager::MATERIAL);
@@ -290,6 +296,8 @@ struct PipelineInstanceImpl : public PipelineInstance
 			Lumix::Path("models/editor/debug_line.mat")));
 
 		m_scene = nullptr;
+		m_camera_pos.set(0, 0, 0);
+		m_screen_size_scale = 0;
 		m_width = m_height = -1;
 		m_framebuffer_width = m_framebuffer_height = -1;
 		pipeline.onLoaded<PipelineInstanceImpl,
@@ -303,6 +311,7 @@ struct PipelineInstanceImpl : public PipelineInstance
 			m_source.getResourceManager().get(ResourceManager::MATERIAL);
 		material_manager->unload(*m_screen_space_material);
 		material_manager->unload(*m_debug_line_material);
+		bgfx::destroyUniform(m_terrain_tile_uniform);
 		bgfx::destroyUniform(m_terrain_matrix_uniform);
 		bgfx::destroyUniform(m_specular_shininess_uniform);
 		bgfx::destroyUniform(m_bone_matrices_uniform);
@@ -354,7 +363,7 @@ struct PipelineInstanceImpl : public PipelineInstance
 			const Geometry& geometry = model.getGeometry();
 			const Material* material = mesh.getMaterial();
 
-			setMaterial(material);
+			setMaterial(material, m_instances_data[idx].m_screen_size);
 			bgfx::setVertexBuffer(geometry.getAttributesArrayID(),
 								  mesh.getAttributeArrayOffset() /
 									  mesh.getVertexDefinition().getStride(),
@@ -549,29 +558,14 @@ struct PipelineInstanceImpl : public PipelineInstance
 		float camera_fov = m_scene->getCameraFOV(camera);
 		float camera_ratio = m_scene->getCameraWidth(camera) /
 							 m_scene->getCameraHeight(camera);
+		Matrix camera_matrix =
+			universe.getMatrix(m_scene->getCameraEntity(camera));
+		Frustum shadow_camera_frustums[4];
+		Matrix view_matrices[4];
+		Matrix projection_matrices[4];
 		for (int split_index = 0; split_index < 4; ++split_index)
 		{
-			if (split_index > 0)
-			{
-				m_renderer.viewCounterAdd();
-				m_view_idx = m_renderer.getViewCounter();
-				m_view2pass_map[m_view_idx] = m_pass_idx;
-			}
-
-			bgfx::setViewFrameBuffer(m_view_idx,
-									 m_current_framebuffer->getHandle());
-			bgfx::setViewClear(m_view_idx, BGFX_CLEAR_DEPTH, 0, 1.0f, 0);
-			bgfx::touch(m_view_idx);
-			float* viewport = viewports + split_index * 2;
-			bgfx::setViewRect(m_view_idx,
-							  (uint16_t)(1 + shadowmap_width * viewport[0]),
-							  (uint16_t)(1 + shadowmap_height * viewport[1]),
-							  (uint16_t)(0.5f * shadowmap_width - 2),
-							  (uint16_t)(0.5f * shadowmap_height - 2));
-
 			Frustum frustum;
-			Matrix camera_matrix =
-				universe.getMatrix(m_scene->getCameraEntity(camera));
 			frustum.computePerspective(camera_matrix.getTranslation(),
 									   camera_matrix.getZVector(),
 									   camera_matrix.getYVector(),
@@ -584,7 +578,7 @@ struct PipelineInstanceImpl : public PipelineInstance
 
 			Vec3 shadow_cam_pos = frustum.getCenter();
 			float bb_size = frustum.getRadius();
-			Matrix projection_matrix;
+			Matrix& projection_matrix = projection_matrices[split_index];
 			projection_matrix.setOrtho(bb_size,
 									   -bb_size,
 									   -bb_size,
@@ -594,12 +588,10 @@ struct PipelineInstanceImpl : public PipelineInstance
 
 			Vec3 light_forward = light_mtx.getZVector();
 			shadow_cam_pos -= light_forward * SHADOW_CAM_FAR * 0.5f;
-			Matrix view_matrix;
+			Matrix& view_matrix = view_matrices[split_index];
 			view_matrix.lookAt(shadow_cam_pos,
 							   shadow_cam_pos + light_forward,
 							   light_mtx.getYVector());
-			bgfx::setViewTransform(
-				m_view_idx, &view_matrix.m11, &projection_matrix.m11);
 			static const Matrix biasMatrix(0.5, 0.0, 0.0, 0.0,
 										   0.0, -0.5, 0.0, 0.0,
 										   0.0, 0.0, 0.5, 0.0,
@@ -607,15 +599,58 @@ struct PipelineInstanceImpl : public PipelineInstance
 			m_shadow_modelviewprojection[split_index] =
 				biasMatrix * (projection_matrix * view_matrix);
 
-			Frustum shadow_camera_frustum;
-			shadow_camera_frustum.computeOrtho(shadow_cam_pos,
-											   -light_forward,
-											   light_mtx.getYVector(),
-											   bb_size * 2,
-											   bb_size * 2,
-											   SHADOW_CAM_NEAR,
-											   SHADOW_CAM_FAR);
-			renderAll(shadow_camera_frustum, layer_mask, true);
+			shadow_camera_frustums[split_index].computeOrtho(
+				shadow_cam_pos,
+				-light_forward,
+				light_mtx.getYVector(),
+				bb_size * 2,
+				bb_size * 2,
+				SHADOW_CAM_NEAR,
+				SHADOW_CAM_FAR);
+		}
+
+		// terrain of all splits is culled at once
+		while (m_tmp_shadow_terrains.size() < 4)
+		{
+			m_tmp_shadow_terrains.emplace(m_allocator);
+		}
+		for (int i = 0; i < 4; ++i)
+		{
+			m_tmp_shadow_terrains[i].clear();
+		}
+		m_scene->getTerrainInfos(shadow_camera_frustums,
+								 4,
+								 &m_tmp_shadow_terrains[0],
+								 layer_mask,
+								 camera_matrix.getTranslation());
+
+		for (int split_index = 0; split_index < 4; ++split_index)
+		{
+			if (split_index > 0)
+			{
+				m_renderer.viewCounterAdd();
+				m_view_idx = m_renderer.getViewCounter();
+				m_view2pass_map[m_view_idx] = m_pass_idx;
+			}
+
+			bgfx::setViewFrameBuffer(m_view_idx,
+									 m_current_framebuffer->getHandle());
+			bgfx::setViewClear(m_view_idx, BGFX_CLEAR_DEPTH, 0, 1.0f, 0);
+			bgfx::touch(m_view_idx);
+			float* viewport = viewports + split_index * 2;
+			bgfx::setViewRect(m_view_idx,
+							  (uint16_t)(1 + shadowmap_width * viewport[0]),
+							  (uint16_t)(1 + shadowmap_height * viewport[1]),
+							  (uint16_t)(0.5f * shadowmap_width - 2),
+							  (uint16_t)(0.5f * shadowmap_height - 2));
+			bgfx::setViewTransform(m_view_idx,
+								   &view_matrices[split_index].m11,
+								   &projection_matrices[split_index].m11);
+
+			renderAll(shadow_camera_frustums[split_index],
+					  layer_mask,
+					  true,
+					  m_tmp_shadow_terrains[split_index]);
 		}
 	}
 
@@ -766,11 +801,12 @@ struct PipelineInstanceImpl : public PipelineInstance
 				light, frustum, m_tmp_meshes, layer_mask);
 
 			m_scene->getTerrainInfos(
-				m_tmp_terrains,
+				&frustum,
+				1,
+				&m_tmp_terrains,
 				layer_mask,
 				m_scene->getUniverse().getPosition(
-					m_scene->getCameraEntity(m_scene->getAppliedCamera())),
-				m_frame_allocator);
+					m_scene->getCameraEntity(m_scene->getAppliedCamera())));
 
 			m_scene->getGrassInfos(frustum, m_tmp_grasses, layer_mask);
 			setPointLightUniforms(light);
@@ -858,6 +894,26 @@ struct PipelineInstanceImpl : public PipelineInstance
 
 	void
 	renderAll(const Frustum& frustum, int64_t layer_mask, bool is_shadowmap)
+	{
+		if (m_scene->getAppliedCamera() >= 0)
+		{
+			m_tmp_terrains.clear();
+			m_scene->getTerrainInfos(
+				&frustum,
+				1,
+				&m_tmp_terrains,
+				layer_mask,
+				m_scene->getUniverse().getPosition(
+					m_scene->getCameraEntity(m_scene->getAppliedCamera())));
+			renderAll(frustum, layer_mask, is_shadowmap, m_tmp_terrains);
+		}
+	}
+
+
+	void renderAll(const Frustum& frustum,
+				   int64_t layer_mask,
+				   bool is_shadowmap,
+				   const Array<TerrainInfo>& terrains)
 	{
 		PROFILE_FUNCTION();
 
@@ -865,18 +921,11 @@ struct PipelineInstanceImpl : public PipelineInstance
 		{
 			m_tmp_grasses.clear();
 			m_tmp_meshes.clear();
-			m_tmp_terrains.clear();
 
 			m_scene->getRenderableInfos(frustum, m_tmp_meshes, layer_mask);
-			m_scene->getTerrainInfos(
-				m_tmp_terrains,
-				layer_mask,
-				m_scene->getUniverse().getPosition(
-					m_scene->getCameraEntity(m_scene->getAppliedCamera())),
-				m_frame_allocator);
 			setDirectionalLightUniforms(m_scene->getActiveGlobalLight());
 			renderMeshes(m_tmp_meshes);
-			renderTerrains(m_tmp_terrains);
+			renderTerrains(terrains);
 			if (!is_shadowmap)
 			{
 				m_scene->getGrassInfos(frustum, m_tmp_grasses, layer_mask);
@@ -916,24 +965,54 @@ struct PipelineInstanceImpl : public PipelineInstance
 
 	void setPoseUniform(const RenderableMesh& renderable_mesh) const
 	{
-		Matrix bone_mtx[64];
+		Matrix bone_mtx[Model::MAX_BONES_PER_MESH];
 
 		const Pose& pose = *renderable_mesh.m_pose;
 		const Model& model = *renderable_mesh.m_model;
+		const Mesh& mesh = *renderable_mesh.m_mesh;
+		const int* bones = model.getMeshBones(mesh);
+		int bone_count = mesh.getBoneCount();
+		// models with more bones per mesh fail to load
+		ASSERT(bone_count <= lengthOf(bone_mtx));
+		const Matrix* skinning_matrices = pose.getSkinningMatrices();
+		int skinning_bone_count = pose.getSkinningBoneCount();
 		Vec3* poss = pose.getPositions();
 		Quat* rots = pose.getRotations();
 
-		ASSERT(pose.getCount() <= lengthOf(bone_mtx));
-		for (int bone_index = 0, bone_count = pose.getCount();
-			 bone_index < bone_count;
-			 ++bone_index)
+		// only the bones the mesh references are uploaded
+		for (int i = 0; i < bone_count; ++i)
 		{
-			rots[bone_index].toMatrix(bone_mtx[bone_index]);
-			bone_mtx[bone_index].translate(poss[bone_index]);
-			bone_mtx[bone_index] = bone_mtx[bone_index] *
-								   model.getBone(bone_index).inv_bind_matrix;
+			int bone_index = bones[i];
+			ASSERT(bone_index < pose.getCount());
+			if (skinning_matrices)
+			{
+				// the pose was evaluated for a coarser LOD than this view
+				// draws, bones it skipped follow their closest evaluated
+				// parent, parents always precede their children
+				while (bone_index >= skinning_bone_count)
+				{
+					bone_index = model.getBone(bone_index).parent_idx;
+					if (bone_index < 0)
+					{
+						break;
+					}
+				}
+				if (bone_index < 0)
+				{
+					bone_mtx[i] = Matrix::IDENTITY;
+				}
+				else
+				{
+					bone_mtx[i] = skinning_matrices[bone_index];
+				}
+				continue;
+			}
+			rots[bone_index].toMatrix(bone_mtx[i]);
+			bone_mtx[i].translate(poss[bone_index]);
+			bone_mtx[i] =
+				bone_mtx[i] * model.getBone(bone_index).inv_bind_matrix;
 		}
-		bgfx::setUniform(m_bone_matrices_uniform, bone_mtx, pose.getCount());
+		bgfx::setUniform(m_bone_matrices_uniform, bone_mtx, bone_count);
 	}
 
 
@@ -948,7 +1027,7 @@ struct PipelineInstanceImpl : public PipelineInstance
 		const Material* material = mesh.getMaterial();
 
 		setPoseUniform(info);
-		setMaterial(material);
+		setMaterial(material, getScreenSize(info));
 		bgfx::setTransform(info.m_matrix);
 		bgfx::setVertexBuffer(geometry.getAttributesArrayID(),
 							  mesh.getAttributeArrayOffset() /
@@ -979,7 +1058,7 @@ struct PipelineInstanceImpl : public PipelineInstance
 	{
 		bgfx::setState(m_render_state | material.getRenderStates());
 		bgfx::setTransform(nullptr);
-		setMaterial(&material);
+		setMaterial(&material, FLT_MAX);
 		bgfx::setVertexBuffer(&geom.getVertexBuffer(), 0, geom.getNumVertices());
 		bgfx::setIndexBuffer(&geom.getIndexBuffer(), first_index, num_indices);
 		bgfx::submit(
@@ -1013,17 +1092,20 @@ struct PipelineInstanceImpl : public PipelineInstance
 				InstanceData::MAX_INSTANCE_COUNT, sizeof(Matrix));
 			data.m_instance_count = 0;
 			data.m_mesh = info;
+			data.m_screen_size = 0;
 		}
 		Matrix* mtcs = (Matrix*)data.m_buffer->data;
 		mtcs[data.m_instance_count] = *info.m_matrix;
 		++data.m_instance_count;
+		data.m_screen_size =
+			Math::maxValue(data.m_screen_size, getScreenSize(info));
 		if (data.m_instance_count == InstanceData::MAX_INSTANCE_COUNT)
 		{
 			const Mesh& mesh = *info.m_mesh;
 			const Geometry& geometry = info.m_model->getGeometry();
 			const Material* material = mesh.getMaterial();
 
-			setMaterial(material);
+			setMaterial(material, data.m_screen_size);
 			bgfx::setVertexBuffer(geometry.getAttributesArrayID(),
 								  mesh.getAttributeArrayOffset() /
 									  mesh.getVertexDefinition().getStride(),
@@ -1045,7 +1127,25 @@ struct PipelineInstanceImpl : public PipelineInstance
 	}
 
 
-	void setMaterial(const Material* material) const
+	// projected diameter of the mesh's bounding sphere in pixels, FLT_MAX
+	// when the camera is inside it
+	float getScreenSize(const RenderableMesh& info) const
+	{
+		float radius = info.m_model->getBoundingRadius() *
+					   info.m_matrix->getXVector().length();
+		float distance =
+			(info.m_matrix->getTranslation() - m_camera_pos).length();
+		if (distance <= radius)
+		{
+			return FLT_MAX;
+		}
+		return radius * m_screen_size_scale / distance;
+	}
+
+
+	// screen_size is the size of the drawn object in pixels, textures of
+	// the material are streamed in the resolution it needs
+	void setMaterial(const Material* material, float screen_size) const
 	{
 		for (int i = 0; i < material->getUniformCount(); ++i)
 		{
@@ -1077,6 +1177,7 @@ struct PipelineInstanceImpl : public PipelineInstance
 			Texture* texture = material->getTexture(i);
 			if (texture)
 			{
+				texture->onUsed(screen_size);
 				bgfx::setTexture(
 					i,
 					shader->getTextureSlot(i).m_uniform_handle,
@@ -1106,7 +1207,8 @@ struct PipelineInstanceImpl : public PipelineInstance
 		}
 		auto& inst = m_terrain_instances[info.m_index];
 		if ((inst.m_count > 0 &&
-			 inst.m_infos[0]->m_terrain != info.m_terrain) ||
+			 (inst.m_infos[0]->m_terrain != info.m_terrain ||
+			  inst.m_infos[0]->m_tile != info.m_tile)) ||
 			inst.m_count == lengthOf(inst.m_infos))
 		{
 			finishTerrainInstances(info.m_index);
@@ -1116,6 +1218,37 @@ struct PipelineInstanceImpl : public PipelineInstance
 	}
 
 
+	// tile's maps replace the material's heightmap and splatmap, shaders
+	// remap the position to the tile using u_terrainTile, it is the tile's
+	// origin and size in heightmap pixels, zero size if there is no tile
+	void setTerrainTile(const Terrain& terrain, const TerrainTile* tile)
+	{
+		if (!tile)
+		{
+			Vec4 no_tile(0, 0, 0, 0);
+			bgfx::setUniform(m_terrain_tile_uniform, &no_tile);
+			return;
+		}
+
+		Vec2 extent = terrain.getTileExtent();
+		Vec4 tile_rect(tile->m_x * extent.x, tile->m_z * extent.y, extent.x, extent.y);
+		bgfx::setUniform(m_terrain_tile_uniform, &tile_rect);
+		Shader* shader = terrain.getMaterial()->getShader();
+		for (int i = 0; i < shader->getTextureSlotCount(); ++i)
+		{
+			const Shader::TextureSlot& slot = shader->getTextureSlot(i);
+			if (strcmp(slot.m_uniform, "u_texHeightmap") == 0)
+			{
+				bgfx::setTexture(i, slot.m_uniform_handle, tile->m_heightmap_texture);
+			}
+			else if (strcmp(slot.m_uniform, "u_texSplatmap") == 0)
+			{
+				bgfx::setTexture(i, slot.m_uniform_handle, tile->m_splatmap_texture);
+			}
+		}
+	}
+
+
 	void finishTerrainInstances(int index)
 	{
 		if (m_terrain_instances[index].m_count == 0)
@@ -1162,7 +1295,8 @@ struct PipelineInstanceImpl : public PipelineInstance
 						 &Vec4(info.m_terrain->getScale(), 0));
 		bgfx::setUniform(m_terrain_matrix_uniform, &info.m_world_matrix.m11);
 
-		setMaterial(material);
+		setMaterial(material, FLT_MAX);
+		setTerrainTile(*info.m_terrain, info.m_tile);
 
 		const bgfx::InstanceDataBuffer* instance_buffer =
 			bgfx::allocInstanceDataBuffer(m_terrain_instances[index].m_count,
@@ -1199,18 +1333,15 @@ struct PipelineInstanceImpl : public PipelineInstance
 	}
 
 
+	// instances live in a static buffer owned by the terrain, nothing is
+	// uploaded here
 	void renderGrass(const GrassInfo& grass)
 	{
-		const bgfx::InstanceDataBuffer* idb =
-			bgfx::allocInstanceDataBuffer(grass.m_matrix_count, sizeof(Matrix));
-		memcpy(idb->data,
-			   &grass.m_matrices[0],
-			   grass.m_matrix_count * sizeof(Matrix));
 		const Mesh& mesh = grass.m_model->getMesh(0);
 		const Geometry& geometry = grass.m_model->getGeometry();
 		const Material* material = mesh.getMaterial();
 
-		setMaterial(material);
+		setMaterial(material, FLT_MAX);
 		bgfx::setVertexBuffer(geometry.getAttributesArrayID(),
 							  mesh.getAttributeArrayOffset() /
 								  mesh.getVertexDefinition().getStride(),
@@ -1220,7 +1351,8 @@ struct PipelineInstanceImpl : public PipelineInstance
 							 mesh.getIndicesOffset(),
 							 mesh.getIndexCount());
 		bgfx::setState(m_render_state | material->getRenderStates());
-		bgfx::setInstanceDataBuffer(idb, grass.m_matrix_count);
+		bgfx::setInstanceDataBuffer(
+			grass.m_instance_buffer, 0, grass.m_instance_count);
 		bgfx::submit(m_view_idx, material->getShaderInstance().m_program_handles[m_pass_idx]);
 	}
 
@@ -1235,12 +1367,12 @@ struct PipelineInstanceImpl : public PipelineInstance
 	}
 
 
-	void renderTerrains(const Array<const TerrainInfo*>& terrains)
+	void renderTerrains(const Array<TerrainInfo>& terrains)
 	{
 		PROFILE_FUNCTION();
-		for (auto* info : terrains)
+		for (const auto& info : terrains)
 		{
-			renderTerrain(*info);
+			renderTerrain(info);
 		}
 		for (int i = 0; i < lengthOf(m_terrain_instances); ++i)
 		{
@@ -1299,6 +1431,14 @@ struct PipelineInstanceImpl : public PipelineInstance
 		m_global_textures.clear();
 		m_view2pass_map.assign(0xFF);
 		m_instance_data_idx = 0;
+		ComponentIndex camera = m_scene ? m_scene->getAppliedCamera() : -1;
+		if (camera >= 0)
+		{
+			m_camera_pos = m_scene->getUniverse().getPosition(
+				m_scene->getCameraEntity(camera));
+			float fov = Math::degreesToRadians(m_scene->getCameraFOV(camera));
+			m_screen_size_scale = m_height / tanf(fov * 0.5f);
+		}
 		for (int i = 0; i < lengthOf(m_terrain_instances); ++i)
 		{
 			m_terrain_instances[i].m_count = 0;
@@ -1320,8 +1460,6 @@ struct PipelineInstanceImpl : public PipelineInstance
 			}
 		}
 		finishInstances();
-
-		m_frame_allocator.clear();
 	}
 
 
@@ -1368,7 +1506,6 @@ struct PipelineInstanceImpl : public PipelineInstance
 	uint64_t m_render_state;
 	IAllocator& m_allocator;
 	Renderer& m_renderer;
-	LIFOAllocator m_frame_allocator;
 	PipelineImpl& m_source;
 	RenderScene* m_scene;
 	FrameBuffer* m_current_framebuffer;
@@ -1378,6 +1515,9 @@ struct PipelineInstanceImpl : public PipelineInstance
 	Array<bgfx::UniformHandle> m_uniforms;
 	InstanceData m_instances_data[128];
 	int m_instance_data_idx;
+	Vec3 m_camera_pos;
+	// pixels per unit of size at unit distance from the applied camera
+	float m_screen_size_scale;
 
 	Matrix m_shadow_modelviewprojection[4];
 	Vec4 m_shadowmap_splits;
@@ -1387,7 +1527,8 @@ struct PipelineInstanceImpl : public PipelineInstance
 	int m_framebuffer_height;
 	AssociativeArray<uint32_t, CustomCommandHandler> m_custom_commands_handlers;
 	Array<const RenderableMesh*> m_tmp_meshes;
-	Array<const TerrainInfo*> m_tmp_terrains;
+	Array<TerrainInfo> m_tmp_terrains;
+	Array<Array<TerrainInfo>> m_tmp_shadow_terrains;
 	Array<GrassInfo> m_tmp_grasses;
 	bgfx::UniformHandle m_specular_shininess_uniform;
 	bgfx::UniformHandle m_bone_matrices_uniform;
@@ -1403,6 +1544,7 @@ struct PipelineInstanceImpl : public PipelineInstance
 	bgfx::UniformHandle m_shadowmap_splits_uniform;
 	bgfx::UniformHandle m_light_specular_uniform;
 	bgfx::UniformHandle m_terrain_matrix_uniform;
+	bgfx::UniformHandle m_terrain_tile_uniform;
 	Material* m_screen_space_material;
 	Material* m_debug_line_material;
 
@@ -1,7 +1,7 @@
 #include "renderer/pose.h"
 #include "core/matrix.h"
 #include "core/quat.h"
-#include "core/profiler.h"
+#include "core/simd.h"
 #include "core/vec3.h"
 #include "renderer/model.h"
 
@@ -15,8 +15,11 @@ Pose::Pose(IAllocator& allocator)
 {
 	m_positions = 0;
 	m_rotations = 0;
+	m_skinning_matrices = 0;
 	m_count = 0;
+	m_skinning_bone_count = 0;
 	m_is_absolute = false;
+	m_has_skinning_matrices = false;
 }
 
 
@@ -24,22 +27,91 @@ Pose::~Pose()
 {
 	m_allocator.deallocate(m_positions);
 	m_allocator.deallocate(m_rotations);
+	m_allocator.deallocate(m_skinning_matrices);
 }
 
 
 void Pose::blend(Pose& rhs, float weight)
 {
 	ASSERT(m_count == rhs.m_count);
-	if (weight <= 0.001f)
+	if (weight <= 0.001f || m_count == 0)
 	{
 		return;
 	}
+	m_has_skinning_matrices = false;
 	weight = Math::clamp(weight, 0.0f, 1.0f);
 	float inv = 1.0f - weight;
-	for (int i = 0, c = m_count; i < c; ++i)
+	float4 weight4 = f4Splat(weight);
+	float4 inv4 = f4Splat(inv);
+
+	// positions are lerped as a flat array of floats
+	float* LUMIX_RESTRICT pos = &m_positions[0].x;
+	const float* LUMIX_RESTRICT rhs_pos = &rhs.m_positions[0].x;
+	int float_count = m_count * 3;
+	int i = 0;
+	for (; i + 4 <= float_count; i += 4)
+	{
+		float4 a = f4LoadUnaligned(pos + i);
+		float4 b = f4LoadUnaligned(rhs_pos + i);
+		f4StoreUnaligned(pos + i, f4Add(f4Mul(a, inv4), f4Mul(b, weight4)));
+	}
+	for (; i < float_count; ++i)
 	{
-		m_positions[i] = m_positions[i] * inv + rhs.m_positions[i] * weight;
-		nlerp(m_rotations[i], rhs.m_rotations[i], &m_rotations[i], weight);
+		pos[i] = pos[i] * inv + rhs_pos[i] * weight;
+	}
+
+	// four rotations at once, transposed to x, y, z, w registers
+	Quat* LUMIX_RESTRICT rot = m_rotations;
+	const Quat* LUMIX_RESTRICT rhs_rot = rhs.m_rotations;
+	i = 0;
+	for (; i + 4 <= m_count; i += 4)
+	{
+		float4 ax = f4LoadUnaligned(&rot[i]);
+		float4 ay = f4LoadUnaligned(&rot[i + 1]);
+		float4 az = f4LoadUnaligned(&rot[i + 2]);
+		float4 aw = f4LoadUnaligned(&rot[i + 3]);
+		f4Transpose(ax, ay, az, aw);
+		float4 bx = f4LoadUnaligned(&rhs_rot[i]);
+		float4 by = f4LoadUnaligned(&rhs_rot[i + 1]);
+		float4 bz = f4LoadUnaligned(&rhs_rot[i + 2]);
+		float4 bw = f4LoadUnaligned(&rhs_rot[i + 3]);
+		f4Transpose(bx, by, bz, bw);
+
+		// interpolate along the shorter arc
+		float4 dot = f4Add(f4Add(f4Mul(ax, bx), f4Mul(ay, by)),
+			f4Add(f4Mul(az, bz), f4Mul(aw, bw)));
+		float4 sign = f4Sign(dot);
+		bx = f4Xor(bx, sign);
+		by = f4Xor(by, sign);
+		bz = f4Xor(bz, sign);
+		bw = f4Xor(bw, sign);
+
+		float4 x = f4Add(f4Mul(ax, inv4), f4Mul(bx, weight4));
+		float4 y = f4Add(f4Mul(ay, inv4), f4Mul(by, weight4));
+		float4 z = f4Add(f4Mul(az, inv4), f4Mul(bz, weight4));
+		float4 w = f4Add(f4Mul(aw, inv4), f4Mul(bw, weight4));
+		float4 len = f4Sqrt(f4Add(f4Add(f4Mul(x, x), f4Mul(y, y)),
+			f4Add(f4Mul(z, z), f4Mul(w, w))));
+		x = f4Div(x, len);
+		y = f4Div(y, len);
+		z = f4Div(z, len);
+		w = f4Div(w, len);
+
+		f4Transpose(x, y, z, w);
+		f4StoreUnaligned(&rot[i], x);
+		f4StoreUnaligned(&rot[i + 1], y);
+		f4StoreUnaligned(&rot[i + 2], z);
+		f4StoreUnaligned(&rot[i + 3], w);
+	}
+	for (; i < m_count; ++i)
+	{
+		Quat q = rhs_rot[i];
+		const Quat& lhs_rot = rot[i];
+		if (lhs_rot.x * q.x + lhs_rot.y * q.y + lhs_rot.z * q.z + lhs_rot.w * q.w < 0)
+		{
+			q.set(-q.x, -q.y, -q.z, -q.w);
+		}
+		nlerp(rot[i], q, &rot[i], weight);
 	}
 }
 
@@ -47,38 +119,136 @@ void Pose::blend(Pose& rhs, float weight)
 void Pose::resize(int count)
 {
 	m_is_absolute = false;
+	m_has_skinning_matrices = false;
 	m_allocator.deallocate(m_positions);
 	m_allocator.deallocate(m_rotations);
+	m_allocator.deallocate(m_skinning_matrices);
 	m_count = count;
 	if(m_count)
 	{
 		m_positions = static_cast<Vec3*>(m_allocator.allocate(sizeof(Vec3) * count));
 		m_rotations = static_cast<Quat*>(m_allocator.allocate(sizeof(Quat) * count));
+		m_skinning_matrices = static_cast<Matrix*>(m_allocator.allocate(sizeof(Matrix) * count));
 	}
 	else
 	{
 		m_positions = nullptr;
 		m_rotations = nullptr;
+		m_skinning_matrices = nullptr;
 	}
 }
 
 
-void Pose::computeAbsolute(Model& model)
+void Pose::computeAbsolute(Model& model, int bone_count)
 {
-	PROFILE_FUNCTION();
+	ASSERT(bone_count <= m_count);
 	if(!m_is_absolute)
 	{
-		for (int i = model.getFirstNonrootBoneIndex(); i < m_count; ++i)
+		// -1 when all bones are roots
+		int first = model.getFirstNonrootBoneIndex();
+		for (int i = first < 0 ? bone_count : first; i < bone_count; ++i)
 		{
 			int parent = model.getBone(i).parent_idx;
-			m_positions[i] = m_rotations[parent] * m_positions[i] + m_positions[parent];
-			m_rotations[i] = m_rotations[i] * m_rotations[parent];
+			const Quat& parent_rot = m_rotations[parent];
+			Quat& rot = m_rotations[i];
+			float4 q = f4LoadUnaligned(&parent_rot);
+			float4 r = f4LoadUnaligned(&rot);
+
+			// position = parent_rot * position + parent_position
+			float4 v = f4Load3(&m_positions[i].x);
+			float4 t = f4Cross3(q, v);
+			t = f4Add(t, t);
+			v = f4Add(v, f4Add(f4Mul(f4Splat4(q, 3), t), f4Cross3(q, t)));
+			v = f4Add(v, f4Load3(&m_positions[parent].x));
+			f4Store3(&m_positions[i].x, v);
+
+			// rotation = rotation * parent_rot
+			float w = rot.w * parent_rot.w - rot.x * parent_rot.x -
+					  rot.y * parent_rot.y - rot.z * parent_rot.z;
+			float4 xyz = f4Add(f4Add(f4Mul(f4Splat4(q, 3), r),
+									 f4Mul(f4Splat4(r, 3), q)),
+				f4Cross3(q, r));
+			f4Store3(&rot.x, xyz);
+			rot.w = w;
 		}
 		m_is_absolute = true;
 	}
 }
 
 
+void Pose::computeSkinningMatrices(const Model& model, int bone_count)
+{
+	ASSERT(m_is_absolute);
+	ASSERT(bone_count <= m_count);
+	const float4 one_w = _mm_set_ps(1, 0, 0, 0);
+	int i = 0;
+
+	// rotation parts of four bones at once
+	for (; i + 4 <= bone_count; i += 4)
+	{
+		float4 x = f4LoadUnaligned(&m_rotations[i]);
+		float4 y = f4LoadUnaligned(&m_rotations[i + 1]);
+		float4 z = f4LoadUnaligned(&m_rotations[i + 2]);
+		float4 w = f4LoadUnaligned(&m_rotations[i + 3]);
+		f4Transpose(x, y, z, w);
+
+		float4 fx = f4Add(x, x);
+		float4 fy = f4Add(y, y);
+		float4 fz = f4Add(z, z);
+		float4 fwx = f4Mul(fx, w);
+		float4 fwy = f4Mul(fy, w);
+		float4 fwz = f4Mul(fz, w);
+		float4 fxx = f4Mul(fx, x);
+		float4 fxy = f4Mul(fy, x);
+		float4 fxz = f4Mul(fz, x);
+		float4 fyy = f4Mul(fy, y);
+		float4 fyz = f4Mul(fz, y);
+		float4 fzz = f4Mul(fz, z);
+		float4 one = f4Splat(1);
+
+		float4 r0[4] = {f4Sub(one, f4Add(fyy, fzz)),
+			f4Add(fxy, fwz),
+			f4Sub(fxz, fwy),
+			f4Zero()};
+		float4 r1[4] = {f4Sub(fxy, fwz),
+			f4Sub(one, f4Add(fxx, fzz)),
+			f4Add(fyz, fwx),
+			f4Zero()};
+		float4 r2[4] = {f4Add(fxz, fwy),
+			f4Sub(fyz, fwx),
+			f4Sub(one, f4Add(fxx, fyy)),
+			f4Zero()};
+		f4Transpose(r0[0], r0[1], r0[2], r0[3]);
+		f4Transpose(r1[0], r1[1], r1[2], r1[3]);
+		f4Transpose(r2[0], r2[1], r2[2], r2[3]);
+
+		for (int j = 0; j < 4; ++j)
+		{
+			float4 r3 = f4Add(f4Load3(&m_positions[i + j].x), one_w);
+			const Matrix& inv_bind = model.getBone(i + j).inv_bind_matrix;
+			float* out = &m_skinning_matrices[i + j].m11;
+			for (int row = 0; row < 4; ++row)
+			{
+				float4 b = f4LoadUnaligned(&inv_bind.m11 + row * 4);
+				float4 res = f4Add(f4Add(f4Mul(f4Splat4(b, 0), r0[j]),
+										 f4Mul(f4Splat4(b, 1), r1[j])),
+					f4Add(f4Mul(f4Splat4(b, 2), r2[j]), f4Mul(f4Splat4(b, 3), r3)));
+				f4StoreUnaligned(out + row * 4, res);
+			}
+		}
+	}
+	for (; i < bone_count; ++i)
+	{
+		Matrix mtx;
+		m_rotations[i].toMatrix(mtx);
+		mtx.translate(m_positions[i]);
+		m_skinning_matrices[i] = mtx * model.getBone(i).inv_bind_matrix;
+	}
+	m_skinning_bone_count = bone_count;
+	m_has_skinning_matrices = true;
+}
+
+
 void Pose::setMatrices(Matrix* mtx) const
 {
 	for(int i = 0, c = m_count; i < c; ++i)
@@ -26,9 +26,29 @@ class LUMIX_RENDERER_API Pose
 		int getCount() const { return m_count; }
 		Vec3* getPositions() const { return m_positions; }
 		Quat* getRotations() const { return m_rotations; }
-		void computeAbsolute(Model& model);
-		void setIsRelative() { m_is_absolute = false; }
+		void computeAbsolute(Model& model) { computeAbsolute(model, m_count); }
+		// only the first bone_count bones, used for animation LOD, see
+		// Model::getLODBoneCount
+		void computeAbsolute(Model& model, int bone_count);
+		void setIsRelative() { m_is_absolute = false; m_has_skinning_matrices = false; }
 		void blend(Pose& rhs, float weight);
+		// bone matrices multiplied by the inverse bind matrices, pose must be
+		// absolute; invalidated by setIsRelative, resize and blend
+		void computeSkinningMatrices(const Model& model)
+		{
+			computeSkinningMatrices(model, m_count);
+		}
+		void computeSkinningMatrices(const Model& model, int bone_count);
+		const Matrix* getSkinningMatrices() const
+		{
+			return m_has_skinning_matrices ? m_skinning_matrices : nullptr;
+		}
+		// only the first getSkinningBoneCount() skinning matrices are valid,
+		// animation LOD skips the rest
+		int getSkinningBoneCount() const
+		{
+			return m_has_skinning_matrices ? m_skinning_bone_count : 0;
+		}
 
 	private:
 		Pose(const Pose&);
@@ -37,9 +57,12 @@ class LUMIX_RENDERER_API Pose
 	private:
 		IAllocator& m_allocator;
 		bool m_is_absolute;
+		bool m_has_skinning_matrices;
 		int32_t m_count;
+		int32_t m_skinning_bone_count;
 		Vec3* m_positions;
 		Quat* m_rotations;
+		Matrix* m_skinning_matrices;
 };
 
 
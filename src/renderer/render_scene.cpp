@@ -6,7 +6,6 @@
 #include "core/FS/file_system.h"
 #include "core/FS/ifile.h"
 #include "core/json_serializer.h"
-#include "core/lifo_allocator.h"
 #include "core/log.h"
 #include "core/math_utils.h"
 #include "core/mtjd/generic_job.h"
@@ -33,6 +32,7 @@
 #include "renderer/texture.h"
 
 #include "universe/universe.h"
+#include <cfloat>
 
 
 namespace Lumix
@@ -44,6 +44,7 @@ static const uint32_t POINT_LIGHT_HASH = crc32("point_light");
 static const uint32_t GLOBAL_LIGHT_HASH = crc32("global_light");
 static const uint32_t CAMERA_HASH = crc32("camera");
 static const uint32_t TERRAIN_HASH = crc32("terrain");
+static const int MIN_RAYS_PER_JOB = 64;
 
 
 struct Renderable
@@ -51,6 +52,8 @@ struct Renderable
 	Renderable(IAllocator& allocator)
 		: m_pose(allocator)
 		, m_meshes(allocator)
+		, m_last_visible_frame(-1)
+		, m_visible_squared_distance(FLT_MAX)
 	{
 	}
 
@@ -61,6 +64,9 @@ struct Renderable
 	Matrix m_matrix;
 	Entity m_entity;
 	bool m_is_always_visible;
+	// written by culling jobs, see getRenderableInfos
+	int32_t m_last_visible_frame;
+	float m_visible_squared_distance;
 
 private:
 	Renderable(const Renderable&);
@@ -182,6 +188,7 @@ public:
 		m_culling_system =
 			CullingSystem::create(m_engine.getMTJDManager(), m_allocator);
 		m_time = 0;
+		m_frame = 0;
 	}
 
 
@@ -294,6 +301,7 @@ public:
 	{
 		PROFILE_FUNCTION();
 		m_time += dt;
+		++m_frame;
 		for (int i = m_debug_lines.size() - 1; i >= 0; --i)
 		{
 			float life = m_debug_lines[i].m_life;
@@ -307,6 +315,19 @@ public:
 				m_debug_lines[i].m_life = life;
 			}
 		}
+
+		if (m_applied_camera != INVALID_COMPONENT)
+		{
+			Vec3 camera_pos = m_universe.getPosition(
+				m_cameras[m_applied_camera].m_entity);
+			for (int i = 0; i < m_terrains.size(); ++i)
+			{
+				if (m_terrains[i])
+				{
+					m_terrains[i]->updateTiles(camera_pos);
+				}
+			}
+		}
 	}
 
 	void serializeCameras(OutputBlob& serializer)
@@ -509,7 +530,7 @@ public:
 		serializer.read(m_active_global_light_uid);
 	}
 
-	void deserializeTerrains(InputBlob& serializer)
+	void deserializeTerrains(InputBlob& serializer, int version)
 	{
 		int32_t size = 0;
 		serializer.read(size);
@@ -528,7 +549,7 @@ public:
 				m_terrains[i] = m_allocator.newObject<Terrain>(
 					m_renderer, INVALID_ENTITY, *this, m_allocator);
 				Terrain* terrain = m_terrains[i];
-				terrain->deserialize(serializer, m_universe, *this, i);
+				terrain->deserialize(serializer, m_universe, *this, i, version);
 			}
 			else
 			{
@@ -537,12 +558,12 @@ public:
 		}
 	}
 
-	virtual void deserialize(InputBlob& serializer) override
+	virtual void deserialize(InputBlob& serializer, int version) override
 	{
 		deserializeCameras(serializer);
 		deserializeRenderables(serializer);
 		deserializeLights(serializer);
-		deserializeTerrains(serializer);
+		deserializeTerrains(serializer, version);
 	}
 
 
@@ -806,6 +827,22 @@ public:
 	}
 
 
+	virtual void getTerrainHeightsAt(ComponentIndex cmp,
+									 const Vec2* points,
+									 float* heights,
+									 int count) override
+	{
+		m_terrains[cmp]->getHeights(points, heights, count);
+	}
+
+
+	virtual Vec3
+	getTerrainNormalAt(ComponentIndex cmp, float x, float z) override
+	{
+		return m_terrains[cmp]->getNormal(x, z);
+	}
+
+
 	virtual void
 	getTerrainSize(ComponentIndex cmp, float* width, float* height) override
 	{
@@ -854,6 +891,19 @@ public:
 	}
 
 
+	virtual void setTerrainTilesPath(ComponentIndex cmp,
+									 const char* path) override
+	{
+		m_terrains[cmp]->setTilesPath(Path(path));
+	}
+
+
+	virtual const char* getTerrainTilesPath(ComponentIndex cmp) override
+	{
+		return m_terrains[cmp]->getTilesPath().c_str();
+	}
+
+
 	virtual void setTerrainYScale(ComponentIndex cmp, float scale) override
 	{
 		m_terrains[cmp]->setYScale(scale);
@@ -871,6 +921,37 @@ public:
 	}
 
 
+	virtual int getFrame() const override { return m_frame; }
+
+
+	virtual int getRenderableLastVisibleFrame(ComponentIndex cmp) override
+	{
+		return m_renderables[getRenderable(cmp)]->m_last_visible_frame;
+	}
+
+
+	virtual float getRenderableVisibleSquaredDistance(ComponentIndex cmp) override
+	{
+		return m_renderables[getRenderable(cmp)]->m_visible_squared_distance;
+	}
+
+
+	// every renderable is in at most one subresult of a culling pass, so
+	// jobs never write the same renderable
+	static void markVisible(Renderable& renderable, int frame, float squared_distance)
+	{
+		if (renderable.m_last_visible_frame != frame)
+		{
+			renderable.m_last_visible_frame = frame;
+			renderable.m_visible_squared_distance = squared_distance;
+		}
+		else if (squared_distance < renderable.m_visible_squared_distance)
+		{
+			renderable.m_visible_squared_distance = squared_distance;
+		}
+	}
+
+
 	virtual Entity getRenderableEntity(ComponentIndex cmp) override
 	{
 		return m_renderables[getRenderable(cmp)]->m_entity;
@@ -959,24 +1040,71 @@ public:
 	}
 
 
-	virtual void getTerrainInfos(Array<const TerrainInfo*>& infos,
+	virtual void getTerrainInfos(const Frustum* frustums,
+								 int frustum_count,
+								 Array<TerrainInfo>* infos,
 								 int64_t layer_mask,
-								 const Vec3& camera_pos,
-								 LIFOAllocator& frame_allocator) override
+								 const Vec3& camera_pos) override
 	{
 		PROFILE_FUNCTION();
-		infos.reserve(m_terrains.size());
+		if (frustum_count == 1)
+		{
+			getTerrainInfos(frustums[0], infos[0], layer_mask, camera_pos);
+			return;
+		}
+
+		m_jobs.clear();
+		for (int i = 0; i < frustum_count; ++i)
+		{
+			const Frustum* frustum = &frustums[i];
+			Array<TerrainInfo>* frustum_infos = &infos[i];
+			MTJD::Job* job = MTJD::makeJob(
+				m_engine.getMTJDManager(),
+				[this, frustum, frustum_infos, layer_mask, camera_pos]()
+				{
+					getTerrainInfos(
+						*frustum, *frustum_infos, layer_mask, camera_pos);
+				},
+				m_allocator);
+			job->addDependency(&m_sync_point);
+			m_jobs.push(job);
+		}
+		runJobs(m_jobs, m_sync_point);
+	}
+
+
+	void getTerrainInfos(const Frustum& frustum,
+						 Array<TerrainInfo>& infos,
+						 int64_t layer_mask,
+						 const Vec3& camera_pos)
+	{
 		for (int i = 0; i < m_terrains.size(); ++i)
 		{
 			if (m_terrains[i] &&
 				(m_terrains[i]->getLayerMask() & layer_mask) != 0)
 			{
-				m_terrains[i]->getInfos(infos, camera_pos, frame_allocator);
+				m_terrains[i]->getInfos(infos, frustum, camera_pos);
 			}
 		}
 	}
 
 
+	virtual void onTerrainHeightmapChanged(ComponentIndex cmp,
+										   int x,
+										   int z,
+										   int width,
+										   int height) override
+	{
+		m_terrains[cmp]->onHeightmapChanged(x, z, width, height);
+	}
+
+
+	virtual void waitForTerrainJobs(ComponentIndex cmp) override
+	{
+		m_terrains[cmp]->waitForGrassJobs();
+	}
+
+
 	virtual void getGrassInfos(const Frustum& frustum,
 							   Array<GrassInfo>& infos,
 							   int64_t layer_mask) override
@@ -1166,6 +1294,7 @@ public:
 			Array<const RenderableMesh*>& subinfos =
 				m_temporary_infos[subresult_index];
 			subinfos.clear();
+			int frame = m_frame;
 			MTJD::Job* job = MTJD::makeJob(
 				m_engine.getMTJDManager(),
 				[&subinfos,
@@ -1173,20 +1302,22 @@ public:
 				 this,
 				 &results,
 				 subresult_index,
-				 &frustum]()
+				 &frustum,
+				 frame]()
 				{
 					Vec3 frustum_position = frustum.getPosition();
 					const CullingSystem::Subresults& subresults =
 						results[subresult_index];
 					for (int i = 0, c = subresults.size(); i < c; ++i)
 					{
-						const Renderable* LUMIX_RESTRICT renderable =
+						Renderable* LUMIX_RESTRICT renderable =
 							m_renderables[subresults[i]];
 						const Model* LUMIX_RESTRICT model = renderable->m_model;
 						float squared_distance =
 							(renderable->m_matrix.getTranslation() -
 							 frustum_position)
 								.squaredLength();
+						markVisible(*renderable, frame, squared_distance);
 						if (model && model->isReady())
 						{
 							LODMeshIndices lod =
@@ -1276,14 +1407,19 @@ public:
 		fillTemporaryInfos(*results, frustum, layer_mask);
 		mergeTemporaryInfos(meshes);
 
+		Vec3 frustum_position = frustum.getPosition();
 		for (int i = 0, c = m_always_visible.size(); i < c; ++i)
 		{
 			int renderable_index = getRenderable(m_always_visible[i]);
-			const Renderable* LUMIX_RESTRICT renderable =
+			Renderable* LUMIX_RESTRICT renderable =
 				m_renderables[renderable_index];
 			if ((m_culling_system->getLayerMask(renderable_index) &
 				 layer_mask) != 0)
 			{
+				markVisible(*renderable,
+					m_frame,
+					(renderable->m_matrix.getTranslation() - frustum_position)
+						.squaredLength());
 				for (int j = 0, c = renderable->m_meshes.size(); j < c; ++j)
 				{
 					meshes.push(&renderable->m_meshes[j]);
@@ -1671,38 +1807,45 @@ public:
 	}
 
 
-	virtual RayCastModelHit castRay(const Vec3& origin,
-									const Vec3& dir,
-									ComponentIndex ignored_renderable) override
+	// renderables are tested front to back in the order their bounding
+	// spheres are hit, so the search stops at the first sphere behind the
+	// closest hit; any_hit stops at the first hit
+	RayCastModelHit castRayInternal(const Vec3& origin,
+		const Vec3& dir,
+		float max_t,
+		int ignore_index,
+		bool any_hit,
+		CullingSystem::RayHits& candidates)
 	{
 		RayCastModelHit hit;
 		hit.m_is_hit = false;
-		Universe& universe = getUniverse();
-		int ignore_index = getRenderable(ignored_renderable);
-		for (int i = 0; i < m_renderables.size(); ++i)
+		hit.m_origin = origin;
+		hit.m_dir = dir;
+		m_culling_system->castRay(origin, dir, max_t, candidates);
+		for (int i = 0; i < candidates.size(); ++i)
 		{
-			if (ignore_index != i && m_renderables[i]->m_model)
+			if (hit.m_is_hit && candidates[i].m_t > hit.m_t)
+			{
+				break;
+			}
+			int renderable_index = candidates[i].m_index;
+			const Renderable* renderable = m_renderables[renderable_index];
+			if (renderable_index == ignore_index || !renderable->m_model)
+			{
+				continue;
+			}
+			RayCastModelHit new_hit =
+				renderable->m_model->castRay(origin, dir, renderable->m_matrix);
+			if (new_hit.m_is_hit && new_hit.m_t <= max_t &&
+				(!hit.m_is_hit || new_hit.m_t < hit.m_t))
 			{
-				const Vec3& pos = m_renderables[i]->m_matrix.getTranslation();
-				float radius = m_renderables[i]->m_model->getBoundingRadius();
-				float scale = universe.getScale(m_renderables[i]->m_entity);
-				Vec3 intersection;
-				if (dotProduct(pos - origin, pos - origin) < radius * radius ||
-					Math::getRaySphereIntersection(
-						origin, dir, pos, radius * scale, intersection))
+				new_hit.m_component = renderable_index;
+				new_hit.m_entity = renderable->m_entity;
+				new_hit.m_component_type = RENDERABLE_HASH;
+				hit = new_hit;
+				if (any_hit)
 				{
-					RayCastModelHit new_hit =
-						m_renderables[i]->m_model->castRay(
-							origin, dir, m_renderables[i]->m_matrix);
-					if (new_hit.m_is_hit &&
-						(!hit.m_is_hit || new_hit.m_t < hit.m_t))
-					{
-						new_hit.m_component = i;
-						new_hit.m_entity = m_renderables[i]->m_entity;
-						new_hit.m_component_type = RENDERABLE_HASH;
-						hit = new_hit;
-						hit.m_is_hit = true;
-					}
+					return hit;
 				}
 			}
 		}
@@ -1712,13 +1855,17 @@ public:
 			{
 				RayCastModelHit terrain_hit =
 					m_terrains[i]->castRay(origin, dir);
-				if (terrain_hit.m_is_hit &&
+				if (terrain_hit.m_is_hit && terrain_hit.m_t <= max_t &&
 					(!hit.m_is_hit || terrain_hit.m_t < hit.m_t))
 				{
 					terrain_hit.m_component = i;
 					terrain_hit.m_component_type = TERRAIN_HASH;
 					terrain_hit.m_entity = m_terrains[i]->getEntity();
 					hit = terrain_hit;
+					if (any_hit)
+					{
+						return hit;
+					}
 				}
 			}
 		}
@@ -1726,6 +1873,74 @@ public:
 	}
 
 
+	virtual RayCastModelHit castRay(const Vec3& origin,
+									const Vec3& dir,
+									ComponentIndex ignored_renderable) override
+	{
+		m_culling_system->prepareRayCasts();
+		CullingSystem::RayHits candidates(m_allocator);
+		return castRayInternal(origin,
+			dir,
+			FLT_MAX,
+			getRenderable(ignored_renderable),
+			false,
+			candidates);
+	}
+
+
+	virtual void castRays(const Ray* rays,
+		int count,
+		RayCastModelHit* hits,
+		bool any_hit) override
+	{
+		PROFILE_FUNCTION();
+		m_culling_system->prepareRayCasts();
+		int job_count = Math::minValue(
+			(int)m_engine.getMTJDManager().getCpuThreadsCount(),
+			(count + MIN_RAYS_PER_JOB - 1) / MIN_RAYS_PER_JOB);
+		if (job_count <= 1)
+		{
+			CullingSystem::RayHits candidates(m_allocator);
+			for (int i = 0; i < count; ++i)
+			{
+				hits[i] = castRayInternal(rays[i].m_origin,
+					rays[i].m_dir,
+					rays[i].m_max_t,
+					-1,
+					any_hit,
+					candidates);
+			}
+			return;
+		}
+
+		m_jobs.clear();
+		for (int job_index = 0; job_index < job_count; ++job_index)
+		{
+			int from = count * job_index / job_count;
+			int to = count * (job_index + 1) / job_count;
+			MTJD::Job* job = MTJD::makeJob(
+				m_engine.getMTJDManager(),
+				[this, rays, hits, from, to, any_hit]()
+				{
+					CullingSystem::RayHits candidates(m_allocator);
+					for (int i = from; i < to; ++i)
+					{
+						hits[i] = castRayInternal(rays[i].m_origin,
+							rays[i].m_dir,
+							rays[i].m_max_t,
+							-1,
+							any_hit,
+							candidates);
+					}
+				},
+				m_allocator);
+			job->addDependency(&m_sync_point);
+			m_jobs.push(job);
+		}
+		runJobs(m_jobs, m_sync_point);
+	}
+
+
 	int getPointLightIndex(ComponentIndex cmp) const
 	{
 		for (int i = 0; i < m_point_lights.size(); ++i)
@@ -2146,6 +2361,7 @@ private:
 	MTJD::Group m_sync_point;
 	Array<MTJD::Job*> m_jobs;
 	float m_time;
+	int m_frame;
 	bool m_is_forward_rendered;
 	DelegateList<void(ComponentIndex)> m_renderable_created;
 	DelegateList<void(ComponentIndex)> m_renderable_destroyed;
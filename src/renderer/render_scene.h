@@ -8,6 +8,7 @@
 #include "iplugin.h"
 #include "renderer/ray_cast_model_hit.h"
 #include "universe/component.h"
+#include <bgfx.h>
 
 
 namespace Lumix
@@ -16,7 +17,6 @@ namespace Lumix
 class Engine;
 class Frustum;
 class Geometry;
-class LIFOAllocator;
 class Material;
 class Mesh;
 class Model;
@@ -27,8 +27,10 @@ class Pose;
 class Renderer;
 class Shader;
 class Terrain;
+struct TerrainTile;
 class Timer;
 class Universe;
+struct Vec2;
 
 
 struct TerrainInfo
@@ -40,6 +42,8 @@ struct TerrainInfo
 	float m_size;
 	Vec3 m_min;
 	int m_index;
+	// resident tile covering the whole quad, nullptr if there is none
+	const TerrainTile* m_tile;
 };
 
 
@@ -55,8 +59,8 @@ struct RenderableMesh
 struct GrassInfo
 {
 	Model* m_model;
-	const Matrix* m_matrices;
-	int m_matrix_count;
+	bgfx::VertexBufferHandle m_instance_buffer;
+	int m_instance_count;
 };
 
 
@@ -69,6 +73,15 @@ struct DebugLine
 };
 
 
+struct Ray
+{
+	Vec3 m_origin;
+	Vec3 m_dir;
+	// hits farther than m_origin + m_dir * m_max_t are ignored
+	float m_max_t;
+};
+
+
 enum class RenderableType
 {
 	SKINNED_MESH,
@@ -91,6 +104,14 @@ public:
 									const Vec3& dir,
 									ComponentIndex ignore) = 0;
 
+	// rays are distributed to worker threads, any_hit returns any hit closer
+	// than the ray's m_max_t instead of the closest one, e.g. for visibility
+	// tests
+	virtual void castRays(const Ray* rays,
+		int count,
+		RayCastModelHit* hits,
+		bool any_hit) = 0;
+
 	virtual RayCastModelHit castRayTerrain(ComponentIndex terrain,
 										   const Vec3& origin,
 										   const Vec3& dir) = 0;
@@ -106,6 +127,13 @@ public:
 	virtual IAllocator& getAllocator() = 0;
 
 	virtual Pose& getPose(ComponentIndex cmp) = 0;
+	// incremented in update()
+	virtual int getFrame() const = 0;
+	// frame in which the renderable last passed culling in
+	// getRenderableInfos, -1 if never, and its squared distance to the
+	// closest frustum origin in that frame
+	virtual int getRenderableLastVisibleFrame(ComponentIndex cmp) = 0;
+	virtual float getRenderableVisibleSquaredDistance(ComponentIndex cmp) = 0;
 	virtual ComponentIndex getActiveGlobalLight() = 0;
 	virtual void setActiveGlobalLight(ComponentIndex cmp) = 0;
 
@@ -194,11 +222,27 @@ public:
 	virtual void getGrassInfos(const Frustum& frustum,
 							   Array<GrassInfo>& infos,
 							   int64_t layer_mask) = 0;
-	virtual void getTerrainInfos(Array<const TerrainInfo*>& infos,
+	// infos[i] gets the patches in frustums[i], the frustums are processed
+	// in parallel; LOD of the patches depends on the distance from camera_pos
+	virtual void getTerrainInfos(const Frustum* frustums,
+								 int frustum_count,
+								 Array<TerrainInfo>* infos,
 								 int64_t layer_mask,
-								 const Vec3& camera_pos,
-								 LIFOAllocator& allocator) = 0;
+								 const Vec3& camera_pos) = 0;
+	virtual void onTerrainHeightmapChanged(ComponentIndex cmp,
+										   int x,
+										   int z,
+										   int width,
+										   int height) = 0;
+	// call before the terrain's heightmap or splatmap data is written
+	virtual void waitForTerrainJobs(ComponentIndex cmp) = 0;
 	virtual float getTerrainHeightAt(ComponentIndex cmp, float x, float z) = 0;
+	// points are x, z pairs in terrain local space
+	virtual void getTerrainHeightsAt(ComponentIndex cmp,
+									 const Vec2* points,
+									 float* heights,
+									 int count) = 0;
+	virtual Vec3 getTerrainNormalAt(ComponentIndex cmp, float x, float z) = 0;
 	virtual void setTerrainMaterialPath(ComponentIndex cmp, const char* path) = 0;
 	virtual const char* getTerrainMaterialPath(ComponentIndex cmp) = 0;
 	virtual Material* getTerrainMaterial(ComponentIndex cmp) = 0;
@@ -206,6 +250,8 @@ public:
 	virtual float getTerrainXZScale(ComponentIndex cmp) = 0;
 	virtual void setTerrainYScale(ComponentIndex cmp, float scale) = 0;
 	virtual float getTerrainYScale(ComponentIndex cmp) = 0;
+	virtual void setTerrainTilesPath(ComponentIndex cmp, const char* path) = 0;
+	virtual const char* getTerrainTilesPath(ComponentIndex cmp) = 0;
 	virtual void
 	setTerrainBrush(ComponentIndex cmp, const Vec3& position, float size) = 0;
 	virtual void
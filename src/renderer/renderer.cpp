@@ -59,6 +59,12 @@ static const uint32_t GLOBAL_LIGHT_HASH = crc32("global_light");
 static const uint32_t POINT_LIGHT_HASH = crc32("point_light");
 static const uint32_t RENDERABLE_HASH = crc32("renderable");
 static const uint32_t CAMERA_HASH = crc32("camera");
+// released resources stay cached until their manager reaches its budget
+static const size_t TEXTURE_BUDGET = 256 * 1024 * 1024;
+static const size_t MODEL_BUDGET = 128 * 1024 * 1024;
+static const size_t MATERIAL_BUDGET = 1024 * 1024;
+// GPU memory of mips of streamed textures
+static const int TEXTURE_STREAMING_BUDGET = 512 * 1024 * 1024;
 
 
 struct RendererImpl : public Renderer
@@ -150,6 +156,10 @@ struct RendererImpl : public Renderer
 		m_material_manager.create(ResourceManager::MATERIAL, manager);
 		m_shader_manager.create(ResourceManager::SHADER, manager);
 		m_pipeline_manager.create(ResourceManager::PIPELINE, manager);
+		m_texture_manager.setBudget(TEXTURE_BUDGET);
+		m_texture_manager.setStreamingBudget(TEXTURE_STREAMING_BUDGET);
+		m_model_manager.setBudget(MODEL_BUDGET);
+		m_material_manager.setBudget(MATERIAL_BUDGET);
 
 		m_current_pass_hash = crc32("MAIN");
 		m_view_counter = 0;
@@ -159,6 +169,11 @@ struct RendererImpl : public Renderer
 
 	~RendererImpl()
 	{
+		// cached models hold materials and those hold textures
+		m_model_manager.clearCache();
+		m_material_manager.clearCache();
+		m_texture_manager.clearCache();
+
 		m_texture_manager.destroy();
 		m_model_manager.destroy();
 		m_material_manager.destroy();
@@ -353,6 +368,14 @@ struct RendererImpl : public Renderer
 				&RenderScene::setTerrainMaterialPath,
 				"Material (*.mat)",
 				allocator));
+		m_engine.registerProperty(
+			"terrain",
+			allocator.newObject<ResourcePropertyDescriptor<RenderScene>>(
+				"tiles",
+				&RenderScene::getTerrainTilesPath,
+				&RenderScene::setTerrainTilesPath,
+				"Terrain tiles (*.tiles)",
+				allocator));
 		m_engine.registerProperty(
 			"terrain",
 			allocator.newObject<DecimalPropertyDescriptor<RenderScene>>(
@@ -441,6 +464,7 @@ struct RendererImpl : public Renderer
 
 	virtual void frame() override
 	{
+		m_texture_manager.updateStreaming();
 		bgfx::frame();
 		m_view_counter = 0;
 	}
@@ -1,4 +1,5 @@
 #include "renderer/shader.h"
+#include "core/blob.h"
 #include "core/crc32.h"
 #include "core/fs/file_system.h"
 #include "core/fs/ifile.h"
@@ -112,8 +113,6 @@ void Shader::parseTextureSlots(lua_State* L)
 					copyString(m_texture_slots[i].m_uniform,
 							   sizeof(m_texture_slots[i].m_uniform),
 							   lua_tostring(L, -1));
-					m_texture_slots[i].m_uniform_handle = bgfx::createUniform(
-						m_texture_slots[i].m_uniform, bgfx::UniformType::Int1);
 					m_texture_slots[i].m_uniform_hash =
 						crc32(m_texture_slots[i].m_uniform);
 				}
@@ -319,48 +318,47 @@ void ShaderCombinations::parse(lua_State* L)
 }
 
 
-void Shader::loaded(FS::IFile& file, bool success, FS::FileSystem& fs)
+bool Shader::parse(InputBlob& data)
 {
-	if (success)
+	PROFILE_FUNCTION();
+	lua_State* L = luaL_newstate();
+	luaL_openlibs(L);
+
+	bool errors =
+		luaL_loadbuffer(
+			L, (const char*)data.getData(), data.getSize(), "") != LUA_OK;
+	errors = errors || lua_pcall(L, 0, LUA_MULTRET, 0) != LUA_OK;
+	if (!errors)
 	{
-		lua_State* L = luaL_newstate();
-		luaL_openlibs(L);
-
-		bool errors =
-			luaL_loadbuffer(
-				L, (const char*)file.getBuffer(), file.size(), "") != LUA_OK;
-		errors = errors || lua_pcall(L, 0, LUA_MULTRET, 0) != LUA_OK;
-		if (errors)
-		{
-			g_log_error.log("lua") << getPath().c_str() << ": "
-								   << lua_tostring(L, -1);
-			lua_pop(L, 1);
-			onFailure();
-		}
-		else
+		parseTextureSlots(L);
+		m_combintions.parse(L);
+	}
+	else
+	{
+		setParseError(lua_tostring(L, -1));
+	}
+	lua_close(L);
+	return !errors;
+}
+
+
+bool Shader::commit(InputBlob&)
+{
+	for (int i = 0; i < m_texture_slot_count; ++i)
+	{
+		if (m_texture_slots[i].m_uniform[0] != '\0')
 		{
-			parseTextureSlots(L);
-			m_combintions.parse(L);
-			if (!generateInstances())
-			{
-				g_log_error.log("renderer")
-					<< "Could not load instances of shader " << m_path.c_str();
-				onFailure();
-			}
-			else
-			{
-				m_size = file.size();
-				decrementDepCount();
-			}
+			m_texture_slots[i].m_uniform_handle = bgfx::createUniform(
+				m_texture_slots[i].m_uniform, bgfx::UniformType::Int1);
 		}
-		lua_close(L);
 	}
-	else
+	if (!generateInstances())
 	{
-		g_log_error.log("renderer") << "Could not load shader "
+		g_log_error.log("renderer") << "Could not load instances of shader "
 									<< m_path.c_str();
-		onFailure();
+		return false;
 	}
+	return true;
 }
 
 
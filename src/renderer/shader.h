@@ -108,7 +108,8 @@ class LUMIX_RENDERER_API Shader : public Resource
 		Renderer& getRenderer();
 
 		virtual void doUnload(void) override;
-		virtual void loaded(FS::IFile& file, bool success, FS::FileSystem& fs) override;
+		virtual bool parse(InputBlob& data) override;
+		virtual bool commit(InputBlob& data) override;
 
 	private:
 		IAllocator&			m_allocator;
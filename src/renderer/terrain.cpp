@@ -4,9 +4,10 @@
 #include "core/crc32.h"
 #include "core/frustum.h"
 #include "core/json_serializer.h"
-#include "core/lifo_allocator.h"
 #include "core/log.h"
 #include "core/math_utils.h"
+#include "core/mtjd/generic_job.h"
+#include "core/mtjd/manager.h"
 #include "core/profiler.h"
 #include "core/resource_manager.h"
 #include "engine.h"
@@ -19,12 +20,14 @@
 #include "renderer/texture.h"
 #include "universe/universe.h"
 #include <cfloat>
+#include <cmath>
 
 
 namespace Lumix
 {
 	
 	static const float GRASS_QUAD_RADIUS = Terrain::GRASS_QUAD_SIZE * 0.7072f;
+	static const int MAX_GRASS_JOBS = 4;
 	static const int GRID_SIZE = 16;
 	static const int COPY_COUNT = 50;
 	static const uint32_t TERRAIN_HASH = crc32("terrain");
@@ -44,137 +47,126 @@ namespace Lumix
 		float u, v;
 	};
 
-	struct TerrainQuad
+	// rand() is neither thread safe nor deterministic when quads are generated
+	// in jobs, each patch has its own generator
+	struct GrassRandom
 	{
-		enum ChildType
-		{
-			TOP_LEFT,
-			TOP_RIGHT,
-			BOTTOM_LEFT,
-			BOTTOM_RIGHT,
-			CHILD_COUNT
-		};
+		explicit GrassRandom(uint32_t seed) : m_seed(seed) {}
 
-		TerrainQuad(IAllocator& allocator)
-			: m_allocator(allocator)
+		uint32_t next()
 		{
-			for (int i = 0; i < CHILD_COUNT; ++i)
-			{
-				m_children[i] = nullptr;
-			}
+			m_seed = m_seed * 1103515245 + 12345;
+			return (m_seed >> 8) & 0xffff;
 		}
 
-		~TerrainQuad()
+		float next(float from, float to)
 		{
-			for (int i = 0; i < CHILD_COUNT; ++i)
-			{
-				m_allocator.deleteObject(m_children[i]);
-			}
+			return from + (to - from) * next() / 65535.0f;
 		}
 
-		void createChildren()
+		// in [0, count)
+		int next(int count)
 		{
-			if (m_lod < 16 && m_size > 16)
-			{
-				for (int i = 0; i < CHILD_COUNT; ++i)
-				{
-					m_children[i] = m_allocator.newObject<TerrainQuad>(m_allocator);
-					m_children[i]->m_lod = m_lod + 1;
-					m_children[i]->m_size = m_size / 2;
-				}
-				m_children[TOP_LEFT]->m_min = m_min;
-				m_children[TOP_RIGHT]->m_min.set(m_min.x + m_size / 2, 0, m_min.z);
-				m_children[BOTTOM_LEFT]->m_min.set(m_min.x, 0, m_min.z + m_size / 2);
-				m_children[BOTTOM_RIGHT]->m_min.set(m_min.x + m_size / 2, 0, m_min.z + m_size / 2);
-				for (int i = 0; i < CHILD_COUNT; ++i)
-				{
-					m_children[i]->createChildren();
-				}
-			}
+			return (int)(next() * (uint32_t)count >> 16);
 		}
 
-		float getSquaredDistance(const Vec3& camera_pos)
+		uint32_t m_seed;
+	};
+
+
+	static uint32_t getGrassSeed(float quad_x, float quad_z, int ground)
+	{
+		return (uint32_t)(int)(quad_x / Terrain::GRASS_QUAD_SIZE) * 73856093 ^
+			   (uint32_t)(int)(quad_z / Terrain::GRASS_QUAD_SIZE) * 19349663 ^
+			   (uint32_t)ground * 83492791;
+	}
+
+
+	// fraction of the instances drawn, patches are shuffled so the first
+	// instances cover the whole quad
+	static float getGrassDensityFalloff(float distance)
+	{
+		const float FALLOFF_START = (float)Terrain::GRASS_QUAD_SIZE;
+		const float FALLOFF_END = (float)Terrain::GRASS_QUAD_SIZE * ((Terrain::GRASS_QUADS_COLUMNS >> 1) + 1);
+		const float MIN_DENSITY = 0.2f;
+		float t = Math::clamp((distance - FALLOFF_START) / (FALLOFF_END - FALLOFF_START), 0.0f, 1.0f);
+		return 1 - t * (1 - MIN_DENSITY);
+	}
+
+
+	// quads do not get smaller than a patch of the terrain mesh
+	static const int MAX_QUAD_LEVELS = 16;
+	static const float MIN_QUAD_SIZE = 16;
+	// a ray cast pushes at most four quads per level
+	static const int MAX_RAY_STACK_SIZE = MAX_QUAD_LEVELS * 4;
+
+
+	static float getQuadSquaredDistance(const Vec3& camera_pos, float min_x, float min_z, float size)
+	{
+		float dist = 0;
+		if (camera_pos.x < min_x)
 		{
-			Vec3 _min = m_min;
-			Vec3 _max(_min.x + m_size, _min.y, _min.z + m_size);
-			float dist = 0;
-			if (camera_pos.x < _min.x)
-			{
-				float d = _min.x - camera_pos.x;
-				dist += d*d;
-			}
-			if (camera_pos.x > _max.x)
-			{
-				float d = _max.x - camera_pos.x;
-				dist += d*d;
-			}
-			if (camera_pos.z < _min.z)
-			{
-				float d = _min.z - camera_pos.z;
-				dist += d*d;
-			}
-			if (camera_pos.z > _max.z)
-			{
-				float d = _max.z - camera_pos.z;
-				dist += d*d;
-			}
-			return dist;
+			float d = min_x - camera_pos.x;
+			dist += d*d;
 		}
-
-		static float getRadiusInner(float size)
+		if (camera_pos.x > min_x + size)
 		{
-			float lower_level_size = size * 0.5f;
-			float lower_level_diagonal = Math::SQRT2 * size * 0.5f;
-			return getRadiusOuter(lower_level_size) + lower_level_diagonal;
+			float d = min_x + size - camera_pos.x;
+			dist += d*d;
 		}
-
-		static float getRadiusOuter(float size)
+		if (camera_pos.z < min_z)
 		{
-			return (size > 17 ? 2.25f : 1.25f) * Math::SQRT2 * size;
+			float d = min_z - camera_pos.z;
+			dist += d*d;
 		}
-
-		bool getInfos(Array<const TerrainInfo*>& infos, const Vec3& camera_pos, Terrain* terrain, const Matrix& world_matrix, LIFOAllocator& allocator)
+		if (camera_pos.z > min_z + size)
 		{
-			float squared_dist = getSquaredDistance(camera_pos);
-			float r = getRadiusOuter(m_size);
-			if (squared_dist > r*r && m_lod > 1)
-			{
-				return false;
-			}
-			
-			Vec3 morph_const(r, getRadiusInner(m_size), 0);
-			Shader& shader = *terrain->getMesh()->getMaterial()->getShader();
-			for (int i = 0; i < CHILD_COUNT; ++i)
-			{
-				if (!m_children[i] || !m_children[i]->getInfos(infos, camera_pos, terrain, world_matrix, allocator))
-				{
-					TerrainInfo* data = (TerrainInfo*)allocator.allocate(sizeof(TerrainInfo));
-					data->m_morph_const = morph_const;
-					data->m_index = i;
-					data->m_terrain = terrain;
-					data->m_size = m_size;
-					data->m_min = m_min;
-					data->m_shader = &shader;
-					data->m_world_matrix = world_matrix;
-					infos.push(data);
-				}
-			}
-			return true;
+			float d = min_z + size - camera_pos.z;
+			dist += d*d;
 		}
+		return dist;
+	}
+
+
+	static float getQuadRadiusOuter(float size)
+	{
+		return (size > 17 ? 2.25f : 1.25f) * Math::SQRT2 * size;
+	}
+
+
+	static float getQuadRadiusInner(float size)
+	{
+		float lower_level_size = size * 0.5f;
+		float lower_level_diagonal = Math::SQRT2 * size * 0.5f;
+		return getQuadRadiusOuter(lower_level_size) + lower_level_diagonal;
+	}
+
+
+	// quads of a level are stored after all quads of the previous levels
+	static int getQuadIndex(int level, int x, int z)
+	{
+		return ((1 << (2 * level)) - 1) / 3 + x + (z << level);
+	}
 
 
-		IAllocator& m_allocator;
-		TerrainQuad* m_children[CHILD_COUNT];
-		Vec3 m_min;
-		float m_size;
-		int m_lod;
+	struct QuadTraversal
+	{
+		const Frustum* frustum;
+		Vec3 camera_pos;
+		Matrix world_matrix;
+		Shader* shader;
+		Array<TerrainInfo>* infos;
 	};
 
 
 	Terrain::Terrain(Renderer& renderer, Entity entity, RenderScene& scene, IAllocator& allocator)
 		: m_mesh(nullptr)
 		, m_material(nullptr)
-		, m_root(nullptr)
+		, m_quads(allocator)
+		, m_height_field(allocator)
+		, m_tiles(scene.getEngine().getFileSystem(), scene.getEngine().getMTJDManager(), allocator)
+		, m_quad_levels(0)
+		, m_root_size(0)
 		, m_detail_texture(nullptr)
 		, m_width(0)
 		, m_height(0)
@@ -186,9 +178,12 @@ namespace Lumix
 		, m_brush_size(1)
 		, m_allocator(allocator)
 		, m_grass_quads(m_allocator)
-		, m_last_camera_position(m_allocator)
 		, m_grass_types(m_allocator)
 		, m_free_grass_quads(m_allocator)
+		, m_generating_grass_quads(m_allocator)
+		, m_generated_grass_quads(m_allocator)
+		, m_grass_mutex(false)
+		, m_grass_sync_point(true, allocator)
 		, m_renderer(renderer)
 	{
 		generateGeometry();
@@ -205,21 +200,14 @@ namespace Lumix
 
 	Terrain::~Terrain()
 	{
+		waitForGrassJobs();
 		setMaterial(nullptr);
 		m_allocator.deleteObject(m_mesh);
-		m_allocator.deleteObject(m_root);
 		for(int i = 0; i < m_grass_types.size(); ++i)
 		{
 			m_allocator.deleteObject(m_grass_types[i]);
 		}
-		for (int j = 0; j < m_grass_quads.size(); ++j)
-		{
-			Array<GrassQuad*>& quads = m_grass_quads.at(j);
-			for (int i = 0; i < quads.size(); ++i)
-			{
-				m_allocator.deleteObject(quads[i]);
-			}
-		}
+		forceGrassUpdate();
 		for (int i = 0; i < m_free_grass_quads.size(); ++i)
 		{
 			m_allocator.deleteObject(m_free_grass_quads[i]);
@@ -238,7 +226,7 @@ namespace Lumix
 
 	float Terrain::getRootSize() const 
 	{
-		return m_root ? m_root->m_size : 0;
+		return m_root_size;
 	}
 
 
@@ -325,16 +313,19 @@ namespace Lumix
 
 	void Terrain::forceGrassUpdate()
 	{
-		m_force_grass_update = true;
 		for (int i = 0; i < m_grass_quads.size(); ++i)
 		{
 			Array<GrassQuad*>& quads = m_grass_quads.at(i);
 			while(!quads.empty())
 			{
-				m_free_grass_quads.push(quads.back());
+				freeGrassQuad(quads.back());
 				quads.pop();
 			}
 		}
+		for (int i = 0; i < m_generating_grass_quads.size(); ++i)
+		{
+			m_generating_grass_quads[i]->m_is_outdated = true;
+		}
 	}
 
 	Array<Terrain::GrassQuad*>& Terrain::getQuads(ComponentIndex camera)
@@ -349,124 +340,269 @@ namespace Lumix
 	}
 
 
+	bool Terrain::hasGrassQuad(ComponentIndex camera, float x, float z)
+	{
+		Array<GrassQuad*>& quads = getQuads(camera);
+		for (int i = 0; i < quads.size(); ++i)
+		{
+			if (quads[i]->m_x == x && quads[i]->m_z == z)
+			{
+				return true;
+			}
+		}
+		for (int i = 0; i < m_generating_grass_quads.size(); ++i)
+		{
+			GrassQuad* quad = m_generating_grass_quads[i];
+			if (quad->m_camera == camera && !quad->m_is_outdated && quad->m_x == x && quad->m_z == z)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+
 	void Terrain::updateGrass(ComponentIndex camera)
 	{
 		PROFILE_FUNCTION();
-		if (!m_splatmap)
+		finishGrassQuads();
+		if (!m_splatmap || !m_heightmap || m_grass_types.empty())
 		{
 			return;
 		}
 
 		Array<GrassQuad*>& quads = getQuads(camera);
 
-		if (m_free_grass_quads.size() + quads.size() < GRASS_QUADS_ROWS * GRASS_QUADS_COLUMNS)
+		Universe& universe = m_scene.getUniverse();
+		Entity camera_entity = m_scene.getCameraEntity(camera);
+		Vec3 camera_position = universe.getPosition(camera_entity);
+		Matrix mtx = universe.getMatrix(m_entity);
+		Matrix inv_mtx = mtx;
+		inv_mtx.fastInverse();
+		Vec3 local_camera_position = inv_mtx.multiplyPosition(camera_position);
+		float cx = (int)(local_camera_position.x / (GRASS_QUAD_SIZE)) * (float)GRASS_QUAD_SIZE;
+		float cz = (int)(local_camera_position.z / (GRASS_QUAD_SIZE)) * (float)GRASS_QUAD_SIZE;
+		const int half_columns = GRASS_QUADS_COLUMNS >> 1;
+		const int half_rows = GRASS_QUADS_ROWS >> 1;
+		float from_quad_x = cx - half_columns * GRASS_QUAD_SIZE;
+		float from_quad_z = cz - half_rows * GRASS_QUAD_SIZE;
+		float to_quad_x = cx + half_columns * GRASS_QUAD_SIZE;
+		float to_quad_z = cz + half_rows * GRASS_QUAD_SIZE;
+
+		for (int i = quads.size() - 1; i >= 0; --i)
 		{
-			int new_count = GRASS_QUADS_ROWS * GRASS_QUADS_COLUMNS - quads.size();
-			for (int i = 0; i < new_count; ++i)
+			GrassQuad* quad = quads[i];
+			if (quad->m_x < from_quad_x || quad->m_x > to_quad_x || quad->m_z < from_quad_z || quad->m_z > to_quad_z)
 			{
-				m_free_grass_quads.push(m_allocator.newObject<GrassQuad>(m_allocator));
+				freeGrassQuad(quads[i]);
+				quads.eraseFast(i);
 			}
 		}
 
-		Universe& universe = m_scene.getUniverse();
-		Entity camera_entity = m_scene.getCameraEntity(camera);
-		Vec3 camera_position = universe.getPosition(camera_entity);
-		if ((m_last_camera_position[camera] - camera_position).length() > 1 || m_force_grass_update)
-		{
-			m_force_grass_update = false;
-			Matrix mtx = universe.getMatrix(m_entity);
-			Matrix inv_mtx = mtx;
-			inv_mtx.fastInverse();
-			Vec3 local_camera_position = inv_mtx.multiplyPosition(camera_position);
-			float cx = (int)(local_camera_position.x / (GRASS_QUAD_SIZE)) * (float)GRASS_QUAD_SIZE;
-			float cz = (int)(local_camera_position.z / (GRASS_QUAD_SIZE)) * (float)GRASS_QUAD_SIZE;
-			float from_quad_x = cx - (GRASS_QUADS_COLUMNS >> 1) * GRASS_QUAD_SIZE;
-			float from_quad_z = cz - (GRASS_QUADS_ROWS >> 1) * GRASS_QUAD_SIZE;
-			float to_quad_x = cx + (GRASS_QUADS_COLUMNS >> 1) * GRASS_QUAD_SIZE;
-			float to_quad_z = cz + (GRASS_QUADS_COLUMNS >> 1) * GRASS_QUAD_SIZE;
-
-			float old_bounds[4] = { FLT_MAX, -FLT_MAX, FLT_MAX, -FLT_MAX };
-			for (int i = quads.size() - 1; i >= 0; --i)
-			{
-				GrassQuad* quad = quads[i];
-				old_bounds[0] = Math::minValue(old_bounds[0], quad->m_x);
-				old_bounds[1] = Math::maxValue(old_bounds[1], quad->m_x);
-				old_bounds[2] = Math::minValue(old_bounds[2], quad->m_z);
-				old_bounds[3] = Math::maxValue(old_bounds[3], quad->m_z);
-				if (quad->m_x < from_quad_x || quad->m_x > to_quad_x || quad->m_z < from_quad_z || quad->m_z > to_quad_z)
+		// missing quads are generated nearest first, at most MAX_GRASS_JOBS
+		// at once, the rest waits for the next frames
+		float width = m_width * m_scale.x;
+		float height = m_height * m_scale.z;
+		int max_ring = Math::maxValue(half_columns, half_rows);
+		for (int ring = 0; ring <= max_ring; ++ring)
+		{
+			for (int j = -ring; j <= ring; ++j)
+			{
+				for (int i = -ring; i <= ring; ++i)
 				{
-					m_free_grass_quads.push(quads[i]);
-					quads.eraseFast(i);
+					if (Math::maxValue(Math::abs(i), Math::abs(j)) != ring || Math::abs(i) > half_columns ||
+						Math::abs(j) > half_rows)
+					{
+						continue;
+					}
+					float quad_x = cx + i * GRASS_QUAD_SIZE;
+					float quad_z = cz + j * GRASS_QUAD_SIZE;
+					if (quad_x < 0 || quad_z < 0 || quad_x >= width || quad_z >= height || hasGrassQuad(camera, quad_x, quad_z))
+					{
+						continue;
+					}
+					if (m_generating_grass_quads.size() >= MAX_GRASS_JOBS)
+					{
+						return;
+					}
+					startGrassQuad(camera, quad_x, quad_z, mtx);
 				}
 			}
+		}
+	}
+
+
+	void Terrain::startGrassQuad(ComponentIndex camera, float x, float z, const Matrix& mtx)
+	{
+		GrassQuad* quad = nullptr;
+		if (!m_free_grass_quads.empty())
+		{
+			quad = m_free_grass_quads.back();
+			m_free_grass_quads.pop();
+		}
+		else
+		{
+			quad = m_allocator.newObject<GrassQuad>(m_allocator);
+		}
+		quad->m_x = x;
+		quad->m_z = z;
+		quad->m_camera = camera;
+		quad->m_is_outdated = false;
+		quad->m_patches.clear();
+		float model_radius = 0;
+		for (int i = 0; i < m_grass_types.size(); ++i)
+		{
+			GrassType* type = m_grass_types[i];
+			if (!type->m_grass_model || !type->m_grass_model->isReady() || type->m_density <= 0)
+			{
+				continue;
+			}
+			GrassPatch& patch = quad->m_patches.emplace(m_allocator);
+			patch.m_type = type;
+			patch.m_ground = type->m_ground;
+			patch.m_density = type->m_density;
+			model_radius = Math::maxValue(model_radius, type->m_grass_model->getBoundingRadius());
+		}
+
+		m_generating_grass_quads.push(quad);
+		MTJD::Manager& manager = m_scene.getEngine().getMTJDManager();
+		MTJD::Job* job = MTJD::makeJob(manager,
+			[this, quad, mtx, model_radius]()
+			{
+				generateGrassQuad(*quad, mtx, model_radius);
+
+				MT::SpinLock lock(m_grass_mutex);
+				m_generated_grass_quads.push(quad);
+			},
+			m_allocator);
+		job->addDependency(&m_grass_sync_point);
+		manager.schedule(job);
+	}
 
-			from_quad_x = Math::maxValue(0.0f, from_quad_x);
-			from_quad_z = Math::maxValue(0.0f, from_quad_z);
 
-			for (float quad_z = from_quad_z; quad_z <= to_quad_z; quad_z += GRASS_QUAD_SIZE)
+	// runs in a worker thread, it touches only the quad and reads the
+	// heightmap, the splatmap and the resident tiles
+	void Terrain::generateGrassQuad(GrassQuad& quad, const Matrix& mtx, float model_radius)
+	{
+		Vec3 min_pos(FLT_MAX, FLT_MAX, FLT_MAX);
+		Vec3 max_pos(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for (int patch_idx = 0; patch_idx < quad.m_patches.size(); ++patch_idx)
+		{
+			GrassPatch& patch = quad.m_patches[patch_idx];
+			GrassRandom random(getGrassSeed(quad.m_x, quad.m_z, patch.m_ground));
+			float step = GRASS_QUAD_SIZE / (float)patch.m_density;
+			for (float dx = 0; dx < GRASS_QUAD_SIZE; dx += step)
 			{
-				for (float quad_x = from_quad_x; quad_x <= to_quad_x; quad_x += GRASS_QUAD_SIZE)
+				for (float dz = 0; dz < GRASS_QUAD_SIZE; dz += step)
 				{
-					if (quad_x < old_bounds[0] || quad_x > old_bounds[1] || quad_z < old_bounds[2] || quad_z > old_bounds[3])
+					uint32_t pixel_value = getSplat(quad.m_x + dx, quad.m_z + dz);
+					uint8_t count = (pixel_value >> (8 * patch.m_ground)) & 0xff;
+					float density = count / 255.0f;
+					if (density > 0.25f)
 					{
-						GrassQuad* quad = nullptr;
-						if(!m_free_grass_quads.empty())
-						{
-							quad = m_free_grass_quads.back();
-							m_free_grass_quads.pop();
-						}
-						else
-						{
-							quad = m_allocator.newObject<GrassQuad>(m_allocator);
-						}
-						quads.push(quad);
-						quad->m_x = quad_x;
-						quad->m_z = quad_z;
-						quad->m_patches.clear();
-						srand((int)quad_x + (int)quad_z * GRASS_QUADS_COLUMNS);
-						for(int grass_type_idx = 0; grass_type_idx < m_grass_types.size(); ++grass_type_idx)
-						{
-							if (!m_grass_types[grass_type_idx]->m_grass_model->isReady())
-								continue;
-							GrassPatch& patch = quad->m_patches.emplace(m_allocator);
-							patch.m_matrices.clear();
-							patch.m_type = m_grass_types[grass_type_idx];
-							if (patch.m_type->m_grass_model && patch.m_type->m_grass_model->isReady())
-							{
-								int index = 0;
-								Texture* splat_map = m_splatmap;
-								float step = GRASS_QUAD_SIZE / (float)patch.m_type->m_density;
-								for (float dx = 0; dx < GRASS_QUAD_SIZE; dx += step)
-								{
-									for (float dz = 0; dz < GRASS_QUAD_SIZE; dz += step)
-									{
-										uint32_t pixel_value = splat_map->getPixel(splat_map->getWidth() * (quad_x + dx) / (m_width * m_scale.x), splat_map->getHeight() * (quad_z + dz) / (m_height * m_scale.x));
-										uint8_t count = (pixel_value >> (8 * patch.m_type->m_ground)) & 0xff;
-										float density = count / 255.0f;
-										if(density > 0.25f)
-										{
-											Matrix& grass_mtx = patch.m_matrices.pushEmpty();
-											grass_mtx = Matrix::IDENTITY;
-											float x = quad_x + dx + step * (rand() % 100 - 50) / 100.0f;
-											float z = quad_z + dz + step * (rand() % 100 - 50) / 100.0f;
-											grass_mtx.setTranslation(Vec3(x, getHeight(x, z), z));
-											Quat q(Vec3(0, 1, 0), Math::degreesToRadians((float)(rand() % 360)));
-											Matrix rotMatrix;
-											q.toMatrix(rotMatrix);
-											grass_mtx = mtx * grass_mtx * rotMatrix;
-											grass_mtx.multiply3x3(density + (rand() % 20 - 10) / 100.0f);
-										}
-
-										++index;
-									}
-								}
-							}
-						}
+						float x = quad.m_x + dx + step * random.next(-0.5f, 0.5f);
+						float z = quad.m_z + dz + step * random.next(-0.5f, 0.5f);
+						Vec3 position(x, getHeight(x, z), z);
+						min_pos.set(Math::minValue(min_pos.x, x), Math::minValue(min_pos.y, position.y), Math::minValue(min_pos.z, z));
+						max_pos.set(Math::maxValue(max_pos.x, x), Math::maxValue(max_pos.y, position.y), Math::maxValue(max_pos.z, z));
+
+						Matrix& grass_mtx = patch.m_matrices.pushEmpty();
+						grass_mtx = Matrix::IDENTITY;
+						grass_mtx.setTranslation(position);
+						Quat q(Vec3(0, 1, 0), random.next(0, 2 * Math::PI));
+						Matrix rotMatrix;
+						q.toMatrix(rotMatrix);
+						grass_mtx = mtx * grass_mtx * rotMatrix;
+						grass_mtx.multiply3x3(density + random.next(-0.1f, 0.1f));
 					}
 				}
 			}
-			m_last_camera_position[camera] = camera_position;
+
+			for (int i = patch.m_matrices.size() - 1; i > 0; --i)
+			{
+				int j = random.next(i + 1);
+				Matrix tmp = patch.m_matrices[i];
+				patch.m_matrices[i] = patch.m_matrices[j];
+				patch.m_matrices[j] = tmp;
+			}
+		}
+
+		if (min_pos.x > max_pos.x)
+		{
+			quad.m_center = mtx.multiplyPosition(Vec3(quad.m_x, 0, quad.m_z));
+			quad.m_radius = 0;
+			return;
+		}
+		// instances are scaled by at most 1.1
+		quad.m_center = mtx.multiplyPosition((min_pos + max_pos) * 0.5f);
+		quad.m_radius = (max_pos - min_pos).length() * 0.5f + model_radius * 1.1f;
+	}
+
+
+	void Terrain::finishGrassQuads()
+	{
+		// the same layout as instance data buffers, i_data0 - i_data3
+		bgfx::VertexDecl instance_decl;
+		instance_decl.begin()
+			.add(bgfx::Attrib::TexCoord7, 4, bgfx::AttribType::Float)
+			.add(bgfx::Attrib::TexCoord6, 4, bgfx::AttribType::Float)
+			.add(bgfx::Attrib::TexCoord5, 4, bgfx::AttribType::Float)
+			.add(bgfx::Attrib::TexCoord4, 4, bgfx::AttribType::Float)
+			.end();
+
+		MT::SpinLock lock(m_grass_mutex);
+		for (int i = 0; i < m_generated_grass_quads.size(); ++i)
+		{
+			GrassQuad* quad = m_generated_grass_quads[i];
+			m_generating_grass_quads.eraseItemFast(quad);
+			if (quad->m_is_outdated)
+			{
+				freeGrassQuad(quad);
+				continue;
+			}
+			for (int j = 0; j < quad->m_patches.size(); ++j)
+			{
+				GrassPatch& patch = quad->m_patches[j];
+				patch.m_instance_count = patch.m_matrices.size();
+				if (!patch.m_matrices.empty())
+				{
+					const bgfx::Memory* mem = bgfx::copy(
+						&patch.m_matrices[0], patch.m_matrices.size() * sizeof(patch.m_matrices[0]));
+					patch.m_instance_buffer = bgfx::createVertexBuffer(mem, instance_decl);
+				}
+				Array<Matrix> empty(m_allocator);
+				patch.m_matrices.swap(empty);
+			}
+			getQuads(quad->m_camera).push(quad);
+		}
+		m_generated_grass_quads.clear();
+	}
+
+
+	void Terrain::freeGrassQuad(GrassQuad* quad)
+	{
+		for (int i = 0; i < quad->m_patches.size(); ++i)
+		{
+			GrassPatch& patch = quad->m_patches[i];
+			if (bgfx::isValid(patch.m_instance_buffer))
+			{
+				bgfx::destroyVertexBuffer(patch.m_instance_buffer);
+				patch.m_instance_buffer = BGFX_INVALID_HANDLE;
+			}
+		}
+		m_free_grass_quads.push(quad);
+	}
+
+
+	void Terrain::waitForGrassJobs()
+	{
+		// every quad in m_generating_grass_quads has a job, the sync point
+		// has no dependencies without them
+		if (!m_generating_grass_quads.empty())
+		{
+			m_grass_sync_point.sync();
 		}
+		finishGrassQuads();
 	}
 
 
@@ -479,25 +615,29 @@ namespace Lumix
 	}
 
 
-	void Terrain::getGrassInfos(const Frustum&, Array<GrassInfo>& infos, ComponentIndex camera)
+	void Terrain::getGrassInfos(const Frustum& frustum, Array<GrassInfo>& infos, ComponentIndex camera)
 	{
 		updateGrass(camera);
 		Array<GrassQuad*>& quads = getQuads(camera);
+		Vec3 camera_position = m_scene.getUniverse().getPosition(m_scene.getCameraEntity(camera));
 		for (int i = 0; i < quads.size(); ++i)
 		{
-			//Vec3 quad_center(quads[i]->m_x + GRASS_QUAD_SIZE * 0.5f, 0, quads[i]->m_z + GRASS_QUAD_SIZE * 0.5f);
-			//if(frustum.isSphereInside(quad_center, GRASS_QUAD_RADIUS)) 
+			const GrassQuad& quad = *quads[i];
+			if (!frustum.isSphereInside(quad.m_center, quad.m_radius))
+			{
+				continue;
+			}
+			float falloff = getGrassDensityFalloff((quad.m_center - camera_position).length() - GRASS_QUAD_RADIUS);
+			for(int patch_idx = 0; patch_idx < quad.m_patches.size(); ++patch_idx)
 			{
-				for(int patch_idx = 0; patch_idx < quads[i]->m_patches.size(); ++patch_idx)
+				const GrassPatch& patch = quad.m_patches[patch_idx];
+				int count = (int)(patch.m_instance_count * falloff + 0.5f);
+				if (count > 0)
 				{
-					const GrassPatch& patch = quads[i]->m_patches[patch_idx];
-					if (!patch.m_matrices.empty())
-					{
-						GrassInfo& info = infos.pushEmpty();
-						info.m_matrices = &patch.m_matrices[0];
-						info.m_matrix_count = patch.m_matrices.size();
-						info.m_model = patch.m_type->m_grass_model;
-					}
+					GrassInfo& info = infos.pushEmpty();
+					info.m_instance_buffer = patch.m_instance_buffer;
+					info.m_instance_count = count;
+					info.m_model = patch.m_type->m_grass_model;
 				}
 			}
 		}
@@ -508,6 +648,7 @@ namespace Lumix
 	{
 		if (material != m_material)
 		{
+			waitForGrassJobs();
 			if (m_material)
 			{
 				m_material->getResourceManager().get(ResourceManager::MATERIAL)->unload(*m_material);
@@ -528,7 +669,7 @@ namespace Lumix
 		}
 	}
 
-	void Terrain::deserialize(InputBlob& serializer, Universe& universe, RenderScene& scene, int index)
+	void Terrain::deserialize(InputBlob& serializer, Universe& universe, RenderScene& scene, int index, int version)
 	{
 		serializer.read(m_entity);
 		serializer.read(m_layer_mask);
@@ -556,6 +697,11 @@ namespace Lumix
 			serializer.read(m_grass_types[i]->m_density);
 			setGrassTypePath(i, Path(path));
 		}
+		if (version > (int)SerializedEngineVersion::TERRAIN_TILES)
+		{
+			serializer.readString(path, MAX_PATH_LENGTH);
+			setTilesPath(Path(path));
+		}
 		universe.addComponent(m_entity, TERRAIN_HASH, &scene, index);
 	}
 
@@ -576,73 +722,250 @@ namespace Lumix
 			serializer.write(type.m_density);
 
 		}
+		serializer.writeString(m_tiles.getPath().c_str());
 	}
 
 
-	void Terrain::getInfos(Array<const TerrainInfo*>& infos, const Vec3& camera_pos, LIFOAllocator& allocator)
+	void Terrain::getInfos(Array<TerrainInfo>& infos, const Frustum& frustum, const Vec3& camera_pos)
 	{
-		if (m_root)
+		if (m_quads.empty())
 		{
-			Matrix matrix = m_scene.getUniverse().getMatrix(m_entity);
-			Matrix inv_matrix = matrix;
-			inv_matrix.fastInverse();
-			Vec3 local_camera_pos = inv_matrix.multiplyPosition(camera_pos);
-			local_camera_pos.x /= m_scale.x;
-			local_camera_pos.z /= m_scale.z;
-			m_root->getInfos(infos, local_camera_pos, this, matrix, allocator);
+			return;
+		}
+		QuadTraversal traversal;
+		traversal.frustum = &frustum;
+		traversal.world_matrix = m_scene.getUniverse().getMatrix(m_entity);
+		Matrix inv_matrix = traversal.world_matrix;
+		inv_matrix.fastInverse();
+		traversal.camera_pos = inv_matrix.multiplyPosition(camera_pos);
+		traversal.camera_pos.x /= m_scale.x;
+		traversal.camera_pos.z /= m_scale.z;
+		traversal.shader = m_mesh->getMaterial()->getShader();
+		traversal.infos = &infos;
+		if (isQuadVisible(traversal, 0, 0, 0))
+		{
+			getQuadInfos(traversal, 0, 0, 0);
 		}
 	}
 
-	
-	float Terrain::getHeight(float x, float z)
+
+	bool Terrain::isQuadVisible(const QuadTraversal& traversal, int level, int x, int z) const
 	{
-		int int_x = (int)(x / m_scale.x);
-		int int_z = (int)(z / m_scale.x);
-		float dec_x = (x - (int_x * m_scale.x)) / m_scale.x;
-		float dec_z = (z - (int_z * m_scale.x)) / m_scale.x;
-		if (dec_z == 0 && dec_x == 0)
+		const Quad& quad = m_quads[getQuadIndex(level, x, z)];
+		float size = m_root_size / (1 << level) * m_scale.x;
+		Vec3 half_size(size * 0.5f, (quad.m_max_height - quad.m_min_height) * m_scale.y * 0.5f, size * 0.5f);
+		Vec3 center((x + 0.5f) * size, (quad.m_max_height + quad.m_min_height) * m_scale.y * 0.5f, (z + 0.5f) * size);
+
+		const Matrix& mtx = traversal.world_matrix;
+		Vec3 world_center = mtx.multiplyPosition(center);
+		Vec3 world_half_size(
+			Math::abs(mtx.m11) * half_size.x + Math::abs(mtx.m21) * half_size.y + Math::abs(mtx.m31) * half_size.z,
+			Math::abs(mtx.m12) * half_size.x + Math::abs(mtx.m22) * half_size.y + Math::abs(mtx.m32) * half_size.z,
+			Math::abs(mtx.m13) * half_size.x + Math::abs(mtx.m23) * half_size.y + Math::abs(mtx.m33) * half_size.z);
+		return traversal.frustum->isBoxInside(world_center, world_half_size);
+	}
+
+
+	// returns false if the quad is too far and its parent should render the
+	// whole area of the quad; quadrants outside the frustum are skipped
+	bool Terrain::getQuadInfos(const QuadTraversal& traversal, int level, int x, int z)
+	{
+		float size = m_root_size / (1 << level);
+		Vec3 min(x * size, 0, z * size);
+		float squared_dist = getQuadSquaredDistance(traversal.camera_pos, min.x, min.z, size);
+		float r = getQuadRadiusOuter(size);
+		if (squared_dist > r*r && level > 0)
 		{
-			return getHeight(int_x, int_z);
+			return false;
 		}
-		else if (dec_x > dec_z)
+
+		Vec3 morph_const(r, getQuadRadiusInner(size), 0);
+		bool has_children = level + 1 < m_quad_levels;
+		for (int i = 0; i < 4; ++i)
 		{
-			float h0 = getHeight(int_x, int_z);
-			float h1 = getHeight(int_x + 1, int_z);
-			float h2 = getHeight(int_x + 1, int_z + 1);
-			return h0 + (h1 - h0) * dec_x + (h2 - h1) * dec_z;
+			int child_x = x * 2 + (i & 1);
+			int child_z = z * 2 + (i >> 1);
+			if (has_children && !isQuadVisible(traversal, level + 1, child_x, child_z))
+			{
+				continue;
+			}
+			if (!has_children || !getQuadInfos(traversal, level + 1, child_x, child_z))
+			{
+				TerrainInfo& data = traversal.infos->pushEmpty();
+				data.m_morph_const = morph_const;
+				data.m_index = i;
+				data.m_terrain = this;
+				data.m_size = size;
+				data.m_min = min;
+				data.m_shader = traversal.shader;
+				data.m_world_matrix = traversal.world_matrix;
+				data.m_tile = getQuadTile(min.x + (i & 1) * size * 0.5f, min.z + (i >> 1) * size * 0.5f, size * 0.5f);
+			}
 		}
-		else
+		return true;
+	}
+
+
+	// the tile the whole quad lies in, quads bigger than a tile are far
+	// enough to be rendered with the material's maps; shaders without
+	// TERRAIN_TILES do not know u_terrainTile and sample the bound maps
+	// with the material's coordinates
+	const TerrainTile* Terrain::getQuadTile(float min_x, float min_z, float size) const
+	{
+		if (!m_tiles.isLoaded() || !m_material || !m_material->getShader() ||
+			m_material->getShader()->getDefineMask("TERRAIN_TILES") == 0)
 		{
-			float h0 = getHeight(int_x, int_z);
-			float h1 = getHeight(int_x + 1, int_z + 1);
-			float h2 = getHeight(int_x, int_z + 1);
-			return h0 + (h2 - h0) * dec_z + (h1 - h2) * dec_x;
+			return nullptr;
 		}
+		return m_tiles.getAreaTile(min_x, min_z, size);
 	}
-	
 
-	float Terrain::getHeight(int x, int z)
+
+	Vec2 Terrain::getTileExtent() const
+	{
+		float extent = m_tiles.getTileExtent();
+		return Vec2(extent, extent);
+	}
+
+
+	Vec3 Terrain::getTileScale() const
+	{
+		float samples_per_pixel = (float)m_tiles.getSamplesPerPixel();
+		return Vec3(m_scale.x / samples_per_pixel, m_scale.y, m_scale.x / samples_per_pixel);
+	}
+
+
+	Vec2 Terrain::getTileOrigin(const TerrainTile& tile) const
+	{
+		float extent = m_tiles.getTileExtent() * m_scale.x;
+		return Vec2(tile.m_x * extent, tile.m_z * extent);
+	}
+
+
+	float Terrain::getCellSample(const TerrainTile* tile, int x, int z) const
+	{
+		return tile ? m_tiles.getHeightSample(*tile, x, z) : m_height_field.getSample(x, z);
+	}
+
+
+	float Terrain::getHeight(float x, float z) const
+	{
+		const TerrainTile* tile = m_tiles.getPointTile(x / m_scale.x, z / m_scale.x);
+		if (!tile)
+		{
+			return m_height_field.getHeight(x, z, m_scale);
+		}
+		int size = m_tiles.getTileSize() + 1;
+		Vec2 origin = getTileOrigin(*tile);
+		return HeightField::getHeight(tile->m_heights, size, size, x - origin.x, z - origin.y, getTileScale());
+	}
+
+
+	void Terrain::getHeights(const Vec2* points, float* heights, int count) const
+	{
+		if (m_tiles.getResidentMemory() == 0)
+		{
+			m_height_field.getHeights(points, heights, count, m_scale);
+			return;
+		}
+		for (int i = 0; i < count; ++i)
+		{
+			heights[i] = getHeight(points[i].x, points[i].y);
+		}
+	}
+
+
+	Vec3 Terrain::getNormal(float x, float z) const
+	{
+		const TerrainTile* tile = m_tiles.getPointTile(x / m_scale.x, z / m_scale.x);
+		if (!tile)
+		{
+			return m_height_field.getNormal(x, z, m_scale);
+		}
+		int size = m_tiles.getTileSize() + 1;
+		Vec2 origin = getTileOrigin(*tile);
+		return HeightField::getNormal(tile->m_heights, size, size, x - origin.x, z - origin.y, getTileScale());
+	}
+
+
+	void Terrain::getNormals(const Vec2* points, Vec3* normals, int count) const
+	{
+		if (m_tiles.getResidentMemory() == 0)
+		{
+			m_height_field.getNormals(points, normals, count, m_scale);
+			return;
+		}
+		for (int i = 0; i < count; ++i)
+		{
+			normals[i] = getNormal(points[i].x, points[i].y);
+		}
+	}
+
+
+	// the splatmap can have a different resolution than the heightmap, the
+	// tiles have one splat sample per height sample
+	uint32_t Terrain::getSplat(float x, float z) const
 	{
-		int texture_x = x;
-		int texture_y = z;
-		Texture* t = m_heightmap;
-		int idx = Math::clamp(texture_x, 0, m_width) + Math::clamp(texture_y, 0, m_height) * m_width;
-		if (t->getBytesPerPixel() == 2)
+		const TerrainTile* tile = m_tiles.getPointTile(x / m_scale.x, z / m_scale.x);
+		if (tile)
 		{
-			return m_scale.y / 65535.0f * ((uint16_t*)t->getData())[idx];
+			float samples_per_pixel = (float)m_tiles.getSamplesPerPixel();
+			return m_tiles.getSplatSample(
+				*tile, (int)(x * samples_per_pixel / m_scale.x), (int)(z * samples_per_pixel / m_scale.x));
 		}
-		else if(t->getBytesPerPixel() == 4)
+		float splat_scale_x = m_splatmap->getWidth() / (m_width * m_scale.x);
+		float splat_scale_z = m_splatmap->getHeight() / (m_height * m_scale.x);
+		return m_splatmap->getPixel(splat_scale_x * x, splat_scale_z * z);
+	}
+
+
+	void Terrain::setTilesPath(const Path& path)
+	{
+		// grass jobs read the resident tiles
+		waitForGrassJobs();
+		if (path.isValid())
 		{
-			return ((m_scale.y / 255.0f) * ((uint8_t*)t->getData())[idx * 4]);
+			m_tiles.load(path);
 		}
 		else
 		{
-			ASSERT(false);
+			m_tiles.unload();
+		}
+		updateQuadHeights(0, 0, m_width, m_height);
+		forceGrassUpdate();
+	}
+
+
+	void Terrain::updateTiles(const Vec3& camera_pos)
+	{
+		if (!m_tiles.isLoaded() || m_quads.empty())
+		{
+			return;
 		}
-		return 0;
+		Matrix mtx = m_scene.getUniverse().getMatrix(m_entity);
+		mtx.fastInverse();
+		Vec3 local_camera_pos = mtx.multiplyPosition(camera_pos);
+		Vec2 extent = getTileExtent();
+		// quads of the size of a tile are rendered up to this distance
+		float radius = getQuadRadiusOuter(extent.x * 2) / extent.x;
+		// evicted tiles are freed, grass jobs could be reading them
+		waitForGrassJobs();
+		m_tiles.update(local_camera_pos.x / m_scale.x / extent.x, local_camera_pos.z / m_scale.z / extent.y, radius);
 	}
 
 
+	void Terrain::onHeightmapChanged(int x, int z, int width, int height)
+	{
+		// grass jobs read the height field
+		waitForGrassJobs();
+		if (m_heightmap && m_heightmap->getData())
+		{
+			m_height_field.update(m_heightmap->getData(), m_heightmap->getBytesPerPixel(), x, z, width, height);
+		}
+		updateQuadHeights(x, z, x + width, z + height);
+	}
+
+	
 	bool getRayTriangleIntersection(const Vec3& local_origin, const Vec3& local_dir, const Vec3& p0, const Vec3& p1, const Vec3& p2, float& out)
 	{
 		Vec3 normal = crossProduct(p1 - p0, p2 - p0);
@@ -685,72 +1008,221 @@ namespace Lumix
 	}
 
 	
+	// entry and exit of a ray and an axis aligned box, the part behind the
+	// origin is cut off
+	static bool getRayBoxInterval(const Vec3& origin, const Vec3& dir, const Vec3& min, const Vec3& max, float& t_from, float& t_to)
+	{
+		t_from = 0;
+		t_to = FLT_MAX;
+		for (int i = 0; i < 3; ++i)
+		{
+			float o = (&origin.x)[i];
+			float d = (&dir.x)[i];
+			float lo = (&min.x)[i];
+			float hi = (&max.x)[i];
+			if (d == 0)
+			{
+				if (o < lo || o > hi)
+				{
+					return false;
+				}
+				continue;
+			}
+			float t0 = (lo - o) / d;
+			float t1 = (hi - o) / d;
+			if (t0 > t1)
+			{
+				float tmp = t0;
+				t0 = t1;
+				t1 = tmp;
+			}
+			t_from = Math::maxValue(t_from, t0);
+			t_to = Math::minValue(t_to, t1);
+			if (t_from > t_to)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+
+	// heightmap cells covered by a quad, quads of a heightmap whose size is not
+	// a power of two share the cells on their borders
+	void Terrain::getQuadCells(int level, int x, int z, int& from_x, int& from_z, int& to_x, int& to_z) const
+	{
+		float size = m_root_size / (1 << level);
+		from_x = (int)(x * size);
+		from_z = (int)(z * size);
+		to_x = Math::minValue((int)ceil((x + 1) * size), m_width - 1);
+		to_z = Math::minValue((int)ceil((z + 1) * size), m_height - 1);
+	}
+
+
+	bool Terrain::getQuadRayInterval(const Vec3& origin, const Vec3& dir, int level, int x, int z, float& t_from, float& t_to) const
+	{
+		int from_x, from_z, to_x, to_z;
+		getQuadCells(level, x, z, from_x, from_z, to_x, to_z);
+		if (from_x >= to_x || from_z >= to_z)
+		{
+			return false;
+		}
+		const Quad& quad = m_quads[getQuadIndex(level, x, z)];
+		Vec3 min(from_x * m_scale.x, quad.m_min_height * m_scale.y, from_z * m_scale.x);
+		Vec3 max(to_x * m_scale.x, quad.m_max_height * m_scale.y, to_z * m_scale.x);
+		return getRayBoxInterval(origin, dir, min, max, t_from, t_to);
+	}
+
+
+	// walks the cells along the ray between t_from and t_to, returns the first hit
+	// cells are in samples of the tile if there is one
+	bool Terrain::castRayInCells(const Vec3& origin, const Vec3& dir, float t_from, float t_to, const TerrainTile* tile, int from_x, int from_z, int to_x, int to_z, float& t) const
+	{
+		float cell_size = tile ? getTileScale().x : m_scale.x;
+		Vec3 start = origin + dir * t_from;
+		int hx = Math::clamp((int)(start.x / cell_size), from_x, to_x - 1);
+		int hz = Math::clamp((int)(start.z / cell_size), from_z, to_z - 1);
+		int step_x = dir.x < 0 ? -1 : 1;
+		int step_z = dir.z < 0 ? -1 : 1;
+		float next_x = dir.x == 0 ? FLT_MAX : ((hx + (dir.x < 0 ? 0 : 1)) * cell_size - origin.x) / dir.x;
+		float next_z = dir.z == 0 ? FLT_MAX : ((hz + (dir.z < 0 ? 0 : 1)) * cell_size - origin.z) / dir.z;
+		float delta_x = dir.x == 0 ? FLT_MAX : cell_size / Math::abs(dir.x);
+		float delta_z = dir.z == 0 ? FLT_MAX : cell_size / Math::abs(dir.z);
+
+		while (hx >= from_x && hx < to_x && hz >= from_z && hz < to_z)
+		{
+			float x = hx * cell_size;
+			float z = hz * cell_size;
+			Vec3 p0(x, getCellSample(tile, hx, hz) * m_scale.y, z);
+			Vec3 p1(x + cell_size, getCellSample(tile, hx + 1, hz) * m_scale.y, z);
+			Vec3 p2(x + cell_size, getCellSample(tile, hx + 1, hz + 1) * m_scale.y, z + cell_size);
+			Vec3 p3(x, getCellSample(tile, hx, hz + 1) * m_scale.y, z + cell_size);
+			float t0, t1;
+			bool is_hit0 = getRayTriangleIntersection(origin, dir, p0, p1, p2, t0);
+			bool is_hit1 = getRayTriangleIntersection(origin, dir, p0, p2, p3, t1);
+			if (is_hit0 || is_hit1)
+			{
+				t = is_hit0 && is_hit1 ? Math::minValue(t0, t1) : (is_hit0 ? t0 : t1);
+				return true;
+			}
+			if (Math::minValue(next_x, next_z) > t_to)
+			{
+				return false;
+			}
+			if (next_x < next_z)
+			{
+				next_x += delta_x;
+				hx += step_x;
+			}
+			else
+			{
+				next_z += delta_z;
+				hz += step_z;
+			}
+		}
+		return false;
+	}
+
+
+	// descends the min / max height quadtree nearest child first and skips
+	// quads the ray passes above, only leaves are walked cell by cell
 	RayCastModelHit Terrain::castRay(const Vec3& origin, const Vec3& dir)
 	{
 		RayCastModelHit hit;
 		hit.m_is_hit = false;
-		if (m_root)
+		if (m_quads.empty())
 		{
-			Matrix mtx = m_scene.getUniverse().getMatrix(m_entity);
-			mtx.fastInverse();
-			Vec3 rel_origin = mtx.multiplyPosition(origin);
-			Vec3 rel_dir = mtx * dir;
-			Vec3 start;
-			Vec3 size(m_root->m_size * m_scale.x, m_scale.y * 65535.0f, m_root->m_size * m_scale.x);
-			if (Math::getRayAABBIntersection(rel_origin, rel_dir, m_root->m_min, size, start))
-			{
-				int hx = (int)(start.x / m_scale.x);
-				int hz = (int)(start.z / m_scale.x);
+			return hit;
+		}
 
-				float next_x = fabs(rel_dir.x) < 0.01f ? hx : ((hx + (rel_dir.x < 0 ? 0 : 1)) * m_scale.x - rel_origin.x) / rel_dir.x;
-				float next_z = fabs(rel_dir.z) < 0.01f ? hx : ((hz + (rel_dir.z < 0 ? 0 : 1)) * m_scale.x - rel_origin.z) / rel_dir.z;
+		Matrix mtx = m_scene.getUniverse().getMatrix(m_entity);
+		mtx.fastInverse();
+		Vec3 rel_origin = mtx.multiplyPosition(origin);
+		Vec3 rel_dir = mtx * dir;
 
-				float delta_x = fabs(rel_dir.x) < 0.01f ? 0 : m_scale.x / Math::abs(rel_dir.x);
-				float delta_z = fabs(rel_dir.z) < 0.01f ? 0 : m_scale.x / Math::abs(rel_dir.z);
-				int step_x = (int)Math::signum(rel_dir.x);
-				int step_z = (int)Math::signum(rel_dir.z);
+		struct StackItem
+		{
+			int level;
+			int x;
+			int z;
+			float t_from;
+			float t_to;
+		};
+		StackItem stack[MAX_RAY_STACK_SIZE];
+		int stack_size = 0;
+		StackItem root = { 0, 0, 0, 0, 0 };
+		if (!getQuadRayInterval(rel_origin, rel_dir, 0, 0, 0, root.t_from, root.t_to))
+		{
+			return hit;
+		}
+		stack[stack_size++] = root;
 
-				while (hx >= 0 && hz >= 0 && hx + 1 < m_width && hz + 1 < m_height)
+		float best_t = FLT_MAX;
+		int leaf_level = m_quad_levels - 1;
+		while (stack_size > 0)
+		{
+			StackItem item = stack[--stack_size];
+			if (item.t_from >= best_t)
+			{
+				continue;
+			}
+
+			if (item.level == leaf_level)
+			{
+				int from_x, from_z, to_x, to_z;
+				getQuadCells(item.level, item.x, item.z, from_x, from_z, to_x, to_z);
+				// a leaf in a resident tile is walked in the tile's samples
+				const TerrainTile* tile =
+					m_tiles.getAreaTile((float)from_x, (float)from_z, (float)Math::maxValue(to_x - from_x, to_z - from_z));
+				if (tile)
 				{
-					float t;
-					float x = hx * m_scale.x;
-					float z = hz * m_scale.x;
-					Vec3 p0(x, getHeight(x, z), z);
-					Vec3 p1(x + m_scale.x, getHeight(x + m_scale.x, z), z);
-					Vec3 p2(x + m_scale.x, getHeight(x + m_scale.x, z + m_scale.x), z + m_scale.x);
-					Vec3 p3(x, getHeight(x, z + m_scale.x), z + m_scale.x);
-					if (getRayTriangleIntersection(rel_origin, rel_dir, p0, p1, p2, t))
-					{
-						hit.m_is_hit = true;
-						hit.m_origin = origin;
-						hit.m_dir = dir;
-						hit.m_t = t;
-						return hit;
-					}
-					if (getRayTriangleIntersection(rel_origin, rel_dir, p0, p2, p3, t))
-					{
-						hit.m_is_hit = true;
-						hit.m_origin = origin;
-						hit.m_dir = dir;
-						hit.m_t = t;
-						return hit;
-					}
-					if (next_x < next_z)
-					{
-						next_x += delta_x;
-						hx += step_x;
-					}
-					else
-					{
-						next_z += delta_z;
-						hz += step_z;
-					}
-					if (delta_x == 0 && delta_z == 0)
-					{
-						return hit;
-					}
+					int samples_per_pixel = m_tiles.getSamplesPerPixel();
+					from_x *= samples_per_pixel;
+					from_z *= samples_per_pixel;
+					to_x *= samples_per_pixel;
+					to_z *= samples_per_pixel;
 				}
+				float t;
+				if (castRayInCells(rel_origin, rel_dir, item.t_from, Math::minValue(item.t_to, best_t), tile, from_x, from_z, to_x, to_z, t) && t < best_t)
+				{
+					best_t = t;
+				}
+				continue;
 			}
+
+			// sorted by the entry, the farthest first so the nearest is popped first
+			StackItem children[4];
+			int child_count = 0;
+			for (int i = 0; i < 4; ++i)
+			{
+				StackItem child = { item.level + 1, item.x * 2 + (i & 1), item.z * 2 + (i >> 1), 0, 0 };
+				if (!getQuadRayInterval(rel_origin, rel_dir, child.level, child.x, child.z, child.t_from, child.t_to) ||
+					child.t_from >= best_t)
+				{
+					continue;
+				}
+				int j = child_count;
+				while (j > 0 && children[j - 1].t_from < child.t_from)
+				{
+					children[j] = children[j - 1];
+					--j;
+				}
+				children[j] = child;
+				++child_count;
+			}
+			ASSERT(stack_size + child_count <= MAX_RAY_STACK_SIZE);
+			for (int i = 0; i < child_count; ++i)
+			{
+				stack[stack_size++] = children[i];
+			}
+		}
+
+		if (best_t < FLT_MAX)
+		{
+			hit.m_is_hit = true;
+			hit.m_origin = origin;
+			hit.m_dir = dir;
+			hit.m_t = best_t;
 		}
 		return hit;
 	}
@@ -811,16 +1283,101 @@ namespace Lumix
 		m_mesh = m_allocator.newObject<Mesh>(vertex_def, m_material, 0, points.size() * sizeof(points[0]), 0, indices.size(), "terrain", m_allocator);
 	}
 
-	TerrainQuad* Terrain::generateQuadTree(float size)
+	void Terrain::generateQuadTree()
 	{
-		TerrainQuad* root = m_allocator.newObject<TerrainQuad>(m_allocator);
-		root->m_lod = 1;
-		root->m_min.set(0, 0, 0);
-		root->m_size = size;
-		root->createChildren();
-		return root;
+		m_root_size = (float)m_width;
+		m_quad_levels = 1;
+		float size = m_root_size;
+		while (m_quad_levels < MAX_QUAD_LEVELS && size > MIN_QUAD_SIZE)
+		{
+			size *= 0.5f;
+			++m_quad_levels;
+		}
+		m_quads.resize(getQuadIndex(m_quad_levels, 0, 0));
+		updateQuadHeights(0, 0, m_width, m_height);
 	}
 
+
+	// heights of the leaves in the rectangle are read from the heightmap,
+	// their parents are merged from the children
+	void Terrain::updateQuadHeights(int from_x, int from_z, int to_x, int to_z)
+	{
+		PROFILE_FUNCTION();
+		if (m_quads.empty())
+		{
+			return;
+		}
+		int leaf_level = m_quad_levels - 1;
+		int leaf_count = 1 << leaf_level;
+		float leaf_size = m_root_size / leaf_count;
+		// a quad uses the samples on its border too
+		int from_leaf_x = Math::clamp(int((from_x - 1) / leaf_size), 0, leaf_count - 1);
+		int from_leaf_z = Math::clamp(int((from_z - 1) / leaf_size), 0, leaf_count - 1);
+		int to_leaf_x = Math::clamp(int(to_x / leaf_size), 0, leaf_count - 1);
+		int to_leaf_z = Math::clamp(int(to_z / leaf_size), 0, leaf_count - 1);
+		for (int z = from_leaf_z; z <= to_leaf_z; ++z)
+		{
+			for (int x = from_leaf_x; x <= to_leaf_x; ++x)
+			{
+				Quad& quad = m_quads[getQuadIndex(leaf_level, x, z)];
+				quad.m_min_height = FLT_MAX;
+				quad.m_max_height = -FLT_MAX;
+				int sample_to_x = Math::minValue((int)ceil((x + 1) * leaf_size), m_width - 1);
+				int sample_to_z = Math::minValue((int)ceil((z + 1) * leaf_size), m_height - 1);
+				for (int j = (int)(z * leaf_size); j <= sample_to_z; ++j)
+				{
+					for (int i = (int)(x * leaf_size); i <= sample_to_x; ++i)
+					{
+						float h = m_height_field.getSample(i, j);
+						quad.m_min_height = Math::minValue(quad.m_min_height, h);
+						quad.m_max_height = Math::maxValue(quad.m_max_height, h);
+					}
+				}
+				// quads outside of a non square heightmap
+				if (quad.m_min_height > quad.m_max_height)
+				{
+					quad.m_min_height = quad.m_max_height = 0;
+				}
+				// tiles have more samples, they can reach out of the heightmap's range
+				float tiles_min_height, tiles_max_height;
+				if (m_tiles.getHeightRange(x * leaf_size,
+						z * leaf_size,
+						(x + 1) * leaf_size,
+						(z + 1) * leaf_size,
+						tiles_min_height,
+						tiles_max_height))
+				{
+					quad.m_min_height = Math::minValue(quad.m_min_height, tiles_min_height);
+					quad.m_max_height = Math::maxValue(quad.m_max_height, tiles_max_height);
+				}
+			}
+		}
+
+		for (int level = leaf_level - 1; level >= 0; --level)
+		{
+			from_leaf_x >>= 1;
+			from_leaf_z >>= 1;
+			to_leaf_x >>= 1;
+			to_leaf_z >>= 1;
+			for (int z = from_leaf_z; z <= to_leaf_z; ++z)
+			{
+				for (int x = from_leaf_x; x <= to_leaf_x; ++x)
+				{
+					Quad& quad = m_quads[getQuadIndex(level, x, z)];
+					quad.m_min_height = FLT_MAX;
+					quad.m_max_height = -FLT_MAX;
+					for (int i = 0; i < 4; ++i)
+					{
+						const Quad& child = m_quads[getQuadIndex(level + 1, x * 2 + (i & 1), z * 2 + (i >> 1))];
+						quad.m_min_height = Math::minValue(quad.m_min_height, child.m_min_height);
+						quad.m_max_height = Math::maxValue(quad.m_max_height, child.m_max_height);
+					}
+				}
+			}
+		}
+	}
+
+
 	void Terrain::onMaterialLoaded(Resource::State, Resource::State new_state)
 	{
 		PROFILE_FUNCTION();
@@ -851,19 +1408,24 @@ namespace Lumix
 
 			if (is_data_ready)
 			{
-				m_allocator.deleteObject(m_root);
+				// grass jobs read the height field
+				waitForGrassJobs();
+				m_quads.clear();
+				m_height_field.clear();
 				if (m_heightmap && m_splatmap)
 				{
 					m_width = m_heightmap->getWidth();
 					m_height = m_heightmap->getHeight();
-					m_root = generateQuadTree((float)m_width);
+					m_height_field.create(m_heightmap->getData(), m_width, m_height, m_heightmap->getBytesPerPixel());
+					generateQuadTree();
 				}
 			}
 		}
 		else
 		{
-			m_allocator.deleteObject(m_root);
-			m_root = nullptr;
+			waitForGrassJobs();
+			m_quads.clear();
+			m_height_field.clear();
 		}
 	}
 
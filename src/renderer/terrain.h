@@ -4,24 +4,28 @@
 #include "core/array.h"
 #include "core/associative_array.h"
 #include "core/matrix.h"
+#include "core/mt/spin_mutex.h"
+#include "core/mtjd/group.h"
 #include "core/resource.h"
+#include "core/vec2.h"
 #include "core/vec3.h"
 #include "renderer/geometry.h"
+#include "renderer/height_field.h"
 #include "renderer/render_scene.h"
+#include "renderer/terrain_tiles.h"
 
 
 namespace Lumix
 {
 
 
-class LIFOAllocator;
 class Material;
 class Mesh;
 class OutputBlob;
 class PipelineInstance;
 class Renderer;
 class RenderScene;
-struct TerrainQuad;
+struct QuadTraversal;
 class Texture;
 
 
@@ -47,10 +51,22 @@ class Terrain
 			public:
 				GrassPatch(IAllocator& allocator)
 					: m_matrices(allocator)
-				{ }
-
+				{
+					m_instance_buffer = BGFX_INVALID_HANDLE;
+					m_instance_count = 0;
+				}
+
+				// written by the generating job and freed once they are in
+				// m_instance_buffer; shuffled, so any prefix is spread over
+				// the whole quad, grass shaders read them from i_data0 - i_data3
 				Array<Matrix> m_matrices;
+				// created once the quad is generated, kept until it is freed
+				bgfx::VertexBufferHandle m_instance_buffer;
+				int m_instance_count;
 				GrassType* m_type;
+				// copied from m_type, the generating job must not touch it
+				int32_t m_ground;
+				int32_t m_density;
 		};
 
 		class GrassQuad
@@ -63,6 +79,12 @@ class Terrain
 				Array<GrassPatch> m_patches;
 				float m_x;
 				float m_z;
+				// bounding sphere of all instances in world space
+				Vec3 m_center;
+				float m_radius;
+				ComponentIndex m_camera;
+				// types changed while the quad was being generated
+				bool m_is_outdated;
 		};
 
 	public:
@@ -80,7 +102,12 @@ class Terrain
 		int64_t getLayerMask() const { return m_layer_mask; }
 		Entity getEntity() const { return m_entity; }
 		float getRootSize() const;
-		float getHeight(float x, float z);
+		// heights and normals are in terrain local space, resident tiles are
+		// used where there are any
+		float getHeight(float x, float z) const;
+		void getHeights(const Vec2* points, float* heights, int count) const;
+		Vec3 getNormal(float x, float z) const;
+		void getNormals(const Vec2* points, Vec3* normals, int count) const;
 		float getXZScale() const { return m_scale.x; }
 		float getYScale() const { return m_scale.y; }
 		float getBrushSize() const { return m_brush_size; }
@@ -92,6 +119,11 @@ class Terrain
 		int getGrassTypeGround(int index);
 		int getGrassTypeDensity(int index);
 		int getGrassTypeCount() const { return m_grass_types.size(); }
+		const TerrainTiles& getTiles() const { return m_tiles; }
+		const Path& getTilesPath() const { return m_tiles.getPath(); }
+		// area of a tile in heightmap pixels, the tiles cover the heightmap
+		// and can have more samples per pixel
+		Vec2 getTileExtent() const;
 
 		void setXZScale(float scale) { m_scale.x = scale; m_scale.z = scale; }
 		void setYScale(float scale) { m_scale.y = scale; }
@@ -100,22 +132,57 @@ class Terrain
 		void setGrassTypeDensity(int index, int density);
 		void setMaterial(Material* material);
 		void setBrush(const Vec3& position, float size) { m_brush_position = position; m_brush_size = size; }
+		void setTilesPath(const Path& path);
 
-		void getInfos(Array<const TerrainInfo*>& infos, const Vec3& camera_pos, LIFOAllocator& allocator);
+		// patches in the frustum, their LOD depends on the distance from camera_pos
+		void getInfos(Array<TerrainInfo>& infos, const Frustum& frustum, const Vec3& camera_pos);
 		void getGrassInfos(const Frustum& frustum, Array<GrassInfo>& infos, ComponentIndex camera);
+		// streams the tiles around the camera, called once per frame
+		void updateTiles(const Vec3& camera_pos);
 
 		RayCastModelHit castRay(const Vec3& origin, const Vec3& dir);
 		void serialize(OutputBlob& serializer);
-		void deserialize(InputBlob& serializer, Universe& universe, RenderScene& scene, int index);
+		void deserialize(InputBlob& serializer, Universe& universe, RenderScene& scene, int index, int version);
 
+		// rectangle in heightmap pixels
+		void onHeightmapChanged(int x, int z, int width, int height);
+		// grass jobs read the heightmap and the splatmap, their data must not
+		// be written before this returns
+		void waitForGrassJobs();
 		void addGrassType(int index);
 		void removeGrassType(int index);
 
+	private:
+		// height range of a node of the quadtree, in 0-1 range
+		struct Quad
+		{
+			float m_min_height;
+			float m_max_height;
+		};
+
 	private: 
 		Array<Terrain::GrassQuad*>& getQuads(ComponentIndex camera);
-		TerrainQuad* generateQuadTree(float size);
-		float getHeight(int x, int z);
+		void generateQuadTree();
+		void updateQuadHeights(int from_x, int from_z, int to_x, int to_z);
+		bool isQuadVisible(const QuadTraversal& traversal, int level, int x, int z) const;
+		bool getQuadInfos(const QuadTraversal& traversal, int level, int x, int z);
+		const TerrainTile* getQuadTile(float min_x, float min_z, float size) const;
+		void getQuadCells(int level, int x, int z, int& from_x, int& from_z, int& to_x, int& to_z) const;
+		bool getQuadRayInterval(const Vec3& origin, const Vec3& dir, int level, int x, int z, float& t_from, float& t_to) const;
+		bool castRayInCells(const Vec3& origin, const Vec3& dir, float t_from, float t_to, const TerrainTile* tile, int from_x, int from_z, int to_x, int to_z, float& t) const;
+		// scale of a tile's samples, the same as m_scale without tiles
+		Vec3 getTileScale() const;
+		// position of the tile's first sample in terrain local space
+		Vec2 getTileOrigin(const TerrainTile& tile) const;
+		// cells are in samples of the tile or in pixels of the heightmap
+		float getCellSample(const TerrainTile* tile, int x, int z) const;
+		uint32_t getSplat(float x, float z) const;
 		void updateGrass(ComponentIndex camera);
+		bool hasGrassQuad(ComponentIndex camera, float x, float z);
+		void startGrassQuad(ComponentIndex camera, float x, float z, const Matrix& mtx);
+		void generateGrassQuad(GrassQuad& quad, const Matrix& mtx, float model_radius);
+		void finishGrassQuads();
+		void freeGrassQuad(GrassQuad* quad);
 		void generateGeometry();
 		void onMaterialLoaded(Resource::State, Resource::State new_state);
 		void forceGrassUpdate();
@@ -123,7 +190,15 @@ class Terrain
 	private:
 		IAllocator& m_allocator;
 		Mesh* m_mesh;
-		TerrainQuad* m_root;
+		// complete quadtree stored level by level, the root covers
+		// m_root_size x m_root_size heightmap pixels
+		Array<Quad> m_quads;
+		HeightField m_height_field;
+		// full resolution maps of the area around the camera, the material's
+		// heightmap is used for the rest and for the quadtree
+		TerrainTiles m_tiles;
+		int m_quad_levels;
+		float m_root_size;
 		Geometry m_geometry;
 		int32_t m_width;
 		int32_t m_height;
@@ -138,10 +213,15 @@ class Terrain
 		Array<GrassType*> m_grass_types;
 		Array<GrassQuad*> m_free_grass_quads;
 		AssociativeArray<ComponentIndex, Array<GrassQuad*> > m_grass_quads;
-		AssociativeArray<ComponentIndex, Vec3> m_last_camera_position;
+		// quads with a job in flight, touched only by the main thread
+		Array<GrassQuad*> m_generating_grass_quads;
+		// quads whose job is done, guarded by m_grass_mutex
+		Array<GrassQuad*> m_generated_grass_quads;
+		MT::SpinMutex m_grass_mutex;
+		// all grass jobs depend on it
+		MTJD::Group m_grass_sync_point;
 		Vec3 m_brush_position;
 		float m_brush_size;
-		bool m_force_grass_update;
 		Renderer& m_renderer;
 };
 
@@ -0,0 +1,575 @@
+#include "renderer/terrain_tiles.h"
+#include "core/fs/file_system.h"
+#include "core/fs/ifile.h"
+#include "core/log.h"
+#include "core/math_utils.h"
+#include "core/mt/atomic.h"
+#include "core/mtjd/generic_job.h"
+#include "core/mtjd/group.h"
+#include "core/mtjd/manager.h"
+#include "core/profiler.h"
+#include <cfloat>
+#include <cmath>
+
+
+namespace Lumix
+{
+
+
+static const uint32_t TILES_MAGIC = 0x5f4c5454; // == '_LTT'
+// 0 - tiles have the resolution of the material's heightmap, no height ranges
+// 1 - samples per pixel and the height ranges follow the header
+static const int32_t TILES_VERSION = 1;
+// a single job reads at most this many tiles, so the nearest missing tiles
+// are picked again soon after the camera moves
+static const int MAX_TILES_PER_JOB = 4;
+
+
+// followed by int32_t samples per pixel, uint16_t min and max height of each
+// tile and the tiles row by row, each tile is uint16_t heights followed by
+// uint32_t splatmap values, (tile_size + 1) x (tile_size + 1) of both
+struct TilesHeader
+{
+	uint32_t m_magic;
+	int32_t m_version;
+	int32_t m_tile_size;
+	int32_t m_tiles_x;
+	int32_t m_tiles_z;
+};
+
+
+static size_t getTileFileSize(int tile_size)
+{
+	size_t samples = (tile_size + 1) * (tile_size + 1);
+	return samples * (sizeof(uint16_t) + sizeof(uint32_t));
+}
+
+
+TerrainTiles::TerrainTiles(FS::FileSystem& file_system,
+	MTJD::Manager& mtjd_manager,
+	IAllocator& allocator)
+	: m_allocator(allocator)
+	, m_file_system(file_system)
+	, m_mtjd_manager(mtjd_manager)
+	, m_file(nullptr)
+	, m_tile_size(0)
+	, m_samples_per_pixel(1)
+	, m_tiles_offset(0)
+	, m_tiles_x(0)
+	, m_tiles_z(0)
+	, m_tiles(allocator)
+	, m_requests(allocator)
+	, m_loaded(allocator)
+	, m_mutex(false)
+	, m_jobs_count(0)
+	, m_sync_point(true, allocator)
+	, m_memory_budget(DEFAULT_MEMORY_BUDGET)
+	, m_resident_memory(0)
+{
+}
+
+
+TerrainTiles::~TerrainTiles()
+{
+	unload();
+}
+
+
+bool TerrainTiles::createArchive(FS::IFile& file,
+	const uint16_t* heights,
+	const uint32_t* splatmap,
+	int width,
+	int height,
+	int tile_size,
+	int samples_per_pixel,
+	IAllocator& allocator)
+{
+	ASSERT(width > 1 && height > 1 && tile_size > 0 && samples_per_pixel > 0);
+	TilesHeader header;
+	header.m_magic = TILES_MAGIC;
+	header.m_version = TILES_VERSION;
+	header.m_tile_size = tile_size;
+	header.m_tiles_x = (width - 1 + tile_size - 1) / tile_size;
+	header.m_tiles_z = (height - 1 + tile_size - 1) / tile_size;
+	int32_t spp = samples_per_pixel;
+	if (!file.write(&header, sizeof(header)) || !file.write(&spp, sizeof(spp)))
+	{
+		return false;
+	}
+
+	// the height ranges are needed before any tile is loaded
+	Array<uint16_t> ranges(allocator);
+	ranges.resize(header.m_tiles_x * header.m_tiles_z * 2);
+	for (int tile_z = 0; tile_z < header.m_tiles_z; ++tile_z)
+	{
+		for (int tile_x = 0; tile_x < header.m_tiles_x; ++tile_x)
+		{
+			uint16_t min_height = 0xffff;
+			uint16_t max_height = 0;
+			for (int j = 0; j <= tile_size; ++j)
+			{
+				int z = Math::minValue(tile_z * tile_size + j, height - 1);
+				for (int i = 0; i <= tile_size; ++i)
+				{
+					int x = Math::minValue(tile_x * tile_size + i, width - 1);
+					min_height = Math::minValue(min_height, heights[x + z * width]);
+					max_height = Math::maxValue(max_height, heights[x + z * width]);
+				}
+			}
+			int index = tile_x + tile_z * header.m_tiles_x;
+			ranges[index * 2] = min_height;
+			ranges[index * 2 + 1] = max_height;
+		}
+	}
+	if (!file.write(&ranges[0], ranges.size() * sizeof(ranges[0])))
+	{
+		return false;
+	}
+
+	int row_size = tile_size + 1;
+	Array<uint16_t> tile_heights(allocator);
+	Array<uint32_t> tile_splats(allocator);
+	tile_heights.resize(row_size * row_size);
+	tile_splats.resize(row_size * row_size);
+	for (int tile_z = 0; tile_z < header.m_tiles_z; ++tile_z)
+	{
+		for (int tile_x = 0; tile_x < header.m_tiles_x; ++tile_x)
+		{
+			for (int j = 0; j < row_size; ++j)
+			{
+				int z = Math::minValue(tile_z * tile_size + j, height - 1);
+				for (int i = 0; i < row_size; ++i)
+				{
+					int x = Math::minValue(tile_x * tile_size + i, width - 1);
+					tile_heights[i + j * row_size] = heights[x + z * width];
+					tile_splats[i + j * row_size] = splatmap[x + z * width];
+				}
+			}
+			if (!file.write(&tile_heights[0], tile_heights.size() * sizeof(tile_heights[0])) ||
+				!file.write(&tile_splats[0], tile_splats.size() * sizeof(tile_splats[0])))
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+
+bool TerrainTiles::load(const Path& path)
+{
+	unload();
+	m_file = m_file_system.open(m_file_system.getDiskDevice(), path.c_str(), FS::Mode::OPEN | FS::Mode::READ);
+	if (!m_file)
+	{
+		g_log_error.log("renderer") << "Could not open terrain tiles " << path.c_str();
+		return false;
+	}
+
+	TilesHeader header;
+	int32_t samples_per_pixel = 1;
+	bool is_valid = m_file->read(&header, sizeof(header)) && header.m_magic == TILES_MAGIC &&
+					header.m_version <= TILES_VERSION && header.m_tile_size > 0 && header.m_tiles_x > 0 &&
+					header.m_tiles_z > 0;
+	if (is_valid && header.m_version > 0)
+	{
+		is_valid = m_file->read(&samples_per_pixel, sizeof(samples_per_pixel)) && samples_per_pixel > 0 &&
+				   header.m_tile_size % samples_per_pixel == 0;
+	}
+	int tile_count = is_valid ? header.m_tiles_x * header.m_tiles_z : 0;
+	Array<uint16_t> ranges(m_allocator);
+	if (is_valid && header.m_version > 0)
+	{
+		ranges.resize(tile_count * 2);
+		is_valid = m_file->read(&ranges[0], ranges.size() * sizeof(ranges[0]));
+	}
+	size_t tiles_offset = m_file->pos();
+	if (!is_valid || m_file->size() < tiles_offset + getTileFileSize(header.m_tile_size) * tile_count)
+	{
+		g_log_error.log("renderer") << "Invalid terrain tiles " << path.c_str();
+		m_file_system.close(*m_file);
+		m_file = nullptr;
+		return false;
+	}
+
+	m_path = path;
+	m_tile_size = header.m_tile_size;
+	m_samples_per_pixel = samples_per_pixel;
+	m_tiles_offset = tiles_offset;
+	m_tiles_x = header.m_tiles_x;
+	m_tiles_z = header.m_tiles_z;
+	m_tiles.resize(tile_count);
+	for (int z = 0; z < m_tiles_z; ++z)
+	{
+		for (int x = 0; x < m_tiles_x; ++x)
+		{
+			int index = x + z * m_tiles_x;
+			TerrainTile& tile = m_tiles[index];
+			tile.m_state = TerrainTile::EMPTY;
+			tile.m_x = x;
+			tile.m_z = z;
+			// older archives do not know, any height is possible
+			tile.m_min_height = ranges.empty() ? 0 : ranges[index * 2] / 65535.0f;
+			tile.m_max_height = ranges.empty() ? 1 : ranges[index * 2 + 1] / 65535.0f;
+			tile.m_heights = nullptr;
+			tile.m_splats = nullptr;
+			tile.m_heightmap_texture = BGFX_INVALID_HANDLE;
+			tile.m_splatmap_texture = BGFX_INVALID_HANDLE;
+		}
+	}
+	return true;
+}
+
+
+void TerrainTiles::unload()
+{
+	waitForJobs();
+	for (int i = 0; i < m_tiles.size(); ++i)
+	{
+		if (m_tiles[i].m_state == TerrainTile::READY)
+		{
+			evictTile(m_tiles[i]);
+		}
+	}
+	ASSERT(m_resident_memory == 0);
+	m_tiles.clear();
+	m_requests.clear();
+	if (m_file)
+	{
+		m_file_system.close(*m_file);
+		m_file = nullptr;
+	}
+	m_path = "";
+	m_tile_size = m_tiles_x = m_tiles_z = 0;
+	m_samples_per_pixel = 1;
+	m_tiles_offset = 0;
+}
+
+
+const TerrainTile* TerrainTiles::getTile(int x, int z) const
+{
+	if (x < 0 || z < 0 || x >= m_tiles_x || z >= m_tiles_z)
+	{
+		return nullptr;
+	}
+	const TerrainTile& tile = m_tiles[x + z * m_tiles_x];
+	return tile.m_state == TerrainTile::READY ? &tile : nullptr;
+}
+
+
+const TerrainTile* TerrainTiles::getAreaTile(float min_x, float min_z, float size) const
+{
+	if (m_tile_size <= 0 || min_x < 0 || min_z < 0)
+	{
+		return nullptr;
+	}
+	float extent = getTileExtent();
+	int x = (int)(min_x / extent);
+	int z = (int)(min_z / extent);
+	// quads end exactly on the tile border, allow for rounding
+	float tolerance = extent * 0.001f;
+	if (min_x + size > (x + 1) * extent + tolerance || min_z + size > (z + 1) * extent + tolerance)
+	{
+		return nullptr;
+	}
+	return getTile(x, z);
+}
+
+
+const TerrainTile* TerrainTiles::getPointTile(float x, float z) const
+{
+	if (m_tile_size <= 0 || x < 0 || z < 0)
+	{
+		return nullptr;
+	}
+	float extent = getTileExtent();
+	return getTile((int)(x / extent), (int)(z / extent));
+}
+
+
+bool TerrainTiles::getHeightRange(float min_x,
+	float min_z,
+	float max_x,
+	float max_z,
+	float& min_height,
+	float& max_height) const
+{
+	if (m_tile_size <= 0)
+	{
+		return false;
+	}
+	float extent = getTileExtent();
+	// samples on the border belong to both tiles
+	int from_x = Math::clamp((int)ceil(min_x / extent) - 1, 0, m_tiles_x - 1);
+	int from_z = Math::clamp((int)ceil(min_z / extent) - 1, 0, m_tiles_z - 1);
+	int to_x = Math::clamp((int)(max_x / extent), 0, m_tiles_x - 1);
+	int to_z = Math::clamp((int)(max_z / extent), 0, m_tiles_z - 1);
+	if (min_x > m_tiles_x * extent || min_z > m_tiles_z * extent)
+	{
+		return false;
+	}
+	min_height = FLT_MAX;
+	max_height = -FLT_MAX;
+	for (int z = from_z; z <= to_z; ++z)
+	{
+		for (int x = from_x; x <= to_x; ++x)
+		{
+			const TerrainTile& tile = m_tiles[x + z * m_tiles_x];
+			min_height = Math::minValue(min_height, tile.m_min_height);
+			max_height = Math::maxValue(max_height, tile.m_max_height);
+		}
+	}
+	return true;
+}
+
+
+float TerrainTiles::getHeightSample(const TerrainTile& tile, int x, int z) const
+{
+	ASSERT(tile.m_state == TerrainTile::READY);
+	int i = Math::clamp(x - tile.m_x * m_tile_size, 0, m_tile_size);
+	int j = Math::clamp(z - tile.m_z * m_tile_size, 0, m_tile_size);
+	return tile.m_heights[i + j * (m_tile_size + 1)];
+}
+
+
+uint32_t TerrainTiles::getSplatSample(const TerrainTile& tile, int x, int z) const
+{
+	ASSERT(tile.m_state == TerrainTile::READY);
+	int i = Math::clamp(x - tile.m_x * m_tile_size, 0, m_tile_size);
+	int j = Math::clamp(z - tile.m_z * m_tile_size, 0, m_tile_size);
+	return tile.m_splats[i + j * (m_tile_size + 1)];
+}
+
+
+// the textures and the samples kept in memory
+int TerrainTiles::getTileMemory() const
+{
+	int samples = (m_tile_size + 1) * (m_tile_size + 1);
+	return samples * (sizeof(float) + sizeof(uint32_t)) * 2;
+}
+
+
+float TerrainTiles::getTileDistance(const TerrainTile& tile, float x, float z) const
+{
+	float dx = Math::maxValue(Math::maxValue(tile.m_x - x, x - (tile.m_x + 1)), 0.0f);
+	float dz = Math::maxValue(Math::maxValue(tile.m_z - z, z - (tile.m_z + 1)), 0.0f);
+	return sqrt(dx * dx + dz * dz);
+}
+
+
+// resident tile farther than min_distance, -1 if there is none
+int TerrainTiles::findFarthestTile(float x, float z, float min_distance) const
+{
+	int farthest = -1;
+	float farthest_distance = min_distance;
+	for (int i = 0; i < m_tiles.size(); ++i)
+	{
+		if (m_tiles[i].m_state != TerrainTile::READY)
+		{
+			continue;
+		}
+		float distance = getTileDistance(m_tiles[i], x, z);
+		if (distance > farthest_distance)
+		{
+			farthest = i;
+			farthest_distance = distance;
+		}
+	}
+	return farthest;
+}
+
+
+void TerrainTiles::evictTile(TerrainTile& tile)
+{
+	ASSERT(tile.m_state == TerrainTile::READY);
+	bgfx::destroyTexture(tile.m_heightmap_texture);
+	bgfx::destroyTexture(tile.m_splatmap_texture);
+	tile.m_heightmap_texture = BGFX_INVALID_HANDLE;
+	tile.m_splatmap_texture = BGFX_INVALID_HANDLE;
+	m_allocator.deallocate(tile.m_heights);
+	m_allocator.deallocate(tile.m_splats);
+	tile.m_heights = nullptr;
+	tile.m_splats = nullptr;
+	tile.m_state = TerrainTile::EMPTY;
+	m_resident_memory -= getTileMemory();
+}
+
+
+void TerrainTiles::update(float camera_x, float camera_z, float radius)
+{
+	PROFILE_FUNCTION();
+	if (!m_file)
+	{
+		return;
+	}
+	finishLoading();
+	// the budget could have been lowered
+	while (m_resident_memory > m_memory_budget)
+	{
+		int index = findFarthestTile(camera_x, camera_z, -1);
+		if (index < 0)
+		{
+			break;
+		}
+		evictTile(m_tiles[index]);
+	}
+	if (m_jobs_count > 0)
+	{
+		return;
+	}
+
+	// the nearest missing tiles in the radius
+	struct Request
+	{
+		int m_index;
+		float m_distance;
+	};
+	Request requests[MAX_TILES_PER_JOB];
+	int request_count = 0;
+	int from_x = Math::clamp((int)(camera_x - radius), 0, m_tiles_x - 1);
+	int from_z = Math::clamp((int)(camera_z - radius), 0, m_tiles_z - 1);
+	int to_x = Math::clamp((int)(camera_x + radius), 0, m_tiles_x - 1);
+	int to_z = Math::clamp((int)(camera_z + radius), 0, m_tiles_z - 1);
+	for (int z = from_z; z <= to_z; ++z)
+	{
+		for (int x = from_x; x <= to_x; ++x)
+		{
+			const TerrainTile& tile = m_tiles[x + z * m_tiles_x];
+			float distance = getTileDistance(tile, camera_x, camera_z);
+			if (tile.m_state != TerrainTile::EMPTY || distance > radius)
+			{
+				continue;
+			}
+			if (request_count == MAX_TILES_PER_JOB && requests[request_count - 1].m_distance <= distance)
+			{
+				continue;
+			}
+			int j = request_count < MAX_TILES_PER_JOB ? request_count++ : MAX_TILES_PER_JOB - 1;
+			while (j > 0 && requests[j - 1].m_distance > distance)
+			{
+				requests[j] = requests[j - 1];
+				--j;
+			}
+			requests[j].m_index = x + z * m_tiles_x;
+			requests[j].m_distance = distance;
+		}
+	}
+
+	// tiles farther than the requested one make room for it, never the
+	// nearer ones, otherwise tiles would be loaded and evicted in turns
+	m_requests.clear();
+	int tile_memory = getTileMemory();
+	for (int i = 0; i < request_count; ++i)
+	{
+		while (m_resident_memory + tile_memory > m_memory_budget)
+		{
+			int index = findFarthestTile(camera_x, camera_z, requests[i].m_distance);
+			if (index < 0)
+			{
+				break;
+			}
+			evictTile(m_tiles[index]);
+		}
+		if (m_resident_memory + tile_memory > m_memory_budget)
+		{
+			break;
+		}
+		m_tiles[requests[i].m_index].m_state = TerrainTile::LOADING;
+		m_resident_memory += tile_memory;
+		m_requests.push(requests[i].m_index);
+	}
+	if (m_requests.empty())
+	{
+		return;
+	}
+
+	MT::atomicIncrement(&m_jobs_count);
+	MTJD::Job* job = MTJD::makeJob(m_mtjd_manager,
+		[this]()
+		{
+			loadTiles();
+		},
+		m_allocator);
+	job->addDependency(&m_sync_point);
+	m_mtjd_manager.schedule(job);
+}
+
+
+// runs in a worker thread, it is the only user of m_file while it runs
+void TerrainTiles::loadTiles()
+{
+	int samples = (m_tile_size + 1) * (m_tile_size + 1);
+	Array<uint16_t> heights(m_allocator);
+	heights.resize(samples);
+	for (int i = 0; i < m_requests.size(); ++i)
+	{
+		int index = m_requests[i];
+		TerrainTile& tile = m_tiles[index];
+		tile.m_heights = (float*)m_allocator.allocate(samples * sizeof(float));
+		tile.m_splats = (uint32_t*)m_allocator.allocate(samples * sizeof(uint32_t));
+		m_file->seek(FS::SeekMode::BEGIN, m_tiles_offset + index * getTileFileSize(m_tile_size));
+		if (m_file->read(&heights[0], samples * sizeof(uint16_t)) &&
+			m_file->read(tile.m_splats, samples * sizeof(uint32_t)))
+		{
+			// the same format as raw heightmaps are uploaded in
+			for (int j = 0; j < samples; ++j)
+			{
+				tile.m_heights[j] = heights[j] / 65535.0f;
+			}
+		}
+		else
+		{
+			m_allocator.deallocate(tile.m_heights);
+			m_allocator.deallocate(tile.m_splats);
+			tile.m_heights = nullptr;
+			tile.m_splats = nullptr;
+		}
+
+		MT::SpinLock lock(m_mutex);
+		m_loaded.push(index);
+	}
+	MT::atomicDecrement(&m_jobs_count);
+}
+
+
+void TerrainTiles::finishLoading()
+{
+	int size = m_tile_size + 1;
+	int samples = size * size;
+	uint32_t flags = BGFX_TEXTURE_U_CLAMP | BGFX_TEXTURE_V_CLAMP;
+	MT::SpinLock lock(m_mutex);
+	for (int i = 0; i < m_loaded.size(); ++i)
+	{
+		TerrainTile& tile = m_tiles[m_loaded[i]];
+		ASSERT(tile.m_state == TerrainTile::LOADING);
+		if (!tile.m_heights)
+		{
+			g_log_error.log("renderer") << "Could not read tile " << tile.m_x << ", " << tile.m_z << " of "
+										<< m_path.c_str();
+			tile.m_state = TerrainTile::FAILED;
+			m_resident_memory -= getTileMemory();
+			continue;
+		}
+		tile.m_heightmap_texture = bgfx::createTexture2D(
+			size, size, 1, bgfx::TextureFormat::R32F, flags, bgfx::copy(tile.m_heights, samples * sizeof(float)));
+		tile.m_splatmap_texture = bgfx::createTexture2D(
+			size, size, 1, bgfx::TextureFormat::RGBA8, flags, bgfx::copy(tile.m_splats, samples * sizeof(uint32_t)));
+		tile.m_state = TerrainTile::READY;
+	}
+	m_loaded.clear();
+}
+
+
+void TerrainTiles::waitForJobs()
+{
+	// the job decrements the count as the last thing it does, so the sync
+	// point still waits for it while the count is not zero
+	if (m_jobs_count > 0)
+	{
+		m_sync_point.sync();
+	}
+	finishLoading();
+}
+
+
+} // namespace Lumix
@@ -0,0 +1,151 @@
+#pragma once
+
+
+#include "lumix.h"
+#include "core/array.h"
+#include "core/mtjd/group.h"
+#include "core/mt/spin_mutex.h"
+#include "core/path.h"
+#include <bgfx.h>
+
+
+namespace Lumix
+{
+
+
+namespace FS
+{
+class FileSystem;
+class IFile;
+}
+
+namespace MTJD
+{
+class Manager;
+}
+
+
+// piece of a tiled terrain, it has (size + 1) x (size + 1) samples, the last
+// row and column are shared with the neighbours so tiles do not have seams
+struct TerrainTile
+{
+	enum State
+	{
+		EMPTY,
+		LOADING,
+		READY,
+		FAILED
+	};
+
+	State m_state;
+	int m_x;
+	int m_z;
+	// normalized height range of the whole tile, known before it is loaded
+	float m_min_height;
+	float m_max_height;
+	// written by the loading job, kept while the tile is resident for height
+	// queries, ray casts and grass
+	float* m_heights;
+	uint32_t* m_splats;
+	bgfx::TextureHandle m_heightmap_texture;
+	bgfx::TextureHandle m_splatmap_texture;
+};
+
+
+// heightmap and splatmap of a terrain cut to tiles and stored in one archive,
+// tiles around the camera are read by a job nearest first, the farthest ones
+// are evicted when the resident tiles do not fit in the memory budget;
+// the archive can have a finer resolution than the material's heightmap,
+// positions in the interface are in pixels of that heightmap
+class LUMIX_RENDERER_API TerrainTiles
+{
+public:
+	static const int DEFAULT_MEMORY_BUDGET = 128 << 20;
+
+public:
+	TerrainTiles(FS::FileSystem& file_system,
+		MTJD::Manager& mtjd_manager,
+		IAllocator& allocator);
+	~TerrainTiles();
+
+	// heights and splatmap have width x height samples, tiles on the right
+	// and bottom border are padded with the last sample; samples_per_pixel
+	// is the number of samples per pixel of the material's heightmap
+	static bool createArchive(FS::IFile& file,
+		const uint16_t* heights,
+		const uint32_t* splatmap,
+		int width,
+		int height,
+		int tile_size,
+		int samples_per_pixel,
+		IAllocator& allocator);
+
+	bool load(const Path& path);
+	void unload();
+	bool isLoaded() const { return m_file != nullptr; }
+	const Path& getPath() const { return m_path; }
+
+	// camera position and radius are in tiles, called once per frame
+	void update(float camera_x, float camera_z, float radius);
+	void waitForJobs();
+
+	// nullptr if the tile is not resident
+	const TerrainTile* getTile(int x, int z) const;
+	// resident tile the whole area lies in
+	const TerrainTile* getAreaTile(float min_x, float min_z, float size) const;
+	// resident tile under the point
+	const TerrainTile* getPointTile(float x, float z) const;
+	// union of the height ranges of all tiles the area touches, resident or
+	// not, false if there are none
+	bool getHeightRange(float min_x, float min_z, float max_x, float max_z, float& min_height, float& max_height) const;
+	// sample of a resident tile, coordinates are in samples of the archive
+	// and they are clamped to the tile
+	float getHeightSample(const TerrainTile& tile, int x, int z) const;
+	uint32_t getSplatSample(const TerrainTile& tile, int x, int z) const;
+	// in samples
+	int getTileSize() const { return m_tile_size; }
+	int getSamplesPerPixel() const { return m_samples_per_pixel; }
+	// in pixels
+	float getTileExtent() const { return (float)m_tile_size / m_samples_per_pixel; }
+	int getTilesX() const { return m_tiles_x; }
+	int getTilesZ() const { return m_tiles_z; }
+	void setMemoryBudget(int bytes) { m_memory_budget = bytes; }
+	int getMemoryBudget() const { return m_memory_budget; }
+	// textures and samples of resident tiles and tiles being loaded
+	int getResidentMemory() const { return m_resident_memory; }
+
+private:
+	int getTileMemory() const;
+	float getTileDistance(const TerrainTile& tile, float x, float z) const;
+	int findFarthestTile(float x, float z, float min_distance) const;
+	void evictTile(TerrainTile& tile);
+	void loadTiles();
+	void finishLoading();
+
+private:
+	IAllocator& m_allocator;
+	FS::FileSystem& m_file_system;
+	MTJD::Manager& m_mtjd_manager;
+	Path m_path;
+	FS::IFile* m_file;
+	int m_tile_size;
+	int m_samples_per_pixel;
+	// where the first tile starts in the file
+	size_t m_tiles_offset;
+	int m_tiles_x;
+	int m_tiles_z;
+	Array<TerrainTile> m_tiles;
+	// read by the job, touched by the main thread only when no job runs
+	Array<int> m_requests;
+	// tiles read by the job, guarded by m_mutex
+	Array<int> m_loaded;
+	MT::SpinMutex m_mutex;
+	// polled by update, waitForJobs syncs on m_sync_point
+	volatile int32_t m_jobs_count;
+	MTJD::Group m_sync_point;
+	int m_memory_budget;
+	int m_resident_memory;
+};
+
+
+} // namespace Lumix
@@ -1,3 +1,4 @@
+#include "core/blob.h"
 #include "core/fs/file_system.h"
 #include "core/fs/ifile.h"
 #include "core/log.h"
@@ -9,6 +10,7 @@
 #include "renderer/texture.h"
 #include "renderer/texture_manager.h"
 #include <bgfx.h>
+#include <climits>
 #include <cmath>
 
 namespace Lumix
@@ -34,6 +36,58 @@ struct TGAHeader
 #pragma pack()
 
 
+struct DDSHeader
+{
+	uint32_t m_magic;
+	uint32_t m_size;
+	uint32_t m_flags;
+	uint32_t m_height;
+	uint32_t m_width;
+	uint32_t m_pitch_or_linear_size;
+	uint32_t m_depth;
+	uint32_t m_mip_count;
+	uint32_t m_reserved1[11];
+	struct
+	{
+		uint32_t m_size;
+		uint32_t m_flags;
+		uint32_t m_four_cc;
+		uint32_t m_bit_count;
+		uint32_t m_masks[4];
+	} m_pixel_format;
+	uint32_t m_caps1;
+	uint32_t m_caps2;
+	uint32_t m_reserved2[3];
+};
+
+
+static const uint32_t DDS_MAGIC = 0x20534444; // "DDS "
+static const uint32_t DDPF_FOURCC = 0x4;
+static const uint32_t DDSCAPS2_CUBEMAP = 0x200;
+static const uint32_t DDSCAPS2_VOLUME = 0x200000;
+
+
+static uint32_t makeFourCC(char a, char b, char c, char d)
+{
+	return (uint32_t)a | ((uint32_t)b << 8) | ((uint32_t)c << 16) |
+		   ((uint32_t)d << 24);
+}
+
+
+static bool hasExtension(const Path& path, const char* ext)
+{
+	size_t len = path.length();
+	return len > 3 && strcmp(path.c_str() + len - 4, ext) == 0;
+}
+
+
+static void freeArray(Array<uint8_t>& array, IAllocator& allocator)
+{
+	Array<uint8_t> empty(allocator);
+	array.swap(empty);
+}
+
+
 Texture::Texture(const Path& path,
 				 ResourceManager& resource_manager,
 				 IAllocator& allocator)
@@ -41,11 +95,20 @@ Texture::Texture(const Path& path,
 	, m_data_reference(0)
 	, m_allocator(allocator)
 	, m_data(m_allocator)
+	, m_staging(m_allocator)
 	, m_BPP(-1)
 	, m_depth(-1)
 {
 	m_flags = 0;
 	m_texture_handle = BGFX_INVALID_HANDLE;
+	m_format = bgfx::TextureFormat::Unknown;
+	m_block_size = 0;
+	m_mip_count = 0;
+	m_first_mip = 0;
+	m_base_mip = 0;
+	m_wanted_mip = 0;
+	m_requested_mip = INT_MAX;
+	m_unused_frames = 0;
 }
 
 
@@ -301,50 +364,74 @@ void Texture::save()
 }
 
 
-void Texture::onDataUpdated()
+// only the rectangle is uploaded, painting on a big terrain map touches
+// a small part of it
+void Texture::onDataUpdated(int x, int y, int w, int h)
 {
+	PROFILE_FUNCTION();
+	if (w <= 0 || h <= 0)
+	{
+		return;
+	}
+	ASSERT(x >= 0 && y >= 0 && x + w <= m_width && y + h <= m_height);
+
 	const bgfx::Memory* mem = nullptr;
 
 	if (m_BPP == 2)
 	{
 		const uint16_t* src_mem = (const uint16_t*)&m_data[0];
-		mem = bgfx::alloc(m_width * m_height * sizeof(float));
+		mem = bgfx::alloc(w * h * sizeof(float));
 		float* dst_mem = (float*)mem->data;
 
-		for (int i = 0; i < m_width * m_height; ++i)
+		for (int j = 0; j < h; ++j)
 		{
-			dst_mem[i] = src_mem[i] / 65535.0f;
+			for (int i = 0; i < w; ++i)
+			{
+				dst_mem[i + j * w] = src_mem[x + i + (y + j) * m_width] / 65535.0f;
+			}
 		}
 	}
 	else
 	{
-		mem = bgfx::copy(&m_data[0], m_data.size() * sizeof(m_data[0]));
+		mem = bgfx::alloc(w * h * m_BPP);
+		for (int j = 0; j < h; ++j)
+		{
+			memcpy(mem->data + j * w * m_BPP,
+				   &m_data[(x + (y + j) * m_width) * m_BPP],
+				   w * m_BPP);
+		}
 	}
-	bgfx::updateTexture2D(m_texture_handle, 0, 0, 0, m_width, m_height, mem);
+	bgfx::updateTexture2D(m_texture_handle, 0, x, y, w, h, mem);
 }
 
 
-bool Texture::loadRaw(FS::IFile& file)
+bool Texture::parseRaw(InputBlob& data)
 {
 	PROFILE_FUNCTION();
-	size_t size = file.size();
+	int size = data.getSize();
 	m_BPP = 2;
 	m_width = (int)sqrt(size / m_BPP);
 	m_height = m_width;
 
-	if (m_data_reference)
+	const uint16_t* src_mem = (const uint16_t*)data.getData();
+	m_staging.resize(m_width * m_height * sizeof(float));
+	float* dst_mem = (float*)&m_staging[0];
+
+	for (int i = 0; i < m_width * m_height; ++i)
 	{
-		m_data.resize(size);
-		file.read(&m_data[0], size);
+		dst_mem[i] = src_mem[i] / 65535.0f;
 	}
+	m_depth = 1;
+	return true;
+}
 
-	const uint16_t* src_mem = (const uint16_t*)file.getBuffer();
-	const bgfx::Memory* mem = bgfx::alloc(m_width * m_height * sizeof(float));
-	float* dst_mem = (float*)mem->data;
 
-	for (int i = 0; i < m_width * m_height; ++i)
+bool Texture::commitRaw(InputBlob& data)
+{
+	if (m_data_reference)
 	{
-		dst_mem[i] = src_mem[i] / 65535.0f;
+		m_data.resize(data.getSize());
+		memcpy(&m_data[0], data.getData(), data.getSize());
 	}
 
 	m_texture_handle = bgfx::createTexture2D(
@@ -356,45 +443,46 @@ bool Texture::loadRaw(FS::IFile& file)
 		0,
 		m_width,
 		m_height,
-		mem);
-	m_depth = 1;
+		bgfx::copy(&m_staging[0], m_staging.size()));
+	freeArray(m_staging, m_allocator);
 	return bgfx::isValid(m_texture_handle);
 }
 
 
-bool Texture::loadTGA(FS::IFile& file)
+bool Texture::parseTGA(InputBlob& data)
 {
 	PROFILE_FUNCTION();
 	TGAHeader header;
-	file.read(&header, sizeof(header));
+	if (!data.read(&header, sizeof(header)))
+	{
+		return false;
+	}
 
 	int color_mode = header.bitsPerPixel / 8;
 	int image_size = header.width * header.height * 4;
 	if (header.dataType != 2)
 	{
-		g_log_error.log("renderer") << "Unsupported texture format "
-									<< m_path.c_str();
+		setParseError("Unsupported texture format");
 		return false;
 	}
-
 	if (color_mode < 3)
 	{
-		g_log_error.log("renderer") << "Unsupported color mode "
-									<< m_path.c_str();
+		setParseError("Unsupported color mode");
+		return false;
+	}
+	if (data.getSize() - (int)sizeof(header) <
+		header.width * header.height * color_mode)
+	{
+		setParseError("Truncated texture data");
 		return false;
 	}
 
 	m_width = header.width;
 	m_height = header.height;
-	TextureManager* manager = static_cast<TextureManager*>(
-		getResourceManager().get(ResourceManager::TEXTURE));
-	if (m_data_reference)
-	{
-		m_data.resize(image_size);
-	}
-	uint8_t* image_dest = m_data_reference
-							  ? &m_data[0]
-							  : (uint8_t*)manager->getBuffer(image_size);
+	m_staging.resize(image_size);
+	uint8_t* image_dest = &m_staging[0];
+	const uint8_t* image_src =
+		(const uint8_t*)data.getData() + sizeof(header);
 
 	// Targa is BGR, swap to RGB, add alpha and flip Y axis
 	for (long y = 0; y < header.height; y++)
@@ -403,23 +491,28 @@ bool Texture::loadTGA(FS::IFile& file)
 		long write_index = ((header.imageDescriptor & 32) != 0)
 							   ? read_index
 							   : y * header.width * 4;
+		const uint8_t* src = image_src + read_index;
 		for (long x = 0; x < header.width; x++)
 		{
-			file.read(&image_dest[write_index + 2], sizeof(uint8_t));
-			file.read(&image_dest[write_index + 1], sizeof(uint8_t));
-			file.read(&image_dest[write_index + 0], sizeof(uint8_t));
-			if (color_mode == 4)
-				file.read(&image_dest[write_index + 3], sizeof(uint8_t));
-			else
-				image_dest[write_index + 3] = 255;
+			image_dest[write_index + 2] = src[0];
+			image_dest[write_index + 1] = src[1];
+			image_dest[write_index + 0] = src[2];
+			image_dest[write_index + 3] = color_mode == 4 ? src[3] : 255;
+			src += color_mode;
 			write_index += 4;
 		}
 	}
 	m_BPP = 4;
+	m_depth = 1;
+	return true;
+}
+
 
+bool Texture::commitTGA()
+{
 	m_texture_handle = bgfx::createTexture2D(
-		header.width,
-		header.height,
+		m_width,
+		m_height,
 		1,
 		bgfx::TextureFormat::RGBA8,
 		m_flags,
@@ -429,10 +522,14 @@ bool Texture::loadTGA(FS::IFile& file)
 		0,
 		0,
 		0,
-		header.width,
-		header.height,
-		bgfx::copy(image_dest, header.width * header.height * 4));
-	m_depth = 1;
+		m_width,
+		m_height,
+		bgfx::copy(&m_staging[0], m_width * m_height * 4));
+	if (m_data_reference)
+	{
+		m_data.swap(m_staging);
+	}
+	freeArray(m_staging, m_allocator);
 	return bgfx::isValid(m_texture_handle);
 }
 
@@ -457,11 +554,206 @@ void Texture::removeDataReference()
 }
 
 
-bool Texture::loadDDS(FS::IFile& file)
+// only block compressed 2D textures are streamed, the rest goes through
+// bgfx's own DDS parser in commitDDS
+bool Texture::readDDSHeader(FS::IFile& file)
+{
+	DDSHeader header;
+	if (file.size() < sizeof(header) || !file.read(&header, sizeof(header)))
+	{
+		return false;
+	}
+	if (header.m_magic != DDS_MAGIC ||
+		(header.m_pixel_format.m_flags & DDPF_FOURCC) == 0 ||
+		(header.m_caps2 & (DDSCAPS2_CUBEMAP | DDSCAPS2_VOLUME)) != 0 ||
+		header.m_mip_count < 2)
+	{
+		return false;
+	}
+
+	uint32_t four_cc = header.m_pixel_format.m_four_cc;
+	if (four_cc == makeFourCC('D', 'X', 'T', '1'))
+	{
+		m_format = bgfx::TextureFormat::BC1;
+		m_block_size = 8;
+	}
+	else if (four_cc == makeFourCC('D', 'X', 'T', '3'))
+	{
+		m_format = bgfx::TextureFormat::BC2;
+		m_block_size = 16;
+	}
+	else if (four_cc == makeFourCC('D', 'X', 'T', '5'))
+	{
+		m_format = bgfx::TextureFormat::BC3;
+		m_block_size = 16;
+	}
+	else if (four_cc == makeFourCC('A', 'T', 'I', '2'))
+	{
+		m_format = bgfx::TextureFormat::BC5;
+		m_block_size = 16;
+	}
+	else
+	{
+		return false;
+	}
+
+	m_width = header.m_width;
+	m_height = header.m_height;
+	m_depth = 1;
+	m_BPP = -1;
+	m_mip_count = header.m_mip_count;
+	m_base_mip = 0;
+	while (m_base_mip + 1 < m_mip_count &&
+		   Math::maxValue(m_width, m_height) >> m_base_mip > STREAMING_BASE_SIZE)
+	{
+		++m_base_mip;
+	}
+	if (m_base_mip == 0 || file.size() < sizeof(header) + getMipsSize(0))
+	{
+		m_mip_count = 0;
+		return false;
+	}
+	return true;
+}
+
+
+int Texture::getMipsSize(int first_mip) const
+{
+	int size = 0;
+	for (int mip = first_mip; mip < m_mip_count; ++mip)
+	{
+		int blocks_x = Math::maxValue(((m_width >> mip) + 3) / 4, 1);
+		int blocks_y = Math::maxValue(((m_height >> mip) + 3) / 4, 1);
+		size += blocks_x * blocks_y * m_block_size;
+	}
+	return size;
+}
+
+
+// the file is positioned after the header, mips are stored from the biggest
+// one, so mips from first_mip on are at the end of the file
+bool Texture::loadDDSMips(FS::IFile& file, int first_mip)
+{
+	PROFILE_FUNCTION();
+	int size = getMipsSize(first_mip);
+	file.seek(FS::SeekMode::BEGIN, sizeof(DDSHeader) + getMipsSize(0) - size);
+	// memory from bgfx::alloc can not be given back if the read fails
+	m_staging.resize(size);
+	if (!file.read(&m_staging[0], size))
+	{
+		freeArray(m_staging, m_allocator);
+		return false;
+	}
+	bgfx::TextureHandle handle = bgfx::createTexture2D(
+		(uint16_t)Math::maxValue(m_width >> first_mip, 1),
+		(uint16_t)Math::maxValue(m_height >> first_mip, 1),
+		(uint8_t)(m_mip_count - first_mip),
+		m_format,
+		m_flags,
+		bgfx::copy(&m_staging[0], size));
+	freeArray(m_staging, m_allocator);
+	if (!bgfx::isValid(handle))
+	{
+		return false;
+	}
+	if (bgfx::isValid(m_texture_handle))
+	{
+		bgfx::destroyTexture(m_texture_handle);
+	}
+	m_texture_handle = handle;
+	m_first_mip = first_mip;
+	return true;
+}
+
+
+void Texture::loaded(FS::IFile& file, bool success, FS::FileSystem& fs)
+{
+	if (success && hasExtension(m_path, ".dds"))
+	{
+		if (readDDSHeader(file))
+		{
+			if (!loadDDSMips(file, m_base_mip))
+			{
+				g_log_error.log("renderer") << "Error loading " << m_path.c_str();
+				m_mip_count = 0;
+				onFailure();
+				return;
+			}
+			m_wanted_mip = m_base_mip;
+			m_requested_mip = INT_MAX;
+			m_unused_frames = 0;
+			static_cast<TextureManager*>(
+				m_resource_manager.get(ResourceManager::TEXTURE))
+				->addStreamed(*this);
+			m_size = getMipsSize(m_first_mip);
+			decrementDepCount();
+			return;
+		}
+		file.seek(FS::SeekMode::BEGIN, 0);
+	}
+	Resource::loaded(file, success, fs);
+}
+
+
+void Texture::onUsed(float screen_size)
+{
+	if (m_mip_count == 0)
+	{
+		return;
+	}
+	int mip = 0;
+	float size = (float)Math::maxValue(m_width, m_height);
+	while (mip < m_base_mip && size * 0.5f >= screen_size)
+	{
+		size *= 0.5f;
+		++mip;
+	}
+	m_requested_mip = Math::minValue(m_requested_mip, mip);
+}
+
+
+void Texture::updateWantedMip()
+{
+	if (m_requested_mip == INT_MAX)
+	{
+		++m_unused_frames;
+		if (m_unused_frames > STREAMING_UNUSED_FRAMES)
+		{
+			m_wanted_mip = m_base_mip;
+		}
+	}
+	else
+	{
+		m_unused_frames = 0;
+		m_wanted_mip = m_requested_mip;
+	}
+	m_requested_mip = INT_MAX;
+}
+
+
+bool Texture::loadMips(FS::IFile& file, int first_mip)
+{
+	ASSERT(isStreamed());
+	int mip_count = m_mip_count;
+	int width = m_width;
+	int height = m_height;
+	if (!readDDSHeader(file) || m_mip_count != mip_count ||
+		m_width != width || m_height != height)
+	{
+		m_mip_count = mip_count;
+		m_width = width;
+		m_height = height;
+		return false;
+	}
+	return loadDDSMips(file, first_mip);
+}
+
+
+bool Texture::commitDDS(InputBlob& data)
 {
 	bgfx::TextureInfo info;
 	m_texture_handle =
-		bgfx::createTexture(bgfx::copy(file.getBuffer(), file.size()),
+		bgfx::createTexture(bgfx::copy(data.getData(), data.getSize()),
 							m_flags,
 							0,
 							&info);
@@ -473,55 +765,53 @@ bool Texture::loadDDS(FS::IFile& file)
 }
 
 
-void Texture::loaded(FS::IFile& file, bool success, FS::FileSystem& fs)
+bool Texture::parse(InputBlob& data)
 {
 	PROFILE_FUNCTION();
-	if (success)
+	if (hasExtension(m_path, ".dds"))
 	{
-		const char* path = m_path.c_str();
-		size_t len = m_path.length();
-		bool loaded = false;
-		if (len > 3 && strcmp(path + len - 4, ".dds") == 0)
-		{
-			loaded = loadDDS(file);
-		}
-		else if (len > 3 && strcmp(path + len - 4, ".raw") == 0)
-		{
-			loaded = loadRaw(file);
-		}
-		else
-		{
-			loaded = loadTGA(file);
-		}
-		if (!loaded)
-		{
-			g_log_warning.log("renderer") << "Error loading texture "
-										  << m_path.c_str();
-			onFailure();
-		}
-		else
-		{
-			m_size = file.size();
-			decrementDepCount();
-		}
+		// bgfx parses DDS itself, this has to happen on the main thread
+		return true;
 	}
-	else
+	if (hasExtension(m_path, ".raw"))
 	{
-		g_log_warning.log("renderer") << "Error loading texture "
-									  << m_path.c_str();
-		onFailure();
+		return parseRaw(data);
 	}
+	return parseTGA(data);
+}
+
+
+bool Texture::commit(InputBlob& data)
+{
+	PROFILE_FUNCTION();
+	if (hasExtension(m_path, ".dds"))
+	{
+		return commitDDS(data);
+	}
+	if (hasExtension(m_path, ".raw"))
+	{
+		return commitRaw(data);
+	}
+	return commitTGA();
 }
 
 
 void Texture::doUnload(void)
 {
+	if (isStreamed())
+	{
+		static_cast<TextureManager*>(
+			m_resource_manager.get(ResourceManager::TEXTURE))
+			->removeStreamed(*this);
+		m_mip_count = 0;
+	}
 	if (bgfx::isValid(m_texture_handle))
 	{
 		bgfx::destroyTexture(m_texture_handle);
 		m_texture_handle = BGFX_INVALID_HANDLE;
 	}
 	m_data.clear();
+	freeArray(m_staging, m_allocator);
 	m_size = 0;
 	onEmpty();
 }
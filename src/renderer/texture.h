@@ -10,11 +10,18 @@ namespace Lumix
 namespace FS
 {
 	class FileSystem;
+	class IFile;
 }
 
 
 class LUMIX_RENDERER_API Texture : public Resource
 {
+	public:
+		static const int STREAMING_BASE_SIZE = 64;
+		// a texture which is not drawn for this many frames may lose its
+		// mips above the base one
+		static const int STREAMING_UNUSED_FRAMES = 120;
+
 	public:
 		Texture(const Path& path, ResourceManager& resource_manager, IAllocator& allocator);
 		~Texture();
@@ -30,24 +37,49 @@ class LUMIX_RENDERER_API Texture : public Resource
 		uint8_t* getData() { return m_data.empty() ? nullptr : &m_data[0]; }
 		void addDataReference();
 		void removeDataReference();
-		void onDataUpdated();
+		void onDataUpdated(int x, int y, int w, int h);
 		void save();
 		void setFlags(uint32_t flags);
 		uint32_t getPixel(float x, float y) const;
 		bgfx::TextureHandle getTextureHandle() const { return m_texture_handle; }
 
+		// streamed textures are DDS files which have on the GPU only mips
+		// from getFirstMip() on, mip 0 is the biggest one; they are loaded
+		// with mips up to STREAMING_BASE_SIZE pixels, TextureManager streams
+		// in the mips they are drawn with
+		bool isStreamed() const { return m_mip_count > 0; }
+		int getFirstMip() const { return m_first_mip; }
+		int getBaseMip() const { return m_base_mip; }
+		int getWantedMip() const { return m_wanted_mip; }
+		int getUnusedFrames() const { return m_unused_frames; }
+		// GPU memory of mips from first_mip on
+		int getMipsSize(int first_mip) const;
+		// the texture is drawn on screen_size pixels
+		void onUsed(float screen_size);
+		// the mip requested in the last frame becomes the wanted one
+		void updateWantedMip();
+		// replaces the mips on the GPU with mips from first_mip on read
+		// from the file
+		bool loadMips(FS::IFile& file, int first_mip);
+
 		static bool saveTGA(IAllocator& allocator, FS::IFile* file, int width, int height, int bits_per_pixel, const uint8_t* data, const Path& path);
 		static unsigned int compareTGA(IAllocator& allocator, FS::IFile* file1, FS::IFile* file2, int difference);
 
 	private:
 		bool load3D(FS::IFile& file);
-		bool loadDDS(FS::IFile& file);
-		bool loadTGA(FS::IFile& file);
-		bool loadRaw(FS::IFile& file);
+		bool readDDSHeader(FS::IFile& file);
+		bool loadDDSMips(FS::IFile& file, int first_mip);
+		bool parseTGA(InputBlob& data);
+		bool parseRaw(InputBlob& data);
+		bool commitDDS(InputBlob& data);
+		bool commitTGA();
+		bool commitRaw(InputBlob& data);
 		void saveTGA();
 
 		virtual void doUnload(void) override;
 		virtual void loaded(FS::IFile& file, bool success, FS::FileSystem& fs) override;
+		virtual bool parse(InputBlob& data) override;
+		virtual bool commit(InputBlob& data) override;
 
 	private:
 		IAllocator& m_allocator;
@@ -58,7 +90,16 @@ class LUMIX_RENDERER_API Texture : public Resource
 		int m_data_reference;
 		uint32_t m_flags;
 		Array<uint8_t> m_data;
+		Array<uint8_t> m_staging;
 		bgfx::TextureHandle m_texture_handle;
+		bgfx::TextureFormat::Enum m_format;
+		int m_block_size;
+		int m_mip_count;
+		int m_first_mip;
+		int m_base_mip;
+		int m_wanted_mip;
+		int m_requested_mip;
+		int m_unused_frames;
 };
 
 
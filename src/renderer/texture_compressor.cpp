@@ -0,0 +1,657 @@
+#include "renderer/texture_compressor.h"
+#include "core/array.h"
+#include "core/blob.h"
+#include "core/math_utils.h"
+#include "core/mtjd/generic_job.h"
+#include "core/mtjd/group.h"
+#include "core/mtjd/manager.h"
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+
+namespace Lumix
+{
+
+
+namespace TextureCompressor
+{
+
+
+static const int KAISER_TAPS = 6;
+static const float KAISER_ALPHA = 4.0f;
+// a job gets at least this many rows of a level
+static const int MIN_BAND_ROWS = 32;
+static const int MAX_JOBS_PER_LEVEL = 64;
+
+
+#pragma pack(1)
+struct DDSPixelFormat
+{
+	uint32_t m_size;
+	uint32_t m_flags;
+	uint32_t m_four_cc;
+	uint32_t m_rgb_bit_count;
+	uint32_t m_masks[4];
+};
+
+
+struct DDSHeader
+{
+	uint32_t m_magic;
+	uint32_t m_size;
+	uint32_t m_flags;
+	uint32_t m_height;
+	uint32_t m_width;
+	uint32_t m_linear_size;
+	uint32_t m_depth;
+	uint32_t m_mip_count;
+	uint32_t m_reserved[11];
+	DDSPixelFormat m_pixel_format;
+	uint32_t m_caps[4];
+	uint32_t m_reserved2;
+};
+#pragma pack()
+
+
+static const uint32_t DDS_MAGIC = 0x20534444; // == 'DDS '
+static const uint32_t DDSD_CAPS = 0x1;
+static const uint32_t DDSD_HEIGHT = 0x2;
+static const uint32_t DDSD_WIDTH = 0x4;
+static const uint32_t DDSD_PIXELFORMAT = 0x1000;
+static const uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+static const uint32_t DDSD_LINEARSIZE = 0x80000;
+static const uint32_t DDPF_FOURCC = 0x4;
+static const uint32_t DDSCAPS_COMPLEX = 0x8;
+static const uint32_t DDSCAPS_TEXTURE = 0x1000;
+static const uint32_t DDSCAPS_MIPMAP = 0x400000;
+
+
+static uint32_t makeFourCC(char a, char b, char c, char d)
+{
+	return (uint32_t)a | ((uint32_t)b << 8) | ((uint32_t)c << 16) | ((uint32_t)d << 24);
+}
+
+
+static int getLevelWidth(int width, int level)
+{
+	return Math::maxValue(1, width >> level);
+}
+
+
+int getMipCount(int width, int height)
+{
+	int count = 1;
+	while (width > 1 || height > 1)
+	{
+		width = Math::maxValue(1, width >> 1);
+		height = Math::maxValue(1, height >> 1);
+		++count;
+	}
+	return count;
+}
+
+
+int getBlockSize(Format format)
+{
+	return format == Format::BC1 ? 8 : 16;
+}
+
+
+int getLevelSize(int width, int height, int level, Format format)
+{
+	int blocks_x = (getLevelWidth(width, level) + 3) / 4;
+	int blocks_y = (getLevelWidth(height, level) + 3) / 4;
+	return blocks_x * blocks_y * getBlockSize(format);
+}
+
+
+// modified Bessel function of the first kind
+static float besselI0(float x)
+{
+	float sum = 1;
+	float term = 1;
+	for (int k = 1; k < 20; ++k)
+	{
+		float t = x / (2.0f * k);
+		term *= t * t;
+		sum += term;
+	}
+	return sum;
+}
+
+
+// weights of the source pixels 2i - 2 .. 2i + 3 of the destination pixel i
+static void getKaiserWeights(float* weights)
+{
+	float sum = 0;
+	for (int i = 0; i < KAISER_TAPS; ++i)
+	{
+		float d = Math::abs(i - 2.5f);
+		float x = d * 0.5f * Math::PI;
+		float sinc = sin(x) / x;
+		float r = d / 3.0f;
+		float window = besselI0(KAISER_ALPHA * sqrt(1 - r * r)) / besselI0(KAISER_ALPHA);
+		weights[i] = sinc * window;
+		sum += weights[i];
+	}
+	for (int i = 0; i < KAISER_TAPS; ++i)
+	{
+		weights[i] /= sum;
+	}
+}
+
+
+void downsample(const uint8_t* src,
+	int width,
+	int height,
+	uint8_t* dst,
+	int x,
+	int y,
+	int w,
+	int h,
+	MipFilter filter)
+{
+	int dst_width = getLevelWidth(width, 1);
+	float weights[KAISER_TAPS];
+	getKaiserWeights(weights);
+	for (int j = y; j < y + h; ++j)
+	{
+		for (int i = x; i < x + w; ++i)
+		{
+			uint8_t* out = dst + (i + j * dst_width) * 4;
+			if (filter == MipFilter::BOX)
+			{
+				int x0 = Math::minValue(2 * i, width - 1);
+				int x1 = Math::minValue(2 * i + 1, width - 1);
+				int y0 = Math::minValue(2 * j, height - 1);
+				int y1 = Math::minValue(2 * j + 1, height - 1);
+				for (int c = 0; c < 4; ++c)
+				{
+					int sum = src[(x0 + y0 * width) * 4 + c] + src[(x1 + y0 * width) * 4 + c] +
+							  src[(x0 + y1 * width) * 4 + c] + src[(x1 + y1 * width) * 4 + c];
+					out[c] = (uint8_t)((sum + 2) >> 2);
+				}
+				continue;
+			}
+
+			float sum[4] = { 0, 0, 0, 0 };
+			for (int ty = 0; ty < KAISER_TAPS; ++ty)
+			{
+				int sy = Math::clamp(2 * j - 2 + ty, 0, height - 1);
+				for (int tx = 0; tx < KAISER_TAPS; ++tx)
+				{
+					int sx = Math::clamp(2 * i - 2 + tx, 0, width - 1);
+					float weight = weights[tx] * weights[ty];
+					const uint8_t* pixel = src + (sx + sy * width) * 4;
+					for (int c = 0; c < 4; ++c)
+					{
+						sum[c] += pixel[c] * weight;
+					}
+				}
+			}
+			// negative lobes can overshoot
+			for (int c = 0; c < 4; ++c)
+			{
+				out[c] = (uint8_t)Math::clamp((int)(sum[c] + 0.5f), 0, 255);
+			}
+		}
+	}
+}
+
+
+static uint16_t toRGB565(const float* color)
+{
+	int r = Math::clamp((int)(color[0] * (31 / 255.0f) + 0.5f), 0, 31);
+	int g = Math::clamp((int)(color[1] * (63 / 255.0f) + 0.5f), 0, 63);
+	int b = Math::clamp((int)(color[2] * (31 / 255.0f) + 0.5f), 0, 31);
+	return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+
+static void fromRGB565(uint16_t color, int* rgb)
+{
+	int r = (color >> 11) & 31;
+	int g = (color >> 5) & 63;
+	int b = color & 31;
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+
+// endpoints are the extremes along the principal axis of the colors, inset
+// by 1/16 of their distance, which lowers the error of the other colors
+static void compressColorBlock(const uint8_t* pixels, uint8_t* out)
+{
+	float mean[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; ++i)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			mean[c] += pixels[i * 4 + c] / 16.0f;
+		}
+	}
+	float covariance[6] = { 0, 0, 0, 0, 0, 0 };
+	for (int i = 0; i < 16; ++i)
+	{
+		float r = pixels[i * 4] - mean[0];
+		float g = pixels[i * 4 + 1] - mean[1];
+		float b = pixels[i * 4 + 2] - mean[2];
+		covariance[0] += r * r;
+		covariance[1] += r * g;
+		covariance[2] += r * b;
+		covariance[3] += g * g;
+		covariance[4] += g * b;
+		covariance[5] += b * b;
+	}
+	float axis[3] = { 1, 1, 1 };
+	for (int iteration = 0; iteration < 8; ++iteration)
+	{
+		float r = axis[0] * covariance[0] + axis[1] * covariance[1] + axis[2] * covariance[2];
+		float g = axis[0] * covariance[1] + axis[1] * covariance[3] + axis[2] * covariance[4];
+		float b = axis[0] * covariance[2] + axis[1] * covariance[4] + axis[2] * covariance[5];
+		float length = Math::maxValue(Math::abs(r), Math::maxValue(Math::abs(g), Math::abs(b)));
+		if (length < 0.0001f)
+		{
+			break;
+		}
+		axis[0] = r / length;
+		axis[1] = g / length;
+		axis[2] = b / length;
+	}
+
+	float min_t = FLT_MAX;
+	float max_t = -FLT_MAX;
+	int min_index = 0;
+	int max_index = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		float t = (pixels[i * 4] - mean[0]) * axis[0] + (pixels[i * 4 + 1] - mean[1]) * axis[1] +
+				  (pixels[i * 4 + 2] - mean[2]) * axis[2];
+		if (t < min_t)
+		{
+			min_t = t;
+			min_index = i;
+		}
+		if (t > max_t)
+		{
+			max_t = t;
+			max_index = i;
+		}
+	}
+	float max_color[3];
+	float min_color[3];
+	for (int c = 0; c < 3; ++c)
+	{
+		float lo = pixels[min_index * 4 + c];
+		float hi = pixels[max_index * 4 + c];
+		float inset = (hi - lo) / 16.0f;
+		min_color[c] = lo + inset;
+		max_color[c] = hi - inset;
+	}
+
+	uint16_t color0 = toRGB565(max_color);
+	uint16_t color1 = toRGB565(min_color);
+	if (color0 < color1)
+	{
+		uint16_t tmp = color0;
+		color0 = color1;
+		color1 = tmp;
+	}
+	uint32_t indices = 0;
+	if (color0 != color1)
+	{
+		// four color mode, palette is color0, color1, 2/3 color0 + 1/3
+		// color1, 1/3 color0 + 2/3 color1
+		int palette[4][3];
+		fromRGB565(color0, palette[0]);
+		fromRGB565(color1, palette[1]);
+		for (int c = 0; c < 3; ++c)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		for (int i = 0; i < 16; ++i)
+		{
+			int best_index = 0;
+			int best_distance = INT_MAX;
+			for (int k = 0; k < 4; ++k)
+			{
+				int dr = pixels[i * 4] - palette[k][0];
+				int dg = pixels[i * 4 + 1] - palette[k][1];
+				int db = pixels[i * 4 + 2] - palette[k][2];
+				int distance = dr * dr + dg * dg + db * db;
+				if (distance < best_distance)
+				{
+					best_distance = distance;
+					best_index = k;
+				}
+			}
+			indices |= best_index << (2 * i);
+		}
+	}
+	out[0] = color0 & 0xff;
+	out[1] = color0 >> 8;
+	out[2] = color1 & 0xff;
+	out[3] = color1 >> 8;
+	for (int i = 0; i < 4; ++i)
+	{
+		out[4 + i] = (indices >> (8 * i)) & 0xff;
+	}
+}
+
+
+// values are 16 bytes with the given stride, eight value mode only
+static void compressAlphaBlock(const uint8_t* values, int stride, uint8_t* out)
+{
+	int min_value = 255;
+	int max_value = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		min_value = Math::minValue(min_value, (int)values[i * stride]);
+		max_value = Math::maxValue(max_value, (int)values[i * stride]);
+	}
+	out[0] = (uint8_t)max_value;
+	out[1] = (uint8_t)min_value;
+	uint64_t indices = 0;
+	if (max_value != min_value)
+	{
+		int palette[8];
+		palette[0] = max_value;
+		palette[1] = min_value;
+		for (int k = 2; k < 8; ++k)
+		{
+			palette[k] = ((8 - k) * max_value + (k - 1) * min_value) / 7;
+		}
+		for (int i = 0; i < 16; ++i)
+		{
+			int best_index = 0;
+			int best_distance = INT_MAX;
+			for (int k = 0; k < 8; ++k)
+			{
+				int distance = Math::abs(values[i * stride] - palette[k]);
+				if (distance < best_distance)
+				{
+					best_distance = distance;
+					best_index = k;
+				}
+			}
+			indices |= (uint64_t)best_index << (3 * i);
+		}
+	}
+	for (int i = 0; i < 6; ++i)
+	{
+		out[2 + i] = (indices >> (8 * i)) & 0xff;
+	}
+}
+
+
+static void decompressColorBlock(const uint8_t* block, bool force_four_colors, uint8_t* rgba)
+{
+	uint16_t color0 = block[0] | (block[1] << 8);
+	uint16_t color1 = block[2] | (block[3] << 8);
+	int palette[4][4];
+	fromRGB565(color0, palette[0]);
+	fromRGB565(color1, palette[1]);
+	palette[0][3] = palette[1][3] = palette[2][3] = palette[3][3] = 255;
+	for (int c = 0; c < 3; ++c)
+	{
+		if (color0 > color1 || force_four_colors)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		else
+		{
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+		}
+	}
+	if (color0 <= color1 && !force_four_colors)
+	{
+		palette[3][3] = 0;
+	}
+	uint32_t indices = block[4] | (block[5] << 8) | (block[6] << 16) | ((uint32_t)block[7] << 24);
+	for (int i = 0; i < 16; ++i)
+	{
+		int index = (indices >> (2 * i)) & 3;
+		for (int c = 0; c < 4; ++c)
+		{
+			rgba[i * 4 + c] = (uint8_t)palette[index][c];
+		}
+	}
+}
+
+
+static void decompressAlphaBlock(const uint8_t* block, uint8_t* values, int stride)
+{
+	int palette[8];
+	palette[0] = block[0];
+	palette[1] = block[1];
+	if (palette[0] > palette[1])
+	{
+		for (int k = 2; k < 8; ++k)
+		{
+			palette[k] = ((8 - k) * palette[0] + (k - 1) * palette[1]) / 7;
+		}
+	}
+	else
+	{
+		for (int k = 2; k < 6; ++k)
+		{
+			palette[k] = ((6 - k) * palette[0] + (k - 1) * palette[1]) / 5;
+		}
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+	uint64_t indices = 0;
+	for (int i = 0; i < 6; ++i)
+	{
+		indices |= (uint64_t)block[2 + i] << (8 * i);
+	}
+	for (int i = 0; i < 16; ++i)
+	{
+		values[i * stride] = (uint8_t)palette[(indices >> (3 * i)) & 7];
+	}
+}
+
+
+void decompressBlock(const uint8_t* block, Format format, uint8_t* rgba)
+{
+	switch (format)
+	{
+		case Format::BC1:
+			decompressColorBlock(block, false, rgba);
+			break;
+		case Format::BC3:
+			decompressColorBlock(block + 8, true, rgba);
+			decompressAlphaBlock(block, rgba + 3, 4);
+			break;
+		case Format::BC5:
+			for (int i = 0; i < 16; ++i)
+			{
+				rgba[i * 4 + 2] = 0;
+				rgba[i * 4 + 3] = 255;
+			}
+			decompressAlphaBlock(block, rgba, 4);
+			decompressAlphaBlock(block + 8, rgba + 1, 4);
+			break;
+		default:
+			ASSERT(false);
+			break;
+	}
+}
+
+
+void compress(const uint8_t* src,
+	int width,
+	int height,
+	Format format,
+	uint8_t* dst,
+	int x,
+	int y,
+	int w,
+	int h)
+{
+	int blocks_x = (width + 3) / 4;
+	int blocks_y = (height + 3) / 4;
+	int from_block_x = Math::maxValue(x / 4, 0);
+	int from_block_y = Math::maxValue(y / 4, 0);
+	int to_block_x = Math::minValue((x + w + 3) / 4, blocks_x);
+	int to_block_y = Math::minValue((y + h + 3) / 4, blocks_y);
+	int block_size = getBlockSize(format);
+	uint8_t pixels[16 * 4];
+	for (int block_y = from_block_y; block_y < to_block_y; ++block_y)
+	{
+		for (int block_x = from_block_x; block_x < to_block_x; ++block_x)
+		{
+			// blocks over the border of a level repeat its last pixels
+			for (int j = 0; j < 4; ++j)
+			{
+				int py = Math::minValue(block_y * 4 + j, height - 1);
+				for (int i = 0; i < 4; ++i)
+				{
+					int px = Math::minValue(block_x * 4 + i, width - 1);
+					memcpy(&pixels[(i + j * 4) * 4], &src[(px + py * width) * 4], 4);
+				}
+			}
+			uint8_t* out = dst + (block_x + block_y * blocks_x) * block_size;
+			switch (format)
+			{
+				case Format::BC1:
+					compressColorBlock(pixels, out);
+					break;
+				case Format::BC3:
+					compressAlphaBlock(pixels + 3, 4, out);
+					compressColorBlock(pixels, out + 8);
+					break;
+				case Format::BC5:
+					compressAlphaBlock(pixels, 4, out);
+					compressAlphaBlock(pixels + 1, 4, out + 8);
+					break;
+				default:
+					ASSERT(false);
+					break;
+			}
+		}
+	}
+}
+
+
+// calls function(from_row, to_row) for bands of rows on the workers and waits
+// for all of them
+template <typename T>
+static void runBands(MTJD::Manager& mtjd_manager, int rows, int row_alignment, T& function, IAllocator& allocator)
+{
+	int band_rows = Math::maxValue(MIN_BAND_ROWS, (rows + MAX_JOBS_PER_LEVEL - 1) / MAX_JOBS_PER_LEVEL);
+	band_rows = (band_rows + row_alignment - 1) / row_alignment * row_alignment;
+	MTJD::Group sync_point(true, allocator);
+	for (int from = 0; from < rows; from += band_rows)
+	{
+		int to = Math::minValue(from + band_rows, rows);
+		MTJD::Job* job = MTJD::makeJob(mtjd_manager,
+			[&function, from, to]()
+			{
+				function(from, to);
+			},
+			allocator);
+		job->addDependency(&sync_point);
+		mtjd_manager.schedule(job);
+	}
+	// rows > 0, so there is always a job
+	sync_point.sync();
+}
+
+
+bool compressDDS(const uint8_t* rgba,
+	int width,
+	int height,
+	Format format,
+	MipFilter filter,
+	MTJD::Manager& mtjd_manager,
+	OutputBlob& dds,
+	IAllocator& allocator)
+{
+	if (width <= 0 || height <= 0)
+	{
+		return false;
+	}
+
+	int mip_count = getMipCount(width, height);
+	Array<uint8_t> mips(allocator);
+	Array<uint8_t> blocks(allocator);
+	int mips_size = 0;
+	int blocks_size = 0;
+	for (int level = 0; level < mip_count; ++level)
+	{
+		if (level > 0)
+		{
+			mips_size += getLevelWidth(width, level) * getLevelWidth(height, level) * 4;
+		}
+		blocks_size += getLevelSize(width, height, level, format);
+	}
+	mips.resize(Math::maxValue(mips_size, 1));
+	blocks.resize(blocks_size);
+
+	// each level is computed from the previous one, so the levels are done
+	// one after another, the rows of a level in parallel
+	const uint8_t* level_src = rgba;
+	uint8_t* level_blocks = &blocks[0];
+	uint8_t* next_level = &mips[0];
+	for (int level = 0; level < mip_count; ++level)
+	{
+		int level_width = getLevelWidth(width, level);
+		int level_height = getLevelWidth(height, level);
+		auto compress_rows = [level_src, level_width, level_height, format, level_blocks](int from, int to)
+		{
+			compress(level_src, level_width, level_height, format, level_blocks, 0, from, level_width, to - from);
+		};
+		runBands(mtjd_manager, level_height, 4, compress_rows, allocator);
+		level_blocks += getLevelSize(width, height, level, format);
+		if (level + 1 == mip_count)
+		{
+			break;
+		}
+
+		int next_width = getLevelWidth(width, level + 1);
+		int next_height = getLevelWidth(height, level + 1);
+		auto downsample_rows = [level_src, level_width, level_height, next_level, next_width, filter](int from, int to)
+		{
+			downsample(level_src, level_width, level_height, next_level, 0, from, next_width, to - from, filter);
+		};
+		runBands(mtjd_manager, next_height, 1, downsample_rows, allocator);
+		level_src = next_level;
+		next_level += next_width * next_height * 4;
+	}
+
+	DDSHeader header;
+	memset(&header, 0, sizeof(header));
+	header.m_magic = DDS_MAGIC;
+	header.m_size = sizeof(header) - sizeof(header.m_magic);
+	header.m_flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE;
+	header.m_height = height;
+	header.m_width = width;
+	header.m_linear_size = getLevelSize(width, height, 0, format);
+	header.m_mip_count = mip_count;
+	header.m_pixel_format.m_size = sizeof(header.m_pixel_format);
+	header.m_pixel_format.m_flags = DDPF_FOURCC;
+	switch (format)
+	{
+		case Format::BC1: header.m_pixel_format.m_four_cc = makeFourCC('D', 'X', 'T', '1'); break;
+		case Format::BC3: header.m_pixel_format.m_four_cc = makeFourCC('D', 'X', 'T', '5'); break;
+		case Format::BC5: header.m_pixel_format.m_four_cc = makeFourCC('A', 'T', 'I', '2'); break;
+		default: ASSERT(false); break;
+	}
+	header.m_caps[0] = DDSCAPS_TEXTURE | DDSCAPS_COMPLEX | DDSCAPS_MIPMAP;
+	dds.write(&header, sizeof(header));
+	dds.write(&blocks[0], blocks.size());
+	return true;
+}
+
+
+} // ~namespace TextureCompressor
+
+
+} // ~namespace Lumix
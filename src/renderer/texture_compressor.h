@@ -0,0 +1,79 @@
+#pragma once
+
+#include "lumix.h"
+
+namespace Lumix
+{
+
+class IAllocator;
+class OutputBlob;
+
+namespace MTJD
+{
+class Manager;
+}
+
+
+// CPU mip generation and BC1 / BC3 / BC5 compression of RGBA8 images, used
+// by the texture importer; level i of a mip chain has max(1, width >> i) x
+// max(1, height >> i) pixels, rectangles are in pixels of their level
+namespace TextureCompressor
+{
+	enum class Format
+	{
+		BC1, // rgb, 8 bytes per block
+		BC3, // rgba, 16 bytes per block
+		BC5 // red and green, e.g. xy of a normal, 16 bytes per block
+	};
+
+	enum class MipFilter
+	{
+		BOX, // 2x2 average
+		KAISER // 6x6 Kaiser windowed sinc, sharper, reads 2 pixels around
+	};
+
+	LUMIX_RENDERER_API int getMipCount(int width, int height);
+	LUMIX_RENDERER_API int getBlockSize(Format format);
+	// bytes of a compressed level
+	LUMIX_RENDERER_API int getLevelSize(int width, int height, int level, Format format);
+
+	// computes the pixels of the next level in the rectangle, src is width x
+	// height, dst is the whole next level
+	LUMIX_RENDERER_API void downsample(const uint8_t* src,
+		int width,
+		int height,
+		uint8_t* dst,
+		int x,
+		int y,
+		int w,
+		int h,
+		MipFilter filter);
+
+	// compresses the blocks touching the rectangle, dst is the whole level
+	LUMIX_RENDERER_API void compress(const uint8_t* src,
+		int width,
+		int height,
+		Format format,
+		uint8_t* dst,
+		int x,
+		int y,
+		int w,
+		int h);
+
+	LUMIX_RENDERER_API void decompressBlock(const uint8_t* block, Format format, uint8_t* rgba);
+
+	// complete DDS file with the whole mip chain, the work is split to jobs,
+	// returns after all of them are finished
+	LUMIX_RENDERER_API bool compressDDS(const uint8_t* rgba,
+		int width,
+		int height,
+		Format format,
+		MipFilter filter,
+		MTJD::Manager& mtjd_manager,
+		OutputBlob& dds,
+		IAllocator& allocator);
+
+} // namespace TextureCompressor
+
+
+} // namespace Lumix
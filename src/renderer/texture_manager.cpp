@@ -1,17 +1,38 @@
 #include "lumix.h"
 #include "renderer/texture_manager.h"
 
+#include "core/fs/file_system.h"
+#include "core/fs/ifile.h"
+#include "core/log.h"
+#include "core/profiler.h"
 #include "core/resource.h"
+#include "core/resource_manager.h"
 #include "renderer/texture.h"
+#include <cstdlib>
 
 namespace Lumix
 {
+	// the blurriest texture first
+	static int compareCandidates(const void* a, const void* b)
+	{
+		const Texture* texture_a = *(const Texture**)a;
+		const Texture* texture_b = *(const Texture**)b;
+		return (texture_b->getFirstMip() - texture_b->getWantedMip()) -
+			   (texture_a->getFirstMip() - texture_a->getWantedMip());
+	}
+
+
 	TextureManager::TextureManager(IAllocator& allocator)
 		: ResourceManagerBase(allocator)
 		, m_allocator(allocator)
+		, m_streamed(allocator)
+		, m_mips_requests(allocator)
+		, m_candidates(allocator)
 	{
 		m_buffer = nullptr;
 		m_buffer_size = -1;
+		m_streaming_budget = DEFAULT_STREAMING_BUDGET;
+		m_streaming_memory = 0;
 	}
 
 
@@ -46,4 +67,165 @@ namespace Lumix
 		}
 		return m_buffer;
 	}
-}
\ No newline at end of file
+
+
+	void TextureManager::addStreamed(Texture& texture)
+	{
+		m_streamed.push(&texture);
+	}
+
+
+	void TextureManager::removeStreamed(Texture& texture)
+	{
+		m_streamed.eraseItemFast(&texture);
+		for (auto& request : m_mips_requests)
+		{
+			if (request.m_texture == &texture)
+			{
+				request.m_texture = nullptr;
+			}
+		}
+	}
+
+
+	bool TextureManager::isLoadingMips(const Texture& texture) const
+	{
+		for (const auto& request : m_mips_requests)
+		{
+			if (request.m_texture == &texture)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+
+	void TextureManager::requestMips(Texture& texture, int first_mip)
+	{
+		FS::FileSystem& fs = getOwner().getFileSystem();
+		FS::ReadCallback cb;
+		cb.bind<TextureManager, &TextureManager::mipsLoaded>(this);
+		if (fs.openAsync(fs.getDefaultDevice(),
+						 texture.getPath().c_str(),
+						 FS::Mode::OPEN | FS::Mode::READ,
+						 cb))
+		{
+			MipsRequest& request = m_mips_requests.pushEmpty();
+			request.m_texture = &texture;
+			request.m_first_mip = first_mip;
+		}
+	}
+
+
+	void TextureManager::mipsLoaded(FS::IFile& file,
+									bool success,
+									FS::FileSystem&)
+	{
+		ASSERT(!m_mips_requests.empty());
+		MipsRequest request = m_mips_requests[0];
+		m_mips_requests.erase(0);
+		if (!request.m_texture)
+		{
+			return;
+		}
+		if (!success || !request.m_texture->loadMips(file, request.m_first_mip))
+		{
+			g_log_warning.log("renderer")
+				<< "Could not stream mips of "
+				<< request.m_texture->getPath().c_str();
+		}
+	}
+
+
+	void TextureManager::updateStreaming()
+	{
+		PROFILE_FUNCTION();
+		// a texture being read is counted with the bigger of its old and
+		// new mips
+		int memory = 0;
+		int loading_count = 0;
+		for (auto* texture : m_streamed)
+		{
+			texture->updateWantedMip();
+			memory += texture->getMipsSize(texture->getFirstMip());
+		}
+		for (const auto& request : m_mips_requests)
+		{
+			if (request.m_texture)
+			{
+				int first_mip = request.m_texture->getFirstMip();
+				if (request.m_first_mip < first_mip)
+				{
+					memory += request.m_texture->getMipsSize(request.m_first_mip) -
+							  request.m_texture->getMipsSize(first_mip);
+				}
+				++loading_count;
+			}
+		}
+
+		// over the budget, mips nobody needs are dropped, from textures which
+		// were not drawn for the longest time first
+		while (memory > m_streaming_budget)
+		{
+			Texture* victim = nullptr;
+			for (auto* texture : m_streamed)
+			{
+				if (texture->getFirstMip() < texture->getWantedMip() &&
+					(!victim ||
+					 texture->getUnusedFrames() > victim->getUnusedFrames()) &&
+					!isLoadingMips(*texture))
+				{
+					victim = texture;
+				}
+			}
+			if (!victim)
+			{
+				break;
+			}
+			memory -= victim->getMipsSize(victim->getFirstMip()) -
+					  victim->getMipsSize(victim->getWantedMip());
+			requestMips(*victim, victim->getWantedMip());
+		}
+
+		m_candidates.clear();
+		for (auto* texture : m_streamed)
+		{
+			if (texture->getWantedMip() < texture->getFirstMip() &&
+				!isLoadingMips(*texture))
+			{
+				m_candidates.push(texture);
+			}
+		}
+		if (!m_candidates.empty())
+		{
+			qsort(&m_candidates[0],
+				  m_candidates.size(),
+				  sizeof(m_candidates[0]),
+				  compareCandidates);
+		}
+		for (int i = 0;
+			 i < m_candidates.size() && loading_count < MAX_STREAMING_TEXTURES;
+			 ++i)
+		{
+			// as many of the wanted mips as fit in the budget
+			Texture* texture = m_candidates[i];
+			int first_mip = texture->getFirstMip();
+			int resident_size = texture->getMipsSize(first_mip);
+			int mip = texture->getWantedMip();
+			while (mip < first_mip &&
+				   memory + texture->getMipsSize(mip) - resident_size >
+					   m_streaming_budget)
+			{
+				++mip;
+			}
+			if (mip < first_mip)
+			{
+				memory += texture->getMipsSize(mip) - resident_size;
+				requestMips(*texture, mip);
+				++loading_count;
+			}
+		}
+		m_streaming_memory = memory;
+	}
+}
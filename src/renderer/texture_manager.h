@@ -1,24 +1,68 @@
 #pragma once
 
+#include "core/array.h"
 #include "core/resource_manager_base.h"
 
 namespace Lumix
 {
+	namespace FS
+	{
+		class FileSystem;
+		class IFile;
+	}
+
+	class Texture;
+
 	class LUMIX_RENDERER_API TextureManager : public ResourceManagerBase
 	{
+	public:
+		static const int DEFAULT_STREAMING_BUDGET = 512 << 20;
+		// at most this many textures are read at once
+		static const int MAX_STREAMING_TEXTURES = 4;
+
 	public:
 		TextureManager(IAllocator& allocator);
 		~TextureManager();
 
 		uint8_t* getBuffer(int32_t size);
 
+		void addStreamed(Texture& texture);
+		void removeStreamed(Texture& texture);
+		// reads mips the streamed textures were drawn with in the last frame
+		// and, when they do not fit in the budget, drops mips of textures
+		// which do not need them, call once per frame after rendering
+		void updateStreaming();
+		void setStreamingBudget(int bytes) { m_streaming_budget = bytes; }
+		int getStreamingBudget() const { return m_streaming_budget; }
+		// GPU memory of streamed textures including mips being read
+		int getStreamingMemory() const { return m_streaming_memory; }
+
 	protected:
 		virtual Resource* createResource(const Path& path) override;
 		virtual void destroyResource(Resource& resource) override;
 
+	private:
+		struct MipsRequest
+		{
+			Texture* m_texture;
+			int m_first_mip;
+		};
+
+	private:
+		bool isLoadingMips(const Texture& texture) const;
+		void requestMips(Texture& texture, int first_mip);
+		void mipsLoaded(FS::IFile& file, bool success, FS::FileSystem& fs);
+
 	private:
 		IAllocator& m_allocator;
 		uint8_t* m_buffer;
 		int32_t m_buffer_size;
+		Array<Texture*> m_streamed;
+		// in the order of the reads, the file system finishes them in the
+		// same order; unloaded textures are replaced by nullptr
+		Array<MipsRequest> m_mips_requests;
+		Array<Texture*> m_candidates;
+		int m_streaming_budget;
+		int m_streaming_memory;
 	};
-}
\ No newline at end of file
+}
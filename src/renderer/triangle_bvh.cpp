@@ -0,0 +1,386 @@
+#include "renderer/triangle_bvh.h"
+#include "core/math_utils.h"
+#include "core/simd.h"
+#include <cfloat>
+#include <cmath>
+
+
+namespace Lumix
+{
+
+
+static const int MAX_LEAF_SIZE = 4;
+static const int BIN_COUNT = 12;
+// deeper nodes are split in the middle, the traversal stack grows by one
+// item per level so it can not overflow
+static const int MAX_SAH_DEPTH = 32;
+static const int MAX_STACK_SIZE = 64;
+
+
+struct Bounds
+{
+	void reset()
+	{
+		m_min.set(FLT_MAX, FLT_MAX, FLT_MAX);
+		m_max.set(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	}
+
+	void add(const Vec3& p)
+	{
+		m_min.set(Math::minValue(m_min.x, p.x),
+			Math::minValue(m_min.y, p.y),
+			Math::minValue(m_min.z, p.z));
+		m_max.set(Math::maxValue(m_max.x, p.x),
+			Math::maxValue(m_max.y, p.y),
+			Math::maxValue(m_max.z, p.z));
+	}
+
+	void add(const Bounds& rhs)
+	{
+		add(rhs.m_min);
+		add(rhs.m_max);
+	}
+
+	float getHalfArea() const
+	{
+		if (m_min.x > m_max.x)
+		{
+			return 0;
+		}
+		Vec3 size = m_max - m_min;
+		return size.x * size.y + size.y * size.z + size.z * size.x;
+	}
+
+	Vec3 m_min;
+	Vec3 m_max;
+};
+
+
+TriangleBVH::TriangleBVH(IAllocator& allocator)
+	: m_allocator(allocator)
+	, m_nodes(allocator)
+	, m_triangles(allocator)
+{
+}
+
+
+void TriangleBVH::clear()
+{
+	m_nodes.clear();
+	m_triangles.clear();
+}
+
+
+void TriangleBVH::build(const Vec3* vertices,
+	const Triangle* triangles,
+	int count)
+{
+	clear();
+	if (count == 0)
+	{
+		return;
+	}
+
+	m_triangles.resize(count);
+	Array<Vec3> centroids(m_allocator);
+	centroids.resize(count);
+	for (int i = 0; i < count; ++i)
+	{
+		const Triangle& triangle = triangles[i];
+		m_triangles[i] = triangle;
+		centroids[i] = (vertices[triangle.m_vertices[0]] +
+						   vertices[triangle.m_vertices[1]] +
+						   vertices[triangle.m_vertices[2]]) *
+					   (1.0f / 3);
+	}
+	// a binary tree with leaves of at least one triangle
+	m_nodes.reserve(count * 2);
+	buildNode(vertices, &centroids[0], 0, count, 0);
+}
+
+
+void TriangleBVH::buildNode(const Vec3* vertices,
+	Vec3* centroids,
+	int first,
+	int count,
+	int depth)
+{
+	int node_index = m_nodes.size();
+	m_nodes.pushEmpty();
+
+	Bounds bounds;
+	Bounds centroid_bounds;
+	bounds.reset();
+	centroid_bounds.reset();
+	for (int i = first; i < first + count; ++i)
+	{
+		for (int k = 0; k < 3; ++k)
+		{
+			bounds.add(vertices[m_triangles[i].m_vertices[k]]);
+		}
+		centroid_bounds.add(centroids[i]);
+	}
+	m_nodes[node_index].m_min = bounds.m_min;
+	m_nodes[node_index].m_max = bounds.m_max;
+
+	if (count <= MAX_LEAF_SIZE)
+	{
+		m_nodes[node_index].m_first = first;
+		m_nodes[node_index].m_count = count;
+		return;
+	}
+
+	// binned SAH, the split with the smallest area * count of both sides
+	int best_axis = -1;
+	int best_bin = 0;
+	float best_cost = FLT_MAX;
+	Vec3 extent = centroid_bounds.m_max - centroid_bounds.m_min;
+	for (int axis = 0; axis < 3 && depth < MAX_SAH_DEPTH; ++axis)
+	{
+		float axis_min = (&centroid_bounds.m_min.x)[axis];
+		float axis_extent = (&extent.x)[axis];
+		if (axis_extent <= 0)
+		{
+			continue;
+		}
+		Bounds bins[BIN_COUNT];
+		int bin_counts[BIN_COUNT] = {};
+		for (int i = 0; i < BIN_COUNT; ++i)
+		{
+			bins[i].reset();
+		}
+		float scale = BIN_COUNT / axis_extent;
+		for (int i = first; i < first + count; ++i)
+		{
+			int bin = Math::minValue(
+				BIN_COUNT - 1, int(((&centroids[i].x)[axis] - axis_min) * scale));
+			++bin_counts[bin];
+			for (int k = 0; k < 3; ++k)
+			{
+				bins[bin].add(vertices[m_triangles[i].m_vertices[k]]);
+			}
+		}
+
+		float right_areas[BIN_COUNT];
+		int right_counts[BIN_COUNT];
+		Bounds right;
+		right.reset();
+		int right_count = 0;
+		for (int i = BIN_COUNT - 1; i > 0; --i)
+		{
+			right.add(bins[i]);
+			right_count += bin_counts[i];
+			right_areas[i] = right.getHalfArea();
+			right_counts[i] = right_count;
+		}
+		Bounds left;
+		left.reset();
+		int left_count = 0;
+		for (int i = 0; i < BIN_COUNT - 1; ++i)
+		{
+			left.add(bins[i]);
+			left_count += bin_counts[i];
+			if (left_count == 0 || right_counts[i + 1] == 0)
+			{
+				continue;
+			}
+			float cost = left.getHalfArea() * left_count +
+						 right_areas[i + 1] * right_counts[i + 1];
+			if (cost < best_cost)
+			{
+				best_cost = cost;
+				best_axis = axis;
+				best_bin = i;
+			}
+		}
+	}
+
+	int left_count = count / 2;
+	if (best_axis >= 0)
+	{
+		float axis_min = (&centroid_bounds.m_min.x)[best_axis];
+		float scale = BIN_COUNT / (&extent.x)[best_axis];
+		int mid = first;
+		for (int i = first; i < first + count; ++i)
+		{
+			int bin = Math::minValue(BIN_COUNT - 1,
+				int(((&centroids[i].x)[best_axis] - axis_min) * scale));
+			if (bin <= best_bin)
+			{
+				Triangle tmp_triangle = m_triangles[i];
+				m_triangles[i] = m_triangles[mid];
+				m_triangles[mid] = tmp_triangle;
+				Vec3 tmp_centroid = centroids[i];
+				centroids[i] = centroids[mid];
+				centroids[mid] = tmp_centroid;
+				++mid;
+			}
+		}
+		left_count = mid - first;
+	}
+	else
+	{
+		// all centroids are in the same place or the tree is too deep
+		best_axis = 0;
+	}
+
+	m_nodes[node_index].m_count = -1 - best_axis;
+	buildNode(vertices, centroids, first, left_count, depth + 1);
+	m_nodes[node_index].m_first = m_nodes.size();
+	buildNode(vertices,
+		centroids,
+		first + left_count,
+		count - left_count,
+		depth + 1);
+}
+
+
+bool TriangleBVH::castRay(const Vec3* vertices,
+	const Vec3& origin,
+	const Vec3& dir,
+	Hit& hit) const
+{
+	if (m_nodes.empty())
+	{
+		return false;
+	}
+
+	// avoid 0 * inf in the slab test
+	Vec3 safe_dir = dir;
+	for (int i = 0; i < 3; ++i)
+	{
+		float& d = (&safe_dir.x)[i];
+		if (fabs(d) < 1e-20f)
+		{
+			d = d < 0 ? -1e-20f : 1e-20f;
+		}
+	}
+	float4 ray_origin = f4Load3(&origin.x);
+	float4 inv_dir = f4Div(f4Splat(1), f4Load3(&safe_dir.x));
+	float4 dir_x = f4Splat(dir.x);
+	float4 dir_y = f4Splat(dir.y);
+	float4 dir_z = f4Splat(dir.z);
+	float4 origin_x = f4Splat(origin.x);
+	float4 origin_y = f4Splat(origin.y);
+	float4 origin_z = f4Splat(origin.z);
+	float4 zero = f4Zero();
+	float4 one = f4Splat(1);
+
+	float best_t = FLT_MAX;
+	int best_mesh = -1;
+	int stack[MAX_STACK_SIZE];
+	int stack_size = 1;
+	stack[0] = 0;
+	while (stack_size > 0)
+	{
+		const Node& node = m_nodes[stack[--stack_size]];
+
+		// slab test, the 4th lane is ignored
+		float4 t0 = f4Mul(f4Sub(f4Load3(&node.m_min.x), ray_origin), inv_dir);
+		float4 t1 = f4Mul(f4Sub(f4Load3(&node.m_max.x), ray_origin), inv_dir);
+		float4 t_min = f4Min(t0, t1);
+		float4 t_max = f4Max(t0, t1);
+		t_min = f4Max(f4Max(t_min, f4Splat4(t_min, 1)), f4Splat4(t_min, 2));
+		t_max = f4Min(f4Min(t_max, f4Splat4(t_max, 1)), f4Splat4(t_max, 2));
+		float t_near = Math::maxValue(f4GetX(t_min), 0.0f);
+		float t_far = Math::minValue(f4GetX(t_max), best_t);
+		if (t_near > t_far)
+		{
+			continue;
+		}
+
+		if (node.m_count < 0)
+		{
+			// the nearer child is on the top of the stack
+			int axis = -1 - node.m_count;
+			int left = int(&node - &m_nodes[0]) + 1;
+			bool left_first = (&dir.x)[axis] >= 0;
+			stack[stack_size++] = left_first ? node.m_first : left;
+			stack[stack_size++] = left_first ? left : node.m_first;
+			continue;
+		}
+
+		// Moller-Trumbore, 4 triangles at once, missing triangles are
+		// replaced by the last one
+		float4 p[3][4];
+		for (int i = 0; i < 4; ++i)
+		{
+			const Triangle& triangle =
+				m_triangles[node.m_first + Math::minValue(i, node.m_count - 1)];
+			for (int k = 0; k < 3; ++k)
+			{
+				p[k][i] = f4Load3(&vertices[triangle.m_vertices[k]].x);
+			}
+		}
+		for (int k = 0; k < 3; ++k)
+		{
+			f4Transpose(p[k][0], p[k][1], p[k][2], p[k][3]);
+		}
+		float4 e1_x = f4Sub(p[1][0], p[0][0]);
+		float4 e1_y = f4Sub(p[1][1], p[0][1]);
+		float4 e1_z = f4Sub(p[1][2], p[0][2]);
+		float4 e2_x = f4Sub(p[2][0], p[0][0]);
+		float4 e2_y = f4Sub(p[2][1], p[0][1]);
+		float4 e2_z = f4Sub(p[2][2], p[0][2]);
+
+		// pvec = dir x e2
+		float4 pvec_x = f4Sub(f4Mul(dir_y, e2_z), f4Mul(dir_z, e2_y));
+		float4 pvec_y = f4Sub(f4Mul(dir_z, e2_x), f4Mul(dir_x, e2_z));
+		float4 pvec_z = f4Sub(f4Mul(dir_x, e2_y), f4Mul(dir_y, e2_x));
+		float4 det = f4Add(f4Add(f4Mul(e1_x, pvec_x), f4Mul(e1_y, pvec_y)),
+			f4Mul(e1_z, pvec_z));
+		// parallel rays get infinite inv_det and NaN u, which fails all tests
+		float4 inv_det = f4Div(one, det);
+
+		float4 tvec_x = f4Sub(origin_x, p[0][0]);
+		float4 tvec_y = f4Sub(origin_y, p[0][1]);
+		float4 tvec_z = f4Sub(origin_z, p[0][2]);
+		float4 u = f4Mul(f4Add(f4Add(f4Mul(tvec_x, pvec_x), f4Mul(tvec_y, pvec_y)),
+							 f4Mul(tvec_z, pvec_z)),
+			inv_det);
+
+		// qvec = tvec x e1
+		float4 qvec_x = f4Sub(f4Mul(tvec_y, e1_z), f4Mul(tvec_z, e1_y));
+		float4 qvec_y = f4Sub(f4Mul(tvec_z, e1_x), f4Mul(tvec_x, e1_z));
+		float4 qvec_z = f4Sub(f4Mul(tvec_x, e1_y), f4Mul(tvec_y, e1_x));
+		float4 v = f4Mul(f4Add(f4Add(f4Mul(dir_x, qvec_x), f4Mul(dir_y, qvec_y)),
+							 f4Mul(dir_z, qvec_z)),
+			inv_det);
+		float4 t = f4Mul(f4Add(f4Add(f4Mul(e2_x, qvec_x), f4Mul(e2_y, qvec_y)),
+							 f4Mul(e2_z, qvec_z)),
+			inv_det);
+
+		float4 valid = f4And(f4CmpLE(zero, u), f4CmpLE(zero, v));
+		valid = f4And(valid, f4CmpLE(f4Add(u, v), one));
+		valid = f4And(valid, f4CmpLE(zero, t));
+		valid = f4And(valid, f4CmpLT(t, f4Splat(best_t)));
+		int mask = f4MoveMask(valid);
+		if (mask == 0)
+		{
+			continue;
+		}
+		float ts[4];
+		f4StoreUnaligned(ts, t);
+		for (int i = 0; i < 4; ++i)
+		{
+			if ((mask & (1 << i)) && ts[i] < best_t)
+			{
+				best_t = ts[i];
+				best_mesh =
+					m_triangles[node.m_first + Math::minValue(i, node.m_count - 1)]
+						.m_mesh;
+			}
+		}
+	}
+
+	if (best_mesh < 0)
+	{
+		return false;
+	}
+	hit.m_t = best_t;
+	hit.m_mesh = best_mesh;
+	return true;
+}
+
+
+} // ~namespace Lumix
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "lumix.h"
+#include "core/array.h"
+#include "core/vec3.h"
+
+namespace Lumix
+{
+
+
+// bounding volume hierarchy of triangles built with the binned surface area
+// heuristic, leaves have at most 4 triangles which are tested at once with
+// SSE; vertices are not stored, they are passed to castRay()
+class LUMIX_RENDERER_API TriangleBVH
+{
+public:
+	struct Triangle
+	{
+		int m_vertices[3];
+		int m_mesh;
+	};
+
+	struct Hit
+	{
+		float m_t;
+		int m_mesh;
+	};
+
+public:
+	TriangleBVH(IAllocator& allocator);
+
+	void clear();
+	void build(const Vec3* vertices, const Triangle* triangles, int count);
+	// t is in units of dir, two sided, returns the closest hit
+	bool castRay(const Vec3* vertices,
+		const Vec3& origin,
+		const Vec3& dir,
+		Hit& hit) const;
+	int getNodeCount() const { return m_nodes.size(); }
+
+private:
+	struct Node
+	{
+		Vec3 m_min;
+		int m_first; // first triangle of a leaf, right child of an inner node
+		Vec3 m_max;
+		// triangle count of a leaf, inner nodes store -1 - split axis, left
+		// child of an inner node is the next node
+		int m_count;
+	};
+
+private:
+	void buildNode(const Vec3* vertices,
+		Vec3* centroids,
+		int first,
+		int count,
+		int depth);
+
+private:
+	IAllocator& m_allocator;
+	Array<Node> m_nodes;
+	Array<Triangle> m_triangles;
+};
+
+
+} // ~namespace Lumix
@@ -107,7 +107,7 @@ namespace Lumix
 			virtual IPlugin& getPlugin() const;
 
 
-			void deserialize(InputBlob& serializer) override
+			void deserialize(InputBlob& serializer, int) override
 			{
 				int32_t count;
 				serializer.read(count);
@@ -1,17 +1,22 @@
 #include "import_asset_dialog.h"
 #include "ui_import_asset_dialog.h"
 #include "animation/animation.h"
+#include "animation/animation_compression.h"
 #include "assimp/defaultlogger.hpp"
 #include "assimp/postprocess.h"
 #include "assimp/progresshandler.hpp"
 #include "assimp/scene.h"
+#include "core/blob.h"
 #include "core/crc32.h"
+#include "core/default_allocator.h"
 #include "core/log.h"
 #include "core/vec3.h"
-#include "crnlib.h"
 #include "debug/floating_points.h"
 #include "editor/world_editor.h"
+#include "engine.h"
+#include "renderer/mesh_optimizer.h"
 #include "renderer/model.h"
+#include "renderer/texture_compressor.h"
 #include "mainwindow.h"
 #include "metadata.h"
 #include "physics/physics_geometry_manager.h"
@@ -22,6 +27,7 @@
 #include <qmessagebox.h>
 #include <qprocess.h>
 #include <qthread.h>
+#include <cmath>
 
 
 class LogStream : public Assimp::LogStream
@@ -55,6 +61,7 @@ enum class VertexAttributeDef : uint32_t
 	SHORT2,
 	SHORT4,
 	BYTE4,
+	HALF2,
 	NONE
 };
 
@@ -86,9 +93,12 @@ static void writeAttribute(const char* attribute_name,
 }
 
 
-ImportThread::ImportThread(ImportAssetDialog& dialog)
-	: m_dialog(dialog)
-	, m_importer(dialog.getImporter())
+ImportThread::ImportThread(Assimp::Importer& importer,
+						   Lumix::MTJD::Manager& mtjd_manager,
+						   Lumix::IAllocator& allocator)
+	: m_importer(importer)
+	, m_mtjd_manager(mtjd_manager)
+	, m_allocator(allocator)
 {
 	Assimp::Logger::LogSeverity severity = Assimp::Logger::NORMAL;
 	Assimp::DefaultLogger::create("", severity, aiDefaultLogStream_DEBUGGER);
@@ -97,6 +107,12 @@ ImportThread::ImportThread(ImportAssetDialog& dialog)
 	m_import_model = true;
 	m_import_physics = false;
 	m_import_materials = true;
+	m_convert_texture_to_DDS = false;
+	m_optimize_meshes = true;
+	m_optimize_overdraw = true;
+	m_lod_count = 1;
+	m_lod_triangle_ratio = 0.5f;
+	m_lod_distance = 10;
 }
 
 
@@ -147,9 +163,9 @@ static int getVertexSize(const aiMesh* mesh)
 	static const int POSITION_SIZE = sizeof(float) * 3;
 	static const int NORMAL_SIZE = sizeof(uint8_t) * 4;
 	static const int TANGENT_SIZE = sizeof(uint8_t) * 4;
-	static const int UV_SIZE = sizeof(float) * 2;
+	static const int UV_SIZE = sizeof(uint16_t) * 2;
 	static const int BONE_INDICES_WEIGHTS_SIZE =
-		sizeof(float) * 4 + sizeof(uint16_t) * 4;
+		sizeof(uint8_t) * 4 + sizeof(uint16_t) * 4;
 	int size = POSITION_SIZE + NORMAL_SIZE + UV_SIZE;
 	if (mesh->mTangents)
 	{
@@ -166,14 +182,14 @@ static int getVertexSize(const aiMesh* mesh)
 void ImportThread::writeMeshes(QFile& file)
 {
 	const aiScene* scene = m_importer.GetScene();
-	int32_t mesh_count = (int32_t)scene->mNumMeshes;
+	int32_t mesh_count = (int32_t)m_meshes.size();
 
 	file.write((const char*)&mesh_count, sizeof(mesh_count));
 	int32_t attribute_array_offset = 0;
 	int32_t indices_offset = 0;
-	for (unsigned int i = 0; i < scene->mNumMeshes; ++i)
+	for (const auto& import_mesh : m_meshes)
 	{
-		const aiMesh* mesh = scene->mMeshes[i];
+		const aiMesh* mesh = import_mesh.mesh;
 		int vertex_size = getVertexSize(mesh);
 		aiString material_name;
 		scene->mMaterials[mesh->mMaterialIndex]->Get(AI_MATKEY_NAME,
@@ -184,27 +200,31 @@ void ImportThread::writeMeshes(QFile& file)
 
 		file.write((const char*)&attribute_array_offset,
 				   sizeof(attribute_array_offset));
-		int32_t attribute_array_size = mesh->mNumVertices * vertex_size;
+		int32_t attribute_array_size = import_mesh.vertices.size() * vertex_size;
 		attribute_array_offset += attribute_array_size;
 		file.write((const char*)&attribute_array_size,
 				   sizeof(attribute_array_size));
 
 		file.write((const char*)&indices_offset, sizeof(indices_offset));
-		int32_t mesh_tri_count = mesh->mNumFaces;
-		indices_offset += mesh->mNumFaces * 3;
+		int32_t mesh_tri_count = import_mesh.indices.size() / 3;
+		indices_offset += import_mesh.indices.size();
 		file.write((const char*)&mesh_tri_count, sizeof(mesh_tri_count));
 
-		aiString mesh_name = mesh->mName;
-		length = strlen(mesh_name.C_Str());
+		QByteArray mesh_name = mesh->mName.C_Str();
+		if (import_mesh.lod > 0)
+		{
+			mesh_name += QString("_LOD%1").arg(import_mesh.lod).toLatin1();
+		}
+		length = mesh_name.size();
 		file.write((const char*)&length, sizeof(length));
-		file.write((const char*)mesh_name.C_Str(), length);
+		file.write(mesh_name.data(), length);
 
 		int32_t attribute_count = getAttributeCount(mesh);
 		file.write((const char*)&attribute_count, sizeof(attribute_count));
 
 		if (isSkinned(mesh))
 		{
-			writeAttribute("in_weights", VertexAttributeDef::FLOAT4, file);
+			writeAttribute("in_weights", VertexAttributeDef::BYTE4, file);
 			writeAttribute("in_indices", VertexAttributeDef::SHORT4, file);
 		}
 
@@ -214,7 +234,7 @@ void ImportThread::writeMeshes(QFile& file)
 		{
 			writeAttribute("in_tangents", VertexAttributeDef::BYTE4, file);
 		}
-		writeAttribute("in_tex_coords", VertexAttributeDef::FLOAT2, file);
+		writeAttribute("in_tex_coords", VertexAttributeDef::HALF2, file);
 	}
 }
 
@@ -293,56 +313,256 @@ static uint32_t packF4u(const aiVector3D& vec)
 }
 
 
+// weights are normalized so that they sum to exactly 255, the rounding
+// error goes to the biggest weight
+static uint32_t packWeights(const float* weights)
+{
+	float sum = weights[0] + weights[1] + weights[2] + weights[3];
+	float scale = sum > 0 ? 255.0f / sum : 0;
+	uint8_t packed[4];
+	int total = 0;
+	int biggest = 0;
+	for (int i = 0; i < 4; ++i)
+	{
+		packed[i] = uint8_t(weights[i] * scale + 0.5f);
+		total += packed[i];
+		if (weights[i] > weights[biggest]) biggest = i;
+	}
+	if (sum > 0) packed[biggest] = uint8_t(packed[biggest] + 255 - total);
+	return packUint32(packed[0], packed[1], packed[2], packed[3]);
+}
+
+
+static uint16_t floatToHalf(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint16_t sign = uint16_t((bits >> 16) & 0x8000);
+	int exponent = int((bits >> 23) & 0xff) - 127 + 15;
+	uint32_t mantissa = bits & 0x7fffff;
+	if (exponent <= 0)
+	{
+		if (exponent < -10) return sign;
+		mantissa |= 0x800000;
+		int shift = 14 - exponent;
+		return uint16_t(sign | ((mantissa + (1 << (shift - 1))) >> shift));
+	}
+	if (exponent >= 31) return uint16_t(sign | 0x7c00);
+	// rounding may carry into the exponent, which is still correct
+	return uint16_t(
+		sign + (((exponent << 10) | (mantissa >> 13)) + ((mantissa >> 12) & 1)));
+}
+
+
+template <typename T>
+static void writeIndices(QFile& file, const QVector<ImportThread::ImportMesh>& meshes)
+{
+	for (const auto& mesh : meshes)
+	{
+		for (uint32_t index : mesh.indices)
+		{
+			T polygon_idx = T(index);
+			file.write((const char*)&polygon_idx, sizeof(polygon_idx));
+		}
+	}
+}
+
+
+// reorders triangles and vertices of the mesh, unreferenced vertices are
+// dropped
+static void optimizeMesh(ImportThread::ImportMesh& import_mesh,
+	bool optimize,
+	bool optimize_overdraw)
+{
+	const aiMesh* mesh = import_mesh.mesh;
+	QVector<uint32_t>& indices = import_mesh.indices;
+	int vertex_count = (int)mesh->mNumVertices;
+	Lumix::DefaultAllocator allocator;
+	if (optimize && !indices.empty())
+	{
+		Lumix::MeshOptimizer::optimizeVertexCache(
+			&indices[0], indices.size(), vertex_count, allocator);
+		if (optimize_overdraw)
+		{
+			Lumix::MeshOptimizer::optimizeOverdraw(&indices[0],
+				indices.size(),
+				(const Lumix::Vec3*)mesh->mVertices,
+				vertex_count,
+				1.05f,
+				allocator);
+		}
+	}
+
+	QVector<int> remap(vertex_count);
+	int used_count = Lumix::MeshOptimizer::optimizeVertexFetch(
+		indices.empty() ? nullptr : &indices[0],
+		indices.size(),
+		vertex_count,
+		&remap[0]);
+	import_mesh.vertices.resize(used_count);
+	for (int j = 0; j < vertex_count; ++j)
+	{
+		if (remap[j] < used_count)
+		{
+			import_mesh.vertices[remap[j]] = j;
+		}
+	}
+	// indices now refer to the written vertices, the simplifier of the next
+	// LOD needs source vertices
+	for (uint32_t& index : indices)
+	{
+		index = import_mesh.vertices[index];
+	}
+}
+
+
+// a LOD whose mesh could not be simplified to this many times its target
+// is not worth its memory, it and the following LODs are skipped
+static const int MAX_LOD_INDEX_EXCESS = 2;
+
+
+void ImportThread::prepareMeshes()
+{
+	const aiScene* scene = m_importer.GetScene();
+	m_meshes.clear();
+	for (int lod = 0; lod < m_lod_count; ++lod)
+	{
+		float ratio = powf(m_lod_triangle_ratio, (float)lod);
+		int lod_begin = m_meshes.size();
+		bool is_lod_valid = true;
+		for (unsigned int i = 0; i < scene->mNumMeshes && is_lod_valid; ++i)
+		{
+			const aiMesh* mesh = scene->mMeshes[i];
+			ImportMesh import_mesh;
+			import_mesh.mesh = mesh;
+			import_mesh.source_index = i;
+			import_mesh.lod = lod;
+			if (lod == 0)
+			{
+				import_mesh.indices.resize(mesh->mNumFaces * 3);
+				for (unsigned int j = 0; j < mesh->mNumFaces; ++j)
+				{
+					for (int k = 0; k < 3; ++k)
+					{
+						import_mesh.indices[j * 3 + k] =
+							mesh->mFaces[j].mIndices[k];
+					}
+				}
+			}
+			else
+			{
+				// previous LOD is a good starting point and it is smaller
+				import_mesh.indices =
+					m_meshes[m_meshes.size() - scene->mNumMeshes].indices;
+				int target_index_count =
+					qMax(1, int(mesh->mNumFaces * ratio)) * 3;
+				if (!import_mesh.indices.empty())
+				{
+					Lumix::DefaultAllocator allocator;
+					int index_count = Lumix::MeshOptimizer::simplify(
+						&import_mesh.indices[0],
+						import_mesh.indices.size(),
+						(const Lumix::Vec3*)mesh->mVertices,
+						mesh->mNumVertices,
+						target_index_count,
+						allocator);
+					import_mesh.indices.resize(index_count);
+					if (index_count > target_index_count * MAX_LOD_INDEX_EXCESS)
+					{
+						Lumix::g_log_warning.log("import")
+							<< "LOD " << lod << " skipped, mesh "
+							<< mesh->mName.C_Str() << " has " << index_count / 3
+							<< " triangles, " << target_index_count / 3
+							<< " were requested";
+						is_lod_valid = false;
+						continue;
+					}
+				}
+			}
+			optimizeMesh(import_mesh, m_optimize_meshes, m_optimize_overdraw);
+			m_meshes.push_back(import_mesh);
+		}
+		if (!is_lod_valid)
+		{
+			m_meshes.resize(lod_begin);
+			break;
+		}
+	}
+	// written indices are local to the written vertices
+	for (auto& import_mesh : m_meshes)
+	{
+		QVector<int> remap(import_mesh.mesh->mNumVertices);
+		for (int j = 0; j < import_mesh.vertices.size(); ++j)
+		{
+			remap[import_mesh.vertices[j]] = j;
+		}
+		for (uint32_t& index : import_mesh.indices)
+		{
+			index = remap[index];
+		}
+	}
+}
+
+
 void ImportThread::writeGeometry(QFile& file)
 {
 	const aiScene* scene = m_importer.GetScene();
 	int32_t indices_count = 0;
 	int vertices_count = 0;
 	int32_t vertices_size = 0;
+	bool short_indices = true;
 	for (unsigned int i = 0; i < scene->mNumMeshes; ++i)
 	{
-		indices_count += scene->mMeshes[i]->mNumFaces * 3;
 		vertices_count += scene->mMeshes[i]->mNumVertices;
+	}
+	for (const auto& import_mesh : m_meshes)
+	{
+		indices_count += import_mesh.indices.size();
 		vertices_size +=
-			scene->mMeshes[i]->mNumVertices * getVertexSize(scene->mMeshes[i]);
+			import_mesh.vertices.size() * getVertexSize(import_mesh.mesh);
+		// indices are local to the mesh
+		short_indices = short_indices && import_mesh.vertices.size() <= 0x10000;
 	}
 
+	int32_t index_size = short_indices ? sizeof(uint16_t) : sizeof(int32_t);
+	file.write((const char*)&index_size, sizeof(index_size));
 	file.write((const char*)&indices_count, sizeof(indices_count));
-	int32_t polygon_idx = 0;
-	for (unsigned int i = 0; i < scene->mNumMeshes; ++i)
+	if (short_indices)
 	{
-		const aiMesh* mesh = scene->mMeshes[i];
-		for (unsigned int j = 0; j < mesh->mNumFaces; ++j)
-		{
-			polygon_idx = mesh->mFaces[j].mIndices[0];
-			file.write((const char*)&polygon_idx, sizeof(polygon_idx));
-			polygon_idx = mesh->mFaces[j].mIndices[1];
-			file.write((const char*)&polygon_idx, sizeof(polygon_idx));
-			polygon_idx = mesh->mFaces[j].mIndices[2];
-			file.write((const char*)&polygon_idx, sizeof(polygon_idx));
-		}
+		writeIndices<uint16_t>(file, m_meshes);
+	}
+	else
+	{
+		writeIndices<int32_t>(file, m_meshes);
 	}
 
 	file.write((const char*)&vertices_size, sizeof(vertices_size));
 
 	QVector<SkinInfo> skin_infos;
 	fillSkinInfo(scene, skin_infos, vertices_count);
-
-	int skin_index = 0;
+	QVector<int> skin_offsets(scene->mNumMeshes);
+	int skin_offset = 0;
 	for (unsigned int i = 0; i < scene->mNumMeshes; ++i)
 	{
-		const aiMesh* mesh = scene->mMeshes[i];
+		skin_offsets[i] = skin_offset;
+		skin_offset += scene->mMeshes[i]->mNumVertices;
+	}
+
+	for (const auto& import_mesh : m_meshes)
+	{
+		const aiMesh* mesh = import_mesh.mesh;
 		bool is_skinned = isSkinned(mesh);
-		for (unsigned int j = 0; j < mesh->mNumVertices; ++j)
+		for (int j : import_mesh.vertices)
 		{
 			if (is_skinned)
 			{
-				file.write((const char*)skin_infos[skin_index].weights,
-						   sizeof(skin_infos[skin_index].weights));
-				file.write((const char*)skin_infos[skin_index].bone_indices,
-						   sizeof(skin_infos[skin_index].bone_indices));
+				const SkinInfo& skin_info =
+					skin_infos[skin_offsets[import_mesh.source_index] + j];
+				uint32_t weights = packWeights(skin_info.weights);
+				file.write((const char*)&weights, sizeof(weights));
+				file.write((const char*)skin_info.bone_indices,
+						   sizeof(skin_info.bone_indices));
 			}
-			++skin_index;
 
 			Lumix::Vec3 position(mesh->mVertices[j].x,
 								 mesh->mVertices[j].y,
@@ -361,8 +581,8 @@ void ImportThread::writeGeometry(QFile& file)
 			}
 
 			auto uv = mesh->mTextureCoords[0][j];
-			uv.y = -uv.y;
-			file.write((const char*)&uv, sizeof(uv.x) + sizeof(uv.y));
+			uint16_t half_uv[2] = {floatToHalf(uv.x), floatToHalf(-uv.y)};
+			file.write((const char*)half_uv, sizeof(half_uv));
 		}
 	}
 }
@@ -553,23 +773,33 @@ bool ImportThread::saveLumixModel()
 	}
 	Lumix::Model::FileHeader header;
 	header.m_magic = Lumix::Model::FILE_MAGIC;
-	header.m_version = (uint32_t)Lumix::Model::FileVersion::LATEST;
+	header.m_version = (uint32_t)Lumix::Model::FileVersion::COMPACT;
 
 	file.write((const char*)&header, sizeof(header));
 
 	emit progress(1 / 3.0f + 1 / 9.0f, "Saving mesh...");
+	prepareMeshes();
 	writeMeshes(file);
 	emit progress(1 / 3.0f + 2 / 9.0f, "Saving mesh...");
 	writeGeometry(file);
 
 	writeSkeleton(file);
 
-	int32_t lod_count = 1;
+	// prepareMeshes could have skipped some LODs
+	int32_t lod_count = m_meshes.size() / m_importer.GetScene()->mNumMeshes;
 	file.write((const char*)&lod_count, sizeof(lod_count));
-	int32_t to_mesh = m_importer.GetScene()->mNumMeshes - 1;
-	file.write((const char*)&to_mesh, sizeof(to_mesh));
-	float distance = FLT_MAX;
-	file.write((const char*)&distance, sizeof(distance));
+	float distance = m_lod_distance;
+	for (int i = 0; i < lod_count; ++i)
+	{
+		int32_t to_mesh = (i + 1) * m_importer.GetScene()->mNumMeshes - 1;
+		file.write((const char*)&to_mesh, sizeof(to_mesh));
+		// the model compares squared distances
+		float squared_distance =
+			i < lod_count - 1 ? distance * distance : FLT_MAX;
+		file.write((const char*)&squared_distance, sizeof(squared_distance));
+		distance *= 2;
+	}
+	m_meshes.clear();
 
 	file.close();
 	emit progress(2 / 3.0f, "Mesh saved.");
@@ -579,26 +809,14 @@ bool ImportThread::saveLumixModel()
 
 static bool convertToDDS(const QImage& image,
 						 const QString& dest,
-						 crn_progress_callback_func callback,
-						 void* callback_data)
+						 Lumix::MTJD::Manager& mtjd_manager,
+						 Lumix::IAllocator& allocator)
 {
 	if (image.isNull())
 	{
 		return false;
 	}
 
-	crn_uint32 size;
-	crn_comp_params comp_params;
-	comp_params.m_width = image.width();
-	comp_params.m_height = image.height();
-	comp_params.m_file_type = cCRNFileTypeDDS;
-	comp_params.m_format = cCRNFmtDXT3;
-	comp_params.m_quality_level = cCRNMinQualityLevel;
-	comp_params.m_dxt_quality = cCRNDXTQualitySuperFast;
-	comp_params.m_dxt_compressor_type = cCRNDXTCompressorRYG;
-	comp_params.m_pProgress_func = callback;
-	comp_params.m_pProgress_func_data = callback_data;
-	comp_params.m_num_helper_threads = 4;
 	QVector<uint32_t> img_data;
 	img_data.resize(image.width() * image.height());
 	for (int j = 0; j < image.height(); ++j)
@@ -611,25 +829,31 @@ static bool convertToDDS(const QImage& image,
 											  (qAlpha(rgb) << 24);
 		}
 	}
-	comp_params.m_pImages[0][0] = &img_data[0];
-	crn_mipmap_params mipmap_params;
-	mipmap_params.m_mode = cCRNMipModeGenerateMips;
 
-	void* data = crn_compress(comp_params, mipmap_params, size);
-
-	QFile file(dest);
-	if (data && file.open(QIODevice::WriteOnly))
+	Lumix::OutputBlob data(allocator);
+	auto format = image.hasAlphaChannel()
+					  ? Lumix::TextureCompressor::Format::BC3
+					  : Lumix::TextureCompressor::Format::BC1;
+	if (!Lumix::TextureCompressor::compressDDS((const uint8_t*)&img_data[0],
+											   image.width(),
+											   image.height(),
+											   format,
+											   Lumix::TextureCompressor::MipFilter::KAISER,
+											   mtjd_manager,
+											   data,
+											   allocator))
 	{
-		file.write((const char*)data, size);
-		file.close();
-		crn_free_block(data);
-		return true;
+		return false;
 	}
-	else
+
+	QFile file(dest);
+	if (!file.open(QIODevice::WriteOnly))
 	{
-		crn_free_block(data);
 		return false;
 	}
+	file.write((const char*)data.getData(), data.getSize());
+	file.close();
+	return true;
 }
 
 
@@ -675,7 +899,7 @@ bool ImportThread::saveTexture(const QString& source_path,
 		auto source = material_info.path() + "/" + texture_path;
 		auto dest = m_destination + "/" + texture_info.path() + "/" +
 					texture_info.baseName() + ".dds";
-		if (!convertToDDS(QImage(source), dest, nullptr, nullptr))
+		if (!convertToDDS(QImage(source), dest, m_mtjd_manager, m_allocator))
 		{
 			m_error_message =
 				QString("Error converting %1 to %2").arg(source).arg(dest);
@@ -741,8 +965,10 @@ bool ImportThread::saveEmbeddedTextures(const aiScene* scene)
 		{
 			auto texture_name = QString("texture%1.dds").arg(i);
 			m_saved_embedded_textures.push_back(texture_name);
-			convertToDDS(
-				image, m_destination + "/" + texture_name, nullptr, nullptr);
+			convertToDDS(image,
+						 m_destination + "/" + texture_name,
+						 m_mtjd_manager,
+						 m_allocator);
 		}
 		else
 		{
@@ -848,11 +1074,15 @@ void ImportThread::run()
 		m_importer.SetPropertyInteger(AI_CONFIG_PP_RVC_FLAGS,
 									  aiComponent_COLORS | aiComponent_LIGHTS |
 										  aiComponent_CAMERAS);
+		// the engine refuses meshes referencing more bones
+		m_importer.SetPropertyInteger(AI_CONFIG_PP_SBBC_MAX_BONES,
+									  Lumix::Model::MAX_BONES_PER_MESH);
 		const aiScene* scene = m_importer.ReadFile(
 			m_source.toLatin1().data(),
 			aiProcess_JoinIdenticalVertices | aiProcess_RemoveComponent |
 				aiProcess_GenUVCoords | aiProcess_RemoveRedundantMaterials |
 				aiProcess_Triangulate | aiProcess_LimitBoneWeights |
+				aiProcess_SplitByBoneCount |
 				aiProcess_OptimizeGraph | aiProcess_OptimizeMeshes |
 				aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace);
 		if (!scene || !scene->mMeshes || !scene->mMeshes[0]->mTangents)
@@ -880,7 +1110,9 @@ ImportAssetDialog::ImportAssetDialog(MainWindow& main_window,
 	, m_base_path(base_path)
 	, m_main_window(main_window)
 {
-	m_import_thread = new ImportThread(*this);
+	auto& engine = m_main_window.getWorldEditor().getEngine();
+	m_import_thread = new ImportThread(
+		m_importer, engine.getMTJDManager(), engine.getAllocator());
 	m_ui = new Ui::ImportAssetDialog;
 	m_ui->setupUi(this);
 
@@ -891,6 +1123,7 @@ ImportAssetDialog::ImportAssetDialog(MainWindow& main_window,
 	m_ui->importMaterialsCheckbox->hide();
 	m_ui->importAnimationCheckbox->hide();
 	m_ui->importMeshCheckbox->hide();
+	m_ui->lodWidget->hide();
 	m_ui->createDirectoryCheckbox->hide();
 	m_ui->convertToDDSCheckbox->hide();
 	m_ui->importButton->setEnabled(false);
@@ -941,6 +1174,7 @@ void ImportAssetDialog::on_sourceInput_textChanged(const QString& text)
 	m_ui->convertToDDSCheckbox->hide();
 	m_ui->importAnimationCheckbox->hide();
 	m_ui->importMeshCheckbox->hide();
+	m_ui->lodWidget->hide();
 	m_ui->importPhysicsCheckbox->hide();
 	m_ui->convexPhysicsCheckbox->hide();
 	m_ui->createDirectoryCheckbox->hide();
@@ -969,6 +1203,7 @@ void ImportAssetDialog::on_importFinished()
 	{
 		m_ui->importButton->setEnabled(true);
 		m_ui->importMeshCheckbox->show();
+		m_ui->lodWidget->show();
 		m_ui->importPhysicsCheckbox->show();
 		m_ui->convexPhysicsCheckbox->show();
 		m_ui->createDirectoryCheckbox->show();
@@ -1070,6 +1305,9 @@ void ImportAssetDialog::importModel()
 	m_import_thread->setImportMaterials(
 		m_ui->importMaterialsCheckbox->isChecked());
 	m_import_thread->setImportModel(m_ui->importMeshCheckbox->isChecked());
+	m_import_thread->setLODs(m_ui->lodCountSpinBox->value(),
+		(float)m_ui->lodRatioSpinBox->value(),
+		(float)m_ui->lodDistanceSpinBox->value());
 	m_import_thread->setImportPhysics(m_ui->importPhysicsCheckbox->isChecked(),
 									  m_ui->convexPhysicsCheckbox->isChecked());
 	m_import_thread->start();
@@ -1166,18 +1404,20 @@ void ImportAssetDialog::importAnimation()
 							: animation->mTicksPerSecond;
 			header.fps = fps;
 			header.magic = Lumix::Animation::HEADER_MAGIC;
-			header.version = 1;
+			header.version = (uint32_t)Lumix::Animation::Version::COMPRESSED;
 			file.write((const char*)&header, sizeof(header));
-			int32_t frame_count = animation->mDuration;
-			file.write((const char*)&frame_count, sizeof(frame_count));
+			int32_t frame_count =
+				qMin((int32_t)animation->mDuration, (int32_t)0x10000);
+			frame_count = qMax(frame_count, 1);
 			int32_t bone_count = animation->mNumChannels;
-			file.write((const char*)&bone_count, sizeof(bone_count));
 
 			QVector<Lumix::Vec3> positions;
 			QVector<Lumix::Quat> rotations;
+			QVector<uint32_t> bones;
 
 			positions.resize(bone_count * frame_count);
 			rotations.resize(bone_count * frame_count);
+			bones.resize(bone_count);
 
 			for (unsigned int channel_idx = 0;
 				 channel_idx < animation->mNumChannels;
@@ -1191,18 +1431,22 @@ void ImportAssetDialog::importAnimation()
 					rotations[frame * bone_count + channel_idx] =
 						getRotation(channel, frame);
 				}
+				bones[channel_idx] =
+					Lumix::crc32(channel->mNodeName.C_Str());
 			}
 
-			file.write((const char*)&positions[0],
-					   sizeof(positions[0]) * positions.size());
-			file.write((const char*)&rotations[0],
-					   sizeof(rotations[0]) * rotations.size());
-			for (int i = 0; i < bone_count; ++i)
-			{
-				uint32_t hash =
-					Lumix::crc32(animation->mChannels[i]->mNodeName.C_Str());
-				file.write((const char*)&hash, sizeof(hash));
-			}
+			Lumix::DefaultAllocator allocator;
+			Lumix::OutputBlob blob(allocator);
+			Lumix::AnimationCompression::compress(
+				frame_count,
+				bone_count,
+				positions.empty() ? nullptr : &positions[0],
+				rotations.empty() ? nullptr : &rotations[0],
+				bones.empty() ? nullptr : &bones[0],
+				Lumix::AnimationCompression::Settings(),
+				allocator,
+				blob);
+			file.write((const char*)blob.getData(), blob.getSize());
 
 			file.close();
 		}
@@ -1259,29 +1503,14 @@ void ImportAssetDialog::importTexture()
 	}
 	else
 	{
-		struct Callback
-		{
-			static crn_bool foo(crn_uint32 phase_index,
-								crn_uint32 total_phases,
-								crn_uint32 subphase_index,
-								crn_uint32 total_subphases,
-								void* pUser_data_ptr)
-			{
-				static_cast<ImportAssetDialog*>(pUser_data_ptr)
-					->on_progressUpdate(phase_index / (float)total_phases +
-											subphase_index /
-												(float)total_subphases /
-												total_phases,
-										"Importing texture...");
-				QCoreApplication::processEvents();
-				return true;
-			}
-		};
+		on_progressUpdate(0.0f, "Importing texture...");
+		QCoreApplication::processEvents();
+		auto& engine = m_main_window.getWorldEditor().getEngine();
 		if (convertToDDS(QImage(m_ui->sourceInput->text()),
 						 m_ui->destinationInput->text() + "/" +
 							 source_info.baseName() + ".dds",
-						 &Callback::foo,
-						 this))
+						 engine.getMTJDManager(),
+						 engine.getAllocator()))
 		{
 			on_progressUpdate(1.0f, "Import successful.");
 		}
@@ -1,10 +1,12 @@
 #pragma once
 
 
+#include "lumix.h"
 #include "assimp/Importer.hpp"
 #include "assimp/progresshandler.hpp"
 #include <qdialog.h>
 #include <qthread.h>
+#include <qvector.h>
 
 
 namespace Ui
@@ -13,18 +15,42 @@ namespace Ui
 }
 
 
+namespace Lumix
+{
+	class IAllocator;
+	namespace MTJD
+	{
+		class Manager;
+	}
+}
+
+
+struct aiMesh;
 class ImportAssetDialog;
 class MainWindow;
 class QFile;
 class QFileInfo;
 
 
-class ImportThread : public QThread, public Assimp::ProgressHandler
+class LUMIX_STUDIO_LIB_API ImportThread : public QThread, public Assimp::ProgressHandler
 {
 	Q_OBJECT
 
 	public:
-		ImportThread(ImportAssetDialog& dialog);
+		struct ImportMesh
+		{
+			const aiMesh* mesh;
+			unsigned int source_index;
+			int lod;
+			QVector<uint32_t> indices;
+			// source vertex of each written vertex
+			QVector<int> vertices;
+		};
+
+	public:
+		ImportThread(Assimp::Importer& importer,
+			Lumix::MTJD::Manager& mtjd_manager,
+			Lumix::IAllocator& allocator);
 		virtual ~ImportThread();
 	
 		virtual bool Update(float percentage = -1.f) override { emit progress(percentage, "Importing..."); return true; }
@@ -35,12 +61,17 @@ class ImportThread : public QThread, public Assimp::ProgressHandler
 		void setImportMaterials(bool import_materials) { m_import_materials = import_materials; }
 		void setImportModel(bool import_model) { m_import_model = import_model; }
 		void setImportPhysics(bool import_physics, bool make_convex) { m_import_physics = import_physics; m_make_convex = make_convex; }
+		void setOptimizeMeshes(bool optimize, bool optimize_overdraw) { m_optimize_meshes = optimize; m_optimize_overdraw = optimize_overdraw; }
+		// LOD i has triangle_ratio^i of the triangles and it is used from
+		// distance * 2^(i-1)
+		void setLODs(int lod_count, float triangle_ratio, float distance) { m_lod_count = lod_count; m_lod_triangle_ratio = triangle_ratio; m_lod_distance = distance; }
 		const QString& getErrorMessage() const { return m_error_message; }
 
 	private:
 		void writeSkeleton(QFile& file);
 		void writeMeshes(QFile& file);
 		void writeGeometry(QFile& file);
+		void prepareMeshes();
 		bool saveLumixMaterials();
 		bool saveTexture(const QString& texture_path, const QFileInfo& material_info, QFile& material_file, bool is_normal_map);
 		bool saveLumixModel();
@@ -54,13 +85,20 @@ class ImportThread : public QThread, public Assimp::ProgressHandler
 	private:
 		QString m_source;
 		QString m_destination;
-		ImportAssetDialog& m_dialog;
 		bool m_import_model;
 		bool m_import_physics;
 		bool m_make_convex;
 		bool m_import_materials;
 		bool m_convert_texture_to_DDS;
+		bool m_optimize_meshes;
+		bool m_optimize_overdraw;
+		int m_lod_count;
+		float m_lod_triangle_ratio;
+		float m_lod_distance;
+		QVector<ImportMesh> m_meshes;
 		Assimp::Importer& m_importer;
+		Lumix::MTJD::Manager& m_mtjd_manager;
+		Lumix::IAllocator& m_allocator;
 		class LogStream* m_log_stream;
 		QString m_error_message;
 		QVector<QString> m_saved_embedded_textures;
@@ -1,5 +1,6 @@
 #include "mainwindow.h"
 #include "core/crc32.h"
+#include "core/default_allocator.h"
 #include "core/fs/disk_file_device.h"
 #include "core/fs/file_system.h"
 #include "core/fs/memory_file_device.h"
@@ -7,11 +8,13 @@
 #include "core/fs/tcp_file_server.h"
 #include "core/library.h"
 #include "core/log.h"
+#include "core/mtjd/manager.h"
 #include "core/profiler.h"
 #include "core/resource_manager.h"
 #include "core/resource_manager_base.h"
 #include "debug/allocator.h"
 #include "debug/floating_points.h"
+#include "dialogs/import_asset_dialog.h"
 #include "editor/world_editor.h"
 #include "editor/gizmo.h"
 #include "engine.h"
@@ -25,6 +28,8 @@
 #include "gameview.h"
 #include <QApplication>
 #include <qdir.h>
+#include <cstdio>
+#include <cstdlib>
 #include <Windows.h>
 
 
@@ -299,8 +304,55 @@ private:
 	QApplication* m_qt_app;
 };
 
+// imports a model without any UI, so it can be run by build scripts:
+// studio -cook_model <source> <destination_dir> [-no_overdraw] [-lods <count>]
+static int cookModel(int argc, char* argv[])
+{
+	QCoreApplication qt_app(argc, argv);
+	Lumix::DefaultAllocator allocator;
+	Lumix::MTJD::Manager mtjd_manager(allocator);
+	Assimp::Importer importer;
+	ImportThread import_thread(importer, mtjd_manager, allocator);
+	import_thread.setSource(argv[2]);
+	import_thread.setDestination(argv[3]);
+	for (int i = 4; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "-no_overdraw") == 0)
+		{
+			import_thread.setOptimizeMeshes(true, false);
+		}
+		else if (strcmp(argv[i], "-lods") == 0 && i + 1 < argc)
+		{
+			int lod_count = atoi(argv[i + 1]);
+			import_thread.setLODs(lod_count > 0 ? lod_count : 1, 0.5f, 10);
+			++i;
+		}
+	}
+
+	// the first run loads the source, the second one saves the model,
+	// same as in the import dialog
+	for (int i = 0; i < 2; ++i)
+	{
+		import_thread.run();
+		if (!import_thread.getErrorMessage().isEmpty())
+		{
+			fprintf(stderr,
+				"%s\n",
+				import_thread.getErrorMessage().toLatin1().data());
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
 int main(int argc, char* argv[])
 {
+	if (argc >= 4 && strcmp(argv[1], "-cook_model") == 0)
+	{
+		return cookModel(argc, argv);
+	}
+
 	App app;
 	QCoreApplication::addLibraryPath(QDir::currentPath());
 	QCoreApplication::addLibraryPath(QDir::currentPath() + "/bin");
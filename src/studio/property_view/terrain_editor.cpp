@@ -1,5 +1,7 @@
 #include "terrain_editor.h"
 #include "core/crc32.h"
+#include "core/fs/file_system.h"
+#include "core/fs/ifile.h"
 #include "core/json_serializer.h"
 #include "core/resource_manager.h"
 #include "core/resource_manager_base.h"
@@ -11,6 +13,7 @@
 #include "renderer/material.h"
 #include "renderer/model.h"
 #include "renderer/render_scene.h"
+#include "renderer/terrain_tiles.h"
 #include "renderer/texture.h"
 #include "mainwindow.h"
 #include "property_view.h"
@@ -34,6 +37,7 @@ static const char* HEIGHTMAP_UNIFORM = "u_texHeightmap";
 static const char* SPLATMAP_UNIFORM = "u_texSplatmap";
 static const char* COLORMAP_UNIFORM = "u_texColormap";
 static const char* TEX_COLOR_UNIFORM = "u_texColor";
+static const int TERRAIN_TILE_SIZE = 256;
 
 
 class PaintTerrainCommand : public Lumix::IEditorCommand
@@ -473,6 +477,8 @@ private:
 		auto texture = getDestinationTexture();
 		int bpp = texture->getBytesPerPixel();
 
+		static_cast<Lumix::RenderScene*>(m_terrain.scene)
+			->waitForTerrainJobs(m_terrain.index);
 		for (int j = m_y; j < m_y + m_height; ++j)
 		{
 			for (int i = m_x; i < m_x + m_width; ++i)
@@ -485,7 +491,13 @@ private:
 				}
 			}
 		}
-		texture->onDataUpdated();
+		texture->onDataUpdated(m_x, m_y, m_width, m_height);
+		if (m_type != TerrainEditor::LAYER && m_type != TerrainEditor::COLOR)
+		{
+			static_cast<Lumix::RenderScene*>(m_terrain.scene)
+				->onTerrainHeightmapChanged(
+					m_terrain.index, m_x, m_y, m_width, m_height);
+		}
 	}
 
 
@@ -697,6 +709,7 @@ void TerrainComponentPlugin::createEditor(DynamicObjectModel::Node& node,
 		auto layout = new QHBoxLayout(container);
 		auto* height_button = new QPushButton("Heightmap", container);
 		auto* texture_button = new QPushButton("Splatmap", container);
+		auto* tiles_button = new QPushButton("Tiles", container);
 		height_button->connect(
 			height_button,
 			&QPushButton::clicked,
@@ -713,8 +726,15 @@ void TerrainComponentPlugin::createEditor(DynamicObjectModel::Node& node,
 				Lumix::Material* material = m_terrain_editor->getMaterial();
 				material->getTextureByUniform(SPLATMAP_UNIFORM)->save();
 			});
+		tiles_button->connect(tiles_button,
+			&QPushButton::clicked,
+			[this]()
+			{
+				m_terrain_editor->exportTiles();
+			});
 		layout->addWidget(height_button);
 		layout->addWidget(texture_button);
+		layout->addWidget(tiles_button);
 
 		Lumix::Material* material = m_terrain_editor->getMaterial();
 		if (material->getTextureByUniform(COLORMAP_UNIFORM))
@@ -1083,6 +1103,65 @@ Lumix::Material* TerrainEditor::getMaterial()
 }
 
 
+// cuts the heightmap and the splatmap to tiles, the archive is saved next to
+// the heightmap and the terrain streams the tiles from it
+void TerrainEditor::exportTiles()
+{
+	Lumix::Material* material = getMaterial();
+	Lumix::Texture* heightmap = material->getTextureByUniform(HEIGHTMAP_UNIFORM);
+	Lumix::Texture* splatmap = material->getTextureByUniform(SPLATMAP_UNIFORM);
+	if (!heightmap || !splatmap || !heightmap->getData() ||
+		!splatmap->getData() || heightmap->getBytesPerPixel() != 2 ||
+		splatmap->getBytesPerPixel() != 4 ||
+		heightmap->getWidth() != splatmap->getWidth() ||
+		heightmap->getHeight() != splatmap->getHeight())
+	{
+		QMessageBox::warning(nullptr,
+							 "Terrain tiles",
+							 "Heightmap and splatmap must be loaded and "
+							 "have the same size.");
+		return;
+	}
+
+	QString path = heightmap->getPath().c_str();
+	path = path.left(path.lastIndexOf('.')) + ".tiles";
+	auto& fs = m_world_editor.getEngine().getFileSystem();
+	Lumix::FS::IFile* file =
+		fs.open(fs.getDiskDevice(),
+				path.toLatin1().data(),
+				Lumix::FS::Mode::OPEN_OR_CREATE | Lumix::FS::Mode::WRITE);
+	if (!file)
+	{
+		QMessageBox::warning(
+			nullptr, "Terrain tiles", "Could not create " + path);
+		return;
+	}
+	bool success = Lumix::TerrainTiles::createArchive(
+		*file,
+		(const uint16_t*)heightmap->getData(),
+		(const uint32_t*)splatmap->getData(),
+		heightmap->getWidth(),
+		heightmap->getHeight(),
+		TERRAIN_TILE_SIZE,
+		1,
+		m_world_editor.getAllocator());
+	fs.close(*file);
+	if (!success)
+	{
+		QMessageBox::warning(
+			nullptr, "Terrain tiles", "Could not write " + path);
+		return;
+	}
+
+	m_world_editor.setProperty(
+		Lumix::crc32("terrain"),
+		-1,
+		*m_world_editor.getEngine().getProperty("terrain", "tiles"),
+		path.toLatin1().data(),
+		path.length());
+}
+
+
 void TerrainEditor::getProjections(const Lumix::Vec3& axis,
 								   const Lumix::Vec3 vertices[8],
 								   float& min,
@@ -57,6 +57,7 @@ private:
 					const Lumix::ComponentUID& cmp,
 					const Lumix::Vec3& center);
 	Lumix::Material* getMaterial();
+	void exportTiles();
 	bool overlaps(float min1, float max1, float min2, float max2);
 	bool testOBBCollision(const Lumix::Matrix& matrix_a,
 						  const Lumix::Model* model_a,
@@ -197,11 +197,10 @@ void ShaderCompiler::reloadShaders()
 
 	if (m_editor)
 	{
-		auto shader_manager = m_editor->getEngine().getResourceManager().get(
-			Lumix::ResourceManager::SHADER);
+		auto& resource_manager = m_editor->getEngine().getResourceManager();
 		for (auto& path : m_to_reload)
 		{
-			shader_manager->reload(Lumix::Path(path.toLatin1().data()));
+			resource_manager.reload(path.toLatin1().data());
 		}
 	}
 
@@ -1,16 +1,20 @@
 #include "unit_tests/suite/lumix_unit_tests.h"
 
+#include "core/fs/cache_file_device.h"
 #include "core/fs/file_system.h"
 #include "core/fs/disk_file_device.h"
 #include "core/fs/file_events_device.h"
 #include "core/fs/ifile.h"
+#include "core/fs/memory_file_device.h"
+#include "core/fs/os_file.h"
+#include "core/fs/tcp_file_device.h"
+#include "core/fs/tcp_file_server.h"
 
 namespace
 {
 
 
 TODO("UT_disk_file_device");
-TODO("UT_tcp_file_device");
 TODO("UT_memory_file_device");
 
 uint32_t occured_event = 0;
@@ -173,8 +177,220 @@ void UT_file_events_device(const char* params)
 };
 
 
+void UT_tcp_file_device(const char* params)
+{
+	Lumix::DefaultAllocator allocator;
+	Lumix::FS::FileSystem* file_system =
+		Lumix::FS::FileSystem::create(allocator);
+
+	// nothing is left behind by a failed connect
+	Lumix::FS::TCPFileDevice unconnected_device;
+	LUMIX_EXPECT_FALSE(unconnected_device.connect("127.0.0.1", 10002, allocator));
+	unconnected_device.disconnect();
+
+	Lumix::FS::TCPFileServer server;
+	server.start(".", allocator);
+
+	Lumix::FS::DiskFileDevice disk_file_device(allocator);
+	Lumix::FS::MemoryFileDevice memory_file_device(allocator);
+	Lumix::FS::TCPFileDevice tcp_file_device;
+	LUMIX_EXPECT_TRUE(tcp_file_device.connect("127.0.0.1", 10001, allocator));
+
+	file_system->mount(&disk_file_device);
+	file_system->mount(&memory_file_device);
+	file_system->mount(&tcp_file_device);
+
+	Lumix::FS::DeviceList disk_list;
+	Lumix::FS::DeviceList tcp_list;
+	Lumix::FS::DeviceList memory_tcp_list;
+	file_system->fillDeviceList("disk", disk_list);
+	file_system->fillDeviceList("tcp", tcp_list);
+	file_system->fillDeviceList("memory:tcp", memory_tcp_list);
+
+	const char* path = "unit_tests/file_system/selenitic.xml";
+	Lumix::FS::IFile* disk_file =
+		file_system->open(disk_list,
+						  path,
+						  Lumix::FS::Mode::OPEN | Lumix::FS::Mode::READ);
+	LUMIX_EXPECT_NOT_NULL(disk_file);
+	size_t size = disk_file->size();
+	LUMIX_EXPECT_GE(size, size_t(4));
+	char* expected = (char*)allocator.allocate(size);
+	disk_file->read(expected, size);
+	file_system->close(*disk_file);
+
+	// whole file is fetched by open, the rest is served locally
+	Lumix::FS::IFile* tcp_file =
+		file_system->open(tcp_list,
+						  path,
+						  Lumix::FS::Mode::OPEN | Lumix::FS::Mode::READ);
+	LUMIX_EXPECT_NOT_NULL(tcp_file);
+	LUMIX_EXPECT_EQ(tcp_file->size(), size);
+	LUMIX_EXPECT_NOT_NULL(tcp_file->getBuffer());
+	LUMIX_EXPECT_EQ(
+		tcp_file->seek(Lumix::FS::SeekMode::BEGIN, size - 4), size - 4);
+	LUMIX_EXPECT_EQ(tcp_file->pos(), size - 4);
+	uint32_t tail = 0;
+	LUMIX_EXPECT_TRUE(tcp_file->read(&tail, sizeof(tail)));
+	LUMIX_EXPECT_EQ(memcmp(&tail, expected + size - 4, sizeof(tail)), 0);
+	LUMIX_EXPECT_FALSE(tcp_file->read(&tail, sizeof(tail)));
+	file_system->close(*tcp_file);
+
+	Lumix::FS::IFile* memory_file =
+		file_system->open(memory_tcp_list,
+						  path,
+						  Lumix::FS::Mode::OPEN | Lumix::FS::Mode::READ);
+	LUMIX_EXPECT_NOT_NULL(memory_file);
+	LUMIX_EXPECT_EQ(memory_file->size(), size);
+	LUMIX_EXPECT_EQ(memcmp(memory_file->getBuffer(), expected, size), 0);
+	file_system->close(*memory_file);
+
+	LUMIX_EXPECT_NULL(
+		file_system->open(tcp_list,
+						  "unit_tests/file_system/does_not_exist.xml",
+						  Lumix::FS::Mode::OPEN | Lumix::FS::Mode::READ));
+
+	Lumix::FS::IFile* write_file =
+		file_system->open(tcp_list,
+						  "unit_tests/file_system/selenitic_tcp.xml",
+						  Lumix::FS::Mode::OPEN_OR_CREATE |
+							  Lumix::FS::Mode::WRITE);
+	LUMIX_EXPECT_NOT_NULL(write_file);
+	LUMIX_EXPECT_TRUE(write_file->write(expected, size));
+	LUMIX_EXPECT_EQ(write_file->pos(), size);
+	LUMIX_EXPECT_EQ(write_file->size(), size);
+	file_system->close(*write_file);
+
+	tcp_file_device.disconnect();
+	server.stop();
+
+	allocator.deallocate(expected);
+	Lumix::FS::FileSystem::destroy(file_system);
+};
+
+
+void UT_cache_file_device(const char* params)
+{
+	Lumix::DefaultAllocator allocator;
+	Lumix::FS::FileSystem* file_system =
+		Lumix::FS::FileSystem::create(allocator);
+
+	Lumix::FS::TCPFileServer server;
+	server.start(".", allocator);
+
+	Lumix::FS::MemoryFileDevice memory_file_device(allocator);
+	Lumix::FS::TCPFileDevice tcp_file_device;
+	LUMIX_EXPECT_TRUE(tcp_file_device.connect("127.0.0.1", 10001, allocator));
+	Lumix::FS::CacheFileDevice* cache_file_device =
+		allocator.newObject<Lumix::FS::CacheFileDevice>(
+			"unit_tests/file_system/", tcp_file_device, allocator);
+	cache_file_device->invalidate("unit_tests/file_system/selenitic.xml");
+
+	file_system->mount(&memory_file_device);
+	file_system->mount(cache_file_device);
+	file_system->mount(&tcp_file_device);
+
+	Lumix::FS::DeviceList device_list;
+	file_system->fillDeviceList("memory:cache:tcp", device_list);
+
+	const char* path = "unit_tests/file_system/selenitic.xml";
+	Lumix::FS::IFile* file = file_system->open(
+		device_list, path, Lumix::FS::Mode::OPEN | Lumix::FS::Mode::READ);
+	LUMIX_EXPECT_NOT_NULL(file);
+	size_t size = file->size();
+	LUMIX_EXPECT_GE(size, size_t(4));
+	char* expected = (char*)allocator.allocate(size);
+	memcpy(expected, file->getBuffer(), size);
+	file_system->close(*file);
+	LUMIX_EXPECT_EQ(cache_file_device->getMissCount(), 1);
+	LUMIX_EXPECT_EQ(cache_file_device->getHitCount(), 0);
+
+	file = file_system->open(
+		device_list, path, Lumix::FS::Mode::OPEN | Lumix::FS::Mode::READ);
+	LUMIX_EXPECT_NOT_NULL(file);
+	LUMIX_EXPECT_EQ(file->size(), size);
+	LUMIX_EXPECT_EQ(memcmp(file->getBuffer(), expected, size), 0);
+	file_system->close(*file);
+	LUMIX_EXPECT_EQ(cache_file_device->getHitCount(), 1);
+
+	// the index survives the device, entries are validated by stat
+	file_system->unMount(cache_file_device);
+	allocator.deleteObject(cache_file_device);
+	cache_file_device = allocator.newObject<Lumix::FS::CacheFileDevice>(
+		"unit_tests/file_system/", tcp_file_device, allocator);
+	file_system->mount(cache_file_device);
+	file_system->fillDeviceList("memory:cache:tcp", device_list);
+
+	file = file_system->open(
+		device_list, path, Lumix::FS::Mode::OPEN | Lumix::FS::Mode::READ);
+	LUMIX_EXPECT_NOT_NULL(file);
+	LUMIX_EXPECT_EQ(memcmp(file->getBuffer(), expected, size), 0);
+	file_system->close(*file);
+	LUMIX_EXPECT_EQ(cache_file_device->getHitCount(), 1);
+	LUMIX_EXPECT_EQ(cache_file_device->getMissCount(), 0);
+
+	// a file changed after it was checked is fetched again once validated
+	const char* changed_path = "unit_tests/file_system/cache_changed.txt";
+	Lumix::FS::OsFile os_file;
+	LUMIX_EXPECT_TRUE(os_file.open(changed_path,
+		Lumix::FS::Mode::CREATE | Lumix::FS::Mode::WRITE,
+		allocator));
+	os_file.write("old", 3);
+	os_file.close();
+	for (int i = 0; i < 2; ++i)
+	{
+		file = file_system->open(device_list,
+			changed_path,
+			Lumix::FS::Mode::OPEN | Lumix::FS::Mode::READ);
+		LUMIX_EXPECT_NOT_NULL(file);
+		LUMIX_EXPECT_EQ(file->size(), size_t(3));
+		file_system->close(*file);
+	}
+	LUMIX_EXPECT_EQ(cache_file_device->getHitCount(), 2);
+	LUMIX_EXPECT_EQ(cache_file_device->getMissCount(), 1);
+
+	LUMIX_EXPECT_TRUE(os_file.open(changed_path,
+		Lumix::FS::Mode::CREATE | Lumix::FS::Mode::WRITE,
+		allocator));
+	os_file.write("changed", 7);
+	os_file.close();
+	// checked entries are trusted until the next validation
+	file = file_system->open(
+		device_list, changed_path, Lumix::FS::Mode::OPEN | Lumix::FS::Mode::READ);
+	LUMIX_EXPECT_NOT_NULL(file);
+	LUMIX_EXPECT_EQ(file->size(), size_t(3));
+	file_system->close(*file);
+	LUMIX_EXPECT_EQ(cache_file_device->getHitCount(), 3);
+
+	cache_file_device->validate();
+	file = file_system->open(
+		device_list, changed_path, Lumix::FS::Mode::OPEN | Lumix::FS::Mode::READ);
+	LUMIX_EXPECT_NOT_NULL(file);
+	LUMIX_EXPECT_EQ(file->size(), size_t(7));
+	LUMIX_EXPECT_EQ(memcmp(file->getBuffer(), "changed", 7), 0);
+	file_system->close(*file);
+	LUMIX_EXPECT_EQ(cache_file_device->getHitCount(), 3);
+	LUMIX_EXPECT_EQ(cache_file_device->getMissCount(), 2);
+	LUMIX_EXPECT_FALSE(cache_file_device->isDisabled());
+
+	file_system->unMount(cache_file_device);
+	allocator.deleteObject(cache_file_device);
+	tcp_file_device.disconnect();
+	server.stop();
+
+	allocator.deallocate(expected);
+	Lumix::FS::FileSystem::destroy(file_system);
+};
+
+
 } // anonymous namespace
 
 REGISTER_TEST("unit_tests/core/file_system/file_events_device",
 			  UT_file_events_device,
+			  "")
+REGISTER_TEST("unit_tests/core/file_system/tcp_file_device",
+			  UT_tcp_file_device,
+			  "")
+REGISTER_TEST("unit_tests/core/file_system/cache_file_device",
+			  UT_cache_file_device,
 			  "")
\ No newline at end of file
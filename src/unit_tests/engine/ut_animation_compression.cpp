@@ -0,0 +1,96 @@
+#include "unit_tests/suite/lumix_unit_tests.h"
+
+#include "animation/animation_compression.h"
+#include "core/blob.h"
+#include "core/default_allocator.h"
+#include "core/math_utils.h"
+#include "core/quat.h"
+#include "core/vec3.h"
+
+#include <cmath>
+
+
+void UT_pack_quat(const char* params)
+{
+	Lumix::Quat rotations[] = {
+		Lumix::Quat(0, 0, 0, 1),
+		Lumix::Quat(1, 0, 0, 0),
+		Lumix::Quat(0, 0, 0, -1),
+		Lumix::Quat(Lumix::Vec3(1, 0, 0), Lumix::Math::PI / 4),
+		Lumix::Quat(Lumix::Vec3(0, 1, 0), -Lumix::Math::PI / 3),
+		Lumix::Quat(0.5f, -0.5f, 0.5f, -0.5f),
+	};
+
+	for (int i = 0; i < Lumix::lengthOf(rotations); ++i)
+	{
+		const Lumix::Quat& q = rotations[i];
+		Lumix::AnimationCompression::PackedQuat packed;
+		Lumix::AnimationCompression::packQuat(q, &packed);
+		Lumix::Quat unpacked;
+		Lumix::AnimationCompression::unpackQuat(packed, &unpacked);
+
+		// q and -q are the same rotation
+		float dot = q.x * unpacked.x + q.y * unpacked.y + q.z * unpacked.z +
+					q.w * unpacked.w;
+		LUMIX_EXPECT_CLOSE_EQ(fabs(dot), 1.0f, 0.0001f);
+	}
+}
+
+
+void UT_compress_animation(const char* params)
+{
+	Lumix::DefaultAllocator allocator;
+	const int FRAME_COUNT = 100;
+	const int BONE_COUNT = 2;
+	Lumix::Vec3 positions[FRAME_COUNT * BONE_COUNT];
+	Lumix::Quat rotations[FRAME_COUNT * BONE_COUNT];
+	uint32_t bones[BONE_COUNT] = { 1, 2 };
+	for (int i = 0; i < FRAME_COUNT; ++i)
+	{
+		// the first bone does not move, the second one moves linearly
+		positions[i * BONE_COUNT].set(1, 2, 3);
+		rotations[i * BONE_COUNT].set(0, 0, 0, 1);
+		positions[i * BONE_COUNT + 1].set((float)i, 0, 0);
+		rotations[i * BONE_COUNT + 1] = Lumix::Quat(
+			Lumix::Vec3(0, 1, 0), i * Lumix::Math::PI / FRAME_COUNT);
+	}
+
+	Lumix::OutputBlob blob(allocator);
+	Lumix::AnimationCompression::compress(FRAME_COUNT,
+		BONE_COUNT,
+		positions,
+		rotations,
+		bones,
+		Lumix::AnimationCompression::Settings(),
+		allocator,
+		blob);
+
+	Lumix::InputBlob input(blob);
+	LUMIX_EXPECT_EQ(FRAME_COUNT, input.read<int32_t>());
+	LUMIX_EXPECT_EQ(BONE_COUNT, input.read<int32_t>());
+	LUMIX_EXPECT_EQ(1, input.read<uint32_t>());
+	LUMIX_EXPECT_EQ(2, input.read<uint32_t>());
+
+	Lumix::Vec3 min, scale;
+	// constant tracks have a single key
+	LUMIX_EXPECT_EQ(1, input.read<uint16_t>());
+	LUMIX_EXPECT_EQ(1, input.read<uint16_t>());
+	input.read(min);
+	input.read(scale);
+
+	// linear position track needs only the end keys
+	uint16_t position_count = input.read<uint16_t>();
+	uint16_t rotation_count = input.read<uint16_t>();
+	LUMIX_EXPECT_EQ(2, position_count);
+	LUMIX_EXPECT_LT(rotation_count, FRAME_COUNT);
+	LUMIX_EXPECT_GT(rotation_count, 2);
+
+	LUMIX_EXPECT_LT(blob.getSize(),
+		(int)(sizeof(positions) + sizeof(rotations) + sizeof(bones)) / 5);
+}
+
+
+REGISTER_TEST("unit_tests/engine/pack_quat", UT_pack_quat, "");
+REGISTER_TEST("unit_tests/engine/compress_animation",
+			  UT_compress_animation,
+			  "");
@@ -0,0 +1,206 @@
+#include "unit_tests/suite/lumix_unit_tests.h"
+
+#include "animation/animation_graph.h"
+#include "core/blob.h"
+#include "core/default_allocator.h"
+#include "core/resource_manager.h"
+
+
+void UT_animation_graph_state_machine(const char* params)
+{
+	Lumix::DefaultAllocator allocator;
+	Lumix::AnimationGraph graph(allocator);
+
+	int idle = graph.addClip(nullptr);
+	int walk = graph.addClip(nullptr);
+	int sm = graph.addStateMachine();
+	LUMIX_EXPECT_EQ(graph.getRoot(), sm);
+	LUMIX_EXPECT_EQ(graph.getState(sm), -1);
+
+	int idle_state = graph.addState(sm, idle);
+	int walk_state = graph.addState(sm, walk);
+	LUMIX_EXPECT_EQ(idle_state, 0);
+	LUMIX_EXPECT_EQ(walk_state, 1);
+	LUMIX_EXPECT_EQ(graph.getState(sm), idle_state);
+	LUMIX_EXPECT_TRUE(graph.isReady());
+
+	graph.update(1.0f);
+	LUMIX_EXPECT_CLOSE_EQ(graph.getTime(idle), 1.0f, 0.0001f);
+	LUMIX_EXPECT_CLOSE_EQ(graph.getTime(walk), 0.0f, 0.0001f);
+
+	graph.setState(sm, walk_state, 0.5f);
+	LUMIX_EXPECT_EQ(graph.getState(sm), walk_state);
+	LUMIX_EXPECT_TRUE(graph.isInTransition(sm));
+
+	// both states advance during the crossfade
+	graph.update(0.25f);
+	LUMIX_EXPECT_TRUE(graph.isInTransition(sm));
+	LUMIX_EXPECT_CLOSE_EQ(graph.getTime(idle), 1.25f, 0.0001f);
+	LUMIX_EXPECT_CLOSE_EQ(graph.getTime(walk), 0.25f, 0.0001f);
+
+	graph.update(0.3f);
+	LUMIX_EXPECT_FALSE(graph.isInTransition(sm));
+	LUMIX_EXPECT_CLOSE_EQ(graph.getTime(idle), 1.25f, 0.0001f);
+
+	// switching back restarts the clip, without crossfade
+	graph.setState(sm, idle_state, 0);
+	LUMIX_EXPECT_FALSE(graph.isInTransition(sm));
+	LUMIX_EXPECT_CLOSE_EQ(graph.getTime(idle), 0.0f, 0.0001f);
+}
+
+
+void UT_animation_graph_blend(const char* params)
+{
+	Lumix::DefaultAllocator allocator;
+	Lumix::AnimationGraph graph(allocator);
+
+	int a = graph.addClip(nullptr);
+	int b = graph.addClip(nullptr);
+	graph.setSpeed(b, 2.0f);
+	int blend = graph.addBlend(a, b, 0.5f);
+	LUMIX_EXPECT_EQ(graph.getRoot(), blend);
+	LUMIX_EXPECT_TRUE(graph.getNodeType(blend) ==
+					  Lumix::AnimationGraph::NodeType::BLEND);
+
+	graph.setWeight(blend, 2.0f);
+	LUMIX_EXPECT_CLOSE_EQ(graph.getWeight(blend), 1.0f, 0.0001f);
+
+	graph.update(0.5f);
+	LUMIX_EXPECT_CLOSE_EQ(graph.getTime(a), 0.5f, 0.0001f);
+	LUMIX_EXPECT_CLOSE_EQ(graph.getTime(b), 1.0f, 0.0001f);
+
+	graph.clear();
+	LUMIX_EXPECT_EQ(graph.getNodeCount(), 0);
+	LUMIX_EXPECT_EQ(graph.getRoot(), Lumix::AnimationGraph::INVALID_NODE);
+}
+
+
+void UT_animation_graph_serialize(const char* params)
+{
+	Lumix::DefaultAllocator allocator;
+	Lumix::ResourceManager resource_manager(allocator);
+	Lumix::AnimationGraph graph(allocator);
+
+	int idle = graph.addClip(nullptr);
+	int walk = graph.addClip(nullptr, false);
+	int sm = graph.addStateMachine();
+	graph.addState(sm, idle);
+	int walk_state = graph.addState(sm, walk);
+	graph.setState(sm, walk_state, 0.5f);
+	graph.update(0.25f);
+
+	Lumix::OutputBlob blob(allocator);
+	graph.serialize(blob);
+
+	// a running transition continues after loading
+	Lumix::AnimationGraph loaded(allocator);
+	Lumix::InputBlob input(blob);
+	LUMIX_EXPECT_TRUE(loaded.deserialize(input, resource_manager));
+	LUMIX_EXPECT_EQ(loaded.getNodeCount(), graph.getNodeCount());
+	LUMIX_EXPECT_EQ(loaded.getRoot(), sm);
+	LUMIX_EXPECT_EQ(loaded.getState(sm), walk_state);
+	LUMIX_EXPECT_TRUE(loaded.isInTransition(sm));
+	LUMIX_EXPECT_CLOSE_EQ(loaded.getTime(walk), 0.25f, 0.0001f);
+
+	loaded.update(0.3f);
+	LUMIX_EXPECT_FALSE(loaded.isInTransition(sm));
+}
+
+
+
+static void writeNode(Lumix::OutputBlob& blob,
+	Lumix::AnimationGraph::NodeType type,
+	int input0,
+	int input1)
+{
+	blob.write(type);
+	blob.write(1.0f);
+	blob.write(0.0f);
+	blob.write(1.0f);
+	blob.write(true);
+	blob.writeString("");
+	blob.write(input0);
+	blob.write(input1);
+	blob.write(-1);
+	blob.write(0);
+	blob.write(-1);
+	blob.write(-1);
+	blob.write(0.0f);
+	blob.write(0.0f);
+}
+
+
+void UT_animation_graph_deserialize_invalid(const char* params)
+{
+	Lumix::DefaultAllocator allocator;
+	Lumix::ResourceManager resource_manager(allocator);
+	Lumix::AnimationGraph loaded(allocator);
+
+	// input out of range
+	Lumix::OutputBlob blob(allocator);
+	blob.write((int32_t)1);
+	writeNode(blob, Lumix::AnimationGraph::NodeType::BLEND, 0, 5);
+	blob.write((int32_t)0);
+	blob.write(0);
+	Lumix::InputBlob input(blob);
+	LUMIX_EXPECT_FALSE(loaded.deserialize(input, resource_manager));
+	LUMIX_EXPECT_EQ(loaded.getNodeCount(), 0);
+	LUMIX_EXPECT_EQ(loaded.getRoot(), Lumix::AnimationGraph::INVALID_NODE);
+
+	// more nodes than the blob can hold
+	blob.clear();
+	blob.write((int32_t)0x7fffffff);
+	writeNode(blob, Lumix::AnimationGraph::NodeType::CLIP, -1, -1);
+	Lumix::InputBlob huge_input(blob);
+	LUMIX_EXPECT_FALSE(loaded.deserialize(huge_input, resource_manager));
+
+	// a node can not be its own input
+	blob.clear();
+	blob.write((int32_t)2);
+	writeNode(blob, Lumix::AnimationGraph::NodeType::CLIP, -1, -1);
+	writeNode(blob, Lumix::AnimationGraph::NodeType::BLEND, 0, 1);
+	blob.write((int32_t)0);
+	blob.write(1);
+	Lumix::InputBlob cycle_input(blob);
+	LUMIX_EXPECT_FALSE(loaded.deserialize(cycle_input, resource_manager));
+
+	// neither can a state of a state machine be the state machine
+	Lumix::AnimationGraph graph(allocator);
+	int sm = graph.addStateMachine();
+	graph.addState(sm, sm);
+	blob.clear();
+	graph.serialize(blob);
+	Lumix::InputBlob sm_input(blob);
+	LUMIX_EXPECT_FALSE(loaded.deserialize(sm_input, resource_manager));
+
+	// root out of range
+	blob.clear();
+	blob.write((int32_t)1);
+	writeNode(blob, Lumix::AnimationGraph::NodeType::CLIP, -1, -1);
+	blob.write((int32_t)0);
+	blob.write(1);
+	Lumix::InputBlob root_input(blob);
+	LUMIX_EXPECT_FALSE(loaded.deserialize(root_input, resource_manager));
+
+	blob.clear();
+	blob.write((int32_t)1);
+	writeNode(blob, Lumix::AnimationGraph::NodeType::CLIP, -1, -1);
+	blob.write((int32_t)0);
+	blob.write(0);
+	Lumix::InputBlob valid_input(blob);
+	LUMIX_EXPECT_TRUE(loaded.deserialize(valid_input, resource_manager));
+	LUMIX_EXPECT_EQ(loaded.getNodeCount(), 1);
+}
+
+REGISTER_TEST("unit_tests/engine/animation_graph_state_machine",
+			  UT_animation_graph_state_machine,
+			  "");
+REGISTER_TEST("unit_tests/engine/animation_graph_blend",
+			  UT_animation_graph_blend,
+			  "");
+REGISTER_TEST("unit_tests/engine/animation_graph_serialize",
+			  UT_animation_graph_serialize,
+			  "");
+REGISTER_TEST("unit_tests/engine/animation_graph_deserialize_invalid",
+			  UT_animation_graph_deserialize_invalid,
+			  "");
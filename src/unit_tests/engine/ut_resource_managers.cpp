@@ -6,6 +6,7 @@
 #include "core/fs/disk_file_device.h"
 
 #include "core/mt/thread.h"
+#include "core/mtjd/manager.h"
 
 #include "core/resource_manager.h"
 #include "core/resource.h"
@@ -35,6 +36,18 @@ void waitForFinishLoading(Lumix::Resource* resource,
 	} while (resource->isLoading());
 }
 
+void waitForFinishParsing(Lumix::Resource* resource,
+						  Lumix::ResourceManager& resource_manager,
+						  Lumix::FS::FileSystem* file_system)
+{
+	do
+	{
+		file_system->updateAsyncTransactions();
+		resource_manager.update();
+		Lumix::MT::yield();
+	} while (resource->isLoading());
+}
+
 void UT_material_manager(const char* params)
 {
 	Lumix::DefaultAllocator allocator;
@@ -304,6 +317,181 @@ void UT_animation_manager(const char* params)
 	Lumix::FS::FileSystem::destroy(file_system);
 }
 
+void UT_animation_manager_async(const char* params)
+{
+	Lumix::DefaultAllocator allocator;
+	Lumix::FS::FileSystem* file_system =
+		Lumix::FS::FileSystem::create(allocator);
+
+	Lumix::FS::MemoryFileDevice mem_file_device(allocator);
+	Lumix::FS::DiskFileDevice disk_file_device(allocator);
+
+	file_system->mount(&mem_file_device);
+	file_system->mount(&disk_file_device);
+	file_system->setDefaultDevice("memory:disk");
+
+	Lumix::MTJD::Manager mtjd_manager(allocator);
+	Lumix::ResourceManager resource_manager(allocator);
+	Lumix::AnimationManager animation_manager(allocator);
+	resource_manager.create(*file_system);
+	resource_manager.setJobManager(&mtjd_manager);
+	animation_manager.create(Lumix::ResourceManager::ANIMATION,
+							 resource_manager);
+
+	Lumix::g_log_info.log("unit") << "loading ...";
+	Lumix::Resource* animation =
+		animation_manager.load(Lumix::Path(anim_test));
+	Lumix::Resource* animation_fail =
+		animation_manager.load(Lumix::Path(anim_test_failure));
+
+	LUMIX_EXPECT_TRUE(animation->isLoading());
+	LUMIX_EXPECT_TRUE(animation_fail->isLoading());
+
+	waitForFinishParsing(animation, resource_manager, file_system);
+	waitForFinishParsing(animation_fail, resource_manager, file_system);
+
+	LUMIX_EXPECT_TRUE(animation->isReady());
+	LUMIX_EXPECT_EQ(anim_test_size, animation->size());
+	LUMIX_EXPECT_TRUE(animation_fail->isFailure());
+
+	Lumix::g_log_info.log("unit") << "unloading while parsing ...";
+
+	animation_manager.reload(*animation);
+	for (int i = 0; i < 100 && animation->isLoading(); ++i)
+	{
+		file_system->updateAsyncTransactions();
+		Lumix::MT::yield();
+	}
+	animation_manager.forceUnload(*animation);
+	resource_manager.update();
+
+	LUMIX_EXPECT_TRUE(animation->isEmpty());
+	LUMIX_EXPECT_EQ(0, animation->size());
+
+	// exit
+	animation_manager.unload(*animation_fail);
+	animation_manager.destroy();
+	resource_manager.destroy();
+
+	file_system->unMount(&disk_file_device);
+	file_system->unMount(&mem_file_device);
+
+	Lumix::FS::FileSystem::destroy(file_system);
+}
+
+void UT_resource_cache(const char* params)
+{
+	Lumix::DefaultAllocator allocator;
+	Lumix::FS::FileSystem* file_system =
+		Lumix::FS::FileSystem::create(allocator);
+
+	Lumix::FS::MemoryFileDevice mem_file_device(allocator);
+	Lumix::FS::DiskFileDevice disk_file_device(allocator);
+
+	file_system->mount(&mem_file_device);
+	file_system->mount(&disk_file_device);
+	file_system->setDefaultDevice("memory:disk");
+
+	Lumix::ResourceManager resource_manager(allocator);
+	Lumix::AnimationManager animation_manager(allocator);
+	resource_manager.create(*file_system);
+	animation_manager.create(Lumix::ResourceManager::ANIMATION,
+							 resource_manager);
+	animation_manager.setBudget(anim_test_size);
+
+	Lumix::Resource* animation =
+		animation_manager.load(Lumix::Path(anim_test));
+	waitForFinishLoading(animation, file_system);
+	LUMIX_EXPECT_TRUE(animation->isReady());
+
+	Lumix::g_log_info.log("unit") << "releasing into cache ...";
+	animation_manager.unload(*animation);
+
+	Lumix::ResourceManagerBase::Stats stats;
+	animation_manager.getStats(stats);
+	LUMIX_EXPECT_TRUE(animation->isReady());
+	LUMIX_EXPECT_EQ(1, stats.m_cached_count);
+	LUMIX_EXPECT_EQ(anim_test_size, stats.m_cached_size);
+	LUMIX_EXPECT_EQ(anim_test_size, stats.m_resident_size);
+
+	animation_manager.load(*animation);
+	animation_manager.getStats(stats);
+	LUMIX_EXPECT_TRUE(animation->isReady());
+	LUMIX_EXPECT_EQ(1, stats.m_hits);
+	LUMIX_EXPECT_EQ(1, stats.m_misses);
+	LUMIX_EXPECT_EQ(0, stats.m_cached_count);
+
+	Lumix::g_log_info.log("unit") << "evicting ...";
+	animation_manager.unload(*animation);
+	animation_manager.setBudget(anim_test_size - 1);
+	animation_manager.getStats(stats);
+	LUMIX_EXPECT_TRUE(animation->isEmpty());
+	LUMIX_EXPECT_EQ(1, stats.m_evictions);
+	LUMIX_EXPECT_EQ(0, stats.m_cached_count);
+	LUMIX_EXPECT_EQ(0, stats.m_resident_size);
+
+	// exit
+	animation_manager.destroy();
+	resource_manager.destroy();
+
+	file_system->unMount(&disk_file_device);
+	file_system->unMount(&mem_file_device);
+
+	Lumix::FS::FileSystem::destroy(file_system);
+}
+
+void UT_reload_queue(const char* params)
+{
+	Lumix::DefaultAllocator allocator;
+	Lumix::FS::FileSystem* file_system =
+		Lumix::FS::FileSystem::create(allocator);
+
+	Lumix::FS::MemoryFileDevice mem_file_device(allocator);
+	Lumix::FS::DiskFileDevice disk_file_device(allocator);
+
+	file_system->mount(&mem_file_device);
+	file_system->mount(&disk_file_device);
+	file_system->setDefaultDevice("memory:disk");
+
+	Lumix::ResourceManager resource_manager(allocator);
+	Lumix::AnimationManager animation_manager(allocator);
+	resource_manager.create(*file_system);
+	animation_manager.create(Lumix::ResourceManager::ANIMATION,
+							 resource_manager);
+
+	Lumix::Resource* animation =
+		animation_manager.load(Lumix::Path(anim_test));
+	waitForFinishLoading(animation, file_system);
+	LUMIX_EXPECT_TRUE(animation->isReady());
+
+	Lumix::g_log_info.log("unit") << "queueing reloads ...";
+	resource_manager.reload(anim_test);
+	resource_manager.reload(anim_test);
+	resource_manager.reload(anim_test);
+	resource_manager.update();
+
+	// nothing happens until the burst settles
+	LUMIX_EXPECT_TRUE(animation->isReady());
+
+	Lumix::MT::sleep(
+		(uint32_t)(Lumix::ResourceManager::RELOAD_DELAY * 1000) + 50);
+	resource_manager.update();
+	LUMIX_EXPECT_TRUE(animation->isLoading());
+
+	waitForFinishLoading(animation, file_system);
+	LUMIX_EXPECT_TRUE(animation->isReady());
+
+	// exit
+	animation_manager.unload(*animation);
+	animation_manager.destroy();
+	resource_manager.destroy();
+
+	file_system->unMount(&disk_file_device);
+	file_system->unMount(&mem_file_device);
+
+	Lumix::FS::FileSystem::destroy(file_system);
+}
+
 const char anim_test_valid[] = "unit_tests/resource_managers/blender.ani";
 const char anim_test_fail[] = "unit_tests/resource_managers/failure.ani";
 const char anim_test_invalid[] = "unit_tests/resource_managers/cisla.tga";
@@ -459,4 +647,13 @@ void UT_failure_reload(const char* params)
 REGISTER_TEST("unit_tests/engine/animation_manager",
 			  UT_animation_manager,
 			  "unit_tests/resource_managers/blender.ani 3424");
+REGISTER_TEST("unit_tests/engine/animation_manager_async",
+			  UT_animation_manager_async,
+			  "unit_tests/resource_managers/blender.ani 3424");
+REGISTER_TEST("unit_tests/engine/resource_cache",
+			  UT_resource_cache,
+			  "unit_tests/resource_managers/blender.ani 3424");
+REGISTER_TEST("unit_tests/engine/reload_queue",
+			  UT_reload_queue,
+			  "unit_tests/resource_managers/blender.ani 3424");
 REGISTER_TEST("unit_tests/engine/failure_reload", UT_failure_reload, "");
\ No newline at end of file
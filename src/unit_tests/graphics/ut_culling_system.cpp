@@ -0,0 +1,124 @@
+#include "unit_tests/suite/lumix_unit_tests.h"
+#include "unit_tests/suite/random.h"
+
+#include "core/array.h"
+#include "core/default_allocator.h"
+#include "core/mtjd/manager.h"
+#include "core/sphere.h"
+#include "core/vec3.h"
+#include "renderer/culling_system.h"
+#include <cfloat>
+#include <cmath>
+
+
+namespace
+{
+	int countHits(const Lumix::CullingSystem::InputSpheres& spheres,
+		const Lumix::Vec3& origin,
+		const Lumix::Vec3& dir,
+		float max_t)
+	{
+		int count = 0;
+		for (int i = 0; i < spheres.size(); ++i)
+		{
+			// closest point of the ray segment to the center
+			Lumix::Vec3 rel_center = spheres[i].m_position - origin;
+			float t = Lumix::dotProduct(rel_center, dir) /
+					  Lumix::dotProduct(dir, dir);
+			t = t < 0 ? 0 : t;
+			Lumix::Vec3 closest = origin + dir * t;
+			float squared_distance =
+				(closest - spheres[i].m_position).squaredLength();
+			float squared_radius = spheres[i].m_radius * spheres[i].m_radius;
+			if (squared_distance > squared_radius)
+			{
+				continue;
+			}
+			// entry point
+			float entry =
+				t - sqrt((squared_radius - squared_distance) /
+						 Lumix::dotProduct(dir, dir));
+			if (entry <= max_t)
+			{
+				++count;
+			}
+		}
+		return count;
+	}
+
+
+	void checkRayCasts(Lumix::CullingSystem& culling_system,
+		Lumix::UnitTest::Random& random,
+		Lumix::IAllocator& allocator)
+	{
+		culling_system.prepareRayCasts();
+		Lumix::CullingSystem::RayHits hits(allocator);
+		for (int i = 0; i < 200; ++i)
+		{
+			Lumix::Vec3 origin(
+				random.next(-60, 60), random.next(-60, 60), random.next(-60, 60));
+			Lumix::Vec3 dir(
+				random.next(-1, 1), random.next(-1, 1), random.next(-1, 1));
+			float max_t = i % 2 == 0 ? FLT_MAX : 50.0f;
+			culling_system.castRay(origin, dir, max_t, hits);
+
+			LUMIX_EXPECT_EQ(hits.size(),
+				countHits(culling_system.getSpheres(), origin, dir, max_t));
+			for (int j = 1; j < hits.size(); ++j)
+			{
+				LUMIX_EXPECT_LE(hits[j - 1].m_t, hits[j].m_t);
+			}
+		}
+	}
+
+
+	void UT_culling_system_ray_cast(const char* params)
+	{
+		Lumix::DefaultAllocator allocator;
+		Lumix::MTJD::Manager mtjd_manager(allocator);
+		Lumix::CullingSystem* culling_system =
+			Lumix::CullingSystem::create(mtjd_manager, allocator);
+		Lumix::UnitTest::Random random;
+
+		for (int i = 0; i < 500; ++i)
+		{
+			culling_system->addStatic(Lumix::Sphere(random.next(-50, 50),
+				random.next(-50, 50),
+				random.next(-50, 50),
+				random.next(0.5f, 3)));
+		}
+		checkRayCasts(*culling_system, random, allocator);
+
+		// moved spheres refit the tree
+		for (int i = 0; i < 500; i += 3)
+		{
+			culling_system->updateBoundingPosition(
+				Lumix::Vec3(random.next(-50, 50),
+					random.next(-50, 50),
+					random.next(-50, 50)),
+				i);
+			culling_system->updateBoundingRadius(random.next(0.5f, 5), i);
+		}
+		checkRayCasts(*culling_system, random, allocator);
+
+		for (int i = 0; i < 100; ++i)
+		{
+			culling_system->removeStatic(i);
+		}
+		checkRayCasts(*culling_system, random, allocator);
+
+		culling_system->clear();
+		culling_system->prepareRayCasts();
+		Lumix::CullingSystem::RayHits hits(allocator);
+		culling_system->castRay(
+			Lumix::Vec3(0, 0, 0), Lumix::Vec3(1, 0, 0), FLT_MAX, hits);
+		LUMIX_EXPECT_EQ(hits.size(), 0);
+
+		Lumix::CullingSystem::destroy(*culling_system);
+	}
+}
+
+
+REGISTER_TEST("unit_tests/graphics/culling_system_ray_cast",
+	UT_culling_system_ray_cast,
+	"");
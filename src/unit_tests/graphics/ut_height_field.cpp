@@ -0,0 +1,81 @@
+#include "unit_tests/suite/lumix_unit_tests.h"
+#include "unit_tests/suite/random.h"
+
+#include "core/array.h"
+#include "core/default_allocator.h"
+#include "core/vec2.h"
+#include "core/vec3.h"
+#include "renderer/height_field.h"
+#include <cmath>
+
+
+namespace
+{
+	void UT_height_field(const char* params)
+	{
+		Lumix::DefaultAllocator allocator;
+		const int WIDTH = 64;
+		const int HEIGHT = 32;
+		Lumix::Vec3 scale(2, 100, 2);
+
+		// a plane is reproduced exactly by the triangle interpolation
+		Lumix::Array<uint16_t> data(allocator);
+		for (int z = 0; z < HEIGHT; ++z)
+		{
+			for (int x = 0; x < WIDTH; ++x)
+			{
+				data.push(uint16_t(x * 500 + z * 900));
+			}
+		}
+		Lumix::HeightField field(allocator);
+		field.create((const uint8_t*)&data[0], WIDTH, HEIGHT, 2);
+		LUMIX_EXPECT_CLOSE_EQ(field.getSample(3, 4), (3 * 500 + 4 * 900) / 65535.0f, 0.0001f);
+
+		Lumix::UnitTest::Random random;
+		Lumix::Array<Lumix::Vec2> points(allocator);
+		for (int i = 0; i < 103; ++i)
+		{
+			points.push(Lumix::Vec2(random.next(0, (WIDTH - 1) * scale.x),
+				random.next(0, (HEIGHT - 1) * scale.z)));
+		}
+		// outside points are clamped to the border
+		points.push(Lumix::Vec2(-10, 5));
+		points.push(Lumix::Vec2(1000, 1000));
+
+		Lumix::Array<float> heights(allocator);
+		heights.resize(points.size());
+		field.getHeights(&points[0], &heights[0], points.size(), scale);
+		for (int i = 0; i < points.size(); ++i)
+		{
+			float x = Lumix::Math::clamp(points[i].x / scale.x, 0.0f, WIDTH - 1.0f);
+			float z = Lumix::Math::clamp(points[i].y / scale.z, 0.0f, HEIGHT - 1.0f);
+			float expected = (x * 500 + z * 900) / 65535.0f * scale.y;
+			LUMIX_EXPECT_CLOSE_EQ(heights[i], expected, 0.001f);
+			LUMIX_EXPECT_CLOSE_EQ(
+				heights[i], field.getHeight(points[i].x, points[i].y, scale), 0.0001f);
+		}
+
+		Lumix::Vec3 normal = field.getNormal(10, 10, scale);
+		float slope_scale = scale.y / scale.x / 65535.0f;
+		Lumix::Vec3 expected_normal(-500 * slope_scale, 1, -900 * slope_scale);
+		expected_normal.normalize();
+		LUMIX_EXPECT_CLOSE_EQ(normal.x, expected_normal.x, 0.0001f);
+		LUMIX_EXPECT_CLOSE_EQ(normal.y, expected_normal.y, 0.0001f);
+		LUMIX_EXPECT_CLOSE_EQ(normal.z, expected_normal.z, 0.0001f);
+
+		// edited rectangle is decoded again
+		for (int z = 2; z < 4; ++z)
+		{
+			for (int x = 5; x < 8; ++x)
+			{
+				data[x + z * WIDTH] = 65535;
+			}
+		}
+		field.update((const uint8_t*)&data[0], 2, 5, 2, 3, 2);
+		LUMIX_EXPECT_CLOSE_EQ(field.getSample(6, 3), 1.0f, 0.0001f);
+		LUMIX_EXPECT_CLOSE_EQ(field.getSample(8, 3), (8 * 500 + 3 * 900) / 65535.0f, 0.0001f);
+	}
+}
+
+
+REGISTER_TEST("unit_tests/graphics/height_field", UT_height_field, "");
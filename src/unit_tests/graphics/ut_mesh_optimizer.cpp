@@ -0,0 +1,292 @@
+#include "unit_tests/suite/lumix_unit_tests.h"
+#include "unit_tests/suite/random.h"
+
+#include "core/array.h"
+#include "core/default_allocator.h"
+#include "core/math_utils.h"
+#include "core/vec3.h"
+#include "renderer/mesh_optimizer.h"
+
+
+namespace
+{
+	const int GRID_SIZE = 32;
+
+
+	// regular grid of (GRID_SIZE + 1)^2 vertices in the z = z plane
+	void createGrid(float z,
+		Lumix::Array<Lumix::Vec3>& positions,
+		Lumix::Array<uint32_t>& indices)
+	{
+		uint32_t base = positions.size();
+		for (int y = 0; y <= GRID_SIZE; ++y)
+		{
+			for (int x = 0; x <= GRID_SIZE; ++x)
+			{
+				positions.push(Lumix::Vec3((float)x, (float)y, z));
+			}
+		}
+		for (int y = 0; y < GRID_SIZE; ++y)
+		{
+			for (int x = 0; x < GRID_SIZE; ++x)
+			{
+				uint32_t i = base + y * (GRID_SIZE + 1) + x;
+				indices.push(i);
+				indices.push(i + 1);
+				indices.push(i + GRID_SIZE + 1);
+				indices.push(i + 1);
+				indices.push(i + GRID_SIZE + 2);
+				indices.push(i + GRID_SIZE + 1);
+			}
+		}
+	}
+
+
+	// triangles right of the column x = GRID_SIZE / 2 use copies of its
+	// vertices, like an uv seam; returns the index of the first copy
+	int addSeam(Lumix::Array<Lumix::Vec3>& positions, Lumix::Array<uint32_t>& indices)
+	{
+		int seam_x = GRID_SIZE / 2;
+		int first_copy = positions.size();
+		for (int y = 0; y <= GRID_SIZE; ++y)
+		{
+			positions.push(positions[y * (GRID_SIZE + 1) + seam_x]);
+		}
+		for (int i = 0; i < indices.size(); i += 3)
+		{
+			bool is_right = false;
+			for (int k = 0; k < 3; ++k)
+			{
+				is_right = is_right || positions[indices[i + k]].x > seam_x;
+			}
+			for (int k = 0; is_right && k < 3; ++k)
+			{
+				if (indices[i + k] % (GRID_SIZE + 1) == (uint32_t)seam_x)
+				{
+					indices[i + k] = first_copy + indices[i + k] / (GRID_SIZE + 1);
+				}
+			}
+		}
+		return first_copy;
+	}
+
+
+	void shuffleTriangles(Lumix::Array<uint32_t>& indices)
+	{
+		Lumix::UnitTest::Random random;
+		for (int i = indices.size() / 3 - 1; i > 0; --i)
+		{
+			int j = random.next(i + 1);
+			for (int k = 0; k < 3; ++k)
+			{
+				uint32_t tmp = indices[i * 3 + k];
+				indices[i * 3 + k] = indices[j * 3 + k];
+				indices[j * 3 + k] = tmp;
+			}
+		}
+	}
+
+
+	void UT_mesh_optimizer_vertex_cache(const char* params)
+	{
+		Lumix::DefaultAllocator allocator;
+		Lumix::Array<Lumix::Vec3> positions(allocator);
+		Lumix::Array<uint32_t> indices(allocator);
+		createGrid(0, positions, indices);
+		shuffleTriangles(indices);
+
+		Lumix::Array<int> use_count(allocator);
+		use_count.resize(positions.size());
+		for (int i = 0; i < use_count.size(); ++i)
+		{
+			use_count[i] = 0;
+		}
+		for (int i = 0; i < indices.size(); ++i)
+		{
+			++use_count[indices[i]];
+		}
+
+		float acmr_before = Lumix::MeshOptimizer::computeACMR(&indices[0],
+			indices.size(),
+			positions.size(),
+			Lumix::MeshOptimizer::DEFAULT_CACHE_SIZE,
+			allocator);
+		Lumix::MeshOptimizer::optimizeVertexCache(
+			&indices[0], indices.size(), positions.size(), allocator);
+		float acmr_after = Lumix::MeshOptimizer::computeACMR(&indices[0],
+			indices.size(),
+			positions.size(),
+			Lumix::MeshOptimizer::DEFAULT_CACHE_SIZE,
+			allocator);
+
+		// random order misses almost every vertex, an optimized grid should
+		// be close to the 0.5 limit
+		LUMIX_EXPECT_GT(acmr_before, 2.5f);
+		LUMIX_EXPECT_LT(acmr_after, 0.8f);
+
+		for (int i = 0; i < indices.size(); ++i)
+		{
+			--use_count[indices[i]];
+		}
+		for (int i = 0; i < use_count.size(); ++i)
+		{
+			LUMIX_EXPECT_EQ(use_count[i], 0);
+		}
+	}
+
+
+	void UT_mesh_optimizer_overdraw(const char* params)
+	{
+		Lumix::DefaultAllocator allocator;
+		Lumix::Array<Lumix::Vec3> positions(allocator);
+		Lumix::Array<uint32_t> indices(allocator);
+		// both grids face +z, the one at z = 1 is in front of the center and
+		// occludes the one at z = -1
+		createGrid(-1, positions, indices);
+		createGrid(1, positions, indices);
+
+		Lumix::MeshOptimizer::optimizeVertexCache(
+			&indices[0], indices.size(), positions.size(), allocator);
+		float acmr_before = Lumix::MeshOptimizer::computeACMR(&indices[0],
+			indices.size(),
+			positions.size(),
+			Lumix::MeshOptimizer::DEFAULT_CACHE_SIZE,
+			allocator);
+		Lumix::MeshOptimizer::optimizeOverdraw(&indices[0],
+			indices.size(),
+			&positions[0],
+			positions.size(),
+			1.05f,
+			allocator);
+		float acmr_after = Lumix::MeshOptimizer::computeACMR(&indices[0],
+			indices.size(),
+			positions.size(),
+			Lumix::MeshOptimizer::DEFAULT_CACHE_SIZE,
+			allocator);
+
+		LUMIX_EXPECT_CLOSE_EQ(positions[indices[0]].z, 1.0f, 0.0001f);
+		LUMIX_EXPECT_CLOSE_EQ(
+			positions[indices[indices.size() - 1]].z, -1.0f, 0.0001f);
+		LUMIX_EXPECT_LT(acmr_after, acmr_before * 1.1f);
+	}
+
+
+	void UT_mesh_optimizer_simplify(const char* params)
+	{
+		Lumix::DefaultAllocator allocator;
+		Lumix::Array<Lumix::Vec3> positions(allocator);
+		Lumix::Array<uint32_t> indices(allocator);
+		createGrid(0, positions, indices);
+
+		int target_index_count = indices.size() / 4;
+		int index_count = Lumix::MeshOptimizer::simplify(&indices[0],
+			indices.size(),
+			&positions[0],
+			positions.size(),
+			target_index_count,
+			allocator);
+
+		LUMIX_EXPECT_LE(index_count, target_index_count);
+		LUMIX_EXPECT_GT(index_count, 0);
+		// a flat grid can be simplified without changing its shape, border
+		// is kept so the area stays the same and no triangle is flipped
+		float area = 0;
+		for (int i = 0; i < index_count; i += 3)
+		{
+			const Lumix::Vec3& p0 = positions[indices[i]];
+			const Lumix::Vec3& p1 = positions[indices[i + 1]];
+			const Lumix::Vec3& p2 = positions[indices[i + 2]];
+			float triangle_area = Lumix::crossProduct(p1 - p0, p2 - p0).z;
+			LUMIX_EXPECT_GT(triangle_area, 0.0f);
+			area += triangle_area * 0.5f;
+		}
+		LUMIX_EXPECT_CLOSE_EQ(area, float(GRID_SIZE * GRID_SIZE), 0.001f);
+	}
+
+
+	void UT_mesh_optimizer_simplify_seam(const char* params)
+	{
+		Lumix::DefaultAllocator allocator;
+		Lumix::Array<Lumix::Vec3> positions(allocator);
+		Lumix::Array<uint32_t> indices(allocator);
+		createGrid(0, positions, indices);
+		int first_copy = addSeam(positions, indices);
+
+		int target_index_count = indices.size() / 32;
+		int index_count = Lumix::MeshOptimizer::simplify(&indices[0],
+			indices.size(),
+			&positions[0],
+			positions.size(),
+			target_index_count,
+			allocator);
+
+		// the seam does not stop the simplification, it stays a straight
+		// line and each side keeps its own copies
+		LUMIX_EXPECT_LE(index_count, target_index_count);
+		float seam_x = float(GRID_SIZE / 2);
+		float area = 0;
+		for (int i = 0; i < index_count; i += 3)
+		{
+			const Lumix::Vec3& p0 = positions[indices[i]];
+			const Lumix::Vec3& p1 = positions[indices[i + 1]];
+			const Lumix::Vec3& p2 = positions[indices[i + 2]];
+			float triangle_area = Lumix::crossProduct(p1 - p0, p2 - p0).z;
+			LUMIX_EXPECT_GT(triangle_area, 0.0f);
+			area += triangle_area * 0.5f;
+			for (int k = 0; k < 3; ++k)
+			{
+				const Lumix::Vec3& p = positions[indices[i + k]];
+				if ((int)indices[i + k] >= first_copy)
+				{
+					LUMIX_EXPECT_GE(Lumix::Math::minValue(p0.x, Lumix::Math::minValue(p1.x, p2.x)), seam_x);
+				}
+				else if (p.x == seam_x)
+				{
+					LUMIX_EXPECT_LE(Lumix::Math::maxValue(p0.x, Lumix::Math::maxValue(p1.x, p2.x)), seam_x);
+				}
+			}
+		}
+		LUMIX_EXPECT_CLOSE_EQ(area, float(GRID_SIZE * GRID_SIZE), 0.001f);
+	}
+
+
+	void UT_mesh_optimizer_vertex_fetch(const char* params)
+	{
+		Lumix::DefaultAllocator allocator;
+		uint32_t indices[] = {3, 1, 4, 4, 1, 5};
+		int remap[7];
+
+		int used = Lumix::MeshOptimizer::optimizeVertexFetch(
+			indices, Lumix::lengthOf(indices), Lumix::lengthOf(remap), remap);
+
+		LUMIX_EXPECT_EQ(used, 4);
+		uint32_t expected_indices[] = {0, 1, 2, 2, 1, 3};
+		for (int i = 0; i < Lumix::lengthOf(indices); ++i)
+		{
+			LUMIX_EXPECT_EQ(indices[i], expected_indices[i]);
+		}
+		// unused vertices keep their relative order at the end
+		int expected_remap[] = {4, 1, 5, 0, 2, 3, 6};
+		for (int i = 0; i < Lumix::lengthOf(remap); ++i)
+		{
+			LUMIX_EXPECT_EQ(remap[i], expected_remap[i]);
+		}
+	}
+}
+
+
+REGISTER_TEST("unit_tests/graphics/mesh_optimizer_vertex_cache",
+	UT_mesh_optimizer_vertex_cache,
+	"");
+REGISTER_TEST("unit_tests/graphics/mesh_optimizer_overdraw",
+	UT_mesh_optimizer_overdraw,
+	"");
+REGISTER_TEST("unit_tests/graphics/mesh_optimizer_simplify",
+	UT_mesh_optimizer_simplify,
+	"");
+REGISTER_TEST("unit_tests/graphics/mesh_optimizer_simplify_seam",
+	UT_mesh_optimizer_simplify_seam,
+	"");
+REGISTER_TEST("unit_tests/graphics/mesh_optimizer_vertex_fetch",
+	UT_mesh_optimizer_vertex_fetch,
+	"");
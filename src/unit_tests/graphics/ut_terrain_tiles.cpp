@@ -0,0 +1,171 @@
+#include "unit_tests/suite/lumix_unit_tests.h"
+
+#include "core/array.h"
+#include "core/fs/disk_file_device.h"
+#include "core/fs/file_system.h"
+#include "core/fs/ifile.h"
+#include "core/mtjd/manager.h"
+#include "renderer/terrain_tiles.h"
+
+namespace
+{
+
+	const char terrain_tiles_path[] = "unit_tests/texture/terrain.tiles";
+	// 2 x 2 tiles
+	const int TERRAIN_SIZE = 33;
+	const int TILE_SIZE = 16;
+	// textures and the samples kept for height queries
+	const int TILE_MEMORY = (TILE_SIZE + 1) * (TILE_SIZE + 1) * (sizeof(float) + sizeof(uint32_t)) * 2;
+
+
+	bool createTestArchive(Lumix::FS::FileSystem& file_system, Lumix::IAllocator& allocator, int samples_per_pixel = 1)
+	{
+		Lumix::Array<uint16_t> heights(allocator);
+		Lumix::Array<uint32_t> splatmap(allocator);
+		heights.resize(TERRAIN_SIZE * TERRAIN_SIZE);
+		splatmap.resize(TERRAIN_SIZE * TERRAIN_SIZE);
+		for (int i = 0; i < heights.size(); ++i)
+		{
+			heights[i] = (uint16_t)i;
+			splatmap[i] = i;
+		}
+
+		Lumix::FS::IFile* file = file_system.open(file_system.getDiskDevice(),
+			terrain_tiles_path,
+			Lumix::FS::Mode::OPEN_OR_CREATE | Lumix::FS::Mode::WRITE);
+		if (!file)
+		{
+			return false;
+		}
+		bool success = Lumix::TerrainTiles::createArchive(
+			*file, &heights[0], &splatmap[0], TERRAIN_SIZE, TERRAIN_SIZE, TILE_SIZE, samples_per_pixel, allocator);
+		file_system.close(*file);
+		return success;
+	}
+
+
+	void UT_terrain_tiles_stream(const char* params)
+	{
+		Lumix::DefaultAllocator allocator;
+		Lumix::FS::FileSystem* file_system = Lumix::FS::FileSystem::create(allocator);
+		Lumix::FS::DiskFileDevice disk_file_device(allocator);
+		file_system->mount(&disk_file_device);
+		file_system->setDefaultDevice("disk");
+		{
+			Lumix::MTJD::Manager mtjd_manager(allocator);
+			LUMIX_EXPECT_TRUE(createTestArchive(*file_system, allocator));
+
+			Lumix::TerrainTiles tiles(*file_system, mtjd_manager, allocator);
+			LUMIX_EXPECT_FALSE(tiles.load(Lumix::Path("unit_tests/texture/_non_exist.tiles")));
+			LUMIX_EXPECT_TRUE(tiles.load(Lumix::Path(terrain_tiles_path)));
+			LUMIX_EXPECT_EQ(tiles.getTileSize(), TILE_SIZE);
+			LUMIX_EXPECT_EQ(tiles.getTilesX(), 2);
+			LUMIX_EXPECT_EQ(tiles.getTilesZ(), 2);
+			LUMIX_EXPECT_NULL(tiles.getTile(0, 0));
+
+			// only the tile under the camera is in the radius
+			tiles.update(0.5f, 0.5f, 0.25f);
+			tiles.waitForJobs();
+			LUMIX_EXPECT_NOT_NULL(tiles.getTile(0, 0));
+			LUMIX_EXPECT_NULL(tiles.getTile(1, 0));
+			LUMIX_EXPECT_NULL(tiles.getTile(1, 1));
+			LUMIX_EXPECT_EQ(tiles.getResidentMemory(), TILE_MEMORY);
+
+			// quads inside the resident tile get it, quads crossing tiles do not
+			LUMIX_EXPECT_EQ(tiles.getAreaTile(4, 4, 8), tiles.getTile(0, 0));
+			LUMIX_EXPECT_EQ(tiles.getAreaTile(0, 0, TILE_SIZE), tiles.getTile(0, 0));
+			LUMIX_EXPECT_NULL(tiles.getAreaTile(8, 8, TILE_SIZE));
+			LUMIX_EXPECT_NULL(tiles.getAreaTile(16, 0, TILE_SIZE));
+
+			tiles.unload();
+			LUMIX_EXPECT_FALSE(tiles.isLoaded());
+			LUMIX_EXPECT_EQ(tiles.getResidentMemory(), 0);
+		}
+		Lumix::FS::FileSystem::destroy(file_system);
+	}
+
+
+	void UT_terrain_tiles_budget(const char* params)
+	{
+		Lumix::DefaultAllocator allocator;
+		Lumix::FS::FileSystem* file_system = Lumix::FS::FileSystem::create(allocator);
+		Lumix::FS::DiskFileDevice disk_file_device(allocator);
+		file_system->mount(&disk_file_device);
+		file_system->setDefaultDevice("disk");
+		{
+			Lumix::MTJD::Manager mtjd_manager(allocator);
+			LUMIX_EXPECT_TRUE(createTestArchive(*file_system, allocator));
+
+			Lumix::TerrainTiles tiles(*file_system, mtjd_manager, allocator);
+			LUMIX_EXPECT_TRUE(tiles.load(Lumix::Path(terrain_tiles_path)));
+			tiles.setMemoryBudget(TILE_MEMORY);
+
+			tiles.update(0.5f, 0.5f, 0.25f);
+			tiles.waitForJobs();
+			LUMIX_EXPECT_NOT_NULL(tiles.getTile(0, 0));
+
+			// the farther tile makes room for the one under the camera
+			tiles.update(1.5f, 1.5f, 0.25f);
+			tiles.waitForJobs();
+			LUMIX_EXPECT_NULL(tiles.getTile(0, 0));
+			LUMIX_EXPECT_NOT_NULL(tiles.getTile(1, 1));
+			LUMIX_EXPECT_EQ(tiles.getResidentMemory(), TILE_MEMORY);
+
+			// nothing fits, nothing is loaded
+			tiles.setMemoryBudget(0);
+			tiles.update(0.5f, 0.5f, 0.25f);
+			tiles.waitForJobs();
+			LUMIX_EXPECT_NULL(tiles.getTile(0, 0));
+			LUMIX_EXPECT_NULL(tiles.getTile(1, 1));
+			LUMIX_EXPECT_EQ(tiles.getResidentMemory(), 0);
+		}
+		Lumix::FS::FileSystem::destroy(file_system);
+	}
+
+
+	void UT_terrain_tiles_resolution(const char* params)
+	{
+		Lumix::DefaultAllocator allocator;
+		Lumix::FS::FileSystem* file_system = Lumix::FS::FileSystem::create(allocator);
+		Lumix::FS::DiskFileDevice disk_file_device(allocator);
+		file_system->mount(&disk_file_device);
+		file_system->setDefaultDevice("disk");
+		{
+			Lumix::MTJD::Manager mtjd_manager(allocator);
+			// two samples per pixel, a tile covers 8 x 8 heightmap pixels
+			LUMIX_EXPECT_TRUE(createTestArchive(*file_system, allocator, 2));
+
+			Lumix::TerrainTiles tiles(*file_system, mtjd_manager, allocator);
+			LUMIX_EXPECT_TRUE(tiles.load(Lumix::Path(terrain_tiles_path)));
+			LUMIX_EXPECT_EQ(tiles.getSamplesPerPixel(), 2);
+			LUMIX_EXPECT_CLOSE_EQ(tiles.getTileExtent(), 8.0f, 0.0001f);
+
+			// the ranges are known before the tiles are loaded
+			float min_height, max_height;
+			LUMIX_EXPECT_TRUE(tiles.getHeightRange(0, 0, 4, 4, min_height, max_height));
+			LUMIX_EXPECT_CLOSE_EQ(min_height, 0.0f, 0.0001f);
+			LUMIX_EXPECT_CLOSE_EQ(max_height, (16 + 16 * TERRAIN_SIZE) / 65535.0f, 0.0001f);
+			LUMIX_EXPECT_TRUE(tiles.getHeightRange(10, 10, 12, 12, min_height, max_height));
+			LUMIX_EXPECT_CLOSE_EQ(min_height, (16 + 16 * TERRAIN_SIZE) / 65535.0f, 0.0001f);
+			LUMIX_EXPECT_CLOSE_EQ(max_height, (32 + 32 * TERRAIN_SIZE) / 65535.0f, 0.0001f);
+			LUMIX_EXPECT_FALSE(tiles.getHeightRange(20, 20, 24, 24, min_height, max_height));
+
+			tiles.update(1.5f, 0.5f, 0.25f);
+			tiles.waitForJobs();
+			LUMIX_EXPECT_NULL(tiles.getPointTile(4, 4));
+			const Lumix::TerrainTile* tile = tiles.getPointTile(12, 4);
+			LUMIX_EXPECT_NOT_NULL(tile);
+			LUMIX_EXPECT_EQ(tile, tiles.getAreaTile(8, 0, 8));
+			LUMIX_EXPECT_NULL(tiles.getAreaTile(0, 0, 16));
+			// samples are addressed in the archive's resolution
+			LUMIX_EXPECT_CLOSE_EQ(tiles.getHeightSample(*tile, 20, 3), (20 + 3 * TERRAIN_SIZE) / 65535.0f, 0.0001f);
+			LUMIX_EXPECT_EQ(tiles.getSplatSample(*tile, 20, 3), (uint32_t)(20 + 3 * TERRAIN_SIZE));
+		}
+		Lumix::FS::FileSystem::destroy(file_system);
+	}
+
+}
+
+REGISTER_TEST("unit_tests/graphics/terrain_tiles/stream", UT_terrain_tiles_stream, "");
+REGISTER_TEST("unit_tests/graphics/terrain_tiles/budget", UT_terrain_tiles_budget, "");
+REGISTER_TEST("unit_tests/graphics/terrain_tiles/resolution", UT_terrain_tiles_resolution, "");
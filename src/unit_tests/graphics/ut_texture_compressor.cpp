@@ -0,0 +1,185 @@
+#include "unit_tests/suite/lumix_unit_tests.h"
+
+#include "core/array.h"
+#include "core/blob.h"
+#include "core/MTJD/manager.h"
+#include "renderer/texture_compressor.h"
+#include <cmath>
+
+namespace
+{
+
+	void fillGradient(Lumix::Array<uint8_t>& image, int width, int height)
+	{
+		image.resize(width * height * 4);
+		for (int j = 0; j < height; ++j)
+		{
+			for (int i = 0; i < width; ++i)
+			{
+				uint8_t* pixel = &image[(i + j * width) * 4];
+				pixel[0] = (uint8_t)(i * 255 / (width - 1));
+				pixel[1] = (uint8_t)(j * 255 / (height - 1));
+				pixel[2] = (uint8_t)((i + j) * 255 / (width + height - 2));
+				pixel[3] = (uint8_t)(255 - i * 255 / (width - 1));
+			}
+		}
+	}
+
+
+	float getRMSError(const Lumix::Array<uint8_t>& image,
+		const Lumix::Array<uint8_t>& blocks,
+		int width,
+		int height,
+		Lumix::TextureCompressor::Format format,
+		int channels)
+	{
+		int block_size = Lumix::TextureCompressor::getBlockSize(format);
+		float error = 0;
+		for (int block_y = 0; block_y < height / 4; ++block_y)
+		{
+			for (int block_x = 0; block_x < width / 4; ++block_x)
+			{
+				uint8_t decoded[16 * 4];
+				Lumix::TextureCompressor::decompressBlock(
+					&blocks[(block_x + block_y * width / 4) * block_size], format, decoded);
+				for (int k = 0; k < 16; ++k)
+				{
+					int x = block_x * 4 + k % 4;
+					int y = block_y * 4 + k / 4;
+					for (int c = 0; c < channels; ++c)
+					{
+						float diff = (float)decoded[k * 4 + c] - image[(x + y * width) * 4 + c];
+						error += diff * diff;
+					}
+				}
+			}
+		}
+		return sqrtf(error / (width * height * channels));
+	}
+
+
+	void UT_texture_compressor_flat(const char* params)
+	{
+		uint8_t pixels[16 * 4];
+		for (int i = 0; i < 16; ++i)
+		{
+			pixels[i * 4 + 0] = 255;
+			pixels[i * 4 + 1] = 0;
+			pixels[i * 4 + 2] = 255;
+			pixels[i * 4 + 3] = 128;
+		}
+		uint8_t block[16];
+		Lumix::TextureCompressor::compress(pixels, 4, 4, Lumix::TextureCompressor::Format::BC3, block, 0, 0, 4, 4);
+		uint8_t decoded[16 * 4];
+		Lumix::TextureCompressor::decompressBlock(block, Lumix::TextureCompressor::Format::BC3, decoded);
+		for (int i = 0; i < 16 * 4; ++i)
+		{
+			LUMIX_EXPECT_EQ(decoded[i], pixels[i]);
+		}
+	}
+
+
+	void UT_texture_compressor_quality(const char* params)
+	{
+		Lumix::DefaultAllocator allocator;
+		const int SIZE = 64;
+		Lumix::Array<uint8_t> image(allocator);
+		fillGradient(image, SIZE, SIZE);
+
+		Lumix::TextureCompressor::Format formats[] = {Lumix::TextureCompressor::Format::BC1,
+			Lumix::TextureCompressor::Format::BC3,
+			Lumix::TextureCompressor::Format::BC5};
+		int channels[] = {3, 4, 2};
+		for (int i = 0; i < 3; ++i)
+		{
+			Lumix::Array<uint8_t> blocks(allocator);
+			blocks.resize(Lumix::TextureCompressor::getLevelSize(SIZE, SIZE, 0, formats[i]));
+			Lumix::TextureCompressor::compress(&image[0], SIZE, SIZE, formats[i], &blocks[0], 0, 0, SIZE, SIZE);
+			LUMIX_EXPECT_LT(getRMSError(image, blocks, SIZE, SIZE, formats[i], channels[i]), 4.0f);
+		}
+	}
+
+
+	void UT_texture_compressor_box_mip(const char* params)
+	{
+		uint8_t src[4 * 4 * 4];
+		for (int i = 0; i < 16; ++i)
+		{
+			for (int c = 0; c < 4; ++c)
+			{
+				src[i * 4 + c] = (uint8_t)(i * 10 + c);
+			}
+		}
+		uint8_t dst[2 * 2 * 4];
+		Lumix::TextureCompressor::downsample(src, 4, 4, dst, 0, 0, 2, 2, Lumix::TextureCompressor::MipFilter::BOX);
+		for (int j = 0; j < 2; ++j)
+		{
+			for (int i = 0; i < 2; ++i)
+			{
+				int k = i * 2 + j * 8;
+				for (int c = 0; c < 4; ++c)
+				{
+					int sum = src[k * 4 + c] + src[(k + 1) * 4 + c] + src[(k + 4) * 4 + c] +
+							  src[(k + 5) * 4 + c];
+					LUMIX_EXPECT_CLOSE_EQ(dst[(i + j * 2) * 4 + c], sum / 4.0f, 1.0f);
+				}
+			}
+		}
+	}
+
+
+	void UT_texture_compressor_dds(const char* params)
+	{
+		Lumix::DefaultAllocator allocator;
+		const int SIZE = 64;
+		Lumix::TextureCompressor::Format format = Lumix::TextureCompressor::Format::BC3;
+		Lumix::TextureCompressor::MipFilter filter = Lumix::TextureCompressor::MipFilter::KAISER;
+		int mip_count = Lumix::TextureCompressor::getMipCount(SIZE, SIZE);
+		LUMIX_EXPECT_EQ(mip_count, 7);
+
+		// the levels one after another on this thread
+		Lumix::Array<uint8_t> level(allocator);
+		Lumix::Array<uint8_t> next_level(allocator);
+		Lumix::Array<uint8_t> blocks(allocator);
+		fillGradient(level, SIZE, SIZE);
+		int blocks_size = 0;
+		for (int i = 0; i < mip_count; ++i)
+		{
+			int level_size = SIZE >> i;
+			int level_blocks_size = Lumix::TextureCompressor::getLevelSize(SIZE, SIZE, i, format);
+			blocks.resize(blocks_size + level_blocks_size);
+			Lumix::TextureCompressor::compress(
+				&level[0], level_size, level_size, format, &blocks[blocks_size], 0, 0, level_size, level_size);
+			blocks_size += level_blocks_size;
+			if (i + 1 == mip_count)
+			{
+				break;
+			}
+			next_level.resize((level_size / 2) * (level_size / 2) * 4);
+			Lumix::TextureCompressor::downsample(
+				&level[0], level_size, level_size, &next_level[0], 0, 0, level_size / 2, level_size / 2, filter);
+			level.resize(next_level.size());
+			memcpy(&level[0], &next_level[0], next_level.size());
+		}
+
+		Lumix::Array<uint8_t> image(allocator);
+		fillGradient(image, SIZE, SIZE);
+		Lumix::OutputBlob dds(allocator);
+		{
+			Lumix::MTJD::Manager mtjd_manager(allocator);
+			LUMIX_EXPECT_TRUE(Lumix::TextureCompressor::compressDDS(
+				&image[0], SIZE, SIZE, format, filter, mtjd_manager, dds, allocator));
+		}
+
+		// the bands computed by the jobs give the same result, dds has a 128
+		// bytes header followed by the levels
+		LUMIX_EXPECT_EQ(dds.getSize(), 128 + blocks_size);
+		LUMIX_EXPECT_TRUE(memcmp((const uint8_t*)dds.getData() + 128, &blocks[0], blocks_size) == 0);
+	}
+
+}
+
+REGISTER_TEST("unit_tests/graphics/texture_compressor/flat", UT_texture_compressor_flat, "");
+REGISTER_TEST("unit_tests/graphics/texture_compressor/quality", UT_texture_compressor_quality, "");
+REGISTER_TEST("unit_tests/graphics/texture_compressor/box_mip", UT_texture_compressor_box_mip, "");
+REGISTER_TEST("unit_tests/graphics/texture_compressor/dds", UT_texture_compressor_dds, "");
@@ -0,0 +1,118 @@
+#include "unit_tests/suite/lumix_unit_tests.h"
+#include "unit_tests/suite/random.h"
+
+#include "core/array.h"
+#include "core/default_allocator.h"
+#include "core/vec3.h"
+#include "renderer/triangle_bvh.h"
+#include <cfloat>
+
+
+namespace
+{
+	bool castRayBruteForce(const Lumix::Vec3* vertices,
+		const Lumix::TriangleBVH::Triangle* triangles,
+		int count,
+		const Lumix::Vec3& origin,
+		const Lumix::Vec3& dir,
+		float& t)
+	{
+		t = FLT_MAX;
+		for (int i = 0; i < count; ++i)
+		{
+			const Lumix::Vec3& p0 = vertices[triangles[i].m_vertices[0]];
+			Lumix::Vec3 e1 = vertices[triangles[i].m_vertices[1]] - p0;
+			Lumix::Vec3 e2 = vertices[triangles[i].m_vertices[2]] - p0;
+			Lumix::Vec3 pvec = Lumix::crossProduct(dir, e2);
+			float det = Lumix::dotProduct(e1, pvec);
+			if (det == 0)
+			{
+				continue;
+			}
+			Lumix::Vec3 tvec = origin - p0;
+			float u = Lumix::dotProduct(tvec, pvec) / det;
+			Lumix::Vec3 qvec = Lumix::crossProduct(tvec, e1);
+			float v = Lumix::dotProduct(dir, qvec) / det;
+			float triangle_t = Lumix::dotProduct(e2, qvec) / det;
+			if (u >= 0 && v >= 0 && u + v <= 1 && triangle_t >= 0 &&
+				triangle_t < t)
+			{
+				t = triangle_t;
+			}
+		}
+		return t < FLT_MAX;
+	}
+
+
+	void UT_triangle_bvh(const char* params)
+	{
+		Lumix::DefaultAllocator allocator;
+		Lumix::Array<Lumix::Vec3> vertices(allocator);
+		Lumix::Array<Lumix::TriangleBVH::Triangle> triangles(allocator);
+		Lumix::UnitTest::Random random;
+
+		// soup of small triangles in a 20 x 20 x 20 box
+		const int TRIANGLE_COUNT = 1000;
+		for (int i = 0; i < TRIANGLE_COUNT; ++i)
+		{
+			Lumix::Vec3 center(random.next(-10, 10),
+				random.next(-10, 10),
+				random.next(-10, 10));
+			Lumix::TriangleBVH::Triangle& triangle = triangles.pushEmpty();
+			for (int k = 0; k < 3; ++k)
+			{
+				triangle.m_vertices[k] = vertices.size();
+				vertices.push(center + Lumix::Vec3(random.next(-1, 1),
+										   random.next(-1, 1),
+										   random.next(-1, 1)));
+			}
+			triangle.m_mesh = i;
+		}
+
+		Lumix::TriangleBVH bvh(allocator);
+		bvh.build(&vertices[0], &triangles[0], triangles.size());
+		LUMIX_EXPECT_GT(bvh.getNodeCount(), 1);
+		LUMIX_EXPECT_LT(bvh.getNodeCount(), TRIANGLE_COUNT);
+
+		int hit_count = 0;
+		for (int i = 0; i < 1000; ++i)
+		{
+			Lumix::Vec3 origin(
+				random.next(-15, 15), random.next(-15, 15), random.next(-15, 15));
+			Lumix::Vec3 dir(
+				random.next(-1, 1), random.next(-1, 1), random.next(-1, 1));
+			// axis aligned rays exercise the division by zero in the slab test
+			if (i % 10 == 0)
+			{
+				dir.set(0, 0, i % 20 == 0 ? 1.0f : -1.0f);
+			}
+
+			float expected_t;
+			bool expected_hit = castRayBruteForce(&vertices[0],
+				&triangles[0],
+				triangles.size(),
+				origin,
+				dir,
+				expected_t);
+			Lumix::TriangleBVH::Hit hit;
+			bool is_hit = bvh.castRay(&vertices[0], origin, dir, hit);
+			LUMIX_EXPECT_EQ(is_hit, expected_hit);
+			if (is_hit && expected_hit)
+			{
+				LUMIX_EXPECT_CLOSE_EQ(hit.m_t, expected_t, 0.001f);
+				LUMIX_EXPECT_GE(hit.m_mesh, 0);
+				LUMIX_EXPECT_LT(hit.m_mesh, TRIANGLE_COUNT);
+				++hit_count;
+			}
+		}
+		LUMIX_EXPECT_GT(hit_count, 100);
+
+		bvh.clear();
+		Lumix::TriangleBVH::Hit hit;
+		LUMIX_EXPECT_FALSE(
+			bvh.castRay(&vertices[0], Lumix::Vec3(0, 0, 0), Lumix::Vec3(1, 0, 0), hit));
+	}
+}
+
+
+REGISTER_TEST("unit_tests/graphics/triangle_bvh", UT_triangle_bvh, "");
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "lumix.h"
+
+namespace Lumix
+{
+	namespace UnitTest
+	{
+		// deterministic, tests must not depend on rand()
+		struct Random
+		{
+			Random() : m_seed(12345) {}
+
+			uint32_t next()
+			{
+				m_seed = m_seed * 1103515245 + 12345;
+				return (m_seed >> 8) & 0xffff;
+			}
+
+			float next(float from, float to)
+			{
+				return from + (to - from) * next() / 65535.0f;
+			}
+
+			// in [0, count)
+			int next(int count)
+			{
+				return (int)(next() * (uint32_t)count >> 16);
+			}
+
+			uint32_t m_seed;
+		};
+	} // ~UnitTest
+} // ~Lumix